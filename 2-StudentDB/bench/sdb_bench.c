@@ -0,0 +1,410 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <limits.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <time.h>
+#include <getopt.h>
+#include <unistd.h>
+
+#include "db.h"
+#include "sdbsc.h"
+
+//Benchmark harness for the student database, built by "make bench".
+//
+//Every population is loaded into a fresh database in a scratch directory
+//through the same API sdbsc uses, then each operation is timed:
+//
+//  add, get, delete    per operation latency (p50/p99) and throughput
+//  get_batch           the get ids as one batch, through the I/O backend
+//  count, print        whole database, repeated
+//  compress            after half of the students were deleted
+//
+//In warm mode the database stays open and every id is used.  In cold mode
+//the database is closed, its pages are dropped from the page cache and
+//it is opened again before every timed operation, so only a sample of
+//ids is used.  Results go to stdout (or -o file) as one JSON document;
+//everything the API prints is sent to /dev/null.
+//
+//  usage: sdb_bench [-n students] [-s cold_samples] [-r repeats]
+//                   [-m warm|cold|both] [-d dir] [-o file]
+//
+//SDB_* environment settings (SDB_WAL, SDB_FORMAT, ...) apply as usual,
+//which is how configurations are compared.
+
+#define BENCH_DEFAULT_N         10000
+#define BENCH_DEFAULT_SAMPLES   200
+#define BENCH_DEFAULT_REPEATS   5
+
+typedef enum { POP_SEQUENTIAL, POP_DENSE, POP_SPARSE, POP_RANDOM, NUM_POPS } pop_t;
+
+static const char *pop_names[NUM_POPS] = { "sequential", "dense", "sparse", "random" };
+
+typedef struct bench_cfg {
+    long        n;
+    long        samples;
+    int         repeats;
+    bool        warm;
+    bool        cold;
+    const char *dir;
+    FILE       *out;
+} bench_cfg_t;
+
+typedef struct timing {
+    uint64_t *ns;               //one latency per operation
+    long      n;
+} timing_t;
+
+static int results = 0;         //JSON objects written so far
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+static void shuffle(int *v, long n)
+{
+    for (long i = n - 1; i > 0; i--) {
+        long j = random() % (i + 1);
+        int t = v[i];
+
+        v[i] = v[j];
+        v[j] = t;
+    }
+}
+
+/*
+ *  make_ids
+ *      pop:  population to generate
+ *      n:    number of students
+ *
+ *  sequential   ids 1..n, added in order
+ *  dense        ids 1..n, added in random order
+ *  sparse       n ids spread evenly over the whole id range, in order
+ *  random       n distinct ids anywhere in the id range, in random order
+ *
+ *  returns:  malloc()ed array of n ids, NULL when out of memory
+ */
+static int *make_ids(pop_t pop, long n)
+{
+    long range = MAX_STD_ID - MIN_STD_ID + 1;
+    int *ids = malloc(n * sizeof(*ids));
+
+    if (ids == NULL)
+        return NULL;
+
+    if (pop == POP_RANDOM) {
+        //partial Fisher-Yates over the whole range
+        int *all = malloc(range * sizeof(*all));
+
+        if (all == NULL) {
+            free(ids);
+            return NULL;
+        }
+        for (long i = 0; i < range; i++)
+            all[i] = (int)(MIN_STD_ID + i);
+        for (long i = 0; i < n; i++) {
+            long j = i + random() % (range - i);
+            int t = all[i];
+
+            all[i] = all[j];
+            all[j] = t;
+            ids[i] = all[i];
+        }
+        free(all);
+        return ids;
+    }
+
+    for (long i = 0; i < n; i++)
+        ids[i] = pop == POP_SPARSE ? (int)(MIN_STD_ID + i * (range / n))
+                                   : (int)(MIN_STD_ID + i);
+    if (pop == POP_DENSE)
+        shuffle(ids, n);
+    return ids;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+
+    return (x > y) - (x < y);
+}
+
+static double pct_us(const timing_t *t, int pct)
+{
+    return t->n ? t->ns[(t->n - 1) * pct / 100] / 1000.0 : 0.0;
+}
+
+static void report(bench_cfg_t *cfg, pop_t pop, bool cold, const char *op,
+                   timing_t *t)
+{
+    uint64_t total = 0;
+
+    for (long i = 0; i < t->n; i++)
+        total += t->ns[i];
+    qsort(t->ns, t->n, sizeof(*t->ns), cmp_u64);
+
+    fprintf(cfg->out,
+            "%s\n    {\"population\": \"%s\", \"cache\": \"%s\", \"op\": \"%s\", "
+            "\"ops\": %ld, \"ops_per_sec\": %.1f, \"p50_us\": %.2f, "
+            "\"p99_us\": %.2f, \"total_ms\": %.3f}",
+            results++ ? "," : "", pop_names[pop], cold ? "cold" : "warm", op,
+            t->n, total ? t->n * 1e9 / total : 0.0, pct_us(t, 50),
+            pct_us(t, 99), total / 1e6);
+    t->n = 0;
+}
+
+/*
+ *  drop_cache
+ *      fd:  open database
+ *
+ *  Closes the database, asks the kernel to drop its cached pages and opens
+ *  it again.  The mapping has to go first, mapped pages are never dropped.
+ *
+ *  returns:  the new fd, or -1
+ */
+static int drop_cache(int fd)
+{
+    int raw;
+
+    close_db(fd);
+    raw = open(DB_FILE, O_RDONLY);
+    if (raw != -1) {
+        fdatasync(raw);
+        posix_fadvise(raw, 0, 0, POSIX_FADV_DONTNEED);
+        close(raw);
+    }
+    return open_db(DB_FILE, false);
+}
+
+//removes everything the database left in the scratch directory
+static void clean_dir(void)
+{
+    DIR *d = opendir(".");
+    struct dirent *e;
+
+    if (d == NULL)
+        return;
+    while ((e = readdir(d)) != NULL) {
+        if (strcmp(e->d_name, ".") != 0 && strcmp(e->d_name, "..") != 0)
+            unlink(e->d_name);
+    }
+    closedir(d);
+}
+
+/*
+ *  run_pop
+ *      cfg:   benchmark settings
+ *      pop:   population
+ *      cold:  drop the cache before every timed operation
+ *
+ *  Loads the population into an empty database and times every operation
+ *  on it.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ */
+static int run_pop(bench_cfg_t *cfg, pop_t pop, bool cold)
+{
+    int *ids = make_ids(pop, cfg->n);
+    long ops = cold && cfg->samples < cfg->n ? cfg->samples : cfg->n;
+    long whole = cfg->repeats;
+    timing_t t = { malloc((ops > whole ? ops : whole) * sizeof(uint64_t)), 0 };
+    long step = cfg->n / ops;
+    student_t s;
+    int fd, rc = ERR_DB_FILE;
+    uint64_t t0;
+
+    clean_dir();
+    fd = open_db(DB_FILE, true);
+    if (ids == NULL || t.ns == NULL || fd < 0)
+        goto out;
+
+    //add: in cold mode only every step-th add is timed, the others load
+    //the rest of the population untimed
+    for (long i = 0; i < cfg->n; i++) {
+        bool timed = i % step == 0 && t.n < ops;
+
+        if (timed && cold && (fd = drop_cache(fd)) < 0)
+            goto out;
+        t0 = now_ns();
+        if (add_student(fd, ids[i], "bench", "student", (int)(i % (MAX_STD_GPA + 1))) != NO_ERROR)
+            goto out;
+        if (timed)
+            t.ns[t.n++] = now_ns() - t0;
+    }
+    if (sync_db(fd) != NO_ERROR)
+        goto out;
+    report(cfg, pop, cold, "add", &t);
+
+    shuffle(ids, cfg->n);
+    for (long i = 0; i < ops; i++) {
+        if (cold && (fd = drop_cache(fd)) < 0)
+            goto out;
+        t0 = now_ns();
+        if (get_student(fd, ids[i], &s) != NO_ERROR)
+            goto out;
+        t.ns[t.n++] = now_ns() - t0;
+    }
+    report(cfg, pop, cold, "get", &t);
+
+    //the same ids as one get_students() batch, each id is charged an equal
+    //share of the batch's time
+    {
+        student_t *recs = malloc(ops * sizeof(*recs));
+        int *rcs = malloc(ops * sizeof(*rcs));
+        uint64_t ns;
+
+        if (recs == NULL || rcs == NULL || (cold && (fd = drop_cache(fd)) < 0)) {
+            free(recs);
+            free(rcs);
+            goto out;
+        }
+        t0 = now_ns();
+        rc = get_students(fd, ids, (int)ops, recs, rcs);
+        ns = now_ns() - t0;
+        free(recs);
+        free(rcs);
+        if (rc != NO_ERROR)
+            goto out;
+        rc = ERR_DB_FILE;
+        for (long i = 0; i < ops; i++)
+            t.ns[t.n++] = ns / ops;
+    }
+    report(cfg, pop, cold, "get_batch", &t);
+
+    for (long r = 0; r < whole; r++) {
+        if (cold && (fd = drop_cache(fd)) < 0)
+            goto out;
+        t0 = now_ns();
+        if (count_db_records(fd) != cfg->n)
+            goto out;
+        t.ns[t.n++] = now_ns() - t0;
+    }
+    report(cfg, pop, cold, "count", &t);
+
+    for (long r = 0; r < whole; r++) {
+        if (cold && (fd = drop_cache(fd)) < 0)
+            goto out;
+        t0 = now_ns();
+        if (print_db(fd) != NO_ERROR)
+            goto out;
+        fflush(stdout);
+        t.ns[t.n++] = now_ns() - t0;
+    }
+    report(cfg, pop, cold, "print", &t);
+
+    //delete the first half of the (shuffled) ids
+    for (long i = 0; i < cfg->n / 2; i++) {
+        bool timed = i % step == 0 && t.n < ops;
+
+        if (timed && cold && (fd = drop_cache(fd)) < 0)
+            goto out;
+        t0 = now_ns();
+        if (del_student(fd, ids[i]) != NO_ERROR)
+            goto out;
+        if (timed)
+            t.ns[t.n++] = now_ns() - t0;
+    }
+    if (sync_db(fd) != NO_ERROR)
+        goto out;
+    report(cfg, pop, cold, "delete", &t);
+
+    if (cold && (fd = drop_cache(fd)) < 0)
+        goto out;
+    t0 = now_ns();
+    fd = compress_db(fd);
+    if (fd < 0)
+        goto out;
+    t.ns[t.n++] = now_ns() - t0;
+    report(cfg, pop, cold, "compress", &t);
+    rc = NO_ERROR;
+
+out:
+    if (fd >= 0)
+        close_db(fd);
+    clean_dir();
+    free(t.ns);
+    free(ids);
+    return rc;
+}
+
+static void bench_usage(char *exename)
+{
+    fprintf(stderr, "usage: %s [-n students] [-s cold_samples] [-r repeats] "
+                    "[-m warm|cold|both] [-d dir] [-o file]\n", exename);
+}
+
+int main(int argc, char *argv[])
+{
+    bench_cfg_t cfg = { BENCH_DEFAULT_N, BENCH_DEFAULT_SAMPLES,
+                        BENCH_DEFAULT_REPEATS, true, true, ".", NULL };
+    char scratch[PATH_MAX];
+    const char *out_path = NULL;
+    int home, out_fd, opt, rc = 0;
+
+    while ((opt = getopt(argc, argv, "n:s:r:m:d:o:h")) != -1) {
+        switch (opt) {
+        case 'n': cfg.n = atol(optarg); break;
+        case 's': cfg.samples = atol(optarg); break;
+        case 'r': cfg.repeats = atoi(optarg); break;
+        case 'm':
+            cfg.warm = strcmp(optarg, "cold") != 0;
+            cfg.cold = strcmp(optarg, "warm") != 0;
+            break;
+        case 'd': cfg.dir = optarg; break;
+        case 'o': out_path = optarg; break;
+        default:
+            bench_usage(argv[0]);
+            return EXIT_FAIL_ARGS;
+        }
+    }
+    if (cfg.n < 2 || cfg.n > MAX_STD_ID - MIN_STD_ID + 1 || cfg.samples < 1 ||
+        cfg.repeats < 1) {
+        bench_usage(argv[0]);
+        return EXIT_FAIL_ARGS;
+    }
+
+    //the JSON goes to the real stdout, the API's messages do not
+    out_fd = out_path ? open(out_path, O_WRONLY | O_CREAT | O_TRUNC, 0644) : dup(STDOUT_FILENO);
+    if (out_fd == -1 || (cfg.out = fdopen(out_fd, "w")) == NULL ||
+        freopen("/dev/null", "w", stdout) == NULL) {
+        perror("sdb_bench");
+        return EXIT_FAIL_DB;
+    }
+
+    //compress_db() works on DB_FILE relative to the working directory
+    snprintf(scratch, sizeof(scratch), "%s/sdb_bench.XXXXXX", cfg.dir);
+    home = open(".", O_RDONLY | O_DIRECTORY);
+    if (home == -1 || mkdtemp(scratch) == NULL || chdir(scratch) == -1) {
+        perror("sdb_bench");
+        return EXIT_FAIL_DB;
+    }
+
+    srandom(1);
+    fprintf(cfg.out, "{\n  \"benchmark\": \"sdbsc\",\n  \"students\": %ld,\n"
+                     "  \"cold_samples\": %ld,\n  \"repeats\": %d,\n  \"results\": [",
+            cfg.n, cfg.samples, cfg.repeats);
+    for (int p = 0; p < NUM_POPS && rc == 0; p++) {
+        if (cfg.warm && run_pop(&cfg, (pop_t)p, false) != NO_ERROR)
+            rc = EXIT_FAIL_DB;
+        if (rc == 0 && cfg.cold && run_pop(&cfg, (pop_t)p, true) != NO_ERROR)
+            rc = EXIT_FAIL_DB;
+    }
+    fprintf(cfg.out, "\n  ]\n}\n");
+    fclose(cfg.out);
+
+    if (fchdir(home) == 0)
+        rmdir(scratch);
+    close(home);
+    if (rc != 0)
+        fprintf(stderr, "sdb_bench: a database operation failed\n");
+    return rc;
+}
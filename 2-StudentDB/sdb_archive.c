@@ -0,0 +1,535 @@
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include "db.h"
+#include "sdbsc.h"
+#include "sdb_handle.h"
+#include "sdb_mmap.h"
+#include "sdb_scan.h"
+#include "sdb_lock.h"
+#include "sdb_wal.h"
+#include "sdb_engine.h"
+#include "sdb_crc.h"
+#include "sdb_archive.h"
+
+//The archive engine reads straight from the shared mapping: an archive
+//never changes once written (it is replaced with rename(), which the gate
+//notices), so no lock beyond the gate is needed.  Blocks are inflated into
+//a buffer on the stack, which keeps lookups safe to run from several
+//threads.
+
+#define HDR_SZ          ((off_t)sizeof(arch_hdr_t))
+#define BLOCK_RAW_MAX   (ARCH_BLOCK_RECS * (size_t)STUDENT_RECORD_SIZE)
+
+//students collected by the archive writer's scan
+typedef struct rec_vec {
+    student_t *v;
+    long       n;
+    long       cap;
+} rec_vec_t;
+
+static const arch_hdr_t *hdr(db_handle_t *h)
+{
+    return (const arch_hdr_t *)h->base;
+}
+
+static const arch_block_t *index_at(db_handle_t *h)
+{
+    return (const arch_block_t *)(h->base + hdr(h)->index_off);
+}
+
+/*
+ *  to_cols / from_cols
+ *      recs:  students of one block, in id order
+ *      n:     how many
+ *      raw:   the same students as columns, packed back to back: n id
+ *             deltas, n GPAs, n first names, n last names
+ *
+ *  returns:  to_cols() returns the length of the columns, n * 64
+ */
+static size_t to_cols(const student_t *recs, int n, char *raw)
+{
+    char *p = raw;
+    int prev = 0;
+
+    for (int i = 0; i < n; i++) {
+        uint32_t d = (uint32_t)(recs[i].id - prev);
+
+        memcpy(p, &d, sizeof(d));
+        p += sizeof(d);
+        prev = recs[i].id;
+    }
+    for (int i = 0; i < n; i++, p += sizeof(int32_t))
+        memcpy(p, &recs[i].gpa, sizeof(int32_t));
+    for (int i = 0; i < n; i++, p += sizeof(recs[i].fname))
+        memcpy(p, recs[i].fname, sizeof(recs[i].fname));
+    for (int i = 0; i < n; i++, p += sizeof(recs[i].lname))
+        memcpy(p, recs[i].lname, sizeof(recs[i].lname));
+    return p - raw;
+}
+
+static void from_cols(const char *raw, int n, student_t *recs)
+{
+    const char *gpas = raw + (size_t)n * sizeof(uint32_t);
+    const char *fnames = gpas + (size_t)n * sizeof(int32_t);
+    const char *lnames = fnames + (size_t)n * sizeof(recs->fname);
+    int id = 0;
+
+    for (int i = 0; i < n; i++) {
+        uint32_t d;
+
+        memcpy(&d, raw + i * sizeof(d), sizeof(d));
+        id += (int)d;
+        recs[i].id = id;
+        memcpy(&recs[i].gpa, gpas + i * sizeof(int32_t), sizeof(int32_t));
+        memcpy(recs[i].fname, fnames + i * sizeof(recs->fname), sizeof(recs->fname));
+        memcpy(recs[i].lname, lnames + i * sizeof(recs->lname), sizeof(recs->lname));
+    }
+}
+
+/*
+ *  load_block
+ *      h:     database handle
+ *      b:     index entry of the block
+ *      recs:  receives the block's b->nrecs students
+ *
+ *  Checks the block's CRC, inflates it and turns the columns back into
+ *  records.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE for a damaged block
+ */
+static int load_block(db_handle_t *h, const arch_block_t *b, student_t *recs)
+{
+    char raw[BLOCK_RAW_MAX];
+    size_t want = (size_t)b->nrecs * STUDENT_RECORD_SIZE;
+    uLongf len = sizeof(raw);
+    const char *src;
+
+    if (b->nrecs == 0 || b->nrecs > ARCH_BLOCK_RECS ||
+        b->off < (uint64_t)HDR_SZ || b->off + b->clen > (uint64_t)h->file_len)
+        return ERR_DB_FILE;
+    src = h->base + b->off;
+    if (crc32c(0, src, b->clen) != b->crc)
+        return ERR_DB_FILE;
+
+    if (b->clen == want) {
+        memcpy(raw, src, want);
+    } else if (uncompress((Bytef *)raw, &len, (const Bytef *)src, b->clen) != Z_OK ||
+               len != want) {
+        return ERR_DB_FILE;
+    }
+    from_cols(raw, b->nrecs, recs);
+    return NO_ERROR;
+}
+
+/*
+ *  find_block
+ *      h:   database handle
+ *      id:  student id
+ *
+ *  returns:  index of the first block whose last id is >= id, nblocks
+ *            when there is none
+ */
+static uint64_t find_block(db_handle_t *h, int id)
+{
+    const arch_block_t *ix = index_at(h);
+    uint64_t lo = 0, hi = hdr(h)->nblocks;
+
+    while (lo < hi) {
+        uint64_t mid = lo + (hi - lo) / 2;
+
+        if (ix[mid].last_id < id)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+static int arch_attach(db_handle_t *h)
+{
+    const arch_hdr_t *hd;
+
+    if (map_refresh(h) != NO_ERROR || h->base == NULL || h->file_len < HDR_SZ)
+        return ERR_DB_FILE;
+
+    hd = hdr(h);
+    if (memcmp(hd->magic, ARCH_MAGIC, sizeof(hd->magic)) != 0 ||
+        hd->version != ARCH_VERSION || hd->block_recs != ARCH_BLOCK_RECS ||
+        hd->index_off < (uint64_t)HDR_SZ || hd->index_off > (uint64_t)h->file_len ||
+        hd->nblocks > ((uint64_t)h->file_len - hd->index_off) / sizeof(arch_block_t))
+        return ERR_DB_FILE;
+    return NO_ERROR;
+}
+
+static int arch_get(db_handle_t *h, int id, student_t *out)
+{
+    student_t recs[ARCH_BLOCK_RECS];
+    uint64_t bi = find_block(h, id);
+    const arch_block_t *b;
+    int lo, hi;
+
+    if (bi == hdr(h)->nblocks || index_at(h)[bi].first_id > id)
+        return SRCH_NOT_FOUND;
+    b = &index_at(h)[bi];
+    if (load_block(h, b, recs) != NO_ERROR)
+        return ERR_DB_FILE;
+
+    lo = 0;
+    hi = (int)b->nrecs - 1;
+    while (lo <= hi) {
+        int mid = lo + (hi - lo) / 2;
+
+        if (recs[mid].id == id) {
+            *out = recs[mid];
+            return NO_ERROR;
+        }
+        if (recs[mid].id < id)
+            lo = mid + 1;
+        else
+            hi = mid - 1;
+    }
+    return SRCH_NOT_FOUND;
+}
+
+static int arch_put(db_handle_t *h, int id, const student_t *rec)
+{
+    (void)h; (void)id; (void)rec;
+    return ERR_DB_FILE;
+}
+
+/*
+ *  arch_range
+ *      h:    database handle, gate held
+ *      lo:   smallest id to visit
+ *      hi:   largest id to visit
+ *      fn:   scan_db() callback
+ *      arg:  passed through to fn
+ *
+ *  Inflates the blocks that overlap [lo, hi] one at a time and hands
+ *  their students to fn in pages of up to RECS_PER_PAGE.
+ *
+ *  returns:  NO_ERROR, ERR_DB_FILE, or the first error returned by fn
+ */
+static int arch_range(db_handle_t *h, int lo, int hi, scan_page_fn fn, void *arg)
+{
+    student_t recs[ARCH_BLOCK_RECS];
+    const arch_block_t *ix = index_at(h);
+    int rc = NO_ERROR;
+
+    for (uint64_t bi = find_block(h, lo);
+         rc == NO_ERROR && bi < hdr(h)->nblocks && ix[bi].first_id <= hi; bi++) {
+        int first = 0, last = (int)ix[bi].nrecs;
+
+        if (load_block(h, &ix[bi], recs) != NO_ERROR)
+            return ERR_DB_FILE;
+        while (first < last && recs[first].id < lo)
+            first++;
+        while (last > first && recs[last - 1].id > hi)
+            last--;
+
+        for (int i = first; rc == NO_ERROR && i < last; i += RECS_PER_PAGE) {
+            int cnt = last - i < RECS_PER_PAGE ? last - i : RECS_PER_PAGE;
+            uint64_t occupied = cnt == 64 ? ~(uint64_t)0 : ((uint64_t)1 << cnt) - 1;
+
+            rc = fn(arg, -1, &recs[i], cnt, occupied);
+        }
+    }
+    return rc;
+}
+
+static int arch_scan(db_handle_t *h, scan_page_fn fn, void *arg)
+{
+    return arch_range(h, MIN_STD_ID, INT_MAX, fn, arg);
+}
+
+static int arch_compact(db_handle_t *h, compact_progress_fn fn, void *arg,
+                        compact_stats_t *st)
+{
+    st->total = st->scanned = h->file_len;
+    st->reclaimed = 0;
+    if (fn != NULL)
+        fn(arg, st);
+    return NO_ERROR;
+}
+
+const db_engine_t archive_engine = {
+    "archive",
+    arch_attach,
+    NULL,
+    arch_get,
+    NULL,
+    NULL,
+    arch_put,
+    NULL,
+    NULL,
+    arch_scan,
+    arch_range,
+    arch_compact,
+};
+
+static int collect_recs(void *arg, int first, const student_t *recs, int n,
+                        uint64_t occupied)
+{
+    rec_vec_t *rv = arg;
+    (void)first; (void)n;
+
+    while (occupied) {
+        if (rv->n == rv->cap) {
+            long cap = rv->cap ? rv->cap * 2 : 1024;
+            student_t *v = realloc(rv->v, cap * sizeof(*v));
+
+            if (v == NULL)
+                return ERR_DB_FILE;
+            rv->v = v;
+            rv->cap = cap;
+        }
+        rv->v[rv->n++] = recs[__builtin_ctzll(occupied)];
+        occupied &= occupied - 1;
+    }
+    return NO_ERROR;
+}
+
+static int write_all(int fd, const void *buf, size_t len, off_t off)
+{
+    return pwrite(fd, buf, len, off) == (ssize_t)len ? NO_ERROR : ERR_DB_FILE;
+}
+
+/*
+ *  write_archive
+ *      out:   file to write, empty
+ *      recs:  every student, in id order
+ *      n:     how many
+ *      size:  receives the size of the archive
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ */
+static int write_archive(int out, const student_t *recs, long n, off_t *size)
+{
+    arch_hdr_t hd = { .version = ARCH_VERSION, .block_recs = ARCH_BLOCK_RECS };
+    uint64_t nblocks = (n + ARCH_BLOCK_RECS - 1) / ARCH_BLOCK_RECS;
+    arch_block_t *ix = calloc(nblocks ? nblocks : 1, sizeof(*ix));
+    uLong bound = compressBound(BLOCK_RAW_MAX);
+    char *raw = malloc(BLOCK_RAW_MAX);
+    Bytef *zbuf = malloc(bound);
+    int level = db_config_int("SDB_ARCHIVE_LEVEL", ARCH_LEVEL);
+    off_t off = HDR_SZ;
+    int rc = NO_ERROR;
+
+    if (ix == NULL || raw == NULL || zbuf == NULL)
+        rc = ERR_DB_FILE;
+    if (level < 0 || level > 9)
+        level = ARCH_LEVEL;
+
+    for (uint64_t bi = 0; rc == NO_ERROR && bi < nblocks; bi++) {
+        const student_t *br = recs + bi * ARCH_BLOCK_RECS;
+        int cnt = n - (long)(bi * ARCH_BLOCK_RECS) < ARCH_BLOCK_RECS
+                      ? (int)(n - (long)(bi * ARCH_BLOCK_RECS)) : ARCH_BLOCK_RECS;
+        size_t rlen = to_cols(br, cnt, raw);
+        uLongf clen = bound;
+        const void *data = zbuf;
+
+        if (compress2(zbuf, &clen, (const Bytef *)raw, rlen, level) != Z_OK ||
+            clen >= rlen) {
+            data = raw;
+            clen = rlen;
+        }
+
+        ix[bi].first_id = br[0].id;
+        ix[bi].last_id = br[cnt - 1].id;
+        ix[bi].nrecs = cnt;
+        ix[bi].clen = clen;
+        ix[bi].off = off;
+        ix[bi].crc = crc32c(0, data, clen);
+        rc = write_all(out, data, clen, off);
+        off += clen;
+    }
+
+    memcpy(hd.magic, ARCH_MAGIC, sizeof(hd.magic));
+    hd.nblocks = nblocks;
+    hd.nrecs = n;
+    hd.index_off = off;
+    if (rc == NO_ERROR)
+        rc = write_all(out, ix, nblocks * sizeof(*ix), off);
+    if (rc == NO_ERROR)
+        rc = write_all(out, &hd, sizeof(hd), 0);
+    if (rc == NO_ERROR && fsync(out) == -1)
+        rc = ERR_DB_FILE;
+    *size = off + (off_t)(nblocks * sizeof(*ix));
+
+    free(ix);
+    free(raw);
+    free(zbuf);
+    return rc;
+}
+
+/*
+ *  replace_db
+ *      fd:   the open database, gate held exclusive
+ *      tmp:  the finished file to put in its place
+ *
+ *  Renames tmp over DB_FILE while still holding the old file's gate, like
+ *  compress_db() does, and opens the new file.
+ *
+ *  returns:  fd of the new database, or ERR_DB_FILE (fd is closed either
+ *            way)
+ *
+ *  console:  M_ERR_DB_CREATE if the rename failed
+ */
+static int replace_db(int fd, const char *tmp)
+{
+    int rc = rename(tmp, DB_FILE);
+    int new_fd;
+
+    close_db(fd);
+    if (rc != 0) {
+        unlink(tmp);
+        printf(M_ERR_DB_CREATE);
+        return ERR_DB_FILE;
+    }
+
+    new_fd = open_db(DB_FILE, false);
+    if (new_fd < 0)
+        return ERR_DB_FILE;
+    db_notify_rebuild(db_handle_get(new_fd));
+    return new_fd;
+}
+
+/*
+ *  archive_db
+ *      fd:    linux file descriptor
+ *      dest:  file to write the archive to, NULL to turn the database
+ *             itself into an archive
+ *
+ *  Writes every student into a compressed archive (-X).  In place the
+ *  archive replaces student.db, which is read-only from then on.  The
+ *  gate is held exclusive for the whole run so no change is lost.
+ *
+ *  returns:  fd of the database (a new one when archived in place), or
+ *            ERR_DB_FILE, in which case fd has been closed
+ *
+ *  console:  M_ARCHIVE_DONE or M_ERR_ARCHIVE
+ */
+int archive_db(int fd, char *dest)
+{
+    db_handle_t *h = db_handle_get(fd);
+    char tmp[PATH_MAX];
+    rec_vec_t rv = {0};
+    struct stat st;
+    off_t size = 0;
+    int out, rc;
+
+    if (h == NULL || db_gate_enter(h, true) != NO_ERROR ||
+        wal_checkpoint(h) != NO_ERROR || fstat(h->fd, &st) == -1 ||
+        scan_db(h, collect_recs, &rv) != NO_ERROR) {
+        free(rv.v);
+        close_db(fd);
+        printf(M_ERR_ARCHIVE);
+        return ERR_DB_FILE;
+    }
+
+    if (dest == NULL)
+        snprintf(tmp, sizeof(tmp), "%s", TMP_DB_FILE);
+    else if (snprintf(tmp, sizeof(tmp), "%s.tmp", dest) >= (int)sizeof(tmp))
+        tmp[0] = '\0';
+
+    out = tmp[0] ? open(tmp, O_RDWR | O_CREAT | O_TRUNC, 0644) : -1;
+    rc = out == -1 ? ERR_DB_FILE : write_archive(out, rv.v, rv.n, &size);
+    if (out != -1)
+        close(out);
+    if (rc == NO_ERROR && dest != NULL && rename(tmp, dest) != 0)
+        rc = ERR_DB_FILE;
+    if (rc != NO_ERROR) {
+        if (out != -1)
+            unlink(tmp);
+        free(rv.v);
+        close_db(fd);
+        printf(M_ERR_ARCHIVE);
+        return ERR_DB_FILE;
+    }
+
+    if (dest == NULL)
+        fd = replace_db(fd, tmp);
+    else
+        db_gate_leave(h);
+    if (fd >= 0)
+        printf(M_ARCHIVE_DONE, rv.n, (long long)size, (long long)st.st_blocks * 512);
+    free(rv.v);
+    return fd;
+}
+
+/*
+ *  unarchive_db
+ *      fd:  linux file descriptor of an archive
+ *
+ *  Turns the archive back into a writable database (-U) in the format
+ *  SDB_FORMAT names, legacy by default.  The new file is built on the
+ *  side and renamed over student.db.
+ *
+ *  returns:  fd of the new database, or ERR_DB_FILE, in which case fd
+ *            has been closed
+ *
+ *  console:  M_UNARCHIVE_DONE, M_ERR_NOT_ARCHIVE or M_ERR_DB_WRITE
+ */
+int unarchive_db(int fd)
+{
+    db_handle_t *h = db_handle_get(fd);
+    db_handle_t *th;
+    rec_vec_t rv = {0};
+    int tfd, rc;
+
+    if (h == NULL || db_gate_enter(h, true) != NO_ERROR) {
+        close_db(fd);
+        printf(M_ERR_DB_READ);
+        return ERR_DB_FILE;
+    }
+    if (h->engine != &archive_engine) {
+        close_db(fd);
+        printf(M_ERR_NOT_ARCHIVE);
+        return ERR_DB_FILE;
+    }
+    if (scan_db(h, collect_recs, &rv) != NO_ERROR) {
+        free(rv.v);
+        close_db(fd);
+        printf(M_ERR_DB_READ);
+        return ERR_DB_FILE;
+    }
+
+    //a handle without a path has no log and no sidecars, the new file
+    //gets those once it is student.db
+    tfd = open(TMP_DB_FILE, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    th = tfd == -1 ? NULL : db_handle_open(tfd, NULL);
+    rc = th == NULL ? ERR_DB_FILE : NO_ERROR;
+    if (rc == NO_ERROR && th->engine->bulk_put != NULL) {
+        rc = th->engine->bulk_put(th, rv.v, rv.n);
+    } else {
+        for (long i = 0; rc == NO_ERROR && i < rv.n; i++)
+            rc = db_put(th, rv.v[i].id, &rv.v[i]);
+    }
+    if (rc == NO_ERROR && (map_flush(th) != NO_ERROR || fsync(tfd) == -1))
+        rc = ERR_DB_FILE;
+    db_handle_release(th);
+    if (tfd != -1)
+        close(tfd);
+    if (rc != NO_ERROR) {
+        unlink(TMP_DB_FILE);
+        free(rv.v);
+        close_db(fd);
+        printf(M_ERR_DB_WRITE);
+        return ERR_DB_FILE;
+    }
+
+    fd = replace_db(fd, TMP_DB_FILE);
+    if (fd >= 0)
+        printf(M_UNARCHIVE_DONE, rv.n);
+    free(rv.v);
+    return fd;
+}
@@ -0,0 +1,60 @@
+#ifndef __SDB_ARCHIVE_H__
+    #define __SDB_ARCHIVE_H__
+
+#include <stdint.h>
+
+#include "db.h"
+#include "sdb_handle.h"
+
+//Compressed read-only archive format, see sdb_archive.c.  Layout:
+//
+//  [arch_hdr_t][block 0][block 1]...[arch_block_t index[nblocks]]
+//
+//A block holds up to ARCH_BLOCK_RECS students with consecutive ids (in
+//id order) and is compressed on its own with zlib, so a lookup inflates
+//one block found by binary search of the index.  Before compression the
+//block is turned into columns: id deltas, GPAs, first names, last names.
+//Each column is runs of similar bytes (mostly 1s, short names padded with
+//zeros) which deflate handles much better than interleaved rows.  A block
+//that does not shrink is stored as is (clen == nrecs * 64).
+//
+//sdbsc opens an archive like any database file, through the archive
+//engine; adds and deletes fail.  -X writes one, -U turns one back into a
+//writable database.
+
+#define ARCH_MAGIC          "SDBARCH1"
+#define ARCH_VERSION        1
+#define ARCH_BLOCK_RECS     256
+#define ARCH_LEVEL          6       //zlib level, SDB_ARCHIVE_LEVEL=0..9
+
+typedef struct arch_hdr {
+    char     magic[8];
+    uint32_t version;
+    uint32_t block_recs;        //ARCH_BLOCK_RECS when written
+    uint64_t nblocks;
+    uint64_t nrecs;
+    uint64_t index_off;         //file offset of the block index
+    char     pad[24];
+} arch_hdr_t;
+
+typedef struct arch_block {
+    int32_t  first_id;
+    int32_t  last_id;
+    uint32_t nrecs;
+    uint32_t clen;              //compressed bytes at off
+    uint64_t off;
+    uint32_t crc;               //crc32c() of the compressed bytes
+    uint32_t pad;
+} arch_block_t;
+
+//Output messages
+#define M_ARCHIVE_DONE      "Archived %ld student(s) into %lld bytes (%lld before).\n"
+#define M_UNARCHIVE_DONE    "Restored %ld student(s) from the archive.\n"
+#define M_ERR_NOT_ARCHIVE   "Database is not an archive.\n"
+#define M_ERR_ARCHIVE       "Error writing the archive, exiting!\n"
+
+//prototypes for sdb_archive.c
+int archive_db(int fd, char *dest);
+int unarchive_db(int fd);
+
+#endif
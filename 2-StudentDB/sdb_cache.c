@@ -0,0 +1,608 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "db.h"
+#include "sdbsc.h"
+#include "sdb_handle.h"
+#include "sdb_mmap.h"
+#include "sdb_lock.h"
+#include "sdb_engine.h"
+#include "sdb_cache.h"
+
+//Every engine reads through the mapping, so what a lookup costs is not
+//the copy but the locking around it: the record lock and unlock are two
+//fcntl() calls, and an archive inflates a whole block for one record.  A
+//hit here needs neither.  Under the server, which holds the gate for a
+//whole round of requests, a hit makes no system call at all.
+//
+//Pages are filled whole, so a hit can also answer "not found".  A miss
+//reads the generation first and only keeps the page if no writer bumped
+//it meanwhile; writers store first and bump after, so any page read
+//before a store is either thrown away or dropped at the next lookup.
+//
+//A legacy slot is one 64 byte copy out of the mapping, so with no store
+//in progress it can be read without the record lock: writers bracket
+//their stores with cache_store_begin()/cache_store_end(), and a copy is
+//kept only if the stores word did not move while it was taken.  The low
+//half counts stores in progress; one left behind by a writer that died
+//mid store keeps readers on the locked path until somebody next holds
+//the gate exclusive.  A writer that cannot bump the word fails its
+//change up front (cache_may_store()) rather than store behind the
+//readers' backs.
+//
+//Replacement is CLOCK: a hit sets the page's reference bit, and the hand
+//evicts the first page it finds with the bit clear, clearing bits as it
+//passes.  Pages that keep getting hit survive a sweep of one-off misses.
+
+typedef struct cache_page {
+    int32_t   page;             //id / CACHE_PAGE_RECS, -1 when free
+    int32_t   next;             //next slot in the hash chain, -1 ends it
+    bool      ref;              //CLOCK reference bit
+    uint64_t  occupied;         //bit i set when recs[i] is a student
+    student_t recs[CACHE_PAGE_RECS];
+} cache_page_t;
+
+typedef struct page_cache {
+    cache_gen_t  *shared;       //mapped sidecar, NULL when there is none
+    bool          writable;     //shared may be bumped
+    uint64_t      gen;          //generation the pages are good for
+    uint32_t      cap;          //slots in pages, 0 when the cache is off
+    uint32_t      hand;
+    uint32_t      nbuckets;     //power of two
+    int32_t      *buckets;      //first slot of each hash chain, -1 if none
+    cache_page_t *pages;
+    cache_stats_t st;
+} page_cache_t;
+
+/*
+ *  map_gen
+ *      h:  database handle
+ *      c:  cache to map the generation counter for
+ *
+ *  Opens (creating it if we may) and maps the .gen sidecar.  Leaves
+ *  c->shared NULL when that is not possible.
+ */
+static void map_gen(db_handle_t *h, page_cache_t *c)
+{
+    char path[PATH_MAX];
+    struct stat st;
+    void *p;
+    int gfd;
+
+    if (db_sidecar_path(h, CACHE_SUFFIX, path, sizeof(path)) != NO_ERROR)
+        return;
+
+    c->writable = !h->read_only;
+    gfd = c->writable ? open(path, O_RDWR | O_CREAT, 0644) : -1;
+    if (gfd == -1) {
+        c->writable = false;
+        gfd = open(path, O_RDONLY);
+    }
+    if (gfd == -1)
+        return;
+
+    //two processes may both size a new file, to the same length
+    if (fstat(gfd, &st) == -1 ||
+        (st.st_size < (off_t)sizeof(cache_gen_t) &&
+         (!c->writable || ftruncate(gfd, sizeof(cache_gen_t)) == -1))) {
+        close(gfd);
+        return;
+    }
+    p = mmap(NULL, sizeof(cache_gen_t), PROT_READ | (c->writable ? PROT_WRITE : 0),
+             MAP_SHARED, gfd, 0);
+    close(gfd);
+    if (p == MAP_FAILED)
+        return;
+
+    c->shared = p;
+    if (c->writable && memcmp(c->shared->magic, CACHE_MAGIC, sizeof(c->shared->magic)) != 0)
+        memcpy(c->shared->magic, CACHE_MAGIC, sizeof(c->shared->magic));
+}
+
+//forgets every page
+static void cache_drop(page_cache_t *c)
+{
+    for (uint32_t i = 0; i < c->nbuckets; i++)
+        c->buckets[i] = -1;
+    for (uint32_t i = 0; i < c->cap; i++)
+        c->pages[i].page = -1;
+    if (c->st.pages > 0)
+        c->st.invalidations++;
+    c->st.pages = 0;
+    c->hand = 0;
+}
+
+/*
+ *  cache_attach
+ *      h:  database handle
+ *
+ *  Sets up the handle's cache on first use.  The generation counter is
+ *  mapped even with SDB_CACHE_PAGES=0, a process that does not cache
+ *  still has to tell the ones that do about its changes.
+ *
+ *  returns:  the cache, or NULL when out of memory
+ */
+static page_cache_t *cache_attach(db_handle_t *h)
+{
+    page_cache_t *c = h->cache;
+    int cap;
+
+    if (c != NULL)
+        return c;
+    c = calloc(1, sizeof(*c));
+    if (c == NULL)
+        return NULL;
+    h->cache = c;
+
+    map_gen(h, c);
+    cap = db_config_int("SDB_CACHE_PAGES", CACHE_PAGES);
+    if (c->shared == NULL || cap <= 0)
+        return c;
+
+    c->nbuckets = 1;
+    while (c->nbuckets < (uint32_t)cap)
+        c->nbuckets *= 2;
+    c->pages = malloc((size_t)cap * sizeof(*c->pages));
+    c->buckets = malloc((size_t)c->nbuckets * sizeof(*c->buckets));
+    if (c->pages == NULL || c->buckets == NULL) {
+        free(c->pages);
+        free(c->buckets);
+        c->pages = NULL;
+        c->buckets = NULL;
+        c->nbuckets = 0;
+        return c;
+    }
+    c->cap = (uint32_t)cap;
+    cache_drop(c);
+    c->gen = __atomic_load_n(&c->shared->gen, __ATOMIC_ACQUIRE);
+    return c;
+}
+
+static cache_page_t *cache_find(page_cache_t *c, int page)
+{
+    int32_t i = c->buckets[(uint32_t)page & (c->nbuckets - 1)];
+
+    while (i != -1 && c->pages[i].page != page)
+        i = c->pages[i].next;
+    return i == -1 ? NULL : &c->pages[i];
+}
+
+static void cache_unlink(page_cache_t *c, cache_page_t *p)
+{
+    int32_t *link = &c->buckets[(uint32_t)p->page & (c->nbuckets - 1)];
+
+    while (*link != p - c->pages)
+        link = &c->pages[*link].next;
+    *link = p->next;
+    p->page = -1;
+    c->st.pages--;
+}
+
+/*
+ *  cache_victim
+ *      c:  the cache
+ *
+ *  Moves the CLOCK hand to a free slot or evicts the first page whose
+ *  reference bit is clear.  Two sweeps at most.
+ *
+ *  returns:  a free slot
+ */
+static cache_page_t *cache_victim(page_cache_t *c)
+{
+    for (;;) {
+        cache_page_t *p = &c->pages[c->hand];
+
+        c->hand = (c->hand + 1) % c->cap;
+        if (p->page == -1)
+            return p;
+        if (p->ref) {
+            p->ref = false;
+            continue;
+        }
+        cache_unlink(c, p);
+        c->st.evictions++;
+        return p;
+    }
+}
+
+//range scan callback, first is -1 for the engines that would call it
+static int fill_page(void *arg, int first, const student_t *recs, int n,
+                     uint64_t occupied)
+{
+    cache_page_t *p = arg;
+    (void)first; (void)n;
+
+    while (occupied) {
+        int i = __builtin_ctzll(occupied);
+        int slot = recs[i].id - p->page * CACHE_PAGE_RECS;
+
+        p->recs[slot] = recs[i];
+        p->occupied |= 1ULL << slot;
+        occupied &= occupied - 1;
+    }
+    return NO_ERROR;
+}
+
+//seqlock read side: false when a store is in progress right now
+static bool read_begin(page_cache_t *c, uint64_t *seq)
+{
+    if (c->shared == NULL)
+        return false;
+    *seq = __atomic_load_n(&c->shared->stores, __ATOMIC_ACQUIRE);
+    return (uint32_t)*seq == 0;
+}
+
+//true when no store began while the copy was taken
+static bool read_end(page_cache_t *c, uint64_t seq)
+{
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&c->shared->stores, __ATOMIC_RELAXED) == seq;
+}
+
+static void copy_legacy(db_handle_t *h, cache_page_t *p, int lo)
+{
+    p->occupied = 0;
+    for (int i = lo == 0 ? 1 : 0; i < CACHE_PAGE_RECS; i++) {
+        student_t *rec = map_slot(h, lo + i);
+
+        if (rec != NULL && rec->id == lo + i) {
+            p->recs[i] = *rec;
+            p->occupied |= 1ULL << i;
+        }
+    }
+}
+
+/*
+ *  load_page
+ *      h:     database handle, gate held
+ *      p:     slot to fill
+ *      page:  page of ids to read
+ *
+ *  A legacy page is copied from the mapping, under a read lock on its 4K
+ *  only if a store got in the way; the other engines are asked for the
+ *  range of ids.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ */
+static int load_page(db_handle_t *h, cache_page_t *p, int page)
+{
+    int lo = page * CACHE_PAGE_RECS;
+    uint64_t seq;
+
+    p->occupied = 0;
+    p->page = page;             //for fill_page(), unset again by the caller
+    if (h->engine != &legacy_engine)
+        return h->engine->range(h, lo, lo + CACHE_PAGE_RECS - 1, fill_page, p)
+               == NO_ERROR ? NO_ERROR : ERR_DB_FILE;
+
+    if (read_begin(h->cache, &seq)) {
+        copy_legacy(h, p, lo);
+        if (read_end(h->cache, seq))
+            return NO_ERROR;
+    }
+    if (db_lock_range(h, (off_t)lo * STUDENT_RECORD_SIZE,
+                      CACHE_PAGE_RECS * STUDENT_RECORD_SIZE, false) != NO_ERROR)
+        return ERR_DB_FILE;
+    copy_legacy(h, p, lo);
+    db_unlock_range(h, (off_t)lo * STUDENT_RECORD_SIZE,
+                    CACHE_PAGE_RECS * STUDENT_RECORD_SIZE);
+    return NO_ERROR;
+}
+
+/*
+ *  cache_get
+ *      h:     database handle, gate held
+ *      id:    student to look up
+ *      out:   receives the student if found
+ *      fill:  on a miss read the page in, false to leave misses to the
+ *             caller
+ *
+ *  returns:  NO_ERROR, SRCH_NOT_FOUND or ERR_DB_FILE like db_get(), or
+ *            CACHE_MISS when the cache is off (or fill is false and the
+ *            page is not cached); the caller then uses db_get()
+ */
+int cache_get(db_handle_t *h, int id, student_t *out, bool fill)
+{
+    page_cache_t *c = cache_attach(h);
+    int page = id / CACHE_PAGE_RECS, slot = id % CACHE_PAGE_RECS;
+    cache_page_t *p;
+    uint64_t g0;
+
+    if (c == NULL || c->cap == 0 || id < 0)
+        return CACHE_MISS;
+
+    g0 = __atomic_load_n(&c->shared->gen, __ATOMIC_ACQUIRE);
+    if (g0 != c->gen) {
+        cache_drop(c);
+        c->gen = g0;
+    }
+
+    p = cache_find(c, page);
+    if (p != NULL) {
+        c->st.hits++;
+        p->ref = true;
+    } else {
+        c->st.misses++;
+        if (!fill)
+            return CACHE_MISS;
+
+        p = cache_victim(c);
+        if (load_page(h, p, page) != NO_ERROR) {
+            p->page = -1;
+            return ERR_DB_FILE;
+        }
+        p->page = -1;
+        if (__atomic_load_n(&c->shared->gen, __ATOMIC_ACQUIRE) == g0) {
+            int32_t *head = &c->buckets[(uint32_t)page & (c->nbuckets - 1)];
+
+            p->page = page;
+            p->ref = false;
+            p->next = *head;
+            *head = (int32_t)(p - c->pages);
+            c->st.pages++;
+        }
+    }
+
+    if (!(p->occupied & (1ULL << slot)))
+        return SRCH_NOT_FOUND;
+    *out = p->recs[slot];
+    return NO_ERROR;
+}
+
+/*
+ *  cache_peek
+ *      h:    database handle, gate held
+ *      id:   student to look up
+ *      out:  receives the student if found
+ *
+ *  Copies a legacy slot straight out of the mapping, without the record
+ *  lock, when no store ran meanwhile.
+ *
+ *  returns:  NO_ERROR or SRCH_NOT_FOUND like db_get(), or CACHE_MISS when
+ *            the format is not legacy or a store got in the way; the
+ *            caller then locks the record and uses db_get()
+ */
+int cache_peek(db_handle_t *h, int id, student_t *out)
+{
+    page_cache_t *c = cache_attach(h);
+    student_t *slot, rec;
+    uint64_t seq;
+
+    if (c == NULL || h->engine != &legacy_engine || !read_begin(c, &seq))
+        return CACHE_MISS;
+
+    slot = map_slot(h, id);
+    if (slot != NULL)
+        rec = *slot;
+    if (!read_end(c, seq))
+        return CACHE_MISS;
+
+    if (slot == NULL || rec.id != id)
+        return SRCH_NOT_FOUND;
+    *out = rec;
+    return NO_ERROR;
+}
+
+/*
+ *  cache_may_store
+ *      h:  database handle, gate held
+ *
+ *  Only legacy slots are read without the record lock, and only by
+ *  processes holding the gate shared.  A writer that cannot bump the
+ *  stores word (there is no .gen it may write) must not store into them
+ *  while they may be reading, they would never see it coming.
+ *
+ *  returns:  true when a store can be bracketed or needs no bracket
+ */
+bool cache_may_store(db_handle_t *h)
+{
+    page_cache_t *c;
+
+    if (h->engine != &legacy_engine || h->gate_excl)
+        return true;
+    c = cache_attach(h);
+    return c != NULL && c->shared != NULL && c->writable;
+}
+
+/*
+ *  cache_store_begin / cache_store_end
+ *      h:  database handle, gate and the record lock of the slot held
+ *
+ *  Bracket a store into the slots for the readers of cache_peek() and
+ *  load_page().
+ *
+ *  returns:  NO_ERROR, or ERR_DB_FILE when the store may not go ahead,
+ *            see cache_may_store()
+ */
+int cache_store_begin(db_handle_t *h)
+{
+    page_cache_t *c;
+
+    if (!cache_may_store(h))
+        return ERR_DB_FILE;
+    c = cache_attach(h);
+    if (c == NULL || c->shared == NULL || !c->writable)
+        return NO_ERROR;
+    __atomic_fetch_add(&c->shared->stores, (1ULL << 32) + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    return NO_ERROR;
+}
+
+void cache_store_end(db_handle_t *h)
+{
+    page_cache_t *c = h->cache;
+
+    if (c == NULL || c->shared == NULL || !c->writable)
+        return;
+    __atomic_fetch_sub(&c->shared->stores, 1, __ATOMIC_RELEASE);
+}
+
+/*
+ *  cache_layout
+ *      h:       database handle
+ *      layout:  receives the layout generation
+ *
+ *  returns:  false when there is no shared counter to read
+ */
+bool cache_layout(db_handle_t *h, uint64_t *layout)
+{
+    page_cache_t *c = cache_attach(h);
+
+    if (c == NULL || c->shared == NULL)
+        return false;
+    *layout = __atomic_load_n(&c->shared->layout, __ATOMIC_ACQUIRE);
+    return true;
+}
+
+/*
+ *  cache_layout_changed
+ *      h:          database handle
+ *      exclusive:  the gate is held exclusive
+ *
+ *  Bumps the layout generation after the file was grown, or before an
+ *  exclusive gate is released.  Nobody stores while the gate is held
+ *  exclusive, so that is also when a count of stores in progress left by
+ *  a writer that died is cleared.
+ */
+void cache_layout_changed(db_handle_t *h, bool exclusive)
+{
+    page_cache_t *c = cache_attach(h);
+
+    if (c == NULL || c->shared == NULL || !c->writable)
+        return;
+    if (exclusive && (uint32_t)c->shared->stores != 0)
+        __atomic_store_n(&c->shared->stores,
+                         (c->shared->stores & ~0xffffffffULL) + (1ULL << 32),
+                         __ATOMIC_RELEASE);
+    __atomic_fetch_add(&c->shared->layout, 1, __ATOMIC_ACQ_REL);
+}
+
+/*
+ *  cache_stats
+ *      h:   database handle
+ *      st:  receives the counters of this process
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ */
+int cache_stats(db_handle_t *h, cache_stats_t *st)
+{
+    page_cache_t *c = cache_attach(h);
+
+    if (c == NULL)
+        return ERR_DB_FILE;
+    *st = c->st;
+    st->capacity = c->cap;
+    return NO_ERROR;
+}
+
+/*
+ *  print_cache_stats
+ *      st:  counters from cache_stats()
+ *
+ *  console:  M_CACHE_STATS, or M_CACHE_OFF
+ */
+void print_cache_stats(const cache_stats_t *st)
+{
+    if (st->capacity == 0) {
+        printf(M_CACHE_OFF);
+        return;
+    }
+    printf(M_CACHE_STATS, st->pages, st->capacity,
+           (unsigned long long)st->hits, (unsigned long long)st->misses,
+           (unsigned long long)st->evictions,
+           (unsigned long long)st->invalidations);
+}
+
+/*
+ *  cache_on_change
+ *      h:    database handle, meta lock held exclusive
+ *      old:  record before the change
+ *      rec:  record after the change
+ *
+ *  Sidecar hook.  Bumps the generation.  If ours was the latest one the
+ *  change is written through to the cached page, otherwise some other
+ *  process wrote in between and our pages are dropped.
+ *
+ *  returns:  NO_ERROR
+ */
+int cache_on_change(db_handle_t *h, const student_t *old, const student_t *rec)
+{
+    page_cache_t *c = cache_attach(h);
+    int id = rec->id ? rec->id : old->id;
+    cache_page_t *p;
+    uint64_t prev;
+
+    if (c == NULL || c->shared == NULL || !c->writable)
+        return NO_ERROR;
+
+    prev = __atomic_fetch_add(&c->shared->gen, 1, __ATOMIC_ACQ_REL);
+    if (c->cap == 0)
+        return NO_ERROR;
+    if (prev != c->gen)
+        cache_drop(c);
+    c->gen = prev + 1;
+
+    p = cache_find(c, id / CACHE_PAGE_RECS);
+    if (p != NULL) {
+        int slot = id % CACHE_PAGE_RECS;
+
+        if (rec->id != 0) {
+            p->recs[slot] = *rec;
+            p->occupied |= 1ULL << slot;
+        } else {
+            p->occupied &= ~(1ULL << slot);
+        }
+    }
+    return NO_ERROR;
+}
+
+/*
+ *  cache_on_rebuild
+ *      h:  database handle, meta lock held exclusive
+ *
+ *  Sidecar hook.  Bumps the generation and drops every page.
+ *
+ *  returns:  NO_ERROR
+ */
+int cache_on_rebuild(db_handle_t *h)
+{
+    page_cache_t *c = cache_attach(h);
+
+    if (c == NULL || c->shared == NULL)
+        return NO_ERROR;
+    if (c->writable)
+        __atomic_fetch_add(&c->shared->gen, 1, __ATOMIC_ACQ_REL);
+    if (c->cap > 0)
+        cache_drop(c);
+    c->gen = __atomic_load_n(&c->shared->gen, __ATOMIC_ACQUIRE);
+    return NO_ERROR;
+}
+
+/*
+ *  cache_on_close
+ *      h:  database handle
+ *
+ *  Sidecar hook.  Frees the cache and unmaps the generation.
+ */
+void cache_on_close(db_handle_t *h)
+{
+    page_cache_t *c = h->cache;
+
+    if (c == NULL)
+        return;
+    if (c->shared != NULL)
+        munmap(c->shared, sizeof(cache_gen_t));
+    free(c->pages);
+    free(c->buckets);
+    free(c);
+    h->cache = NULL;
+}
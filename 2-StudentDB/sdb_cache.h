@@ -0,0 +1,70 @@
+#ifndef __SDB_CACHE_H__
+    #define __SDB_CACHE_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "db.h"
+#include "sdb_handle.h"
+
+//Record cache, see sdb_cache.c.  Each handle keeps up to SDB_CACHE_PAGES
+//(0 turns it off) pages of CACHE_PAGE_RECS consecutive ids, the 4K pages
+//of the legacy file, evicted with the CLOCK algorithm.  get_student()
+//answers from it without taking the record lock.
+//
+//Other processes may change the database under us, so every writer bumps
+//a generation counter kept in the sidecar .student.db.gen, which all of
+//them map.  A reader whose pages are from an older generation drops them
+//all before the next lookup; the check is one load from shared memory.
+//A process's own adds and deletes are written through instead, as long
+//as nobody else wrote in between.
+//
+//The same sidecar carries two more counters every process shares:
+//  layout  bumped whenever the file is grown, or when the gate is left
+//          after being held exclusive (replace, truncate, reformat), so
+//          db_gate_enter() only has to stat the file when it moved
+//  stores  a seqlock around stores into the slots, so a single legacy
+//          slot can be copied out of the mapping without the record lock
+
+#define CACHE_MAGIC         "SDBGEN01"
+#define CACHE_SUFFIX        ".gen"
+#define CACHE_PAGES         256     //default for SDB_CACHE_PAGES
+#define CACHE_PAGE_RECS     64      //ids per page, 4K of the legacy file
+#define CACHE_MISS          1       //cache_get(): not answered, use db_get()
+
+typedef struct cache_gen {
+    char     magic[8];
+    uint64_t gen;               //bumped by every change, in every process
+    uint64_t layout;            //bumped when the file's size or format moves
+    uint64_t stores;            //stores begun << 32 | stores in progress
+    uint8_t  pad[32];
+} cache_gen_t;
+
+typedef struct cache_stats {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+    uint64_t invalidations;     //times the whole cache was dropped
+    uint32_t pages;             //pages cached now
+    uint32_t capacity;
+} cache_stats_t;
+
+//Output messages
+#define M_CACHE_STATS       "Cache: %u of %u page(s), %llu hit(s), %llu miss(es), %llu eviction(s), %llu invalidation(s).\n"
+#define M_CACHE_OFF         "Cache is off (SDB_CACHE_PAGES=0).\n"
+
+//prototypes for sdb_cache.c
+int cache_get(db_handle_t *h, int id, student_t *out, bool fill);
+int cache_peek(db_handle_t *h, int id, student_t *out);
+bool cache_may_store(db_handle_t *h);
+int cache_store_begin(db_handle_t *h);
+void cache_store_end(db_handle_t *h);
+bool cache_layout(db_handle_t *h, uint64_t *layout);
+void cache_layout_changed(db_handle_t *h, bool exclusive);
+int cache_stats(db_handle_t *h, cache_stats_t *st);
+void print_cache_stats(const cache_stats_t *st);
+int cache_on_change(db_handle_t *h, const student_t *old, const student_t *rec);
+int cache_on_rebuild(db_handle_t *h);
+void cache_on_close(db_handle_t *h);
+
+#endif
@@ -0,0 +1,768 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <time.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <sys/random.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "db.h"
+#include "sdbsc.h"
+#include "sdb_handle.h"
+#include "sdb_lock.h"
+#include "sdb_crc.h"
+#include "sdb_out.h"
+#include "sdb_cdc.h"
+
+//Entries are appended under the meta lock, like every sidecar update, so
+//sequence numbers come out in order without any counter of their own:
+//the next one is the last entry's plus one.  An append cut short by a
+//crash leaves a partial entry or one whose crc does not match; the next
+//append writes over it.
+//
+//Readers take no locks.  They read whole entries up to the end of the
+//file and stop at the first one whose crc does not match, which is an
+//append still in progress.  Compaction writes a new log and renames it
+//over the old one with the meta lock held; a reader notices the rename
+//and finds its place in the new file by sequence number.  Followers wait
+//with inotify on the directory, which sees appends, the log being
+//created and the rename.  Every log gets a random id when it is started
+//and keeps it through compactions, so a reader can tell a log that was
+//removed and started over (sequence numbers from 1 again) from its own.
+
+#define HDR_SZ          ((off_t)sizeof(cdc_hdr_t))
+#define REC_SZ          ((off_t)sizeof(cdc_rec_t))
+#define READ_RECS       1024    //entries a reader reads at once
+
+static const char *const op_names[] = {
+    [CDC_ADD]    = "add",
+    [CDC_DEL]    = "del",
+    [CDC_UPDATE] = "update",
+    [CDC_RESET]  = "reset",
+};
+
+static uint32_t rec_crc(const cdc_rec_t *r)
+{
+    cdc_rec_t c = *r;
+
+    c.crc = 0;
+    return crc32c(0, &c, sizeof(c));
+}
+
+static bool rec_ok(const cdc_rec_t *r)
+{
+    return r->op >= CDC_ADD && r->op <= CDC_NAMES && r->crc == rec_crc(r);
+}
+
+static bool hdr_ok(const cdc_hdr_t *hd)
+{
+    return memcmp(hd->magic, CDC_MAGIC, sizeof(hd->magic)) == 0 &&
+           hd->version == CDC_VERSION && hd->rec_sz == REC_SZ;
+}
+
+static int write_hdr(int lfd, uint64_t log_id)
+{
+    cdc_hdr_t hd = {0};
+
+    memcpy(hd.magic, CDC_MAGIC, sizeof(hd.magic));
+    hd.version = CDC_VERSION;
+    hd.rec_sz = REC_SZ;
+    hd.log_id = log_id;
+    return pwrite(lfd, &hd, sizeof(hd), 0) == (ssize_t)sizeof(hd) ? NO_ERROR : ERR_DB_FILE;
+}
+
+//a log id only has to differ from the one a reader saw before
+static uint64_t new_log_id(void)
+{
+    uint64_t id = 0;
+
+    if (getrandom(&id, sizeof(id), 0) != (ssize_t)sizeof(id) || id == 0)
+        id = ((uint64_t)time(NULL) << 20) ^ (uint64_t)getpid();
+    return id;
+}
+
+/*
+ *  last_entry
+ *      lfd:   change log
+ *      end:   set to the offset just past the last good entry, HDR_SZ
+ *             if there is none
+ *      last:  set to that entry
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ */
+static int last_entry(int lfd, off_t *end, cdc_rec_t *last)
+{
+    struct stat st;
+
+    if (fstat(lfd, &st) == -1)
+        return ERR_DB_FILE;
+    *end = st.st_size < HDR_SZ ? HDR_SZ : HDR_SZ + (st.st_size - HDR_SZ) / REC_SZ * REC_SZ;
+    while (*end > HDR_SZ) {
+        if (pread(lfd, last, sizeof(*last), *end - REC_SZ) != (ssize_t)sizeof(*last))
+            return ERR_DB_FILE;
+        if (rec_ok(last))
+            break;
+        *end -= REC_SZ;
+    }
+    return NO_ERROR;
+}
+
+/*
+ *  append
+ *      lfd:    change log, meta lock held exclusive
+ *      op:     CDC_*
+ *      rec:    student the entry is about
+ *      names:  full names of the student, may be NULL
+ *
+ *  Writes the entry after the last good one, with the next sequence
+ *  number, and before it the NAMES entries when rec cannot hold the names
+ *  whole.  They go out with one write, so a reader that sees the entry
+ *  has seen its names.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ */
+static int append(int lfd, uint32_t op, const student_t *rec,
+                  const student_names_t *names)
+{
+    names_chunk_t chunks[NAMES_CHUNK_MAX];
+    cdc_rec_t e[NAMES_CHUNK_MAX + 1], last;
+    int n = names_split(rec, names, chunks);
+    struct stat st;
+    uint64_t seq;
+    off_t end;
+
+    if (fstat(lfd, &st) == -1 || last_entry(lfd, &end, &last) != NO_ERROR)
+        return ERR_DB_FILE;
+    seq = end > HDR_SZ ? last.seq + 1 : 1;
+    if (end != st.st_size && ftruncate(lfd, end) == -1)
+        return ERR_DB_FILE;
+
+    memset(e, 0, ((size_t)n + 1) * sizeof(*e));
+    for (int i = 0; i <= n; i++) {
+        e[i].seq = seq + (uint64_t)i;
+        e[i].op = i < n ? CDC_NAMES : op;
+        if (i < n)
+            e[i].names = chunks[i];
+        else
+            e[i].rec = *rec;
+        e[i].crc = rec_crc(&e[i]);
+    }
+    return pwrite(lfd, e, ((size_t)n + 1) * sizeof(*e), end) ==
+           (ssize_t)(((size_t)n + 1) * sizeof(*e)) ? NO_ERROR : ERR_DB_FILE;
+}
+
+/*
+ *  open_log
+ *      h:       database handle, meta lock held exclusive
+ *      create:  start a log if there is none
+ *
+ *  A new log begins with a RESET, its readers have to read the database
+ *  first.
+ *
+ *  returns:  fd of the log, or -1 (errno ENOENT when there is none)
+ */
+static int open_log(db_handle_t *h, bool create)
+{
+    char path[PATH_MAX];
+    cdc_hdr_t hd;
+    struct stat st;
+    int lfd;
+
+    if (db_sidecar_path(h, CDC_SUFFIX, path, sizeof(path)) != NO_ERROR) {
+        errno = ENOENT;
+        return -1;
+    }
+    lfd = open(path, create ? O_RDWR | O_CREAT : O_RDWR, 0644);
+    if (lfd == -1)
+        return -1;
+
+    if (fstat(lfd, &st) == -1)
+        goto fail;
+    if (st.st_size < HDR_SZ) {
+        if (write_hdr(lfd, new_log_id()) != NO_ERROR || ftruncate(lfd, HDR_SZ) == -1 ||
+            append(lfd, CDC_RESET, &EMPTY_STUDENT_RECORD, NULL) != NO_ERROR)
+            goto fail;
+    } else if (pread(lfd, &hd, sizeof(hd), 0) != (ssize_t)sizeof(hd) || !hdr_ok(&hd)) {
+        goto fail;
+    }
+    return lfd;
+
+fail:
+    close(lfd);
+    errno = EIO;
+    return -1;
+}
+
+/*
+ *  cdc_on_change
+ *      h:    database handle, meta lock held exclusive
+ *      old:  record before the change
+ *      rec:  record after the change
+ *
+ *  Sidecar hook.  Appends the change if there is a log, starting one
+ *  first when SDB_CDC is set.  An add or update carries the full names
+ *  of formats that keep them; the caller holds the record lock, so they
+ *  are the ones just stored.
+ *
+ *  returns:  NO_ERROR, or ERR_DB_FILE to have a RESET appended instead
+ */
+int cdc_on_change(db_handle_t *h, const student_t *old, const student_t *rec)
+{
+    uint32_t op = old->id == 0 ? CDC_ADD : rec->id == 0 ? CDC_DEL : CDC_UPDATE;
+    int lfd = open_log(h, db_config_int("SDB_CDC", 0) != 0);
+    student_names_t names;
+    bool named;
+    int rc;
+
+    if (lfd == -1)
+        return errno == ENOENT ? NO_ERROR : ERR_DB_FILE;
+    named = op != CDC_DEL && db_get_names(h, rec->id, &names) == NO_ERROR;
+    rc = append(lfd, op, op == CDC_DEL ? old : rec, named ? &names : NULL);
+    close(lfd);
+    return rc;
+}
+
+/*
+ *  cdc_on_rebuild
+ *      h:  database handle, meta lock held exclusive
+ *
+ *  Sidecar hook.  The records changed wholesale, appends a RESET.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ */
+int cdc_on_rebuild(db_handle_t *h)
+{
+    int lfd, rc;
+
+    if (h->read_only)
+        return NO_ERROR;
+    lfd = open_log(h, db_config_int("SDB_CDC", 0) != 0);
+    if (lfd == -1)
+        return errno == ENOENT ? NO_ERROR : ERR_DB_FILE;
+    rc = append(lfd, CDC_RESET, &EMPTY_STUDENT_RECORD, NULL);
+    close(lfd);
+    return rc;
+}
+
+/*
+ *  cdc_on_close
+ *      h:  database handle
+ *
+ *  Sidecar hook, the log keeps no per-handle state.
+ */
+void cdc_on_close(db_handle_t *h)
+{
+    (void)h;
+}
+
+/*
+ *  cdc_start
+ *      h:  database handle
+ *
+ *  Starts a change log if there is none, whatever SDB_CDC says, so every
+ *  writer appends to it from now on (-R needs one to ship).
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ */
+int cdc_start(db_handle_t *h)
+{
+    int lfd = -1;
+
+    if (db_gate_enter(h, false) != NO_ERROR)
+        return ERR_DB_FILE;
+    if (db_lock_range(h, LOCK_META_OFF, 1, true) == NO_ERROR) {
+        lfd = open_log(h, true);
+        db_unlock_range(h, LOCK_META_OFF, 1);
+    }
+    db_gate_leave(h);
+    if (lfd == -1)
+        return ERR_DB_FILE;
+    close(lfd);
+    return NO_ERROR;
+}
+
+/*
+ *  cdc_last
+ *      h:       database handle
+ *      log_id:  set to the id of the log
+ *      seq:     set to the sequence number of the last whole entry, 0 if
+ *               there is none yet
+ *
+ *  returns:  NO_ERROR, SRCH_NOT_FOUND when there is no log, or ERR_DB_FILE
+ */
+int cdc_last(db_handle_t *h, uint64_t *log_id, uint64_t *seq)
+{
+    char path[PATH_MAX];
+    cdc_hdr_t hd;
+    cdc_rec_t last;
+    off_t end;
+    int lfd;
+
+    if (db_sidecar_path(h, CDC_SUFFIX, path, sizeof(path)) != NO_ERROR)
+        return ERR_DB_FILE;
+    lfd = open(path, O_RDONLY | O_CLOEXEC);
+    if (lfd == -1)
+        return errno == ENOENT ? SRCH_NOT_FOUND : ERR_DB_FILE;
+    if (pread(lfd, &hd, sizeof(hd), 0) != (ssize_t)sizeof(hd) || !hdr_ok(&hd) ||
+        last_entry(lfd, &end, &last) != NO_ERROR) {
+        close(lfd);
+        return ERR_DB_FILE;
+    }
+    close(lfd);
+    *log_id = hd.log_id;
+    *seq = end > HDR_SZ ? last.seq : 0;
+    return NO_ERROR;
+}
+
+/*
+ *  find_seq
+ *      lfd:  change log
+ *      seq:  sequence number to look for
+ *
+ *  Entries are in sequence order, so this is a binary search.
+ *
+ *  returns:  file offset of the first entry with a sequence number of at
+ *            least seq (the end of the whole entries if there is none),
+ *            or -1
+ */
+static off_t find_seq(int lfd, uint64_t seq)
+{
+    struct stat st;
+    off_t lo = 0, hi;
+
+    if (fstat(lfd, &st) == -1)
+        return -1;
+    hi = st.st_size < HDR_SZ ? 0 : (st.st_size - HDR_SZ) / REC_SZ;
+    while (lo < hi) {
+        off_t mid = lo + (hi - lo) / 2;
+        cdc_rec_t r;
+
+        if (pread(lfd, &r, sizeof(r), HDR_SZ + mid * REC_SZ) != (ssize_t)sizeof(r))
+            return -1;
+        if (rec_ok(&r) && r.seq < seq)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return HDR_SZ + lo * REC_SZ;
+}
+
+//true when path no longer names the file lfd is open on
+static bool replaced(const char *path, int lfd)
+{
+    struct stat a, b;
+
+    return stat(path, &a) == -1 || fstat(lfd, &b) == -1 ||
+           a.st_ino != b.st_ino || a.st_dev != b.st_dev;
+}
+
+/*
+ *  cdc_reader_open
+ *      h:       database handle
+ *      r:       reader to set up
+ *      from:    first sequence number to return
+ *      follow:  the reader will cdc_wait() for more
+ *
+ *  The log does not have to exist yet.  Release the reader with
+ *  cdc_reader_close().
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ */
+int cdc_reader_open(db_handle_t *h, cdc_reader_t *r, uint64_t from, bool follow)
+{
+    char dir[PATH_MAX];
+    const char *slash;
+
+    memset(r, 0, sizeof(*r));
+    r->lfd = r->ifd = -1;
+    r->next = from;
+    if (db_sidecar_path(h, CDC_SUFFIX, r->path, sizeof(r->path)) != NO_ERROR)
+        return ERR_DB_FILE;
+    slash = strrchr(r->path, '/');
+    r->name = slash ? slash + 1 : r->path;
+    if (!follow)
+        return NO_ERROR;
+
+    //watching the directory sees appends, the log being created and the
+    //rename that ends a compaction
+    if (slash == NULL)
+        snprintf(dir, sizeof(dir), ".");
+    else
+        snprintf(dir, sizeof(dir), "%.*s", (int)(slash - r->path), r->path);
+    r->ifd = inotify_init1(IN_CLOEXEC | IN_NONBLOCK);
+    if (r->ifd == -1 ||
+        inotify_add_watch(r->ifd, dir, IN_MODIFY | IN_CREATE | IN_MOVED_TO) == -1) {
+        cdc_reader_close(r);
+        return ERR_DB_FILE;
+    }
+    return NO_ERROR;
+}
+
+/*
+ *  reopen
+ *      r:  reader without an open log
+ *
+ *  Opens the log and finds r->next in it.  A log that is not the one read
+ *  before (it was removed and started again) has new sequence numbers and
+ *  is read from the top.
+ *
+ *  returns:  NO_ERROR, SRCH_NOT_FOUND when there is no log or its header
+ *            is still being written, or ERR_DB_FILE
+ */
+static int reopen(cdc_reader_t *r)
+{
+    cdc_hdr_t hd;
+    ssize_t got;
+    int lfd = open(r->path, O_RDONLY | O_CLOEXEC);
+
+    if (lfd == -1)
+        return errno == ENOENT ? SRCH_NOT_FOUND : ERR_DB_FILE;
+    got = pread(lfd, &hd, sizeof(hd), 0);
+    if (got < 0 || (got == (ssize_t)sizeof(hd) && !hdr_ok(&hd))) {
+        close(lfd);
+        return ERR_DB_FILE;
+    }
+    if (got < (ssize_t)sizeof(hd)) {
+        close(lfd);
+        return SRCH_NOT_FOUND;
+    }
+
+    if (r->log_id != 0 && hd.log_id != r->log_id)
+        r->next = 1;
+    r->pos = find_seq(lfd, r->next);
+    if (r->pos == -1) {
+        close(lfd);
+        return ERR_DB_FILE;
+    }
+    r->lfd = lfd;
+    r->log_id = hd.log_id;
+    return NO_ERROR;
+}
+
+/*
+ *  cdc_read
+ *      r:    reader
+ *      buf:  where the entries go
+ *      max:  room in buf
+ *
+ *  Returns the good entries from r->next on, up to max of them, the end
+ *  of the log or an entry still being written, and moves the reader past
+ *  them.  After a compaction the reader finds its place in the new log.
+ *
+ *  returns:  number of entries, SRCH_NOT_FOUND when there is no log, or
+ *            ERR_DB_FILE
+ */
+int cdc_read(cdc_reader_t *r, cdc_rec_t *buf, int max)
+{
+    int n = 0, rc;
+
+    if (r->lfd != -1 && replaced(r->path, r->lfd)) {
+        close(r->lfd);
+        r->lfd = -1;
+    }
+    if (r->lfd == -1 && (rc = reopen(r)) != NO_ERROR)
+        return rc;
+
+    while (n < max) {
+        size_t want = (size_t)(max - n) * sizeof(*buf);
+        ssize_t got = pread(r->lfd, buf + n, want, r->pos);
+        long k, i, kept = 0;
+
+        if (got < 0)
+            return ERR_DB_FILE;
+        k = got / REC_SZ;
+        for (i = 0; i < k && rec_ok(&buf[n + i]); i++) {
+            if (buf[n + i].seq < r->next)
+                continue;
+            r->next = buf[n + i].seq + 1;
+            buf[n + kept++] = buf[n + i];
+        }
+        r->pos += i * REC_SZ;
+        n += kept;
+        if (i < k || (size_t)got < want)
+            break;
+    }
+    return n;
+}
+
+/*
+ *  cdc_reader_seek
+ *      r:    reader
+ *      seq:  next sequence number to return
+ */
+void cdc_reader_seek(cdc_reader_t *r, uint64_t seq)
+{
+    if (r->lfd != -1)
+        close(r->lfd);
+    r->lfd = -1;
+    r->next = seq;
+}
+
+/*
+ *  cdc_wait
+ *      r:           reader opened to follow
+ *      timeout_ms:  longest wait, -1 for no limit
+ *
+ *  Blocks until something happens to the log or the time is up; either
+ *  way the caller reads again.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ */
+int cdc_wait(cdc_reader_t *r, int timeout_ms)
+{
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    struct timespec now, end;
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    end.tv_sec += timeout_ms / 1000;
+    end.tv_nsec += (long)(timeout_ms % 1000) * 1000000;
+
+    for (;;) {
+        struct pollfd p = { .fd = r->ifd, .events = POLLIN };
+        int left = -1, rc;
+        ssize_t got;
+
+        //a create or rename may have happened while the caller read
+        if (r->lfd == -1 ? access(r->path, F_OK) == 0 : replaced(r->path, r->lfd))
+            return NO_ERROR;
+        if (timeout_ms >= 0) {
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            left = (int)((end.tv_sec - now.tv_sec) * 1000 +
+                         (end.tv_nsec - now.tv_nsec) / 1000000);
+            if (left <= 0)
+                return NO_ERROR;
+        }
+        rc = poll(&p, 1, left);
+        if (rc < 0 && errno == EINTR)
+            continue;
+        if (rc < 0)
+            return ERR_DB_FILE;
+        if (rc == 0)
+            return NO_ERROR;
+
+        got = read(r->ifd, buf, sizeof(buf));
+        if (got < 0 && (errno == EINTR || errno == EAGAIN))
+            continue;
+        if (got <= 0)
+            return ERR_DB_FILE;
+        for (char *p = buf; p < buf + got; ) {
+            struct inotify_event *ev = (struct inotify_event *)p;
+
+            if (ev->len > 0 && strcmp(ev->name, r->name) == 0)
+                return NO_ERROR;
+            p += sizeof(*ev) + ev->len;
+        }
+    }
+}
+
+void cdc_reader_close(cdc_reader_t *r)
+{
+    if (r->lfd != -1)
+        close(r->lfd);
+    if (r->ifd != -1)
+        close(r->ifd);
+    r->lfd = r->ifd = -1;
+}
+
+/*
+ *  tail_db
+ *      fd:      linux file descriptor
+ *      from:    first sequence number to print
+ *      follow:  keep waiting for new changes instead of stopping at the
+ *               end of the log
+ *
+ *  Prints the changes from sequence number from on, see sdb_cdc.h, with
+ *  the full names their NAMES entries carry.  In
+ *  follow mode the log may not exist yet; the output is flushed after
+ *  every batch and this only returns on an error.
+ *
+ *  returns:  NO_ERROR, SRCH_NOT_FOUND when there is no log, or ERR_DB_FILE
+ *
+ *  console:  the changes, M_CDC_NONE or M_ERR_CDC
+ */
+int tail_db(int fd, uint64_t from, bool follow)
+{
+    db_handle_t *h = db_handle_get(fd);
+    names_run_t run = {0};
+    cdc_reader_t r;
+    cdc_rec_t *buf;
+    sdb_out_t *o;
+    int rc = NO_ERROR;
+
+    if (h == NULL || cdc_reader_open(h, &r, from, follow) != NO_ERROR) {
+        printf(M_ERR_CDC);
+        return ERR_DB_FILE;
+    }
+    buf = malloc(READ_RECS * sizeof(*buf));
+    o = out_open(STDOUT_FILENO, OUT_JSONL);
+    if (buf == NULL || o == NULL) {
+        free(buf);
+        if (o != NULL)
+            out_close(o);
+        cdc_reader_close(&r);
+        printf(M_ERR_CDC);
+        return ERR_DB_FILE;
+    }
+
+    for (;;) {
+        int n = cdc_read(&r, buf, READ_RECS);
+
+        if (n == SRCH_NOT_FOUND && follow)
+            n = 0;
+        if (n < 0) {
+            rc = n;
+            break;
+        }
+        for (int i = 0; i < n; i++) {
+            student_names_t names;
+            bool named;
+
+            if (buf[i].op == CDC_NAMES) {
+                names_join(&run, &buf[i].names);
+                continue;
+            }
+            named = names_joined(&run, buf[i].rec.id, &names);
+            out_change(o, buf[i].seq, op_names[buf[i].op],
+                       buf[i].op == CDC_RESET ? NULL : &buf[i].rec,
+                       named ? &names : NULL);
+        }
+        if (n == READ_RECS)
+            continue;
+        if (!follow)
+            break;
+        out_flush(o);
+        if (o->err || cdc_wait(&r, -1) != NO_ERROR) {
+            rc = ERR_DB_FILE;
+            break;
+        }
+    }
+
+    cdc_reader_close(&r);
+    free(buf);
+    if (out_close(o) != NO_ERROR)
+        rc = ERR_DB_FILE;
+    if (rc == SRCH_NOT_FOUND)
+        printf(M_CDC_NONE);
+    else if (rc != NO_ERROR)
+        printf(M_ERR_CDC);
+    return rc;
+}
+
+/*
+ *  compact_cdc
+ *      fd:  linux file descriptor
+ *
+ *  Rewrites the change log with the last RESET and, after it, only the
+ *  last change of each id and its names, in sequence order (-t compact).  The new log
+ *  replaces the old one with rename() while the meta lock is held, so no
+ *  append is lost.
+ *
+ *  returns:  NO_ERROR, SRCH_NOT_FOUND when there is no log, or ERR_DB_FILE
+ *
+ *  console:  M_CDC_COMPACTED, M_CDC_NONE or M_ERR_CDC
+ */
+int compact_cdc(int fd)
+{
+    db_handle_t *h = db_handle_get(fd);
+    char path[PATH_MAX], tmp[PATH_MAX];
+    cdc_rec_t *recs = NULL;
+    uint8_t *seen = NULL;
+    cdc_hdr_t hd;
+    struct stat st;
+    long n = 0, kept = 0, start = 0;
+    int32_t named = 0;          //id whose NAMES entries are kept
+    int lfd = -1, out = -1, rc = ERR_DB_FILE;
+
+    if (h == NULL || db_sidecar_path(h, CDC_SUFFIX, path, sizeof(path)) != NO_ERROR ||
+        snprintf(tmp, sizeof(tmp), "%s.tmp", path) >= (int)sizeof(tmp) ||
+        db_gate_enter(h, false) != NO_ERROR) {
+        printf(M_ERR_CDC);
+        return ERR_DB_FILE;
+    }
+    if (db_lock_range(h, LOCK_META_OFF, 1, true) != NO_ERROR) {
+        db_gate_leave(h);
+        printf(M_ERR_CDC);
+        return ERR_DB_FILE;
+    }
+
+    lfd = open_log(h, false);
+    if (lfd == -1) {
+        rc = errno == ENOENT ? SRCH_NOT_FOUND : ERR_DB_FILE;
+        goto out;
+    }
+    if (fstat(lfd, &st) == -1 || pread(lfd, &hd, sizeof(hd), 0) != (ssize_t)sizeof(hd))
+        goto out;
+    n = (st.st_size - HDR_SZ) / REC_SZ;
+    recs = malloc((n ? n : 1) * sizeof(*recs));
+    seen = calloc(MAX_STD_ID + 1, 1);
+    if (recs == NULL || seen == NULL ||
+        pread(lfd, recs, n * sizeof(*recs), HDR_SZ) != (ssize_t)(n * sizeof(*recs)))
+        goto out;
+    while (n > 0 && !rec_ok(&recs[n - 1]))
+        n--;
+
+    //newest first: the first change seen of an id is its last one, and
+    //nothing before the last RESET is needed.  The NAMES entries just
+    //before a change are kept with it.
+    for (long i = n - 1; i >= 0; i--) {
+        int id = recs[i].rec.id;
+
+        if (recs[i].op == CDC_RESET) {
+            start = i;
+            break;
+        }
+        if (recs[i].op == CDC_NAMES) {
+            if (recs[i].names.id != named)
+                recs[i].op = 0;
+            else if (recs[i].names.off == 0)
+                named = 0;
+            continue;
+        }
+        named = 0;
+        if (id < MIN_STD_ID || id > MAX_STD_ID || seen[id]) {
+            recs[i].op = 0;
+        } else {
+            seen[id] = 1;
+            named = id;
+        }
+    }
+    for (long i = start; i < n; i++) {
+        if (recs[i].op != 0)
+            recs[kept++] = recs[i];
+    }
+
+    out = open(tmp, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (out == -1 || write_hdr(out, hd.log_id) != NO_ERROR ||
+        pwrite(out, recs, kept * sizeof(*recs), HDR_SZ) != (ssize_t)(kept * sizeof(*recs)) ||
+        fsync(out) == -1 || rename(tmp, path) == -1) {
+        unlink(tmp);
+        goto out;
+    }
+    rc = NO_ERROR;
+
+out:
+    if (out != -1)
+        close(out);
+    if (lfd != -1)
+        close(lfd);
+    db_unlock_range(h, LOCK_META_OFF, 1);
+    db_gate_leave(h);
+    free(recs);
+    free(seen);
+
+    if (rc == NO_ERROR)
+        printf(M_CDC_COMPACTED, n, kept);
+    else if (rc == SRCH_NOT_FOUND)
+        printf(M_CDC_NONE);
+    else
+        printf(M_ERR_CDC);
+    return rc;
+}
@@ -0,0 +1,93 @@
+#ifndef __SDB_CDC_H__
+    #define __SDB_CDC_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <limits.h>
+#include <sys/types.h>
+
+#include "db.h"
+#include "sdb_handle.h"
+#include "sdb_engine.h"
+
+//Change log, see sdb_cdc.c.  The sidecar .student.db.cdc is an append-only
+//list of every add, delete and update, each with a sequence number one
+//higher than the last:
+//
+//  [cdc_hdr_t][cdc_rec_t][cdc_rec_t]...
+//
+//SDB_CDC=1 starts the log; once it exists every writer appends to it.  A
+//RESET entry means the records changed wholesale (bulk load, truncate,
+//compress, the log was just started): a consumer reads the database
+//again, and follows the log from the RESET on.  An add or update whose
+//names student_t cannot hold whole (the var format) is preceded by NAMES
+//entries that carry them, see names_split(); -t prints them with the
+//change and a standby stores them.
+//
+//-t seq prints the changes from seq on as JSON lines, and with follow
+//waits for more.  -t compact keeps only the last change of each id since
+//the last RESET; sequence numbers do not change, so a consumer can resume
+//from wherever it was and still ends up with the same records.
+
+#define CDC_MAGIC           "SDBCDC01"
+#define CDC_VERSION         1
+#define CDC_SUFFIX          ".cdc"
+
+//cdc_rec_t ops
+#define CDC_ADD             1
+#define CDC_DEL             2       //rec is the student that was deleted
+#define CDC_UPDATE          3
+#define CDC_RESET           4       //rec is all zero
+#define CDC_NAMES           5       //part of the full names of the change
+                                    //that follows
+
+typedef struct cdc_hdr {
+    char     magic[8];
+    uint32_t version;
+    uint32_t rec_sz;            //sizeof(cdc_rec_t)
+    uint64_t log_id;            //random, set when the log is started
+    uint8_t  pad[40];
+} cdc_hdr_t;
+
+typedef struct cdc_rec {
+    uint64_t  seq;
+    uint32_t  op;               //CDC_*
+    uint32_t  crc;              //crc32c() of the entry with crc 0, torn
+                                //appends never match
+    union {
+        student_t     rec;
+        names_chunk_t names;    //CDC_NAMES
+    };
+} cdc_rec_t;
+
+//Output messages
+#define M_CDC_NONE          "There is no change log, SDB_CDC=1 starts one.\n"
+#define M_CDC_COMPACTED     "Change log compacted from %ld to %ld change(s).\n"
+#define M_ERR_CDC           "Error reading the change log, exiting!\n"
+
+//Reader of the log, see cdc_reader_open().  Takes no locks.
+typedef struct cdc_reader {
+    char        path[PATH_MAX];
+    const char *name;           //file name part of path
+    int         lfd;            //the log, -1 until it is opened
+    int         ifd;            //inotify fd when following, -1 otherwise
+    off_t       pos;            //file offset of the next entry
+    uint64_t    next;           //lowest sequence number still to return
+    uint64_t    log_id;         //id of the log read, 0 before the first
+} cdc_reader_t;
+
+//prototypes for sdb_cdc.c
+int cdc_on_change(db_handle_t *h, const student_t *old, const student_t *rec);
+int cdc_on_rebuild(db_handle_t *h);
+void cdc_on_close(db_handle_t *h);
+int cdc_start(db_handle_t *h);
+int cdc_last(db_handle_t *h, uint64_t *log_id, uint64_t *seq);
+int cdc_reader_open(db_handle_t *h, cdc_reader_t *r, uint64_t from, bool follow);
+int cdc_read(cdc_reader_t *r, cdc_rec_t *buf, int max);
+void cdc_reader_seek(cdc_reader_t *r, uint64_t seq);
+int cdc_wait(cdc_reader_t *r, int timeout_ms);
+void cdc_reader_close(cdc_reader_t *r);
+int tail_db(int fd, uint64_t from, bool follow);
+int compact_cdc(int fd);
+
+#endif
@@ -0,0 +1,588 @@
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "db.h"
+#include "sdbsc.h"
+#include "sdb_handle.h"
+#include "sdb_scan.h"
+#include "sdb_lock.h"
+#include "sdb_cols.h"
+
+//Columnar snapshot.  Unlike the last name index this sidecar is not kept
+//up to date record by record: a change only sets the stale flag in its
+//header, and the next report that finds it stale takes a new snapshot
+//with one scan.  Reports map the file and run the kernels below over the
+//gpa column alone.
+//
+//Writing a snapshot and marking it stale both happen under the meta lock
+//exclusive, reports hold it shared.  A new snapshot replaces the old one
+//with rename(), so writers open the file by path to mark it.
+
+//GCC vector extensions: 8 lanes of int32, compiled to whatever SIMD the
+//target has (two SSE2 registers on plain x86-64, one with -mavx2)
+typedef int32_t v8si __attribute__((vector_size(32)));
+#define LANES               8
+
+//a lane sums at most this many GPAs before it is widened, which keeps
+//it far from overflowing even for out of range values
+#define KERNEL_BLOCK        (1 << 20)
+
+//section offsets computed from a header
+typedef struct cols_layout {
+    off_t ids, gpas, fcode, lcode, foffs, fnames, loffs, lnames, end;
+} cols_layout_t;
+
+//rows collected by the snapshot scan
+typedef struct row_vec {
+    student_t *v;
+    long       n;
+    long       cap;
+} row_vec_t;
+
+static off_t align_up(off_t off)
+{
+    return (off + COLS_ALIGN - 1) & ~(off_t)(COLS_ALIGN - 1);
+}
+
+static void layout(const cols_hdr_t *hdr, cols_layout_t *l)
+{
+    off_t col = (off_t)hdr->nrows * sizeof(int32_t);
+
+    l->ids = align_up(sizeof(*hdr));
+    l->gpas = align_up(l->ids + col);
+    l->fcode = align_up(l->gpas + col);
+    l->lcode = align_up(l->fcode + col);
+    l->foffs = align_up(l->lcode + col);
+    l->fnames = l->foffs + (off_t)(hdr->nfnames + 1) * sizeof(uint32_t);
+    l->loffs = align_up(l->fnames + hdr->fnames_len);
+    l->lnames = l->loffs + (off_t)(hdr->nlnames + 1) * sizeof(uint32_t);
+    l->end = l->lnames + hdr->lnames_len;
+}
+
+static int collect_rows(void *arg, int first, const student_t *recs, int n,
+                        uint64_t occupied)
+{
+    row_vec_t *rv = arg;
+    (void)first; (void)n;
+
+    while (occupied) {
+        if (rv->n == rv->cap) {
+            long cap = rv->cap ? rv->cap * 2 : 256;
+            student_t *v = realloc(rv->v, cap * sizeof(*v));
+
+            if (v == NULL)
+                return ERR_DB_OP;
+            rv->v = v;
+            rv->cap = cap;
+        }
+        rv->v[rv->n++] = recs[__builtin_ctzll(occupied)];
+        occupied &= occupied - 1;
+    }
+    return NO_ERROR;
+}
+
+static int cmp_name(const void *a, const void *b)
+{
+    return strcmp(*(const char *const *)a, *(const char *const *)b);
+}
+
+/*
+ *  build_dict
+ *      names:  pointers to one NUL terminated name per row, sorted and
+ *              deduplicated in place
+ *      n:      number of rows
+ *      nuniq:  receives the number of distinct names
+ *      bytes:  receives the bytes needed for the strings
+ *
+ *  returns:  nothing
+ */
+static void build_dict(const char **names, long n, int64_t *nuniq, int64_t *bytes)
+{
+    long out = 0;
+
+    qsort(names, n, sizeof(*names), cmp_name);
+    *bytes = 0;
+    for (long i = 0; i < n; i++) {
+        if (out > 0 && strcmp(names[out - 1], names[i]) == 0)
+            continue;
+        names[out++] = names[i];
+        *bytes += (int64_t)strlen(names[i]) + 1;
+    }
+    *nuniq = out;
+}
+
+static uint32_t dict_code(const char **dict, int64_t n, const char *name)
+{
+    const char **hit = bsearch(&name, dict, n, sizeof(*dict), cmp_name);
+
+    return (uint32_t)(hit - dict);
+}
+
+//writes a dictionary's offsets then its strings, starting at buf
+static void put_dict(char *buf, const char **dict, int64_t n)
+{
+    uint32_t *offs = (uint32_t *)buf;
+    char *str = buf + (n + 1) * sizeof(uint32_t);
+    uint32_t off = 0;
+
+    for (int64_t i = 0; i < n; i++) {
+        size_t len = strlen(dict[i]) + 1;
+
+        offs[i] = off;
+        memcpy(str + off, dict[i], len);
+        off += (uint32_t)len;
+    }
+    offs[n] = off;
+}
+
+/*
+ *  write_snapshot
+ *      h:  database handle, gate held and meta lock held exclusive
+ *      n:  receives the number of students in the snapshot
+ *
+ *  Scans the database, builds the columns and dictionaries in memory,
+ *  writes them to a temporary file and renames it over the snapshot.
+ *
+ *  returns:  NO_ERROR, ERR_DB_FILE or ERR_DB_OP when out of memory
+ */
+static int write_snapshot(db_handle_t *h, long *n)
+{
+    char path[PATH_MAX], tmp[PATH_MAX + 8];
+    row_vec_t rv = {0};
+    cols_hdr_t hdr = {0};
+    cols_layout_t l;
+    const char **fdict = NULL, **ldict = NULL;
+    char *buf = NULL;
+    struct stat st;
+    int rc, fd;
+
+    if (db_sidecar_path(h, COLS_SUFFIX, path, sizeof(path)) != NO_ERROR ||
+        fstat(h->fd, &st) == -1)
+        return ERR_DB_FILE;
+
+    rc = scan_db(h, collect_rows, &rv);
+    if (rc != NO_ERROR)
+        goto out;
+
+    //names are not always NUL terminated in a record, make sure they are
+    for (long i = 0; i < rv.n; i++) {
+        rv.v[i].fname[sizeof(rv.v[i].fname) - 1] = '\0';
+        rv.v[i].lname[sizeof(rv.v[i].lname) - 1] = '\0';
+    }
+
+    rc = ERR_DB_OP;
+    fdict = malloc((rv.n ? rv.n : 1) * sizeof(*fdict));
+    ldict = malloc((rv.n ? rv.n : 1) * sizeof(*ldict));
+    if (fdict == NULL || ldict == NULL)
+        goto out;
+    for (long i = 0; i < rv.n; i++) {
+        fdict[i] = rv.v[i].fname;
+        ldict[i] = rv.v[i].lname;
+    }
+
+    memcpy(hdr.magic, COLS_MAGIC, sizeof(hdr.magic));
+    hdr.version = COLS_VERSION;
+    hdr.db_dev = (uint64_t)st.st_dev;
+    hdr.db_ino = (uint64_t)st.st_ino;
+    hdr.nrows = rv.n;
+    build_dict(fdict, rv.n, &hdr.nfnames, &hdr.fnames_len);
+    build_dict(ldict, rv.n, &hdr.nlnames, &hdr.lnames_len);
+    layout(&hdr, &l);
+
+    buf = calloc(1, (size_t)l.end);
+    if (buf == NULL)
+        goto out;
+    memcpy(buf, &hdr, sizeof(hdr));
+    for (long i = 0; i < rv.n; i++) {
+        ((int32_t *)(buf + l.ids))[i] = rv.v[i].id;
+        ((int32_t *)(buf + l.gpas))[i] = rv.v[i].gpa;
+        ((uint32_t *)(buf + l.fcode))[i] = dict_code(fdict, hdr.nfnames, rv.v[i].fname);
+        ((uint32_t *)(buf + l.lcode))[i] = dict_code(ldict, hdr.nlnames, rv.v[i].lname);
+    }
+    put_dict(buf + l.foffs, fdict, hdr.nfnames);
+    put_dict(buf + l.loffs, ldict, hdr.nlnames);
+
+    rc = ERR_DB_FILE;
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP);
+    if (fd == -1)
+        goto out;
+    if (pwrite(fd, buf, (size_t)l.end, 0) != (ssize_t)l.end) {
+        close(fd);
+        unlink(tmp);
+    } else if (close(fd) != 0 || rename(tmp, path) != 0) {
+        unlink(tmp);
+    } else {
+        *n = rv.n;
+        rc = NO_ERROR;
+    }
+
+out:
+    free(buf);
+    free(fdict);
+    free(ldict);
+    free(rv.v);
+    return rc;
+}
+
+/*
+ *  map_snapshot
+ *      h:    database handle, meta lock held
+ *      hdr:  receives the header
+ *      len:  receives the length of the mapping
+ *
+ *  Maps the snapshot read only if it exists, is not stale and was taken
+ *  from the file h has open.
+ *
+ *  returns:  the mapping, or NULL if the snapshot cannot be used
+ */
+static char *map_snapshot(db_handle_t *h, cols_hdr_t *hdr, size_t *len)
+{
+    char path[PATH_MAX];
+    struct stat db_st, st;
+    cols_layout_t l;
+    char *base;
+    int fd;
+
+    if (db_sidecar_path(h, COLS_SUFFIX, path, sizeof(path)) != NO_ERROR ||
+        fstat(h->fd, &db_st) == -1)
+        return NULL;
+
+    fd = open(path, O_RDONLY);
+    if (fd == -1)
+        return NULL;
+    if (fstat(fd, &st) == -1 ||
+        pread(fd, hdr, sizeof(*hdr), 0) != (ssize_t)sizeof(*hdr) ||
+        memcmp(hdr->magic, COLS_MAGIC, sizeof(hdr->magic)) != 0 ||
+        hdr->version != COLS_VERSION || hdr->stale ||
+        hdr->db_dev != (uint64_t)db_st.st_dev ||
+        hdr->db_ino != (uint64_t)db_st.st_ino || hdr->nrows < 0) {
+        close(fd);
+        return NULL;
+    }
+
+    layout(hdr, &l);
+    if (st.st_size < l.end) {
+        close(fd);
+        return NULL;
+    }
+
+    *len = (size_t)st.st_size;
+    base = mmap(NULL, *len, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    return base == MAP_FAILED ? NULL : base;
+}
+
+/*
+ *  open_snapshot
+ *      h:    database handle, gate held
+ *      hdr:  receives the header
+ *      len:  receives the length of the mapping
+ *
+ *  Takes the meta lock shared and maps the snapshot, taking a new one
+ *  first (with the lock retaken exclusive) if it is missing or stale.
+ *  Either way the caller releases the meta lock.
+ *
+ *  returns:  the mapping, or NULL on errors (the meta lock is not held)
+ */
+static char *open_snapshot(db_handle_t *h, cols_hdr_t *hdr, size_t *len)
+{
+    char *base;
+    long n;
+
+    if (db_lock_range(h, LOCK_META_OFF, 1, false) != NO_ERROR)
+        return NULL;
+    base = map_snapshot(h, hdr, len);
+    if (base != NULL)
+        return base;
+
+    db_unlock_range(h, LOCK_META_OFF, 1);
+    if (db_lock_range(h, LOCK_META_OFF, 1, true) != NO_ERROR)
+        return NULL;
+    base = map_snapshot(h, hdr, len);
+    if (base == NULL && write_snapshot(h, &n) == NO_ERROR)
+        base = map_snapshot(h, hdr, len);
+    if (base == NULL)
+        db_unlock_range(h, LOCK_META_OFF, 1);
+    return base;
+}
+
+/*
+ *  cols_on_change / cols_on_rebuild
+ *      h:  database handle, meta lock held exclusive
+ *
+ *  Sidecar hooks.  Any change marks an existing snapshot stale, which
+ *  costs one small write; there is nothing to do when there is none.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ */
+int cols_on_rebuild(db_handle_t *h)
+{
+    char path[PATH_MAX];
+    uint32_t stale = 1;
+    int fd, rc = NO_ERROR;
+
+    if (h->path[0] == '\0' ||
+        db_sidecar_path(h, COLS_SUFFIX, path, sizeof(path)) != NO_ERROR)
+        return NO_ERROR;
+
+    fd = open(path, O_WRONLY);
+    if (fd == -1)
+        return NO_ERROR;
+    if (pwrite(fd, &stale, sizeof(stale), offsetof(cols_hdr_t, stale)) != sizeof(stale))
+        rc = ERR_DB_FILE;
+    close(fd);
+
+    //a snapshot that cannot be marked must not be trusted either
+    if (rc != NO_ERROR)
+        unlink(path);
+    return NO_ERROR;
+}
+
+int cols_on_change(db_handle_t *h, const student_t *old, const student_t *rec)
+{
+    (void)old; (void)rec;
+    return cols_on_rebuild(h);
+}
+
+/*
+ *  cols_on_close
+ *      h:  database handle
+ *
+ *  Sidecar hook, the snapshot keeps no per-handle state.
+ */
+void cols_on_close(db_handle_t *h)
+{
+    (void)h;
+}
+
+/*
+ *  gpa_kernel
+ *      gpas:         the gpa column, or a slice of it
+ *      n:            number of values
+ *      st:           receives count, sum, min and max
+ *      want_counts:  also fill st->counts (for percentiles and histograms)
+ *
+ *  Sum, min and max run LANES values at a time; the per-GPA counts are
+ *  a scalar pass that is only made when asked for.
+ */
+void gpa_kernel(const int32_t *gpas, long n, gpa_stats_t *st, int want_counts)
+{
+    v8si vmin = (v8si){0} + INT32_MAX;
+    v8si vmax = (v8si){0} + INT32_MIN;
+    long i = 0;
+
+    memset(st, 0, sizeof(*st));
+    st->n = n;
+    st->min = INT32_MAX;
+    st->max = INT32_MIN;
+
+    while (n - i >= LANES) {
+        long end = i + KERNEL_BLOCK < n ? i + KERNEL_BLOCK : n;
+        v8si vsum = {0};
+
+        for (; end - i >= LANES; i += LANES) {
+            v8si g, lt, gt;
+
+            memcpy(&g, gpas + i, sizeof(g));   //unaligned load
+            lt = g < vmin;
+            gt = g > vmax;
+            vsum += g;
+            vmin = (g & lt) | (vmin & ~lt);
+            vmax = (g & gt) | (vmax & ~gt);
+        }
+        for (int k = 0; k < LANES; k++)
+            st->sum += vsum[k];
+    }
+    for (int k = 0; k < LANES; k++) {
+        st->min = vmin[k] < st->min ? vmin[k] : st->min;
+        st->max = vmax[k] > st->max ? vmax[k] : st->max;
+    }
+    for (; i < n; i++) {
+        st->sum += gpas[i];
+        st->min = gpas[i] < st->min ? gpas[i] : st->min;
+        st->max = gpas[i] > st->max ? gpas[i] : st->max;
+    }
+
+    if (!want_counts)
+        return;
+    for (i = 0; i < n; i++) {
+        int g = gpas[i];
+
+        st->counts[g < 0 ? 0 : g > MAX_STD_GPA ? MAX_STD_GPA : g]++;
+    }
+}
+
+//index of the first id >= key in the sorted id column
+static long lower_bound(const int32_t *ids, long n, long key)
+{
+    long lo = 0, hi = n;
+
+    while (lo < hi) {
+        long mid = lo + (hi - lo) / 2;
+
+        if (ids[mid] < key)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+//nearest rank percentile from the per-GPA counts
+static int percentile(const gpa_stats_t *st, int pct)
+{
+    long rank = ((long)pct * st->n + 99) / 100;
+    long seen = 0;
+
+    if (rank < 1)
+        rank = 1;
+    for (int g = 0; g <= MAX_STD_GPA; g++) {
+        seen += st->counts[g];
+        if (seen >= rank)
+            return g;
+    }
+    return MAX_STD_GPA;
+}
+
+static void print_hist(const gpa_stats_t *st)
+{
+    printf(M_GPA_HIST_HDR, "GPA", "STUDENTS");
+    for (int b = 0; b < GPA_BUCKETS; b++) {
+        int lo = b * GPA_BUCKET;
+        int hi = b == GPA_BUCKETS - 1 ? MAX_STD_GPA : lo + GPA_BUCKET - 1;
+        long count = 0;
+
+        for (int g = lo; g <= hi; g++)
+            count += st->counts[g];
+        printf(M_GPA_HIST_ROW, lo / 100.0, hi / 100.0, count);
+    }
+}
+
+/*
+ *  snapshot_db
+ *      fd:  linux file descriptor
+ *
+ *  Writes the columnar snapshot of the database (-S).
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ *
+ *  console:  M_COLS_WRITTEN on success, M_ERR_COLS on error
+ */
+int snapshot_db(int fd)
+{
+    db_handle_t *h = db_handle_get(fd);
+    long n = 0;
+    int rc;
+
+    if (h == NULL || db_gate_enter(h, false) != NO_ERROR) {
+        printf(M_ERR_COLS);
+        return ERR_DB_FILE;
+    }
+    if (db_lock_range(h, LOCK_META_OFF, 1, true) != NO_ERROR) {
+        db_gate_leave(h);
+        printf(M_ERR_COLS);
+        return ERR_DB_FILE;
+    }
+
+    rc = write_snapshot(h, &n);
+    db_unlock_range(h, LOCK_META_OFF, 1);
+    db_gate_leave(h);
+
+    if (rc != NO_ERROR) {
+        printf(M_ERR_COLS);
+        return ERR_DB_FILE;
+    }
+    printf(M_COLS_WRITTEN, n);
+    return NO_ERROR;
+}
+
+/*
+ *  gpa_report
+ *      fd:    linux file descriptor
+ *      stat:  avg, min, max, hist or p<0-100>
+ *      lo:    smallest id to include
+ *      hi:    largest id to include
+ *
+ *  Computes a GPA statistic over the students with ids in [lo, hi] from
+ *  the columnar snapshot, taking a new snapshot first if needed.  The ids
+ *  are sorted, so the range is found with two binary searches and only
+ *  that slice of the gpa column is read.
+ *
+ *  returns:  NO_ERROR, SRCH_NOT_FOUND if no student is in the range,
+ *            ERR_DB_OP for an unknown statistic or ERR_DB_FILE
+ *
+ *  console:  the statistic, M_GPA_NONE, M_ERR_GPA_STAT or M_ERR_COLS
+ */
+int gpa_report(int fd, char *stat, int lo, int hi)
+{
+    db_handle_t *h = db_handle_get(fd);
+    gpa_stats_t st;
+    cols_hdr_t hdr;
+    cols_layout_t l;
+    size_t len;
+    char *base, *end;
+    int pct = -1;
+
+    if (stat[0] == 'p' && stat[1] != '\0') {
+        pct = (int)strtol(stat + 1, &end, 10);
+        if (*end != '\0' || pct < 0 || pct > 100) {
+            printf(M_ERR_GPA_STAT, stat);
+            return ERR_DB_OP;
+        }
+    } else if (strcmp(stat, "avg") != 0 && strcmp(stat, "min") != 0 &&
+               strcmp(stat, "max") != 0 && strcmp(stat, "hist") != 0) {
+        printf(M_ERR_GPA_STAT, stat);
+        return ERR_DB_OP;
+    }
+
+    if (h == NULL || db_gate_enter(h, false) != NO_ERROR) {
+        printf(M_ERR_COLS);
+        return ERR_DB_FILE;
+    }
+    base = open_snapshot(h, &hdr, &len);
+    if (base == NULL) {
+        db_gate_leave(h);
+        printf(M_ERR_COLS);
+        return ERR_DB_FILE;
+    }
+
+    layout(&hdr, &l);
+    const int32_t *ids = (const int32_t *)(base + l.ids);
+    long first = lower_bound(ids, hdr.nrows, lo);
+    long last = lower_bound(ids, hdr.nrows, (long)hi + 1);
+
+    gpa_kernel((const int32_t *)(base + l.gpas) + first,
+               last > first ? last - first : 0, &st,
+               pct >= 0 || strcmp(stat, "hist") == 0);
+
+    munmap(base, len);
+    db_unlock_range(h, LOCK_META_OFF, 1);
+    db_gate_leave(h);
+
+    if (st.n == 0) {
+        printf(M_GPA_NONE);
+        return SRCH_NOT_FOUND;
+    }
+
+    if (pct >= 0)
+        printf(M_GPA_PCT, pct, st.n, percentile(&st, pct) / 100.0);
+    else if (strcmp(stat, "avg") == 0)
+        printf(M_GPA_AVG, st.n, (double)st.sum / st.n / 100.0);
+    else if (strcmp(stat, "min") == 0)
+        printf(M_GPA_MIN, st.n, st.min / 100.0);
+    else if (strcmp(stat, "max") == 0)
+        printf(M_GPA_MAX, st.n, st.max / 100.0);
+    else
+        print_hist(&st);
+    return NO_ERROR;
+}
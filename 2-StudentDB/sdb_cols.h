@@ -0,0 +1,78 @@
+#ifndef __SDB_COLS_H__
+    #define __SDB_COLS_H__
+
+#include <stdint.h>
+
+#include "db.h"
+#include "sdb_handle.h"
+
+//Columnar snapshot of the database, see sdb_cols.c.  The sidecar
+//.student.db.cols holds the records split into columns, so GPA reports
+//read 4 bytes per student instead of a 64 byte row:
+//
+//  [cols_hdr_t]
+//  ids     int32_t[nrows]      sorted
+//  gpas    int32_t[nrows]
+//  fcode   uint32_t[nrows]     index into the first name dictionary
+//  lcode   uint32_t[nrows]     index into the last name dictionary
+//  foffs   uint32_t[nfnames + 1], followed by the first names
+//  loffs   uint32_t[nlnames + 1], followed by the last names
+//
+//Every section starts on a COLS_ALIGN boundary.  Dictionaries hold each
+//distinct name once, sorted, as NUL terminated strings at their offsets.
+//The snapshot is written by -S, or on demand by -g when it is missing or
+//stale; every change to the records marks it stale.
+
+#define COLS_MAGIC          "SDBCOLS1"
+#define COLS_VERSION        1
+#define COLS_SUFFIX         ".cols"
+#define COLS_ALIGN          64
+
+//GPA histogram buckets of 0.50, the last one includes MAX_STD_GPA
+#define GPA_BUCKET          50
+#define GPA_BUCKETS         (MAX_STD_GPA / GPA_BUCKET)
+
+typedef struct cols_hdr {
+    char     magic[8];
+    uint32_t version;
+    uint32_t stale;             //set once the records change
+    uint64_t db_dev;            //identity of the database the snapshot
+    uint64_t db_ino;            //was taken from
+    int64_t  nrows;
+    int64_t  nfnames;
+    int64_t  nlnames;
+    int64_t  fnames_len;        //bytes of first name strings
+    int64_t  lnames_len;        //bytes of last name strings
+    char     pad[56];
+} cols_hdr_t;
+
+//result of a GPA report over a range of ids
+typedef struct gpa_stats {
+    long      n;
+    long long sum;
+    int       min;
+    int       max;
+    long      counts[MAX_STD_GPA + 1];  //students per exact GPA, optional
+} gpa_stats_t;
+
+//Output messages
+#define M_COLS_WRITTEN      "Snapshot of %ld student(s) written.\n"
+#define M_GPA_AVG           "Average GPA of %ld student(s): %.2f\n"
+#define M_GPA_MIN           "Lowest GPA of %ld student(s): %.2f\n"
+#define M_GPA_MAX           "Highest GPA of %ld student(s): %.2f\n"
+#define M_GPA_PCT           "GPA percentile %d of %ld student(s): %.2f\n"
+#define M_GPA_HIST_HDR      "%-11s %s\n"
+#define M_GPA_HIST_ROW      "%.2f-%.2f  %ld\n"
+#define M_GPA_NONE          "No students to report on.\n"
+#define M_ERR_GPA_STAT      "Unknown GPA statistic %s, use avg|min|max|hist|p<0-100>\n"
+#define M_ERR_COLS          "Error writing the columnar snapshot, exiting!\n"
+
+//prototypes for sdb_cols.c
+int cols_on_change(db_handle_t *h, const student_t *old, const student_t *rec);
+int cols_on_rebuild(db_handle_t *h);
+void cols_on_close(db_handle_t *h);
+void gpa_kernel(const int32_t *gpas, long n, gpa_stats_t *st, int want_counts);
+int snapshot_db(int fd);
+int gpa_report(int fd, char *stat, int lo, int hi);
+
+#endif
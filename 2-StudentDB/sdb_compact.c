@@ -0,0 +1,457 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "db.h"
+#include "sdbsc.h"
+#include "sdb_handle.h"
+#include "sdb_mmap.h"
+#include "sdb_scan.h"
+#include "sdb_lock.h"
+#include "sdb_compact.h"
+#include "sdb_engine.h"
+
+//Because a record lives at offset id*64, compaction never has to move a
+//live record; it only has to give back the blocks that hold nothing but
+//deleted (all zero) records.  fallocate(FALLOC_FL_PUNCH_HOLE) does that
+//in place, so each slice only needs the gate shared plus a write lock on
+//the slice's byte range: readers elsewhere in the file never notice, and
+//readers of the slice wait for one slice, not the whole file.  The empty
+//tail of the file is cut off at the end under a brief exclusive gate.
+//Slices are independent, so they are compacted a round of several at a
+//time on the scan worker threads (see scan_parallel()), one slice each.
+
+/*
+ *  punch
+ *      fd:   database file
+ *      off:  page aligned start of a run of empty pages
+ *      len:  length of the run
+ *
+ *  returns:  NO_ERROR, ERR_DB_OP if the file system cannot punch holes,
+ *            ERR_DB_FILE on other errors
+ */
+static int punch(int fd, off_t off, off_t len)
+{
+    if (len == 0)
+        return NO_ERROR;
+    if (fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, off, len) == 0)
+        return NO_ERROR;
+    return (errno == EOPNOTSUPP || errno == ENOSYS) ? ERR_DB_OP : ERR_DB_FILE;
+}
+
+/*
+ *  compact_slice
+ *      h:     database handle, caller holds the gate shared
+ *      lo:    start of the slice, page aligned
+ *      hi:    end of the slice
+ *      buf:   hi - lo bytes of scratch space
+ *      st:    reclaimed is updated
+ *      live:  raised to the end of the last live record seen
+ *
+ *  Write-locks the slice, reads its populated extents and punches every
+ *  run of empty pages.
+ *
+ *  returns:  NO_ERROR, ERR_DB_OP (no hole punching) or ERR_DB_FILE
+ */
+static int compact_slice(db_handle_t *h, off_t lo, off_t hi, char *buf,
+                         compact_stats_t *st, off_t *live)
+{
+    off_t pos = lo, start, end;
+    int rc = NO_ERROR;
+
+    if (db_lock_range(h, lo, hi - lo, true) != NO_ERROR)
+        return ERR_DB_FILE;
+
+    while (rc == NO_ERROR && next_extent(h->fd, pos, hi, &start, &end)) {
+        off_t run = -1;
+        ssize_t got;
+
+        start -= start % SCAN_PAGE_SZ;
+        if (start < lo)
+            start = lo;
+
+        got = pread(h->fd, buf, (size_t)(end - start), start);
+        if (got != end - start) {
+            rc = ERR_DB_FILE;
+            break;
+        }
+
+        for (off_t off = 0; rc == NO_ERROR && off < got; off += SCAN_PAGE_SZ) {
+            off_t in_page = got - off < SCAN_PAGE_SZ ? got - off : SCAN_PAGE_SZ;
+            uint64_t occupied = page_occupancy((const student_t *)(buf + off),
+                                               (int)(in_page / STUDENT_RECORD_SIZE));
+
+            if (occupied == 0) {
+                if (run < 0)
+                    run = start + off;
+                continue;
+            }
+
+            rc = run < 0 ? NO_ERROR : punch(h->fd, run, start + off - run);
+            if (rc == NO_ERROR && run >= 0)
+                st->reclaimed += start + off - run;
+            run = -1;
+
+            //the highest set bit is the last live record of the page
+            off_t last = start + off + (63 - __builtin_clzll(occupied) + 1) *
+                         (off_t)STUDENT_RECORD_SIZE;
+            if (last > *live)
+                *live = last;
+        }
+
+        if (rc == NO_ERROR && run >= 0) {
+            rc = punch(h->fd, run, end - run);
+            if (rc == NO_ERROR)
+                st->reclaimed += end - run;
+        }
+        pos = end;
+    }
+
+    db_unlock_range(h, lo, hi - lo);
+    return rc;
+}
+
+/*
+ *  trim_tail
+ *      h:     database handle
+ *      live:  end of the last live record the slices saw
+ *
+ *  Shrinks the file to end at its last live record, the same length the
+ *  copying compress used to produce.  Records may have been added past
+ *  live since it was measured, so the rest of the file is rescanned with
+ *  the gate held exclusive (shrinking must not happen under a reader).
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ */
+static int trim_tail(db_handle_t *h, off_t live)
+{
+    off_t pos, start, end;
+    int rc = NO_ERROR;
+    char *buf;
+
+    if (db_gate_enter(h, true) != NO_ERROR)
+        return ERR_DB_FILE;
+
+    buf = malloc(SCAN_CHUNK_SZ);
+    if (buf == NULL) {
+        db_gate_leave(h);
+        return ERR_DB_FILE;
+    }
+
+    pos = live - live % SCAN_PAGE_SZ;
+    while (rc == NO_ERROR && next_extent(h->fd, pos, h->file_len, &start, &end)) {
+        for (pos = start; pos < end; ) {
+            size_t want = end - pos < SCAN_CHUNK_SZ ? (size_t)(end - pos) : SCAN_CHUNK_SZ;
+            ssize_t got = pread(h->fd, buf, want, pos);
+
+            if (got <= 0 || got % STUDENT_RECORD_SIZE != 0) {
+                rc = ERR_DB_FILE;
+                break;
+            }
+            for (ssize_t off = 0; off < got; off += STUDENT_RECORD_SIZE) {
+                if (page_occupancy((const student_t *)(buf + off), 1))
+                    live = pos + off + STUDENT_RECORD_SIZE;
+            }
+            pos += got;
+        }
+    }
+    free(buf);
+
+    if (rc == NO_ERROR && live < h->file_len) {
+        if (ftruncate(h->fd, live) == -1 || map_refresh(h) != NO_ERROR)
+            rc = ERR_DB_FILE;
+    }
+
+    db_gate_leave(h);
+    return rc;
+}
+
+/*
+ *  compact_db
+ *      h:    database handle
+ *      fn:   called with the running totals as compaction proceeds, may be
+ *            NULL
+ *      arg:  passed through to fn
+ *      st:   receives the final totals
+ *
+ *  Compacts the database with the engine's compaction.
+ *
+ *  returns:  NO_ERROR, ERR_DB_OP if the engine cannot compact in place and
+ *            the file has to be copied instead, ERR_DB_FILE on I/O errors
+ */
+int compact_db(db_handle_t *h, compact_progress_fn fn, void *arg,
+               compact_stats_t *st)
+{
+    return h->engine->compact(h, fn, arg, st);
+}
+
+//state shared by the workers of one round of compact_punch()
+typedef struct punch_round {
+    db_handle_t     *h;
+    off_t            slice;
+    off_t            lo, hi;        //the round's part of the file
+    char           **bufs;          //a slice sized buffer per worker
+    int              next_worker;   //claimed with an atomic add
+    long             next_slice;    //the same
+    pthread_mutex_t  mu;
+    off_t            reclaimed;     //totals of the round, under mu
+    off_t            live;
+    int              rc;            //first failure, under mu
+} punch_round_t;
+
+/*
+ *  punch_worker
+ *      arg:  the punch_round_t
+ *
+ *  Compacts slices of the round until there are none left, then adds its
+ *  totals to the round's.
+ */
+static void *punch_worker(void *arg)
+{
+    punch_round_t *r = arg;
+    char *buf = r->bufs[__atomic_fetch_add(&r->next_worker, 1, __ATOMIC_RELAXED)];
+    compact_stats_t st = { 0, 0, 0 };
+    off_t live = 0;
+    int rc = NO_ERROR;
+
+    while (rc == NO_ERROR) {
+        off_t lo = r->lo + __atomic_fetch_add(&r->next_slice, 1, __ATOMIC_RELAXED) * r->slice;
+
+        if (lo >= r->hi)
+            break;
+        rc = compact_slice(r->h, lo, lo + r->slice < r->hi ? lo + r->slice : r->hi,
+                           buf, &st, &live);
+    }
+
+    pthread_mutex_lock(&r->mu);
+    r->reclaimed += st.reclaimed;
+    if (live > r->live)
+        r->live = live;
+    if (r->rc == NO_ERROR)
+        r->rc = rc;
+    pthread_mutex_unlock(&r->mu);
+    return NULL;
+}
+
+/*
+ *  compact_punch
+ *      h:    database handle in the legacy format
+ *      fn:   called with the running totals after every round, may be NULL
+ *      arg:  passed through to fn
+ *      st:   receives the final totals
+ *
+ *  The legacy engine's compaction.  Compacts the database in place, a
+ *  round of slices at a time, one slice per scan worker (scan_threads()).
+ *  The gate is released between rounds so waiting writers (and
+ *  compress_db() callers in other processes) get their turn; a round takes
+ *  about as long as one slice did on one thread.  Nothing changes as far
+ *  as the records are concerned, so the log and the sidecars are left
+ *  alone.
+ *
+ *  returns:  NO_ERROR, ERR_DB_OP if the file system cannot punch holes
+ *            (before anything was changed) or SDB_COMPACT=copy, ERR_DB_FILE
+ *            on I/O errors
+ */
+int compact_punch(db_handle_t *h, compact_progress_fn fn, void *arg,
+                  compact_stats_t *st)
+{
+    off_t slice = db_config_int("SDB_COMPACT_SLICE", COMPACT_SLICE_SZ);
+    off_t live = 0, nslices;
+    char *bufs[SCAN_MAX_THREADS];
+    int nthreads;
+    int rc = NO_ERROR;
+
+    if (strcmp(db_config_str("SDB_COMPACT", "punch"), "copy") == 0)
+        return ERR_DB_OP;
+
+    slice -= slice % SCAN_PAGE_SZ;
+    if (slice < SCAN_PAGE_SZ)
+        slice = SCAN_PAGE_SZ;
+
+    st->scanned = st->reclaimed = 0;
+    if (map_refresh(h) != NO_ERROR)
+        return ERR_DB_FILE;
+    st->total = h->file_len;
+
+    nslices = (h->file_len + slice - 1) / slice;
+    nthreads = scan_threads(h);
+    if (nthreads > nslices)
+        nthreads = nslices < 1 ? 1 : (int)nslices;
+    for (int i = 0; i < nthreads; i++) {
+        bufs[i] = malloc((size_t)slice);
+        if (bufs[i] == NULL) {
+            nthreads = i;
+            break;
+        }
+    }
+    if (nthreads == 0)
+        return ERR_DB_FILE;
+
+    for (off_t lo = 0; rc == NO_ERROR; lo += slice * nthreads) {
+        punch_round_t r = {
+            .h = h, .slice = slice, .lo = lo, .bufs = bufs,
+            .mu = PTHREAD_MUTEX_INITIALIZER,
+        };
+
+        if (db_gate_enter(h, false) != NO_ERROR) {
+            rc = ERR_DB_FILE;
+            break;
+        }
+        if (lo >= h->file_len) {
+            db_gate_leave(h);
+            break;
+        }
+
+        r.hi = lo + slice * nthreads < h->file_len ? lo + slice * nthreads
+                                                   : h->file_len;
+        scan_workers(nthreads, punch_worker, &r);
+        db_gate_leave(h);
+
+        rc = r.rc;
+        st->reclaimed += r.reclaimed;
+        if (r.live > live)
+            live = r.live;
+        st->scanned = r.hi > st->total ? st->total : r.hi;
+        if (rc == NO_ERROR && fn != NULL)
+            fn(arg, st);
+    }
+    for (int i = 0; i < nthreads; i++)
+        free(bufs[i]);
+
+    if (rc != NO_ERROR)
+        return rc;
+    return trim_tail(h, live);
+}
+
+/*
+ *  copy_run
+ *      from, to:  source and destination files
+ *      off:       start of the run, the same in both files
+ *      len:       bytes to copy
+ *
+ *  Copies in the kernel with copy_file_range(), falling back to pread()
+ *  and pwrite() through a large buffer where that is not supported.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ */
+static int copy_run(int from, int to, off_t off, off_t len)
+{
+    static char *buf;
+    off_t in = off, out = off;
+
+    while (len > 0) {
+        size_t want = len < COMPACT_COPY_MAX ? (size_t)len : COMPACT_COPY_MAX;
+        ssize_t n = copy_file_range(from, &in, to, &out, want, 0);
+
+        if (n > 0) {
+            len -= n;
+            continue;
+        }
+        if (n == 0 || (errno != EXDEV && errno != ENOSYS && errno != EINVAL &&
+                       errno != EOPNOTSUPP))
+            return ERR_DB_FILE;
+
+        if (buf == NULL && (buf = malloc(SCAN_CHUNK_SZ)) == NULL)
+            return ERR_DB_FILE;
+        want = len < SCAN_CHUNK_SZ ? (size_t)len : SCAN_CHUNK_SZ;
+        n = pread(from, buf, want, in);
+        if (n <= 0 || pwrite(to, buf, (size_t)n, out) != n)
+            return ERR_DB_FILE;
+        in += n;
+        out += n;
+        len -= n;
+    }
+    return NO_ERROR;
+}
+
+//collects runs of pages with live records and copies each run in one go
+typedef struct copy_state {
+    int   from, to;
+    off_t run, run_end;         //pending run, run == run_end when none
+} copy_state_t;
+
+static int copy_page(void *arg, int first, const student_t *recs, int n,
+                     uint64_t occupied)
+{
+    copy_state_t *cs = arg;
+    off_t off = (off_t)first * STUDENT_RECORD_SIZE;
+    (void)recs; (void)occupied;
+
+    if (off != cs->run_end) {
+        if (copy_run(cs->from, cs->to, cs->run, cs->run_end - cs->run) != NO_ERROR)
+            return ERR_DB_OP;
+        cs->run = off;
+    }
+    cs->run_end = off + (off_t)n * STUDENT_RECORD_SIZE;
+    return NO_ERROR;
+}
+
+/*
+ *  compact_copy
+ *      h:       database handle, caller holds the gate exclusive
+ *      tmp_fd:  empty file to copy into
+ *
+ *  Fallback for file systems without hole punching: copies the pages that
+ *  hold live records to the same offsets in tmp_fd, a run of adjacent
+ *  pages at a time, and sizes tmp_fd to end at the last live record.
+ *
+ *  returns:  NO_ERROR, ERR_DB_OP on write errors, ERR_DB_FILE on read
+ *            errors
+ */
+int compact_copy(db_handle_t *h, int tmp_fd)
+{
+    copy_state_t cs = { h->fd, tmp_fd, 0, 0 };
+    off_t live = 0;
+    int rc = scan_db(h, copy_page, &cs);
+
+    if (rc == NO_ERROR &&
+        copy_run(cs.from, cs.to, cs.run, cs.run_end - cs.run) != NO_ERROR)
+        rc = ERR_DB_OP;
+    if (rc != NO_ERROR)
+        return rc;
+
+    //whole pages were copied, cut the copy after its last live record
+    for (off_t pos = cs.run_end; pos > cs.run; pos -= STUDENT_RECORD_SIZE) {
+        student_t *s = map_slot(h, (int)(pos / STUDENT_RECORD_SIZE) - 1);
+
+        if (s != NULL && page_occupancy(s, 1)) {
+            live = pos;
+            break;
+        }
+    }
+    return ftruncate(tmp_fd, live) == -1 ? ERR_DB_OP : NO_ERROR;
+}
+
+/*
+ *  compact_report
+ *      arg:  unused
+ *      st:   running totals
+ *
+ *  Progress callback for compress_db().  Writes a single updating line to
+ *  stderr when that is a terminal (or SDB_PROGRESS=1), nothing otherwise.
+ */
+void compact_report(void *arg, const compact_stats_t *st)
+{
+    static int show = -1;
+    (void)arg;
+
+    if (show < 0)
+        show = isatty(STDERR_FILENO) || db_config_int("SDB_PROGRESS", 0) != 0;
+    if (!show)
+        return;
+
+    fprintf(stderr, M_COMPACT_PROGRESS,
+            st->total ? (int)(st->scanned * 100 / st->total) : 100,
+            (long long)(st->scanned / 1024), (long long)(st->total / 1024),
+            (long long)(st->reclaimed / 1024));
+    if (st->scanned >= st->total)
+        fprintf(stderr, M_COMPACT_DONE);
+}
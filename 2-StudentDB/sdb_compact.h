@@ -0,0 +1,47 @@
+#ifndef __SDB_COMPACT_H__
+    #define __SDB_COMPACT_H__
+
+#include <sys/types.h>
+
+#include "db.h"
+#include "sdb_handle.h"
+
+//Online compaction, see sdb_compact.c.  compact_db() runs the engine's
+//compaction (see sdb_engine.h), the rest of this is the legacy engine's.
+//Deleted records are 64 zero bytes that still occupy disk blocks.  The
+//compactor walks the file in slices of COMPACT_SLICE_SZ bytes and punches
+//every page that holds no live record back into a hole, in place, so the
+//file is never taken away from readers.  File systems that cannot punch
+//holes fall back to copying the live pages into a new file with
+//copy_file_range().
+//
+//Settings (environment):
+//  SDB_COMPACT=copy      always use the copying fallback
+//  SDB_COMPACT_SLICE=n   bytes per slice (default COMPACT_SLICE_SZ)
+//  SDB_PROGRESS=1        report progress even when stderr is not a tty
+
+#define COMPACT_SLICE_SZ    (4 * 1024 * 1024)
+#define COMPACT_COPY_MAX    (64 * 1024 * 1024)  //largest copy_file_range()
+
+//Output messages, progress goes to stderr
+#define M_COMPACT_PROGRESS  "\rCompacting: %3d%% (%lld of %lld KB), %lld KB reclaimed"
+#define M_COMPACT_DONE      "\n"
+
+typedef struct compact_stats {
+    off_t scanned;              //bytes of the file looked at so far
+    off_t total;                //size of the file when compaction started
+    off_t reclaimed;            //bytes of empty pages punched out
+} compact_stats_t;
+
+//called after every slice
+typedef void (*compact_progress_fn)(void *arg, const compact_stats_t *st);
+
+//prototypes for sdb_compact.c
+int compact_db(db_handle_t *h, compact_progress_fn fn, void *arg,
+               compact_stats_t *st);
+int compact_punch(db_handle_t *h, compact_progress_fn fn, void *arg,
+                  compact_stats_t *st);
+int compact_copy(db_handle_t *h, int tmp_fd);
+void compact_report(void *arg, const compact_stats_t *st);
+
+#endif
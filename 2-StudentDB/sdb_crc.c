@@ -0,0 +1,120 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <pthread.h>
+
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#elif defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#endif
+
+#include "sdb_crc.h"
+
+//reflected CRC32C polynomial
+#define CRC32C_POLY     0x82F63B78u
+
+//CRC32C is what the SSE4.2 crc32 instruction (and the ARMv8 crc32c ones)
+//compute, 8 bytes per instruction; page checksums run at memory speed
+//with it.  Without it the tables below are used 8 bytes at a time
+//("slicing by 8"): table k holds the CRC of a byte followed by k zero
+//bytes, so the 8 lookups of a word are independent of each other.
+static uint32_t crc_table[8][256];
+static pthread_once_t crc_once = PTHREAD_ONCE_INIT;
+static uint32_t (*crc_update)(uint32_t crc, const unsigned char *p, size_t len);
+
+static uint32_t crc_soft(uint32_t crc, const unsigned char *p, size_t len)
+{
+    while (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__ && len >= 8) {
+        uint32_t lo, hi;
+
+        memcpy(&lo, p, 4);
+        memcpy(&hi, p + 4, 4);
+        lo ^= crc;
+        crc = crc_table[7][lo & 0xff] ^ crc_table[6][(lo >> 8) & 0xff] ^
+              crc_table[5][(lo >> 16) & 0xff] ^ crc_table[4][lo >> 24] ^
+              crc_table[3][hi & 0xff] ^ crc_table[2][(hi >> 8) & 0xff] ^
+              crc_table[1][(hi >> 16) & 0xff] ^ crc_table[0][hi >> 24];
+        p += 8;
+        len -= 8;
+    }
+    while (len--)
+        crc = crc_table[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+    return crc;
+}
+
+#if defined(__x86_64__)
+__attribute__((target("sse4.2")))
+static uint32_t crc_hw(uint32_t crc, const unsigned char *p, size_t len)
+{
+    uint64_t c = crc;
+
+    while (len >= 8) {
+        uint64_t v;
+
+        memcpy(&v, p, 8);
+        c = _mm_crc32_u64(c, v);
+        p += 8;
+        len -= 8;
+    }
+    while (len--)
+        c = _mm_crc32_u8((uint32_t)c, *p++);
+    return (uint32_t)c;
+}
+#elif defined(__ARM_FEATURE_CRC32)
+static uint32_t crc_hw(uint32_t crc, const unsigned char *p, size_t len)
+{
+    while (len >= 8) {
+        uint64_t v;
+
+        memcpy(&v, p, 8);
+        crc = __crc32cd(crc, v);
+        p += 8;
+        len -= 8;
+    }
+    while (len--)
+        crc = __crc32cb(crc, *p++);
+    return crc;
+}
+#endif
+
+static void init_table(void)
+{
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t c = i;
+
+        for (int k = 0; k < 8; k++)
+            c = (c & 1) ? (c >> 1) ^ CRC32C_POLY : c >> 1;
+        crc_table[0][i] = c;
+    }
+    for (uint32_t i = 0; i < 256; i++) {
+        for (int t = 1; t < 8; t++)
+            crc_table[t][i] = crc_table[0][crc_table[t - 1][i] & 0xff] ^
+                              (crc_table[t - 1][i] >> 8);
+    }
+
+    crc_update = crc_soft;
+#if defined(__x86_64__)
+    if (__builtin_cpu_supports("sse4.2"))
+        crc_update = crc_hw;
+#elif defined(__ARM_FEATURE_CRC32)
+    crc_update = crc_hw;
+#endif
+}
+
+/*
+ *  crc32c
+ *      crc:  value returned by a previous call, or 0 to start
+ *      buf:  data to checksum
+ *      len:  number of bytes
+ *
+ *  Safe to call from several threads at once.
+ *
+ *  returns:  the CRC32C of everything passed in so far
+ */
+uint32_t crc32c(uint32_t crc, const void *buf, size_t len)
+{
+    pthread_once(&crc_once, init_table);
+    return ~crc_update(~crc, buf, len);
+}
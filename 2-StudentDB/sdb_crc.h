@@ -0,0 +1,12 @@
+#ifndef __SDB_CRC_H__
+    #define __SDB_CRC_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+//CRC32C (Castagnoli) used to detect torn or corrupted log records
+
+//prototypes for sdb_crc.c
+uint32_t crc32c(uint32_t crc, const void *buf, size_t len);
+
+#endif
@@ -0,0 +1,547 @@
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "db.h"
+#include "sdbsc.h"
+#include "sdb_handle.h"
+#include "sdb_mmap.h"
+#include "sdb_lock.h"
+#include "sdb_engine.h"
+#include "sdb_dense.h"
+
+//The dense engine keeps the file proportional to the number of students
+//rather than to the highest id.  get_student() is one hash probe sequence
+//plus one record copy, both inside the shared mapping.
+//
+//The directory and the packed record array are shared structures, so
+//unlike the legacy format a writer cannot get by with its record lock
+//alone: every change holds the dir lock exclusive, lookups and scans
+//hold it shared.  The header's busy flag is set while a change is in
+//progress; finding it set with the dir lock held means a writer died
+//half way, and the directory is rebuilt from the records (which always
+//carry their own ids).
+
+#define HDR_SZ      ((off_t)sizeof(dense_hdr_t))
+
+static off_t rec_off(uint32_t slot)
+{
+    return HDR_SZ + (off_t)slot * STUDENT_RECORD_SIZE;
+}
+
+static off_t dir_off(uint32_t cap)
+{
+    return rec_off(cap);
+}
+
+static off_t dense_size(uint32_t cap)
+{
+    return dir_off(cap) + (off_t)2 * cap * sizeof(dense_dirent_t);
+}
+
+static dense_hdr_t *hdr(db_handle_t *h)
+{
+    return (dense_hdr_t *)h->base;
+}
+
+static student_t *rec_at(db_handle_t *h, uint32_t slot)
+{
+    return (student_t *)(h->base + rec_off(slot));
+}
+
+static dense_dirent_t *dir_at(db_handle_t *h)
+{
+    return (dense_dirent_t *)(h->base + dir_off(hdr(h)->cap));
+}
+
+static bool is_empty(const student_t *rec)
+{
+    return memcmp(rec, &EMPTY_STUDENT_RECORD, STUDENT_RECORD_SIZE) == 0;
+}
+
+static void set_busy(db_handle_t *h, uint32_t busy)
+{
+    __atomic_store_n(&hdr(h)->busy, busy, __ATOMIC_SEQ_CST);
+    map_dirty(h, 0, HDR_SZ);
+}
+
+static uint32_t hash_id(int32_t id)
+{
+    uint32_t x = (uint32_t)id;
+
+    x ^= x >> 16;
+    x *= 0x45d9f3bu;
+    x ^= x >> 16;
+    x *= 0x45d9f3bu;
+    x ^= x >> 16;
+    return x;
+}
+
+/*
+ *  dir_find
+ *      dir:   directory
+ *      mask:  number of directory entries - 1
+ *      id:    student id to look for
+ *      ins:   if not NULL, receives the entry a new id should go in (the
+ *             first tombstone on the probe sequence, else the free entry
+ *             that ended it)
+ *
+ *  returns:  the entry for id, or NULL if id is not in the directory
+ */
+static dense_dirent_t *dir_find(dense_dirent_t *dir, uint32_t mask, int32_t id,
+                                dense_dirent_t **ins)
+{
+    dense_dirent_t *tomb = NULL;
+    uint32_t i = hash_id(id) & mask;
+
+    for (uint32_t n = 0; n <= mask; n++, i = (i + 1) & mask) {
+        dense_dirent_t *e = &dir[i];
+
+        if (e->id == id)
+            return e;
+        if (e->id == DIRENT_FREE) {
+            if (ins != NULL)
+                *ins = tomb ? tomb : e;
+            return NULL;
+        }
+        if (e->id == DIRENT_TOMB && tomb == NULL)
+            tomb = e;
+    }
+
+    if (ins != NULL)
+        *ins = tomb;
+    return NULL;
+}
+
+/*
+ *  mapped
+ *      h:  database handle
+ *
+ *  Sanity checks the header and makes sure the mapping covers everything
+ *  it describes (another process may have grown the file).
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ */
+static int mapped(db_handle_t *h)
+{
+    dense_hdr_t *hd;
+
+    if ((h->base == NULL || h->file_len < HDR_SZ) && map_refresh(h) != NO_ERROR)
+        return ERR_DB_FILE;
+    if (h->base == NULL || h->file_len < HDR_SZ)
+        return ERR_DB_FILE;
+
+    hd = hdr(h);
+    if (hd->cap < DENSE_MIN_CAP || (hd->cap & (hd->cap - 1)) != 0 ||
+        hd->nrecs > hd->cap)
+        return ERR_DB_FILE;
+
+    if (h->file_len < dense_size(hd->cap) &&
+        (map_refresh(h) != NO_ERROR || h->file_len < dense_size(hdr(h)->cap)))
+        return ERR_DB_FILE;
+    return NO_ERROR;
+}
+
+/*
+ *  relayout
+ *      h:       database handle, dir lock held exclusive and busy set
+ *      newcap:  record capacity to switch to, at least nrecs
+ *
+ *  Builds a directory for newcap from the live records and moves the
+ *  structure over to it.  Growing extends the file first and then clears
+ *  the old directory, which becomes record slots.  Shrinking puts the new
+ *  directory into record slots past nrecs (all zero) and truncates the
+ *  file, so it is only done by compaction with the gate held exclusive.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ */
+static int relayout(db_handle_t *h, uint32_t newcap)
+{
+    uint32_t oldcap = hdr(h)->cap;
+    uint32_t nrecs = hdr(h)->nrecs;
+    uint32_t mask = 2 * newcap - 1;
+    off_t need = dense_size(newcap > oldcap ? newcap : oldcap);
+    dense_dirent_t *nd;
+
+    if (map_reserve(h, need) != NO_ERROR)
+        return ERR_DB_FILE;
+
+    nd = calloc(2 * (size_t)newcap, sizeof(*nd));
+    if (nd == NULL)
+        return ERR_DB_FILE;
+    for (uint32_t slot = 0; slot < nrecs; slot++) {
+        dense_dirent_t *e;
+
+        dir_find(nd, mask, rec_at(h, slot)->id, &e);
+        e->id = rec_at(h, slot)->id;
+        e->slot = slot;
+    }
+
+    memcpy(h->base + dir_off(newcap), nd, 2 * (size_t)newcap * sizeof(*nd));
+    free(nd);
+    hdr(h)->cap = newcap;
+    hdr(h)->ntomb = 0;
+
+    if (newcap > oldcap)
+        memset(h->base + rec_off(oldcap), 0, (size_t)(rec_off(newcap) - rec_off(oldcap)));
+    map_dirty(h, 0, dense_size(newcap));
+
+    if (newcap < oldcap &&
+        (ftruncate(h->fd, dense_size(newcap)) == -1 || map_refresh(h) != NO_ERROR))
+        return ERR_DB_FILE;
+    return NO_ERROR;
+}
+
+/*
+ *  repair
+ *      h:  database handle, dir lock held exclusive
+ *
+ *  Recovers from a writer that died with busy set: packs the live records
+ *  of slots [0, nrecs) to the front again (dropping empty slots and
+ *  repeated ids), clears every slot after them and rebuilds the
+ *  directory.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ */
+static int repair(db_handle_t *h)
+{
+    dense_hdr_t *hd = hdr(h);
+    dense_dirent_t *dir = dir_at(h);
+    uint32_t mask = 2 * hd->cap - 1;
+    uint32_t out = 0;
+
+    memset(dir, 0, 2 * (size_t)hd->cap * sizeof(*dir));
+    for (uint32_t i = 0; i < hd->nrecs; i++) {
+        student_t *r = rec_at(h, i);
+        dense_dirent_t *e;
+
+        if (is_empty(r) || dir_find(dir, mask, r->id, &e) != NULL || e == NULL)
+            continue;
+        if (out != i)
+            *rec_at(h, out) = *r;
+        e->id = r->id;
+        e->slot = out++;
+    }
+
+    memset(rec_at(h, out), 0, (size_t)(rec_off(hd->cap) - rec_off(out)));
+    hd->nrecs = out;
+    hd->ntomb = 0;
+    map_dirty(h, 0, dense_size(hd->cap));
+    set_busy(h, 0);
+    return NO_ERROR;
+}
+
+/*
+ *  lock_dir
+ *      h:          database handle
+ *      exclusive:  lock for a change rather than a lookup
+ *
+ *  Takes the dir lock and checks the structure, repairing it if a writer
+ *  died in the middle of a change.  A shared lock is traded for an
+ *  exclusive one to repair and stays exclusive; either way the caller
+ *  releases it with unlock_dir().
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE (the lock is not held then)
+ */
+static int lock_dir(db_handle_t *h, bool exclusive)
+{
+    if (db_lock_range(h, LOCK_DIR_OFF, 1, exclusive) != NO_ERROR)
+        return ERR_DB_FILE;
+    if (mapped(h) != NO_ERROR)
+        goto fail;
+    if (!__atomic_load_n(&hdr(h)->busy, __ATOMIC_SEQ_CST))
+        return NO_ERROR;
+
+    if (!exclusive) {
+        db_unlock_range(h, LOCK_DIR_OFF, 1);
+        if (db_lock_range(h, LOCK_DIR_OFF, 1, true) != NO_ERROR)
+            return ERR_DB_FILE;
+        if (mapped(h) != NO_ERROR)
+            goto fail;
+        if (!hdr(h)->busy)
+            return NO_ERROR;
+    }
+    if (repair(h) == NO_ERROR)
+        return NO_ERROR;
+
+fail:
+    db_unlock_range(h, LOCK_DIR_OFF, 1);
+    return ERR_DB_FILE;
+}
+
+static void unlock_dir(db_handle_t *h)
+{
+    db_unlock_range(h, LOCK_DIR_OFF, 1);
+}
+
+/*
+ *  put_locked
+ *      h:    database handle, dir lock held exclusive
+ *      id:   student id
+ *      rec:  new contents, EMPTY_STUDENT_RECORD to delete
+ *
+ *  An update overwrites the record in place.  An insert appends it after
+ *  the last live record, growing the file when the array is full (or
+ *  rehashing when tombstones fill the directory).  A delete moves the
+ *  last record into the freed slot so the array stays packed.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ */
+static int put_locked(db_handle_t *h, int id, const student_t *rec)
+{
+    dense_hdr_t *hd = hdr(h);
+    uint32_t mask = 2 * hd->cap - 1;
+    dense_dirent_t *dir = dir_at(h);
+    dense_dirent_t *ins = NULL;
+    dense_dirent_t *e = dir_find(dir, mask, id, &ins);
+    int rc = NO_ERROR;
+
+    if (id <= 0 || (is_empty(rec) && e == NULL))
+        return id <= 0 ? ERR_DB_FILE : NO_ERROR;
+
+    set_busy(h, 1);
+
+    if (is_empty(rec)) {
+        uint32_t slot = e->slot, last = hd->nrecs - 1;
+
+        if (slot != last) {
+            dense_dirent_t *m = dir_find(dir, mask, rec_at(h, last)->id, NULL);
+
+            *rec_at(h, slot) = *rec_at(h, last);
+            if (m != NULL)
+                m->slot = slot;
+            map_dirty(h, rec_off(slot), STUDENT_RECORD_SIZE);
+        }
+        memset(rec_at(h, last), 0, STUDENT_RECORD_SIZE);
+        map_dirty(h, rec_off(last), STUDENT_RECORD_SIZE);
+        e->id = DIRENT_TOMB;
+        hd->nrecs--;
+        hd->ntomb++;
+    } else if (e != NULL) {
+        *rec_at(h, e->slot) = *rec;
+        map_dirty(h, rec_off(e->slot), STUDENT_RECORD_SIZE);
+    } else {
+        //keep live entries plus tombstones under three quarters full
+        if (hd->nrecs == hd->cap || ins == NULL ||
+            (hd->nrecs + hd->ntomb + 1) * 4 > (mask + 1) * 3) {
+            rc = relayout(h, hd->nrecs == hd->cap ? 2 * hd->cap : hd->cap);
+            if (rc != NO_ERROR)
+                return rc;      //busy stays set, the next writer repairs
+            hd = hdr(h);
+            mask = 2 * hd->cap - 1;
+            dir = dir_at(h);
+            dir_find(dir, mask, id, &ins);
+        }
+
+        *rec_at(h, hd->nrecs) = *rec;
+        map_dirty(h, rec_off(hd->nrecs), STUDENT_RECORD_SIZE);
+        ins->id = id;
+        ins->slot = hd->nrecs++;
+    }
+
+    map_dirty(h, dir_off(hd->cap), (off_t)(mask + 1) * sizeof(*dir));
+    set_busy(h, 0);
+    return NO_ERROR;
+}
+
+static int dense_attach(db_handle_t *h)
+{
+    dense_hdr_t hd;
+    struct stat st;
+
+    if (pread(h->fd, &hd, sizeof(hd), 0) != (ssize_t)sizeof(hd) ||
+        fstat(h->fd, &st) == -1 ||
+        memcmp(hd.magic, DENSE_MAGIC, sizeof(hd.magic)) != 0 ||
+        hd.version != DENSE_VERSION || hd.cap < DENSE_MIN_CAP ||
+        (hd.cap & (hd.cap - 1)) != 0 || st.st_size < dense_size(hd.cap))
+        return ERR_DB_FILE;
+
+    return map_refresh(h);
+}
+
+static int dense_format(db_handle_t *h)
+{
+    dense_hdr_t hd = {0};
+
+    memcpy(hd.magic, DENSE_MAGIC, sizeof(hd.magic));
+    hd.version = DENSE_VERSION;
+    hd.cap = DENSE_MIN_CAP;
+
+    if (pwrite(h->fd, &hd, sizeof(hd), 0) != (ssize_t)sizeof(hd) ||
+        ftruncate(h->fd, dense_size(hd.cap)) == -1)
+        return ERR_DB_FILE;
+    return map_refresh(h);
+}
+
+static int dense_get(db_handle_t *h, int id, student_t *out)
+{
+    dense_dirent_t *e;
+    int rc = SRCH_NOT_FOUND;
+
+    if (lock_dir(h, false) != NO_ERROR)
+        return ERR_DB_FILE;
+
+    e = dir_find(dir_at(h), 2 * hdr(h)->cap - 1, id, NULL);
+    if (e != NULL && e->slot < hdr(h)->nrecs && rec_at(h, e->slot)->id == id) {
+        *out = *rec_at(h, e->slot);
+        rc = NO_ERROR;
+    }
+
+    unlock_dir(h);
+    return rc;
+}
+
+static int dense_put(db_handle_t *h, int id, const student_t *rec)
+{
+    int rc;
+
+    if (lock_dir(h, true) != NO_ERROR)
+        return ERR_DB_FILE;
+    rc = put_locked(h, id, rec);
+    unlock_dir(h);
+    return rc;
+}
+
+static int dense_bulk_put(db_handle_t *h, student_t *recs, long n)
+{
+    int rc = NO_ERROR;
+
+    if (lock_dir(h, true) != NO_ERROR)
+        return ERR_DB_FILE;
+    for (long i = 0; rc == NO_ERROR && i < n; i++)
+        rc = put_locked(h, recs[i].id, &recs[i]);
+    unlock_dir(h);
+    return rc;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+
+    return (x > y) - (x < y);
+}
+
+/*
+ *  dense_range
+ *      h:    database handle, gate held
+ *      lo:   smallest id to visit
+ *      hi:   largest id to visit
+ *      fn:   scan_db() callback
+ *      arg:  passed through to fn
+ *
+ *  Sorts the live slots with ids in [lo, hi] and hands the records to fn
+ *  in pages of RECS_PER_PAGE copies, so callers see the same order as
+ *  with the legacy format.
+ *
+ *  returns:  NO_ERROR, ERR_DB_FILE, or the first error returned by fn
+ */
+static int dense_range(db_handle_t *h, int lo, int hi, scan_page_fn fn, void *arg)
+{
+    student_t page[RECS_PER_PAGE];
+    uint64_t *keys;
+    uint32_t n, m = 0;
+    int cnt = 0, rc = NO_ERROR;
+
+    if (lock_dir(h, false) != NO_ERROR)
+        return ERR_DB_FILE;
+
+    n = hdr(h)->nrecs;
+    keys = malloc((n ? n : 1) * sizeof(*keys));
+    if (keys == NULL) {
+        unlock_dir(h);
+        return ERR_DB_FILE;
+    }
+    for (uint32_t i = 0; i < n; i++) {
+        int id = rec_at(h, i)->id;
+
+        if (id >= lo && id <= hi)
+            keys[m++] = (uint64_t)(uint32_t)id << 32 | i;
+    }
+    qsort(keys, m, sizeof(*keys), cmp_u64);
+
+    for (uint32_t i = 0; rc == NO_ERROR && i < m; i++) {
+        page[cnt++] = *rec_at(h, (uint32_t)keys[i]);
+        if (cnt == RECS_PER_PAGE || i + 1 == m) {
+            uint64_t occupied = cnt == 64 ? ~(uint64_t)0 : ((uint64_t)1 << cnt) - 1;
+
+            rc = fn(arg, -1, page, cnt, occupied);
+            cnt = 0;
+        }
+    }
+
+    free(keys);
+    unlock_dir(h);
+    return rc;
+}
+
+static int dense_scan(db_handle_t *h, scan_page_fn fn, void *arg)
+{
+    return dense_range(h, MIN_STD_ID, INT_MAX, fn, arg);
+}
+
+/*
+ *  dense_compact
+ *      h:    database handle
+ *      fn:   progress callback, may be NULL
+ *      arg:  passed through to fn
+ *      st:   receives the totals
+ *
+ *  The dense format never holds deleted records, so compaction only has
+ *  to shrink the capacity to the smallest power of two that still fits
+ *  and drop the directory's tombstones.  The file shrinks, so this holds
+ *  the gate exclusive, for a time proportional to the live records.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ */
+static int dense_compact(db_handle_t *h, compact_progress_fn fn, void *arg,
+                         compact_stats_t *st)
+{
+    uint32_t cap = DENSE_MIN_CAP;
+    int rc = NO_ERROR;
+
+    if (db_gate_enter(h, true) != NO_ERROR)
+        return ERR_DB_FILE;
+    if (lock_dir(h, true) != NO_ERROR) {
+        db_gate_leave(h);
+        return ERR_DB_FILE;
+    }
+
+    st->total = st->scanned = h->file_len;
+    while (cap < hdr(h)->nrecs)
+        cap *= 2;
+    if (cap < hdr(h)->cap || hdr(h)->ntomb > 0) {
+        set_busy(h, 1);
+        rc = relayout(h, cap);
+        if (rc == NO_ERROR)
+            set_busy(h, 0);
+    }
+    st->reclaimed = st->total - h->file_len;
+
+    unlock_dir(h);
+    db_gate_leave(h);
+
+    if (rc == NO_ERROR && fn != NULL)
+        fn(arg, st);
+    return rc;
+}
+
+const db_engine_t dense_engine = {
+    "dense",
+    dense_attach,
+    dense_format,
+    dense_get,
+    NULL,
+    NULL,
+    dense_put,
+    NULL,
+    dense_bulk_put,
+    dense_scan,
+    dense_range,
+    dense_compact,
+};
@@ -0,0 +1,41 @@
+#ifndef __SDB_DENSE_H__
+    #define __SDB_DENSE_H__
+
+#include <stdint.h>
+
+#include "db.h"
+
+//Dense storage format, see sdb_dense.c.  Layout of the file:
+//
+//  [dense_hdr_t][cap records of 64 bytes][2*cap dense_dirent_t]
+//
+//Live records are packed at the front of the record array (a delete
+//moves the last record into the freed slot), the directory is an open
+//addressing hash table from id to slot that is never more than half
+//full.  cap is a power of two; the file grows (and compaction shrinks it)
+//by rebuilding the directory at its new offset, records never move.
+
+#define DENSE_MAGIC         "SDBDENS1"
+#define DENSE_VERSION       1
+#define DENSE_MIN_CAP       64
+
+//directory entry ids besides real student ids
+#define DIRENT_FREE         0
+#define DIRENT_TOMB         (-1)
+
+typedef struct dense_hdr {
+    char     magic[8];
+    uint32_t version;
+    uint32_t cap;               //record slots, a power of two
+    uint32_t nrecs;             //live records, slots [0, nrecs)
+    uint32_t ntomb;             //deleted directory entries
+    uint32_t busy;              //set while a writer changes the structure
+    char     pad[36];
+} dense_hdr_t;
+
+typedef struct dense_dirent {
+    int32_t  id;                //DIRENT_FREE, DIRENT_TOMB or a student id
+    uint32_t slot;
+} dense_dirent_t;
+
+#endif
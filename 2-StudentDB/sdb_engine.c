@@ -0,0 +1,382 @@
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "db.h"
+#include "sdbsc.h"
+#include "sdb_handle.h"
+#include "sdb_mmap.h"
+#include "sdb_lock.h"
+#include "sdb_ingest.h"
+#include "sdb_engine.h"
+#include "sdb_dense.h"
+#include "sdb_archive.h"
+#include "sdb_var.h"
+#include "sdb_io.h"
+#include "sdb_cache.h"
+
+static int legacy_get(db_handle_t *h, int id, student_t *out)
+{
+    student_t *rec = map_slot(h, id);
+
+    if (rec == NULL || rec->id != id)
+        return SRCH_NOT_FOUND;
+    *out = *rec;
+    return NO_ERROR;
+}
+
+/*
+ *  legacy_get_batch
+ *      h:    database handle in the legacy format, gate and record locks
+ *            held
+ *      ids:  students to look up
+ *      n:    number of ids
+ *      out:  out[i] receives student ids[i]
+ *      rcs:  rcs[i] is set to NO_ERROR, SRCH_NOT_FOUND or ERR_DB_FILE
+ *
+ *  Reads every slot straight from the file through the I/O backend, so a
+ *  batch of cold lookups is one round of reads in flight together instead
+ *  of a page fault per id.  The mapping is the same page cache, so what
+ *  is read is what legacy_get() would see.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE when the batch could not run at all
+ */
+static int legacy_get_batch(db_handle_t *h, const int *ids, int n,
+                            student_t *out, int *rcs)
+{
+    io_req_t *reqs = calloc(n, sizeof(*reqs));
+    int *at = malloc(n * sizeof(*at));
+    int nreqs = 0, rc;
+
+    if (reqs == NULL || at == NULL) {
+        free(reqs);
+        free(at);
+        return ERR_DB_FILE;
+    }
+
+    //an id that cannot exist is not found, it is not a read error for the
+    //whole batch (a negative one would be a negative offset)
+    for (int i = 0; i < n; i++) {
+        rcs[i] = SRCH_NOT_FOUND;
+        if (ids[i] < 0 || ids[i] > MAX_STD_ID)
+            continue;
+        reqs[nreqs].off = (off_t)ids[i] * STUDENT_RECORD_SIZE;
+        reqs[nreqs].buf = &out[i];
+        reqs[nreqs].len = sizeof(out[i]);
+        at[nreqs++] = i;
+    }
+
+    rc = io_run(h->fd, reqs, nreqs, false);
+    for (int r = 0; r < nreqs; r++) {
+        int i = at[r];
+
+        if (reqs[r].res < 0)
+            rcs[i] = ERR_DB_FILE;
+        else if (reqs[r].res < (ssize_t)sizeof(out[i]) || out[i].id != ids[i])
+            rcs[i] = SRCH_NOT_FOUND;    //past the end of the file, or empty
+        else
+            rcs[i] = NO_ERROR;
+    }
+    free(reqs);
+    free(at);
+    return rc;
+}
+
+static int legacy_put(db_handle_t *h, int id, const student_t *rec)
+{
+    return map_store(h, id, rec);
+}
+
+const db_engine_t legacy_engine = {
+    "legacy",
+    NULL,
+    NULL,
+    legacy_get,
+    legacy_get_batch,
+    NULL,
+    legacy_put,
+    NULL,
+    ingest_write_sorted,
+    scan_extents,
+    range_extents,
+    compact_punch,
+};
+
+static const db_engine_t *engine_named(const char *name)
+{
+    if (strcmp(name, dense_engine.name) == 0)
+        return &dense_engine;
+    return strcmp(name, var_engine.name) == 0 ? &var_engine : &legacy_engine;
+}
+
+/*
+ *  engine_check
+ *      h:  database handle with a current mapping
+ *
+ *  Picks the engine from the first bytes of the mapped file.  Called on
+ *  every gate entry as well, since another process may have truncated and
+ *  reformatted the file since we last looked.
+ */
+void engine_check(db_handle_t *h)
+{
+    bool dense = h->base != NULL && h->file_len >= (off_t)sizeof(dense_hdr_t) &&
+                 memcmp(h->base, DENSE_MAGIC, strlen(DENSE_MAGIC)) == 0;
+    bool archive = h->base != NULL && h->file_len >= (off_t)sizeof(arch_hdr_t) &&
+                   memcmp(h->base, ARCH_MAGIC, strlen(ARCH_MAGIC)) == 0;
+    bool var = h->base != NULL && h->file_len >= (off_t)sizeof(var_hdr_t) &&
+               memcmp(h->base, VAR_MAGIC, strlen(VAR_MAGIC)) == 0;
+
+    h->engine = dense ? &dense_engine : archive ? &archive_engine :
+                var ? &var_engine : &legacy_engine;
+}
+
+/*
+ *  engine_attach
+ *      h:  database handle, freshly mapped
+ *
+ *  Detects the format of the file.  An empty file opened for writing is
+ *  formatted as SDB_FORMAT asks, under the gate held exclusive so two
+ *  processes creating the same database agree on one format.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE if the file is damaged
+ */
+int engine_attach(db_handle_t *h)
+{
+    const char *want = db_config_str("SDB_FORMAT", NULL);
+    struct stat st;
+    int rc = NO_ERROR;
+
+    engine_check(h);
+    if (h->engine == &legacy_engine && want != NULL && !h->read_only &&
+        engine_named(want)->format != NULL && h->file_len == 0) {
+        if (db_gate_enter(h, true) != NO_ERROR)
+            return ERR_DB_FILE;
+        if (fstat(h->fd, &st) == 0 && st.st_size == 0) {
+            h->engine = engine_named(want);
+            rc = h->engine->format(h);
+        }
+        engine_check(h);
+        db_gate_leave(h);
+        if (rc != NO_ERROR)
+            return rc;
+    }
+
+    return h->engine->attach ? h->engine->attach(h) : NO_ERROR;
+}
+
+/*
+ *  engine_reset
+ *      h:  database handle of a file that was just truncated, gate held
+ *          exclusive
+ *
+ *  Formats the empty file, in the format it had before unless SDB_FORMAT
+ *  names another.  A truncated archive becomes an empty legacy database,
+ *  archives are only ever written whole by archive_db().
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ */
+int engine_reset(db_handle_t *h)
+{
+    const char *want = db_config_str("SDB_FORMAT", NULL);
+
+    if (want != NULL)
+        h->engine = engine_named(want);
+    else if (h->engine == &archive_engine)
+        h->engine = &legacy_engine;
+    return h->engine->format ? h->engine->format(h) : NO_ERROR;
+}
+
+/*
+ *  db_get / db_put
+ *      h:    database handle, gate held
+ *      id:   student id
+ *      out:  where a found record is copied
+ *      rec:  new contents of the record, EMPTY_STUDENT_RECORD to delete
+ *
+ *  Record access for everything above the storage layer.  With the legacy
+ *  and var engines the caller holds the record lock of id; the dense
+ *  engine locks its directory itself.  Stores are bracketed for the
+ *  lockless readers in sdb_cache.c, and fail with ERR_DB_FILE when they
+ *  cannot be.
+ *
+ *  returns:  see db_engine_t
+ */
+int db_get(db_handle_t *h, int id, student_t *out)
+{
+    return h->engine->get(h, id, out);
+}
+
+/*
+ *  db_get_batch
+ *      h:    database handle, gate held
+ *      ids:  students to look up
+ *      n:    number of ids
+ *      out:  out[i] receives student ids[i]
+ *      rcs:  rcs[i] is set to what db_get() would return for ids[i]
+ *
+ *  Lookups of many ids at once, through the engine's get_batch or one
+ *  get() per id.  The same locking as db_get() applies to every id.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE when the batch could not run at all
+ */
+int db_get_batch(db_handle_t *h, const int *ids, int n, student_t *out, int *rcs)
+{
+    if (h->engine->get_batch != NULL)
+        return h->engine->get_batch(h, ids, n, out, rcs);
+    for (int i = 0; i < n; i++)
+        rcs[i] = h->engine->get(h, ids[i], &out[i]);
+    return NO_ERROR;
+}
+
+int db_put(db_handle_t *h, int id, const student_t *rec)
+{
+    int rc;
+
+    if (cache_store_begin(h) != NO_ERROR)
+        return ERR_DB_FILE;
+    rc = h->engine->put(h, id, rec);
+    cache_store_end(h);
+    return rc;
+}
+
+/*
+ *  db_get_names / db_put_names
+ *      h:      database handle, gate and record lock of id held
+ *      id:     student id
+ *      out:    receives the full names of student id
+ *      rec:    new contents of the record, as for db_put()
+ *      names:  full names of the student, rec holds them cut to fit
+ *
+ *  Full length names for formats that keep them.  db_put_names() is
+ *  db_put() for formats that do not.
+ *
+ *  returns:  NO_ERROR, SRCH_NOT_FOUND, ERR_DB_FILE, or ERR_DB_OP when the
+ *            format keeps no more of the names than student_t holds
+ */
+int db_get_names(db_handle_t *h, int id, student_names_t *out)
+{
+    if (h->engine->get_names == NULL)
+        return ERR_DB_OP;
+    return h->engine->get_names(h, id, out);
+}
+
+int db_put_names(db_handle_t *h, int id, const student_t *rec,
+                 const student_names_t *names)
+{
+    int rc;
+
+    if (h->engine->put_names == NULL)
+        return db_put(h, id, rec);
+    if (cache_store_begin(h) != NO_ERROR)
+        return ERR_DB_FILE;
+    rc = h->engine->put_names(h, id, rec, names);
+    cache_store_end(h);
+    return rc;
+}
+
+/*
+ *  db_has_names
+ *      h:      database handle, gate and record lock of id held
+ *      id:     student id
+ *      names:  full names
+ *
+ *  returns:  true when student id is stored with exactly these names
+ */
+bool db_has_names(db_handle_t *h, int id, const student_names_t *names)
+{
+    student_names_t have;
+
+    return db_get_names(h, id, &have) == NO_ERROR &&
+           strcmp(have.fname, names->fname) == 0 &&
+           strcmp(have.lname, names->lname) == 0;
+}
+
+/*
+ *  names_split
+ *      rec:    record the names go with, holding them cut to fit
+ *      names:  full names of the student, may be NULL
+ *      out:    room for NAMES_CHUNK_MAX chunks
+ *
+ *  Cuts the names into the chunks that travel ahead of rec in the logs.
+ *
+ *  returns:  number of chunks, 0 when rec holds the names whole
+ */
+int names_split(const student_t *rec, const student_names_t *names,
+                names_chunk_t *out)
+{
+    char text[NAMES_TEXT_MAX];
+    size_t flen, llen, len;
+    int n = 0;
+
+    if (names == NULL)
+        return 0;
+    flen = strnlen(names->fname, STUDENT_NAME_MAX);
+    llen = strnlen(names->lname, STUDENT_NAME_MAX);
+    if (flen < sizeof(rec->fname) && llen < sizeof(rec->lname))
+        return 0;
+
+    memcpy(text, names->fname, flen);
+    text[flen] = '\0';
+    memcpy(text + flen + 1, names->lname, llen);
+    text[flen + 1 + llen] = '\0';
+    len = flen + llen + 2;
+
+    for (size_t off = 0; off < len; off += NAMES_CHUNK_TEXT, n++) {
+        memset(&out[n], 0, sizeof(out[n]));
+        out[n].id = rec->id;
+        out[n].off = (uint16_t)off;
+        out[n].len = (uint16_t)(len - off < NAMES_CHUNK_TEXT ? len - off : NAMES_CHUNK_TEXT);
+        memcpy(out[n].text, text + off, out[n].len);
+    }
+    return n;
+}
+
+/*
+ *  names_join / names_joined
+ *      run:  chunks gathered so far, zeroed to start
+ *      c:    next chunk in log order
+ *      id:   student of the record that follows the chunks
+ *      out:  receives the full names
+ *
+ *  names_join() adds a chunk to the run; one with offset 0 starts a new
+ *  run, one that does not follow on spoils it.  names_joined() is called
+ *  at the record the chunks belong to and empties the run.
+ *
+ *  returns:  true when the run holds the whole names of student id
+ */
+void names_join(names_run_t *run, const names_chunk_t *c)
+{
+    if (c->off == 0) {
+        run->id = c->id;
+        run->len = 0;
+    }
+    if (run->id == 0 || c->id != run->id || c->off != run->len ||
+        c->len > NAMES_CHUNK_TEXT || run->len + c->len > sizeof(run->text)) {
+        run->id = 0;
+        return;
+    }
+    memcpy(run->text + run->len, c->text, c->len);
+    run->len += c->len;
+}
+
+bool names_joined(names_run_t *run, int id, student_names_t *out)
+{
+    const char *fend = memchr(run->text, '\0', run->len);
+    const char *lend = NULL;
+    bool ok = false;
+
+    if (fend != NULL)
+        lend = memchr(fend + 1, '\0', run->len - (size_t)(fend + 1 - run->text));
+    if (run->id != 0 && run->id == id && lend != NULL &&
+        fend - run->text <= STUDENT_NAME_MAX && lend - (fend + 1) <= STUDENT_NAME_MAX) {
+        memset(out, 0, sizeof(*out));
+        memcpy(out->fname, run->text, (size_t)(fend - run->text));
+        memcpy(out->lname, fend + 1, (size_t)(lend - (fend + 1)));
+        ok = true;
+    }
+    run->id = 0;
+    return ok;
+}
@@ -0,0 +1,126 @@
+#ifndef __SDB_ENGINE_H__
+    #define __SDB_ENGINE_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "db.h"
+#include "sdb_handle.h"
+#include "sdb_scan.h"
+#include "sdb_compact.h"
+
+//Storage engines, see sdb_engine.c.  The file format is detected when the
+//database is opened and every record access goes through the engine's
+//table of operations:
+//
+//  legacy   record id lives at offset id*64 (the original format, holes
+//           keep sparse ids cheap on disk but the file is as long as the
+//           highest id)
+//  dense    header, packed record array and an id->slot hash directory,
+//           see sdb_dense.c
+//  archive  compressed blocks of records, read-only, see sdb_archive.c
+//  var      16 byte slots at their id and a heap of names stored at full
+//           length, see sdb_var.c
+//
+//A legacy file always starts with 64 zero bytes (there is no student 0),
+//so dense files and archives are recognized by the magic in their header.  New (empty or
+//truncated) databases get the format named by SDB_FORMAT=legacy|dense|var,
+//legacy by default; truncating keeps the existing format unless
+//SDB_FORMAT says otherwise.
+
+//longest name the var format keeps, student_t holds 23 and 31 bytes
+#define STUDENT_NAME_MAX    255
+
+typedef struct student_names {
+    char fname[STUDENT_NAME_MAX + 1];
+    char lname[STUDENT_NAME_MAX + 1];
+} student_names_t;
+
+//Full names travel through the write-ahead log and the change log as a
+//run of names_chunk_t records just ahead of the record they belong to,
+//each in the place of a student_t.  The text is the first and the last
+//name, each NUL terminated, cut into NAMES_CHUNK_TEXT byte pieces.  Only
+//names that student_t cannot hold whole are sent this way.
+#define NAMES_CHUNK_TEXT    56
+#define NAMES_TEXT_MAX      (2 * (STUDENT_NAME_MAX + 1))
+#define NAMES_CHUNK_MAX     ((NAMES_TEXT_MAX + NAMES_CHUNK_TEXT - 1) / NAMES_CHUNK_TEXT)
+
+typedef struct names_chunk {
+    int32_t  id;                //student, where student_t keeps its id
+    uint16_t off;               //offset of text in the names
+    uint16_t len;               //bytes of text used
+    char     text[NAMES_CHUNK_TEXT];
+} names_chunk_t;
+
+//puts a run of names_chunk_t back together, see names_join()
+typedef struct names_run {
+    int32_t  id;                //0 when no run is being gathered
+    size_t   len;
+    char     text[NAMES_TEXT_MAX];
+} names_run_t;
+
+typedef struct db_engine {
+    const char *name;
+
+    //check the file and set up per-handle state, NULL if nothing to do
+    int  (*attach)(db_handle_t *h);
+
+    //initialize an empty file (caller holds the gate exclusive)
+    int  (*format)(db_handle_t *h);
+
+    //copy student id into *out: NO_ERROR, SRCH_NOT_FOUND or ERR_DB_FILE
+    int  (*get)(db_handle_t *h, int id, student_t *out);
+
+    //get() for n ids at once, rcs[i] is the result for ids[i], NULL to
+    //fall back to get()
+    int  (*get_batch)(db_handle_t *h, const int *ids, int n, student_t *out,
+                      int *rcs);
+
+    //copy the full names of student id, NULL when the format keeps no
+    //more of them than student_t holds
+    int  (*get_names)(db_handle_t *h, int id, student_names_t *out);
+
+    //make slot id hold rec, EMPTY_STUDENT_RECORD deletes it
+    int  (*put)(db_handle_t *h, int id, const student_t *rec);
+
+    //put() with the full names of the student, NULL to fall back to put()
+    int  (*put_names)(db_handle_t *h, int id, const student_t *rec,
+                      const student_names_t *names);
+
+    //store n new students sorted by id, NULL to fall back to put()
+    int  (*bulk_put)(db_handle_t *h, student_t *recs, long n);
+
+    //walk every live record in id order, see scan_db()
+    int  (*scan)(db_handle_t *h, scan_page_fn fn, void *arg);
+
+    //walk the live records with ids in [lo, hi] in id order, see
+    //scan_range()
+    int  (*range)(db_handle_t *h, int lo, int hi, scan_page_fn fn, void *arg);
+
+    //give back the space of deleted records, see compact_db()
+    int  (*compact)(db_handle_t *h, compact_progress_fn fn, void *arg,
+                    compact_stats_t *st);
+} db_engine_t;
+
+extern const db_engine_t legacy_engine;
+extern const db_engine_t dense_engine;
+extern const db_engine_t archive_engine;
+extern const db_engine_t var_engine;
+
+//prototypes for sdb_engine.c
+void engine_check(db_handle_t *h);
+int engine_attach(db_handle_t *h);
+int engine_reset(db_handle_t *h);
+int db_get(db_handle_t *h, int id, student_t *out);
+int db_get_batch(db_handle_t *h, const int *ids, int n, student_t *out, int *rcs);
+int db_put(db_handle_t *h, int id, const student_t *rec);
+int db_get_names(db_handle_t *h, int id, student_names_t *out);
+int db_put_names(db_handle_t *h, int id, const student_t *rec,
+                 const student_names_t *names);
+bool db_has_names(db_handle_t *h, int id, const student_names_t *names);
+int names_split(const student_t *rec, const student_names_t *names,
+                names_chunk_t *out);
+void names_join(names_run_t *run, const names_chunk_t *c);
+bool names_joined(names_run_t *run, int id, student_names_t *out);
+
+#endif
@@ -0,0 +1,276 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "db.h"
+#include "sdbsc.h"
+#include "sdb_handle.h"
+#include "sdb_scan.h"
+#include "sdb_filter.h"
+
+//Ids are at most MAX_STD_ID, so an exact bitmap of every possible id is
+//12K, less than a Bloom filter with a useful false positive rate would
+//take for the same ids, and unlike one it can forget deleted ids.
+//
+//The bits must never miss a live id.  add_student() sets the bit before
+//it stores the record and del_student() clears it after, both under the
+//record's write lock, so whoever holds that lock can trust a clear bit
+//and a reader never sees a clear bit for a record that was stored.
+//
+//A rebuild scans the records and ORs their bits in, so an add running at
+//the same time in another process keeps its bit.  Only with the gate held
+//exclusive, when nothing else can be writing, are the bits replaced, which
+//drops ids deleted before the filter was tracking them.  The header's seq
+//is odd while a rebuild writes and changes with each one; a reader checks
+//it before and after it looks at a bit, like a seqlock, so it never
+//trusts bits that were half way to another database's.
+
+typedef struct id_filter {
+    filter_hdr_t *hdr;          //mapped sidecar, NULL when not mapped
+    uint64_t     *bits;
+    bool          writable;
+    bool          asked;        //on_change() already asked for a build
+    uint64_t      dev, ino;     //identity of the database we have open
+} id_filter_t;
+
+/*
+ *  filter_map
+ *      h:       database handle
+ *      f:       filter state to map the sidecar into
+ *      create:  create the sidecar when it does not exist
+ *
+ *  Leaves f->hdr NULL when there is no sidecar or it cannot be mapped.
+ */
+static void filter_map(db_handle_t *h, id_filter_t *f, bool create)
+{
+    char path[PATH_MAX];
+    struct stat st;
+    void *p;
+    int ffd;
+
+    if (fstat(h->fd, &st) == -1 ||
+        db_sidecar_path(h, FILTER_SUFFIX, path, sizeof(path)) != NO_ERROR)
+        return;
+    f->dev = st.st_dev;
+    f->ino = st.st_ino;
+
+    f->writable = !h->read_only;
+    if (f->writable)
+        ffd = open(path, create ? O_RDWR | O_CREAT : O_RDWR, 0644);
+    else
+        ffd = open(path, O_RDONLY);
+    if (ffd == -1)
+        return;
+
+    //another process may be creating it, only the creator sizes it
+    if (fstat(ffd, &st) == -1 ||
+        (st.st_size < (off_t)FILTER_FILE_SZ &&
+         (!create || !f->writable || ftruncate(ffd, FILTER_FILE_SZ) == -1))) {
+        close(ffd);
+        return;
+    }
+    p = mmap(NULL, FILTER_FILE_SZ, PROT_READ | (f->writable ? PROT_WRITE : 0),
+             MAP_SHARED, ffd, 0);
+    close(ffd);
+    if (p == MAP_FAILED)
+        return;
+
+    f->hdr = p;
+    f->bits = (uint64_t *)(f->hdr + 1);
+}
+
+/*
+ *  filter_get
+ *      h:      database handle
+ *      retry:  try to map the sidecar again if an earlier try found none
+ *
+ *  Readers look for the sidecar once per handle, writers every time
+ *  until it is there, they must not miss the bits of their changes.
+ *
+ *  returns:  the mapped filter, or NULL
+ */
+static id_filter_t *filter_get(db_handle_t *h, bool retry)
+{
+    id_filter_t *f = h->filter;
+
+    if (f == NULL) {
+        f = calloc(1, sizeof(*f));
+        if (f == NULL)
+            return NULL;
+        h->filter = f;
+        filter_map(h, f, false);
+    } else if (f->hdr == NULL && retry) {
+        filter_map(h, f, false);
+    }
+    return f->hdr != NULL ? f : NULL;
+}
+
+//true when the bits were built for the database f was mapped for
+static bool filter_current(id_filter_t *f, uint32_t seq)
+{
+    return seq != 0 && !(seq & 1) &&
+           __atomic_load_n(&f->hdr->db_dev, __ATOMIC_RELAXED) == f->dev &&
+           __atomic_load_n(&f->hdr->db_ino, __ATOMIC_RELAXED) == f->ino;
+}
+
+/*
+ *  filter_absent
+ *      h:   database handle, gate held
+ *      id:  student to look up
+ *
+ *  returns:  true when student id is certainly not in the database, false
+ *            when it may be (or there is no usable filter)
+ */
+bool filter_absent(db_handle_t *h, int id)
+{
+    id_filter_t *f = filter_get(h, false);
+    uint32_t seq;
+    bool clear;
+
+    if (f == NULL || id < MIN_STD_ID || id > MAX_STD_ID)
+        return false;
+
+    seq = __atomic_load_n(&f->hdr->seq, __ATOMIC_ACQUIRE);
+    if (!filter_current(f, seq))
+        return false;
+    clear = !(__atomic_load_n(&f->bits[id / 64], __ATOMIC_RELAXED) & (1ULL << (id % 64)));
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return clear && __atomic_load_n(&f->hdr->seq, __ATOMIC_RELAXED) == seq;
+}
+
+/*
+ *  filter_add / filter_del
+ *      h:   database handle, write lock on record id held
+ *      id:  student being added (before the store) or deleted (after it)
+ */
+void filter_add(db_handle_t *h, int id)
+{
+    id_filter_t *f = filter_get(h, true);
+
+    if (f != NULL && f->writable && id >= MIN_STD_ID && id <= MAX_STD_ID)
+        __atomic_fetch_or(&f->bits[id / 64], 1ULL << (id % 64), __ATOMIC_RELEASE);
+}
+
+void filter_del(db_handle_t *h, int id)
+{
+    id_filter_t *f = filter_get(h, true);
+
+    if (f != NULL && f->writable && id >= MIN_STD_ID && id <= MAX_STD_ID)
+        __atomic_fetch_and(&f->bits[id / 64], ~(1ULL << (id % 64)), __ATOMIC_RELEASE);
+}
+
+/*
+ *  filter_on_change
+ *      h:    database handle, meta lock held exclusive
+ *      old:  record before the change
+ *      rec:  record after the change
+ *
+ *  Sidecar hook.  The bits were already changed under the record lock;
+ *  this only has a missing or never built filter built, once per handle.
+ *
+ *  returns:  NO_ERROR, or ERR_DB_FILE to have the filter built
+ */
+int filter_on_change(db_handle_t *h, const student_t *old, const student_t *rec)
+{
+    id_filter_t *f = filter_get(h, true);
+    (void)old; (void)rec;
+
+    if (f != NULL && filter_current(f, __atomic_load_n(&f->hdr->seq, __ATOMIC_ACQUIRE)))
+        return NO_ERROR;
+    if (h->filter == NULL || h->filter->asked || h->read_only)
+        return NO_ERROR;
+    h->filter->asked = true;
+    return ERR_DB_FILE;
+}
+
+static int set_bits(void *arg, int first, const student_t *recs, int n,
+                    uint64_t occupied)
+{
+    uint64_t *bits = arg;
+    (void)first; (void)n;
+
+    while (occupied) {
+        int id = recs[__builtin_ctzll(occupied)].id;
+
+        if (id >= MIN_STD_ID && id <= MAX_STD_ID)
+            bits[id / 64] |= 1ULL << (id % 64);
+        occupied &= occupied - 1;
+    }
+    return NO_ERROR;
+}
+
+/*
+ *  filter_on_rebuild
+ *      h:  database handle, meta lock held exclusive
+ *
+ *  Sidecar hook.  Creates the filter if needed and sets the bit of every
+ *  live record, replacing the old bits when the gate is held exclusive.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ */
+int filter_on_rebuild(db_handle_t *h)
+{
+    bool exact = h->gate_depth > 0 && h->gate_excl;
+    id_filter_t *f;
+    uint64_t *bits;
+    uint32_t seq;
+
+    if (h->read_only)
+        return NO_ERROR;
+    if (filter_get(h, true) == NULL && h->filter != NULL)
+        filter_map(h, h->filter, true);
+    f = h->filter;
+    if (f == NULL || f->hdr == NULL || !f->writable)
+        return ERR_DB_FILE;
+
+    bits = calloc(FILTER_WORDS, sizeof(*bits));
+    if (bits == NULL)
+        return ERR_DB_FILE;
+    if (scan_db(h, set_bits, bits) != NO_ERROR) {
+        free(bits);
+        return ERR_DB_FILE;
+    }
+
+    seq = __atomic_load_n(&f->hdr->seq, __ATOMIC_ACQUIRE) | 1;
+    __atomic_store_n(&f->hdr->seq, seq, __ATOMIC_RELEASE);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    for (int w = 0; w < FILTER_WORDS; w++) {
+        if (exact)
+            __atomic_store_n(&f->bits[w], bits[w], __ATOMIC_RELAXED);
+        else if (bits[w] != 0)
+            __atomic_fetch_or(&f->bits[w], bits[w], __ATOMIC_RELAXED);
+    }
+    memcpy(f->hdr->magic, FILTER_MAGIC, sizeof(f->hdr->magic));
+    f->hdr->version = FILTER_VERSION;
+    __atomic_store_n(&f->hdr->db_dev, f->dev, __ATOMIC_RELAXED);
+    __atomic_store_n(&f->hdr->db_ino, f->ino, __ATOMIC_RELAXED);
+    __atomic_store_n(&f->hdr->seq, seq + 1, __ATOMIC_RELEASE);
+    free(bits);
+    return NO_ERROR;
+}
+
+/*
+ *  filter_on_close
+ *      h:  database handle
+ *
+ *  Sidecar hook.  Unmaps the filter.
+ */
+void filter_on_close(db_handle_t *h)
+{
+    id_filter_t *f = h->filter;
+
+    if (f == NULL)
+        return;
+    if (f->hdr != NULL)
+        munmap(f->hdr, FILTER_FILE_SZ);
+    free(f);
+    h->filter = NULL;
+}
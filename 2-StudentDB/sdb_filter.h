@@ -0,0 +1,43 @@
+#ifndef __SDB_FILTER_H__
+    #define __SDB_FILTER_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "db.h"
+#include "sdb_handle.h"
+
+//Id filter, see sdb_filter.c.  The sidecar .student.db.ids holds one bit
+//per possible student id:
+//
+//  [filter_hdr_t]
+//  uint64_t bits[FILTER_WORDS]     bit id set when student id may exist
+//
+//The set bits are a superset of the live ids, so a clear bit answers
+//"not found" without looking at the database, and a set bit means look.
+//Every process maps the file and sets or clears bits in place.
+
+#define FILTER_MAGIC        "SDBIDS01"
+#define FILTER_VERSION      1
+#define FILTER_SUFFIX       ".ids"
+#define FILTER_WORDS        ((MAX_STD_ID + 64) / 64)
+#define FILTER_FILE_SZ      (sizeof(filter_hdr_t) + FILTER_WORDS * sizeof(uint64_t))
+
+typedef struct filter_hdr {
+    char     magic[8];
+    uint32_t version;
+    uint32_t seq;               //0 until built, odd while being rebuilt
+    uint64_t db_dev;            //identity of the database the bits
+    uint64_t db_ino;            //were built for
+    uint8_t  pad[32];
+} filter_hdr_t;
+
+//prototypes for sdb_filter.c
+bool filter_absent(db_handle_t *h, int id);
+void filter_add(db_handle_t *h, int id);
+void filter_del(db_handle_t *h, int id);
+int filter_on_change(db_handle_t *h, const student_t *old, const student_t *rec);
+int filter_on_rebuild(db_handle_t *h);
+void filter_on_close(db_handle_t *h);
+
+#endif
@@ -0,0 +1,293 @@
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "db.h"
+#include "sdbsc.h"
+#include "sdb_handle.h"
+#include "sdb_mmap.h"
+#include "sdb_lname.h"
+#include "sdb_cols.h"
+#include "sdb_sum.h"
+#include "sdb_wal.h"
+#include "sdb_lock.h"
+#include "sdb_engine.h"
+#include "sdb_cache.h"
+#include "sdb_filter.h"
+#include "sdb_cdc.h"
+#include "sdb_rank.h"
+
+//every sidecar kept in step with the records, see db_sidecar_t
+static const db_sidecar_t sidecars[] = {
+    { "lname", lname_on_change, lname_on_rebuild, lname_on_close },
+    { "cols",  cols_on_change,  cols_on_rebuild,  cols_on_close },
+    { "sum",   sum_on_change,   sum_on_rebuild,   sum_on_close },
+    { "cache", cache_on_change, cache_on_rebuild, cache_on_close },
+    { "ids",   filter_on_change, filter_on_rebuild, filter_on_close },
+    { "gpa",   rank_on_change,  rank_on_rebuild,  rank_on_close },
+    { "cdc",   cdc_on_change,   cdc_on_rebuild,   cdc_on_close },
+};
+#define NUM_SIDECARS    (int)(sizeof(sidecars) / sizeof(sidecars[0]))
+
+//table of open databases, a slot is free when its fd is -1
+static db_handle_t handles[MAX_DB_HANDLES];
+static bool handles_ready = false;
+
+static void init_handles(void)
+{
+    if (handles_ready)
+        return;
+
+    for (int i = 0; i < MAX_DB_HANDLES; i++)
+        handles[i].fd = -1;
+    handles_ready = true;
+}
+
+/*
+ *  db_config_str / db_config_int
+ *      name:  environment variable holding the setting (for example SDB_MSYNC)
+ *      dflt:  value to use when the variable is not set or is empty
+ *
+ *  The storage layer is tuned with SDB_* environment variables rather than
+ *  command line flags so the one-flag-per-run interface of sdbsc stays the
+ *  same.  These helpers keep the lookups in one place.
+ *
+ *  returns:  the configured value, or dflt
+ */
+const char *db_config_str(const char *name, const char *dflt)
+{
+    const char *val = getenv(name);
+
+    if (val == NULL || *val == '\0')
+        return dflt;
+    return val;
+}
+
+int db_config_int(const char *name, int dflt)
+{
+    const char *val = db_config_str(name, NULL);
+
+    if (val == NULL)
+        return dflt;
+    return atoi(val);
+}
+
+static int parse_msync_policy(void)
+{
+    const char *val = db_config_str("SDB_MSYNC", "none");
+
+    if (strcmp(val, "op") == 0)
+        return MSYNC_PER_OP;
+    if (strcmp(val, "batch") == 0)
+        return MSYNC_PER_BATCH;
+    if (strcmp(val, "close") == 0)
+        return MSYNC_ON_CLOSE;
+    return MSYNC_NONE;
+}
+
+/*
+ *  db_handle_open
+ *      fd:    file descriptor returned by open()
+ *      path:  the file the descriptor refers to, may be NULL if unknown
+ *
+ *  Registers fd in the handle table and maps the database file into memory.
+ *  If fd is already registered the existing handle is returned.
+ *
+ *  returns:  pointer to the handle, or NULL if the table is full or the file
+ *            could not be mapped
+ */
+db_handle_t *db_handle_open(int fd, const char *path)
+{
+    db_handle_t *h = NULL;
+
+    init_handles();
+    for (int i = 0; i < MAX_DB_HANDLES; i++) {
+        if (handles[i].fd == fd)
+            return &handles[i];
+        if (h == NULL && handles[i].fd == -1)
+            h = &handles[i];
+    }
+
+    if (h == NULL)
+        return NULL;
+
+    memset(h, 0, sizeof(*h));
+    h->fd = fd;
+    if (path != NULL)
+        snprintf(h->path, sizeof(h->path), "%s", path);
+    h->msync_policy = parse_msync_policy();
+    h->locking = db_config_int("SDB_LOCKS", 1) != 0;
+
+    if (db_lock_probe(h) != NO_ERROR || map_attach(h) != NO_ERROR ||
+        engine_attach(h) != NO_ERROR) {
+        map_detach(h);
+        h->fd = -1;
+        return NULL;
+    }
+
+    return h;
+}
+
+/*
+ *  db_handle_get
+ *      fd:  file descriptor of an open database
+ *
+ *  Looks up the handle for fd.  Descriptors that were not opened through
+ *  open_db() are attached on first use so callers can keep handing us any
+ *  fd that refers to a database file.
+ *
+ *  returns:  pointer to the handle, or NULL if it could not be attached
+ */
+db_handle_t *db_handle_get(int fd)
+{
+    init_handles();
+    for (int i = 0; i < MAX_DB_HANDLES; i++) {
+        if (handles[i].fd == fd)
+            return &handles[i];
+    }
+
+    return db_handle_open(fd, NULL);
+}
+
+/*
+ *  db_handle_release
+ *      h:  handle to release
+ *
+ *  Closes the write-ahead log and sidecars, unmaps the database and frees
+ *  the table slot.  Does not close the fd and does not flush the database
+ *  file itself, see close_db() for that.
+ */
+void db_handle_release(db_handle_t *h)
+{
+    if (h == NULL || h->fd == -1)
+        return;
+
+    wal_close(h);
+    for (int i = 0; i < NUM_SIDECARS; i++)
+        sidecars[i].on_close(h);
+    map_detach(h);
+    h->fd = -1;
+}
+
+/*
+ *  db_handle_reopen
+ *      h:  handle whose path now names a different file
+ *
+ *  Another process replaced the database (compress_db() renames a new
+ *  file over it).  Drops everything tied to the old file, points h->fd at
+ *  the new one with dup2() so the caller's descriptor number stays valid,
+ *  and attaches the mapping and write-ahead log again.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ */
+int db_handle_reopen(db_handle_t *h)
+{
+    int nfd = open(h->path, h->read_only ? O_RDONLY : O_RDWR);
+
+    if (nfd == -1)
+        return ERR_DB_FILE;
+
+    //whatever is pending was logged and stored in the old file before it
+    //was copied, it must not be synced into a log that now belongs to the
+    //new file
+    if (h->wal != NULL)
+        h->wal->npending = 0;
+    wal_close(h);
+    for (int i = 0; i < NUM_SIDECARS; i++)
+        sidecars[i].on_close(h);
+    map_detach(h);
+
+    if (dup2(nfd, h->fd) == -1) {
+        close(nfd);
+        return ERR_DB_FILE;
+    }
+    close(nfd);
+
+    if (map_attach(h) != NO_ERROR || engine_attach(h) != NO_ERROR)
+        return ERR_DB_FILE;
+    return h->read_only ? NO_ERROR : wal_open(h, false);
+}
+
+/*
+ *  db_sidecar_path
+ *      h:       database handle
+ *      suffix:  identifies the sidecar, for example ".lname"
+ *      buf:     where the path is written
+ *      len:     size of buf
+ *
+ *  Sidecars live next to the database as hidden files, the same way
+ *  TMP_DB_FILE does: student.db gets .student.db.lname and so on.
+ *
+ *  returns:  NO_ERROR, or ERR_DB_FILE if the handle was not opened through
+ *            open_db() (so there is no path) or the name does not fit
+ */
+int db_sidecar_path(db_handle_t *h, const char *suffix, char *buf, size_t len)
+{
+    return db_file_sidecar(h->path, suffix, buf, len);
+}
+
+/*
+ *  db_file_sidecar
+ *      path:    database file
+ *      suffix, buf, len:  as for db_sidecar_path()
+ *
+ *  db_sidecar_path() for a database that is not open.
+ *
+ *  returns:  NO_ERROR, or ERR_DB_FILE if path is empty or the name does
+ *            not fit
+ */
+int db_file_sidecar(const char *path, const char *suffix, char *buf, size_t len)
+{
+    const char *slash;
+    int n;
+
+    if (path[0] == '\0')
+        return ERR_DB_FILE;
+
+    slash = strrchr(path, '/');
+    if (slash == NULL)
+        n = snprintf(buf, len, ".%s%s", path, suffix);
+    else
+        n = snprintf(buf, len, "%.*s/.%s%s", (int)(slash - path),
+                     path, slash + 1, suffix);
+
+    return (n < 0 || (size_t)n >= len) ? ERR_DB_FILE : NO_ERROR;
+}
+
+/*
+ *  db_notify_change
+ *      h:    database handle
+ *      old:  record before the change (EMPTY_STUDENT_RECORD for an add)
+ *      rec:  record after the change (EMPTY_STUDENT_RECORD for a delete)
+ *
+ *  Passes a single record change on to every sidecar.  A sidecar that
+ *  fails to apply it is rebuilt from scratch so it can never go stale.
+ *  Sidecar files are shared between processes, updates to them are
+ *  serialized with the meta lock.  The caller holds it exclusive, taken
+ *  with the record lock by db_lock_change(), so the sidecars see the
+ *  changes of an id in the order they were stored.
+ */
+void db_notify_change(db_handle_t *h, const student_t *old, const student_t *rec)
+{
+    for (int i = 0; i < NUM_SIDECARS; i++) {
+        if (sidecars[i].on_change(h, old, rec) != NO_ERROR)
+            sidecars[i].on_rebuild(h);
+    }
+}
+
+/*
+ *  db_notify_rebuild
+ *      h:  database handle
+ *
+ *  Tells every sidecar the records changed wholesale.
+ */
+void db_notify_rebuild(db_handle_t *h)
+{
+    db_lock_range(h, LOCK_META_OFF, 1, true);
+    for (int i = 0; i < NUM_SIDECARS; i++)
+        sidecars[i].on_rebuild(h);
+    db_unlock_range(h, LOCK_META_OFF, 1);
+}
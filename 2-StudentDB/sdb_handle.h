@@ -0,0 +1,86 @@
+#ifndef __SDB_HANDLE_H__
+    #define __SDB_HANDLE_H__
+
+#include <limits.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "db.h"
+
+//The public API in sdbsc.h passes plain file descriptors around.  Everything
+//the storage layer needs to remember about an open database (the mapping,
+//the path it was opened from, pending dirty ranges, ...) hangs off of a
+//db_handle_t that is looked up by fd.
+
+//Maximum number of databases a single process can have open at once
+#define MAX_DB_HANDLES  16
+
+//msync policies for the memory mapped storage engine.  Selected with the
+//SDB_MSYNC environment variable (none|op|batch|close).
+#define MSYNC_NONE      0   //leave write back to the kernel (default)
+#define MSYNC_PER_OP    1   //flush the touched page after every add/delete
+#define MSYNC_PER_BATCH 2   //flush the dirty range when sync_db() is called
+#define MSYNC_ON_CLOSE  3   //flush the dirty range in close_db()
+
+typedef struct db_handle {
+    int     fd;                 //-1 when the slot is free
+    char    path[PATH_MAX];     //file the db was opened from, "" if unknown
+
+    //memory mapping of the database file, see sdb_mmap.c
+    char   *base;               //start of the shared mapping, NULL if unmapped
+    size_t  map_len;            //bytes reserved by the mapping (page multiple)
+    off_t   file_len;           //size of the file as last seen by this process
+    off_t   dirty_lo;           //byte range written since the last msync,
+    off_t   dirty_hi;           //dirty_lo == dirty_hi means nothing is dirty
+    int     msync_policy;       //one of the MSYNC_* constants
+    bool    read_only;          //fd was opened O_RDONLY, map without PROT_WRITE
+
+    //multi-process locking, see sdb_lock.c
+    bool    locking;            //false when SDB_LOCKS=0
+    int     gate_depth;         //nesting of db_gate_enter() calls
+    bool    gate_excl;          //the gate is held exclusive
+    bool    layout_ok;          //layout is worth comparing
+    uint64_t layout;            //layout generation when the file was last
+                                //checked, see sdb_cache.h
+
+    //storage format of the file, see sdb_engine.c
+    const struct db_engine *engine;
+
+    struct wal *wal;            //write-ahead log, see sdb_wal.c
+
+    //sidecar state, opened lazily by the modules that own it
+    struct lname_index *lname;  //last name index, see sdb_lname.c
+    struct page_cache *cache;   //record cache, see sdb_cache.c
+    struct id_filter *filter;   //id filter, see sdb_filter.c
+    struct rank_index *rank;    //GPA index, see sdb_rank.c
+} db_handle_t;
+
+//Sidecar files (indexes, filters, ...) derived from the records.  Every
+//sidecar is listed in the table in sdb_handle.c and is told about each
+//change so it never has to rescan the database.
+//  on_change:   a record went from old to rec (either may be all zero,
+//               for an add or a delete respectively)
+//  on_rebuild:  the records changed wholesale (bulk load, compress,
+//               truncate), regenerate from a full scan
+//  on_close:    release whatever is attached to the handle
+typedef struct db_sidecar {
+    const char *name;
+    int  (*on_change)(db_handle_t *h, const student_t *old, const student_t *rec);
+    int  (*on_rebuild)(db_handle_t *h);
+    void (*on_close)(db_handle_t *h);
+} db_sidecar_t;
+
+//prototypes for sdb_handle.c
+db_handle_t *db_handle_open(int fd, const char *path);
+db_handle_t *db_handle_get(int fd);
+void db_handle_release(db_handle_t *h);
+int db_handle_reopen(db_handle_t *h);
+int db_config_int(const char *name, int dflt);
+const char *db_config_str(const char *name, const char *dflt);
+int db_sidecar_path(db_handle_t *h, const char *suffix, char *buf, size_t len);
+int db_file_sidecar(const char *path, const char *suffix, char *buf, size_t len);
+void db_notify_change(db_handle_t *h, const student_t *old, const student_t *rec);
+void db_notify_rebuild(db_handle_t *h);
+
+#endif
@@ -0,0 +1,456 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <limits.h>
+#include <ctype.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "db.h"
+#include "sdbsc.h"
+#include "sdb_handle.h"
+#include "sdb_mmap.h"
+#include "sdb_ingest.h"
+#include "sdb_wal.h"
+#include "sdb_lock.h"
+#include "sdb_engine.h"
+#include "sdb_io.h"
+
+//Bulk loader behind "sdbsc -A <file|->".  Instead of one process, one
+//open_db() and one read-check-write per student, the whole input is parsed
+//into memory, sorted by id, checked against the mapping for duplicates and
+//then written with a few large vectored writes, each covering a run of
+//neighbouring id*STUDENT_RECORD_SIZE slots, a batch of them in flight at
+//once through the I/O backend (sdb_io.c).
+
+//growable arrays holding the parsed input
+typedef struct ingest_buf {
+    student_t *recs;        //records in input order
+    long      *lines;       //input line each record came from
+    uint64_t  *keys;        //(id << 32 | index into recs), sorted later
+    long       n;
+    long       cap;
+} ingest_buf_t;
+
+static const char zero_gap[INGEST_GAP_MAX * sizeof(student_t)];
+
+static int buf_push(ingest_buf_t *b, student_t *rec, long line)
+{
+    if (b->n == b->cap) {
+        long cap = b->cap ? b->cap * 2 : 4096;
+        student_t *r = realloc(b->recs, cap * sizeof(*r));
+        long *l = r ? realloc(b->lines, cap * sizeof(*l)) : NULL;
+        uint64_t *k = l ? realloc(b->keys, cap * sizeof(*k)) : NULL;
+
+        if (r) b->recs = r;
+        if (l) b->lines = l;
+        if (k == NULL)
+            return ERR_DB_OP;
+        b->keys = k;
+        b->cap = cap;
+    }
+
+    b->recs[b->n] = *rec;
+    b->lines[b->n] = line;
+    b->keys[b->n] = ((uint64_t)(uint32_t)rec->id << 32) | (uint64_t)b->n;
+    b->n++;
+    return NO_ERROR;
+}
+
+static void buf_free(ingest_buf_t *b)
+{
+    free(b->recs);
+    free(b->lines);
+    free(b->keys);
+}
+
+static int cmp_key(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+
+    return (x > y) - (x < y);
+}
+
+//strips leading and trailing blanks in place
+static char *trim(char *s)
+{
+    char *end;
+
+    while (isspace((unsigned char)*s))
+        s++;
+    end = s + strlen(s);
+    while (end > s && isspace((unsigned char)end[-1]))
+        *--end = '\0';
+    return s;
+}
+
+static bool parse_int(char *s, int *out)
+{
+    char *end;
+    long v;
+
+    if (*s == '\0')
+        return false;
+    v = strtol(s, &end, 10);
+    if (*end != '\0' || v < INT_MIN || v > INT_MAX)
+        return false;
+    *out = (int)v;
+    return true;
+}
+
+/*
+ *  parse_line
+ *      line:  one line of input, modified in place
+ *      rec:   record to fill in
+ *
+ *  Splits a CSV or TSV line (tabs win if the line has any) into the four
+ *  student fields.  Names are truncated the same way add_student() does.
+ *
+ *  returns:  NO_ERROR or ERR_DB_OP if the line is malformed
+ */
+static int parse_line(char *line, student_t *rec)
+{
+    char delim = strchr(line, '\t') ? '\t' : ',';
+    char *field[4];
+    char *p = line;
+
+    for (int i = 0; i < 4; i++) {
+        char *next = (i < 3) ? strchr(p, delim) : NULL;
+
+        if (i < 3 && next == NULL)
+            return ERR_DB_OP;
+        if (next)
+            *next = '\0';
+        field[i] = trim(p);
+        p = next ? next + 1 : NULL;
+    }
+
+    memset(rec, 0, sizeof(*rec));
+    if (!parse_int(field[0], &rec->id) || !parse_int(field[3], &rec->gpa))
+        return ERR_DB_OP;
+    strncpy(rec->fname, field[1], sizeof(rec->fname) - 1);
+    strncpy(rec->lname, field[2], sizeof(rec->lname) - 1);
+    return NO_ERROR;
+}
+
+/*
+ *  read_input
+ *      in:       stream to read
+ *      b:        where parsed, range checked records are collected
+ *      skipped:  incremented for every line that is rejected
+ *
+ *  returns:  NO_ERROR or ERR_DB_OP if we ran out of memory
+ */
+static int read_input(FILE *in, ingest_buf_t *b, long *skipped)
+{
+    char line[INGEST_LINE_MAX];
+    long lineno = 0;
+    student_t rec;
+
+    while (fgets(line, sizeof(line), in) != NULL) {
+        size_t len = strlen(line);
+
+        lineno++;
+        if (len == sizeof(line) - 1 && line[len - 1] != '\n') {
+            //line too long, throw the rest of it away
+            int c;
+            while ((c = fgetc(in)) != EOF && c != '\n')
+                ;
+            printf(M_INGEST_BAD_LINE, lineno);
+            (*skipped)++;
+            continue;
+        }
+
+        if (*trim(line) == '\0')
+            continue;
+
+        if (parse_line(line, &rec) != NO_ERROR) {
+            //a non numeric id on the first line is a header
+            if (lineno == 1 && !isdigit((unsigned char)*trim(line)))
+                continue;
+            printf(M_INGEST_BAD_LINE, lineno);
+            (*skipped)++;
+            continue;
+        }
+
+        if (validate_range(rec.id, rec.gpa) != NO_ERROR) {
+            printf(M_INGEST_RANGE, lineno);
+            (*skipped)++;
+            continue;
+        }
+
+        if (buf_push(b, &rec, lineno) != NO_ERROR)
+            return ERR_DB_OP;
+    }
+
+    return NO_ERROR;
+}
+
+//true if slots [lo, hi) hold no student in the database
+static bool slots_empty(db_handle_t *h, int lo, int hi)
+{
+    for (int id = lo; id < hi; id++) {
+        student_t *s = map_slot(h, id);
+
+        if (s == NULL)
+            return true;    //past the end of the file, so is the rest
+        if (memcmp(s, &EMPTY_STUDENT_RECORD, STUDENT_RECORD_SIZE) != 0)
+            return false;
+    }
+    return true;
+}
+
+/*
+ *  write_extent
+ *      fd:   database file
+ *      iov:  buffers making up one contiguous range of the file
+ *      n:    number of buffers
+ *      off:  file offset of the range
+ *
+ *  pwritev() that keeps going after short writes.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ */
+static int write_extent(int fd, struct iovec *iov, int n, off_t off)
+{
+    while (n > 0) {
+        ssize_t w = pwritev(fd, iov, n, off);
+
+        if (w <= 0)
+            return ERR_DB_FILE;
+        off += w;
+        while (n > 0 && (size_t)w >= iov->iov_len) {
+            w -= iov->iov_len;
+            iov++;
+            n--;
+        }
+        if (n > 0) {
+            iov->iov_base = (char *)iov->iov_base + w;
+            iov->iov_len -= w;
+        }
+    }
+    return NO_ERROR;
+}
+
+/*
+ *  write_batch
+ *      fd:    database file
+ *      reqs:  extents to write, iov and niov set
+ *      n:     number of extents
+ *
+ *  Writes the extents through the I/O backend, all in flight together.
+ *  An extent that comes back short or failed is written again, whole,
+ *  with write_extent() (the bytes are the same, so that is harmless).
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ */
+static int write_batch(int fd, io_req_t *reqs, int n)
+{
+    if (io_run(fd, reqs, n, true) != NO_ERROR)
+        return ERR_DB_FILE;
+
+    for (int i = 0; i < n; i++) {
+        ssize_t bytes = 0;
+
+        for (int j = 0; j < reqs[i].niov; j++)
+            bytes += reqs[i].iov[j].iov_len;
+        if (reqs[i].res != bytes &&
+            write_extent(fd, reqs[i].iov, reqs[i].niov, reqs[i].off) != NO_ERROR)
+            return ERR_DB_FILE;
+    }
+    return NO_ERROR;
+}
+
+/*
+ *  ingest_write_sorted
+ *      h:     database handle, legacy format, gate held exclusive
+ *      recs:  records sorted by id, no duplicates
+ *      n:     number of records
+ *
+ *  Groups the records into extents, one vectored write each.  Consecutive
+ *  ids are one buffer; two runs separated by a short gap of empty slots
+ *  are joined with a zero filled buffer so they still go out in one write.
+ *  Gaps holding existing students, or long gaps that are better left as
+ *  holes, end the extent.  Up to INGEST_BATCH extents are handed to the
+ *  I/O backend at a time, so a sparse load keeps many writes in flight.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ */
+int ingest_write_sorted(db_handle_t *h, student_t *recs, long n)
+{
+    struct iovec (*iovs)[IOV_MAX] = malloc(INGEST_BATCH * sizeof(*iovs));
+    io_req_t reqs[INGEST_BATCH];
+    int nreqs = 0;
+    long i = 0;
+    int rc = NO_ERROR;
+
+    if (iovs == NULL)
+        return ERR_DB_FILE;
+
+    while (rc == NO_ERROR && i < n) {
+        struct iovec *iov = iovs[nreqs];
+        int niov = 0;
+        size_t bytes = 0;
+        off_t start = (off_t)recs[i].id * STUDENT_RECORD_SIZE;
+
+        while (i < n && niov < IOV_MAX && bytes < INGEST_MAX_WRITE) {
+            long j = i + 1;
+
+            //extend the run over consecutive ids
+            while (j < n && recs[j].id == recs[j - 1].id + 1 &&
+                   bytes + (j - i + 1) * sizeof(student_t) <= INGEST_MAX_WRITE)
+                j++;
+
+            iov[niov].iov_base = &recs[i];
+            iov[niov].iov_len = (j - i) * sizeof(student_t);
+            bytes += iov[niov].iov_len;
+            niov++;
+            i = j;
+
+            if (i >= n || niov + 2 > IOV_MAX)
+                break;
+
+            int gap_lo = recs[i - 1].id + 1;
+            int gap = recs[i].id - gap_lo;
+            if (gap > INGEST_GAP_MAX || !slots_empty(h, gap_lo, recs[i].id))
+                break;
+
+            iov[niov].iov_base = (void *)zero_gap;
+            iov[niov].iov_len = gap * sizeof(student_t);
+            bytes += iov[niov].iov_len;
+            niov++;
+        }
+
+        reqs[nreqs] = (io_req_t){ .off = start, .iov = iov, .niov = niov };
+        if (++nreqs == INGEST_BATCH || i >= n) {
+            rc = write_batch(h->fd, reqs, nreqs);
+            nreqs = 0;
+        }
+    }
+
+    free(iovs);
+    return rc;
+}
+
+/*
+ *  ingest_students
+ *      fd:   linux file descriptor of the database
+ *      src:  path of the CSV/TSV file to load, or "-" for stdin
+ *
+ *  Loads every valid line of src into the database.  Lines that do not
+ *  parse, fail validate_range(), or name an id that is already in the
+ *  database (or appeared earlier in the input) are reported and skipped,
+ *  mirroring what a series of "sdbsc -a" calls would do.
+ *
+ *  returns:  <number>       number of students added
+ *            ERR_DB_FILE    database or input file I/O issue
+ *            ERR_DB_OP      out of memory
+ *
+ *  console:  M_INGEST_DONE on success, one M_INGEST_* line per skipped row,
+ *            M_ERR_INGEST_OPEN, M_ERR_INGEST_MEM or M_ERR_DB_WRITE on error
+ */
+int ingest_students(int fd, char *src)
+{
+    ingest_buf_t b = {0};
+    long skipped = 0;
+    long kept = 0;
+    bool use_stdin = (strcmp(src, "-") == 0);
+    FILE *in = use_stdin ? stdin : fopen(src, "r");
+    db_handle_t *h = db_handle_get(fd);
+    int rc;
+
+    if (in == NULL) {
+        printf(M_ERR_INGEST_OPEN, src);
+        return ERR_DB_FILE;
+    }
+    if (h == NULL) {
+        if (!use_stdin)
+            fclose(in);
+        printf(M_ERR_DB_READ);
+        return ERR_DB_FILE;
+    }
+
+    //parse and sort before taking the gate, a slow pipe on stdin must not
+    //hold up every other reader and writer
+    setvbuf(in, NULL, _IOFBF, INGEST_IO_BUF_SZ);
+    rc = read_input(in, &b, &skipped);
+    if (!use_stdin)
+        fclose(in);
+    if (rc != NO_ERROR) {
+        buf_free(&b);
+        printf(M_ERR_INGEST_MEM);
+        return ERR_DB_OP;
+    }
+
+    //sorting (id, input position) keeps the first of any repeated ids
+    qsort(b.keys, b.n, sizeof(*b.keys), cmp_key);
+
+    student_t *sorted = malloc((b.n ? b.n : 1) * sizeof(*sorted));
+    if (sorted == NULL) {
+        buf_free(&b);
+        printf(M_ERR_INGEST_MEM);
+        return ERR_DB_OP;
+    }
+
+    //the bulk writes bypass the log and the record locks, so the load has
+    //the database to itself, and nothing older may be replayed over it
+    //after a crash
+    if (db_gate_enter(h, true) != NO_ERROR || wal_checkpoint(h) != NO_ERROR) {
+        db_gate_leave(h);
+        buf_free(&b);
+        free(sorted);
+        printf(M_ERR_DB_WRITE);
+        return ERR_DB_FILE;
+    }
+
+    int last_id = -1;
+    for (long i = 0; i < b.n; i++) {
+        long idx = (long)(b.keys[i] & 0xffffffffu);
+        student_t *rec = &b.recs[idx];
+        student_t existing;
+
+        if (rec->id == last_id || db_get(h, rec->id, &existing) == NO_ERROR) {
+            printf(M_INGEST_DUP, b.lines[idx], rec->id);
+            skipped++;
+            continue;
+        }
+        last_id = rec->id;
+        sorted[kept++] = *rec;
+    }
+    buf_free(&b);
+
+    //the legacy engine writes whole extents at once, the others take the
+    //records one by one if they have no bulk path of their own
+    if (h->engine->bulk_put != NULL) {
+        rc = h->engine->bulk_put(h, sorted, kept);
+    } else {
+        rc = NO_ERROR;
+        for (long i = 0; rc == NO_ERROR && i < kept; i++)
+            rc = db_put(h, sorted[i].id, &sorted[i]);
+    }
+    free(sorted);
+    if (rc != NO_ERROR || map_refresh(h) != NO_ERROR) {
+        db_gate_leave(h);
+        printf(M_ERR_DB_WRITE);
+        return ERR_DB_FILE;
+    }
+
+    // indexes are cheaper to regenerate than to update row by row
+    if (kept > 0)
+        db_notify_rebuild(h);
+
+    //with the log enabled the load is as durable as a logged add
+    if (sync_db(fd) != NO_ERROR || (h->wal != NULL && fsync(fd) == -1)) {
+        db_gate_leave(h);
+        printf(M_ERR_DB_WRITE);
+        return ERR_DB_FILE;
+    }
+
+    db_gate_leave(h);
+    printf(M_INGEST_DONE, kept, skipped);
+    return (int)kept;
+}
@@ -0,0 +1,31 @@
+#ifndef __SDB_INGEST_H__
+    #define __SDB_INGEST_H__
+
+#include "db.h"
+#include "sdb_handle.h"
+
+//Bulk loading of students from CSV/TSV input, see sdb_ingest.c.  Each line
+//holds   id,first_name,last_name,gpa   (or the same fields separated by
+//tabs), gpa being the 3 digit int used by -a.  A first line whose id field
+//is not a number is treated as a header and skipped.
+
+#define INGEST_LINE_MAX     512             //longest input line accepted
+#define INGEST_IO_BUF_SZ    (1024 * 1024)   //stdio buffer for the input
+#define INGEST_MAX_WRITE    (8 * 1024 * 1024) //largest single write
+#define INGEST_BATCH        32              //extents written at a time
+#define INGEST_GAP_MAX      64              //empty slots bridged with zeros
+                                            //when coalescing two runs
+
+//Output messages
+#define M_INGEST_BAD_LINE   "Skipping line %ld: expected id,first_name,last_name,gpa\n"
+#define M_INGEST_RANGE      "Skipping line %ld: ID or GPA out of allowable range\n"
+#define M_INGEST_DUP        "Skipping line %ld: student with ID=%d already exists\n"
+#define M_INGEST_DONE       "Loaded %ld student(s), skipped %ld line(s).\n"
+#define M_ERR_INGEST_OPEN   "Error opening input file %s\n"
+#define M_ERR_INGEST_MEM    "Out of memory while loading students\n"
+
+//prototypes for sdb_ingest.c
+int ingest_students(int fd, char *src);
+int ingest_write_sorted(db_handle_t *h, student_t *recs, long n);
+
+#endif
@@ -0,0 +1,370 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <linux/io_uring.h>
+
+#include "db.h"
+#include "sdbsc.h"
+#include "sdb_handle.h"
+#include "sdb_io.h"
+
+//A cold lookup is a disk read, and done one at a time a batch of them
+//runs at the latency of the device rather than at its IOPS.  io_uring
+//lets one thread queue dozens of reads and collect them as they finish.
+//
+//The ring is set up once per process and shared, under a mutex, by every
+//thread: a program that links the database in (SDB_NO_MAIN) may look
+//students up from several at once.  There is no liburing in
+//the build, so the ring is driven by hand: the submission and completion
+//rings are mapped from the ring fd, we own the SQ tail and the CQ head,
+//the kernel owns the other two, and each side publishes its index with a
+//release store and reads the other's with an acquire load.
+
+#ifndef __NR_io_uring_setup
+#define __NR_io_uring_setup     425
+#endif
+#ifndef __NR_io_uring_enter
+#define __NR_io_uring_enter     426
+#endif
+
+typedef struct uring {
+    int                  fd;
+    unsigned             entries;   //SQ size, most I/Os we keep in flight
+    unsigned            *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned            *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    bool                 broken;    //requests may still be in flight, see
+                                    //uring_drain(), the ring is not used again
+    pthread_mutex_t      mu;
+} uring_t;
+
+static uring_t ring = { .fd = -1, .mu = PTHREAD_MUTEX_INITIALIZER };
+
+static pthread_once_t backend_once = PTHREAD_ONCE_INIT;
+static const io_backend_t *backend = &sync_backend;
+
+/*
+ *  sync_run
+ *      fd:     file to read or write
+ *      reqs:   requests, res is set in each
+ *      n:      number of requests
+ *      write:  write instead of read
+ *
+ *  The fallback backend: one request after the other, retrying EINTR.
+ *
+ *  returns:  NO_ERROR
+ */
+static int sync_run(int fd, io_req_t *reqs, int n, bool write)
+{
+    for (int i = 0; i < n; i++) {
+        io_req_t *r = &reqs[i];
+        ssize_t got;
+
+        do {
+            if (r->iov != NULL)
+                got = write ? pwritev(fd, r->iov, r->niov, r->off)
+                            : preadv(fd, r->iov, r->niov, r->off);
+            else
+                got = write ? pwrite(fd, r->buf, r->len, r->off)
+                            : pread(fd, r->buf, r->len, r->off);
+        } while (got == -1 && errno == EINTR);
+        r->res = got == -1 ? -errno : got;
+    }
+    return NO_ERROR;
+}
+
+static int sync_setup(unsigned depth)
+{
+    (void)depth;
+    return NO_ERROR;
+}
+
+const io_backend_t sync_backend = {
+    "sync",
+    sync_setup,
+    sync_run,
+};
+
+/*
+ *  uring_setup
+ *      depth:  entries of the submission queue
+ *
+ *  Creates the process's ring and maps its queues.
+ *
+ *  returns:  NO_ERROR, or ERR_DB_FILE when io_uring is missing, disabled
+ *            or too old (no IORING_FEAT_NODROP, completions could be lost)
+ */
+static int uring_setup(unsigned depth)
+{
+    struct io_uring_params p;
+    size_t sq_sz, cq_sz;
+    char *sq, *cq;
+    int fd;
+
+    memset(&p, 0, sizeof(p));
+    fd = (int)syscall(__NR_io_uring_setup, depth, &p);
+    if (fd < 0)
+        return ERR_DB_FILE;
+    if (!(p.features & IORING_FEAT_NODROP)) {
+        close(fd);
+        return ERR_DB_FILE;
+    }
+
+    sq_sz = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    cq_sz = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (cq_sz > sq_sz)
+            sq_sz = cq_sz;
+        cq_sz = sq_sz;
+    }
+
+    sq = mmap(NULL, sq_sz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+              fd, IORING_OFF_SQ_RING);
+    if (sq == MAP_FAILED) {
+        close(fd);
+        return ERR_DB_FILE;
+    }
+    cq = sq;
+    if (!(p.features & IORING_FEAT_SINGLE_MMAP)) {
+        cq = mmap(NULL, cq_sz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                  fd, IORING_OFF_CQ_RING);
+        if (cq == MAP_FAILED) {
+            munmap(sq, sq_sz);
+            close(fd);
+            return ERR_DB_FILE;
+        }
+    }
+    ring.sqes = mmap(NULL, p.sq_entries * sizeof(struct io_uring_sqe),
+                     PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                     fd, IORING_OFF_SQES);
+    if (ring.sqes == MAP_FAILED) {
+        if (cq != sq)
+            munmap(cq, cq_sz);
+        munmap(sq, sq_sz);
+        close(fd);
+        return ERR_DB_FILE;
+    }
+
+    ring.sq_head = (unsigned *)(sq + p.sq_off.head);
+    ring.sq_tail = (unsigned *)(sq + p.sq_off.tail);
+    ring.sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+    ring.sq_array = (unsigned *)(sq + p.sq_off.array);
+    ring.cq_head = (unsigned *)(cq + p.cq_off.head);
+    ring.cq_tail = (unsigned *)(cq + p.cq_off.tail);
+    ring.cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+    ring.cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+    ring.entries = p.sq_entries;
+    ring.fd = fd;
+    return NO_ERROR;
+}
+
+/*
+ *  uring_queue
+ *      fd:     file the request is for
+ *      r:      the request
+ *      idx:    its index, comes back in the completion
+ *      write:  write instead of read
+ *      tail:   our current submission queue tail
+ *
+ *  Fills in the entry at tail.  The caller made sure there is room and
+ *  publishes the new tail.
+ */
+static void uring_queue(int fd, io_req_t *r, int idx, bool write, unsigned tail)
+{
+    unsigned slot = tail & *ring.sq_mask;
+    struct io_uring_sqe *sqe = &ring.sqes[slot];
+
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->fd = fd;
+    sqe->off = (uint64_t)r->off;
+    if (r->iov != NULL) {
+        sqe->opcode = write ? IORING_OP_WRITEV : IORING_OP_READV;
+        sqe->addr = (uint64_t)(uintptr_t)r->iov;
+        sqe->len = (uint32_t)r->niov;
+    } else {
+        sqe->opcode = write ? IORING_OP_WRITE : IORING_OP_READ;
+        sqe->addr = (uint64_t)(uintptr_t)r->buf;
+        sqe->len = (uint32_t)r->len;
+    }
+    sqe->user_data = (uint64_t)idx;
+    ring.sq_array[slot] = slot;
+}
+
+/*
+ *  uring_reap
+ *      fd, reqs, n, write:  see sync_run()
+ *
+ *  Collects every completion there is.  Caller holds ring.mu.
+ *
+ *  returns:  the number of completions collected
+ */
+static int uring_reap(int fd, io_req_t *reqs, int n, bool write)
+{
+    unsigned head = *ring.cq_head;
+    unsigned tail = __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE);
+    int reaped = 0;
+
+    for (; head != tail; head++) {
+        struct io_uring_cqe *cqe = &ring.cqes[head & *ring.cq_mask];
+        uint64_t idx = cqe->user_data;
+
+        reaped++;
+        if (idx >= (uint64_t)n)
+            continue;   //not from this batch, uring_drain() should make
+                        //that impossible
+        reqs[idx].res = cqe->res;
+        if (cqe->res == -EINVAL || cqe->res == -EOPNOTSUPP)
+            sync_run(fd, &reqs[idx], 1, write);
+    }
+    __atomic_store_n(ring.cq_head, head, __ATOMIC_RELEASE);
+    return reaped;
+}
+
+/*
+ *  uring_drain
+ *      fd, reqs, n, write:  see sync_run()
+ *      inflight:            requests queued and not completed yet
+ *
+ *  After io_uring_enter() failed: takes back the entries the kernel has
+ *  not picked up and waits for the rest, so no completion is left for a
+ *  later batch (its user_data would index that batch's reqs) and no read
+ *  lands in a buffer after we returned it.  If even waiting fails the
+ *  ring is given up on and the sync backend used from then on.  Caller
+ *  holds ring.mu.
+ */
+static void uring_drain(int fd, io_req_t *reqs, int n, bool write, int inflight)
+{
+    unsigned head = __atomic_load_n(ring.sq_head, __ATOMIC_ACQUIRE);
+
+    inflight -= (int)(*ring.sq_tail - head);
+    __atomic_store_n(ring.sq_tail, head, __ATOMIC_RELEASE);
+
+    while (inflight > 0) {
+        int ret = (int)syscall(__NR_io_uring_enter, ring.fd, 0, 1,
+                               IORING_ENTER_GETEVENTS, NULL, 0);
+
+        if (ret < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+            ring.broken = true;
+            return;
+        }
+        inflight -= uring_reap(fd, reqs, n, write);
+    }
+}
+
+/*
+ *  uring_run
+ *      fd, reqs, n, write:  see sync_run()
+ *
+ *  Keeps the ring as full as the requests allow: queue what fits, submit
+ *  and wait for at least one completion, collect every completion there
+ *  is, repeat.  Requests the kernel rejects outright (an opcode an old
+ *  kernel does not know) are run again synchronously.
+ *
+ *  returns:  NO_ERROR, or ERR_DB_FILE if io_uring_enter() failed; the
+ *            requests that did not complete are left at -EIO
+ */
+static int uring_run(int fd, io_req_t *reqs, int n, bool write)
+{
+    int next = 0, done = 0, inflight = 0;
+    int rc = NO_ERROR;
+
+    pthread_mutex_lock(&ring.mu);
+    if (ring.broken) {
+        pthread_mutex_unlock(&ring.mu);
+        return sync_run(fd, reqs, n, write);
+    }
+    for (int i = 0; i < n; i++)
+        reqs[i].res = -EIO;
+    while (done < n) {
+        unsigned tail = *ring.sq_tail;
+        unsigned head = __atomic_load_n(ring.sq_head, __ATOMIC_ACQUIRE);
+        int ret, reaped;
+
+        while (next < n && (unsigned)inflight < ring.entries &&
+               tail - head < ring.entries) {
+            uring_queue(fd, &reqs[next], next, write, tail);
+            tail++;
+            next++;
+            inflight++;
+        }
+        __atomic_store_n(ring.sq_tail, tail, __ATOMIC_RELEASE);
+
+        ret = (int)syscall(__NR_io_uring_enter, ring.fd,
+                           tail - __atomic_load_n(ring.sq_head, __ATOMIC_ACQUIRE),
+                           1, IORING_ENTER_GETEVENTS, NULL, 0);
+        if (ret < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+            uring_drain(fd, reqs, n, write, inflight);
+            rc = ERR_DB_FILE;
+            break;
+        }
+
+        reaped = uring_reap(fd, reqs, n, write);
+        inflight -= reaped;
+        done += reaped;
+    }
+    pthread_mutex_unlock(&ring.mu);
+    return rc;
+}
+
+const io_backend_t uring_backend = {
+    "uring",
+    uring_setup,
+    uring_run,
+};
+
+static void pick_backend(void)
+{
+    int depth = db_config_int("SDB_IO_DEPTH", IO_DEPTH);
+
+    if (depth < 1)
+        depth = 1;
+    if (depth > IO_MAX_DEPTH)
+        depth = IO_MAX_DEPTH;
+    if (strcmp(db_config_str("SDB_IO", uring_backend.name), sync_backend.name) != 0 &&
+        uring_backend.setup((unsigned)depth) == NO_ERROR)
+        backend = &uring_backend;
+    else
+        backend = &sync_backend;
+}
+
+/*
+ *  io_backend
+ *
+ *  returns:  the backend this process uses, picked on first use
+ */
+const io_backend_t *io_backend(void)
+{
+    pthread_once(&backend_once, pick_backend);
+    return backend;
+}
+
+/*
+ *  io_run
+ *      fd:     file to read or write
+ *      reqs:   requests, res is set in each
+ *      n:      number of requests
+ *      write:  write instead of read
+ *
+ *  Runs a batch of independent reads or writes, as many at a time as the
+ *  backend allows, and returns once all of them are done.  Requests may
+ *  complete in any order, so no two of them should overlap.
+ *
+ *  returns:  NO_ERROR, or ERR_DB_FILE when the backend failed as a whole;
+ *            errors of single requests are only in their res
+ */
+int io_run(int fd, io_req_t *reqs, int n, bool write)
+{
+    if (n <= 0)
+        return NO_ERROR;
+    return io_backend()->run(fd, reqs, n, write);
+}
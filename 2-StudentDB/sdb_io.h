@@ -0,0 +1,51 @@
+#ifndef __SDB_IO_H__
+    #define __SDB_IO_H__
+
+#include <stdbool.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+//Batched file I/O, see sdb_io.c.  A caller with many independent reads or
+//writes (a batch of lookups, the extents of a bulk load) hands them all
+//to io_run() at once instead of doing one pread() after another, and the
+//backend keeps up to SDB_IO_DEPTH of them in flight:
+//
+//  uring  io_uring through the raw system calls (no liburing needed)
+//  sync   pread()/pwrite() in a loop, for kernels without io_uring or
+//         where it is disabled
+//
+//SDB_IO=uring|sync picks one, uring by default; when the ring cannot be
+//set up the sync backend is used instead.
+
+#define IO_DEPTH            64      //I/Os in flight, SDB_IO_DEPTH
+#define IO_MAX_DEPTH        4096
+
+//one read or write.  Either buf/len or an iovec array.  res is set to the
+//bytes transferred or -errno; short transfers are left to the caller
+typedef struct io_req {
+    off_t         off;
+    void         *buf;
+    size_t        len;
+    struct iovec *iov;              //NULL to use buf and len
+    int           niov;
+    ssize_t       res;
+} io_req_t;
+
+typedef struct io_backend {
+    const char *name;
+
+    //get ready for use, NO_ERROR or ERR_DB_FILE if not available here
+    int  (*setup)(unsigned depth);
+
+    //run all n requests against fd, reads or writes
+    int  (*run)(int fd, io_req_t *reqs, int n, bool write);
+} io_backend_t;
+
+extern const io_backend_t uring_backend;
+extern const io_backend_t sync_backend;
+
+//prototypes for sdb_io.c
+const io_backend_t *io_backend(void);
+int io_run(int fd, io_req_t *reqs, int n, bool write);
+
+#endif
@@ -0,0 +1,662 @@
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "db.h"
+#include "sdbsc.h"
+#include "sdb_handle.h"
+#include "sdb_scan.h"
+#include "sdb_lname.h"
+#include "sdb_lock.h"
+
+//Last name index.  Lookups binary search the in memory fence pointers to
+//find the one block of the sorted run where the name can start, pread()
+//that block (and the following ones only while names still match), then
+//fold in the small change log.  add_student()/del_student() only append
+//to the log, so keeping the index current costs one write() per change.
+//
+//Both the run and the log are keyed by (lname, id).  Presence of a key is
+//"in the run" plus the sum of its log deltas, which makes replaying a log
+//over a run that already contains it harmless.
+//
+//Several processes share the files.  Changes are made under the meta lock
+//(writers hold it around db_notify_change()), lookups hold it shared.  A merge replaces
+//the run with rename(), so an index that was opened earlier is checked
+//against the path before use.
+
+typedef struct entry_vec {
+    lname_entry_t *v;
+    long           n;
+    long           cap;
+} entry_vec_t;
+
+static int vec_push(entry_vec_t *ev, const lname_entry_t *e)
+{
+    if (ev->n == ev->cap) {
+        long cap = ev->cap ? ev->cap * 2 : 256;
+        lname_entry_t *v = realloc(ev->v, cap * sizeof(*v));
+
+        if (v == NULL)
+            return ERR_DB_OP;
+        ev->v = v;
+        ev->cap = cap;
+    }
+    ev->v[ev->n++] = *e;
+    return NO_ERROR;
+}
+
+static void make_entry(lname_entry_t *e, const student_t *s)
+{
+    memset(e, 0, sizeof(*e));
+    memcpy(e->lname, s->lname, LNAME_KEY_SZ - 1);
+    e->id = s->id;
+}
+
+static int cmp_entry(const void *a, const void *b)
+{
+    const lname_entry_t *x = a;
+    const lname_entry_t *y = b;
+    int c = strncmp(x->lname, y->lname, LNAME_KEY_SZ);
+
+    if (c != 0)
+        return c;
+    return (x->id > y->id) - (x->id < y->id);
+}
+
+static int cmp_log(const void *a, const void *b)
+{
+    return cmp_entry(&((const lname_log_rec_t *)a)->e,
+                     &((const lname_log_rec_t *)b)->e);
+}
+
+static int write_all(int fd, const void *buf, size_t len)
+{
+    const char *p = buf;
+
+    while (len > 0) {
+        ssize_t w = write(fd, p, len);
+
+        if (w <= 0)
+            return ERR_DB_FILE;
+        p += w;
+        len -= (size_t)w;
+    }
+    return NO_ERROR;
+}
+
+static int read_all(int fd, void *buf, size_t len, off_t off)
+{
+    char *p = buf;
+
+    while (len > 0) {
+        ssize_t r = pread(fd, p, len, off);
+
+        if (r <= 0)
+            return ERR_DB_FILE;
+        p += r;
+        off += r;
+        len -= (size_t)r;
+    }
+    return NO_ERROR;
+}
+
+/*
+ *  combine
+ *      run:   entries from the sorted run, in order
+ *      nrun:  number of run entries
+ *      log:   log records, sorted with cmp_log()
+ *      nlog:  number of log records
+ *      out:   receives the surviving entries, in order
+ *
+ *  Merges a slice of the run with log changes.  A key survives when its
+ *  presence in the run plus the sum of its deltas is positive.
+ *
+ *  returns:  NO_ERROR or ERR_DB_OP when out of memory
+ */
+static int combine(lname_entry_t *run, long nrun, lname_log_rec_t *log,
+                   long nlog, entry_vec_t *out)
+{
+    long i = 0, j = 0;
+
+    while (i < nrun || j < nlog) {
+        lname_entry_t *key;
+        int c, count = 0;
+
+        if (j >= nlog)
+            c = -1;
+        else if (i >= nrun)
+            c = 1;
+        else
+            c = cmp_entry(&run[i], &log[j].e);
+
+        key = (c <= 0) ? &run[i] : &log[j].e;
+        if (c <= 0) {
+            count = 1;
+            i++;
+        }
+        while (j < nlog && cmp_entry(&log[j].e, key) == 0)
+            count += log[j++].delta;
+
+        if (count > 0 && vec_push(out, key) != NO_ERROR)
+            return ERR_DB_OP;
+    }
+    return NO_ERROR;
+}
+
+static int collect_page(void *arg, int first, const student_t *recs, int n,
+                        uint64_t occupied)
+{
+    lname_entry_t e;
+    (void)first; (void)n;
+
+    while (occupied) {
+        make_entry(&e, &recs[__builtin_ctzll(occupied)]);
+        occupied &= occupied - 1;
+        if (vec_push(arg, &e) != NO_ERROR)
+            return ERR_DB_OP;
+    }
+    return NO_ERROR;
+}
+
+/*
+ *  write_run
+ *      h:  database handle
+ *      v:  entries, sorted with cmp_entry()
+ *      n:  number of entries
+ *
+ *  Writes a new run file (header, fences, entries) next to the old one,
+ *  renames it into place and empties the change log.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ */
+static int write_run(db_handle_t *h, lname_entry_t *v, long n)
+{
+    char path[PATH_MAX], tmp[PATH_MAX + 8], log_path[PATH_MAX];
+    mode_t mode = S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP;
+    lname_hdr_t hdr = {0};
+    struct stat st;
+    int fd, log_fd, rc;
+
+    if (db_sidecar_path(h, LNAME_RUN_SUFFIX, path, sizeof(path)) != NO_ERROR ||
+        db_sidecar_path(h, LNAME_LOG_SUFFIX, log_path, sizeof(log_path)) != NO_ERROR ||
+        fstat(h->fd, &st) == -1)
+        return ERR_DB_FILE;
+
+    memcpy(hdr.magic, LNAME_MAGIC, sizeof(hdr.magic));
+    hdr.fence_every = LNAME_FENCE_EVERY;
+    hdr.db_dev = (uint64_t)st.st_dev;
+    hdr.db_ino = (uint64_t)st.st_ino;
+    hdr.nentries = n;
+    hdr.nfences = (n + LNAME_FENCE_EVERY - 1) / LNAME_FENCE_EVERY;
+
+    char (*fences)[LNAME_KEY_SZ] = malloc((hdr.nfences ? hdr.nfences : 1) * LNAME_KEY_SZ);
+    if (fences == NULL)
+        return ERR_DB_FILE;
+    for (long b = 0; b < hdr.nfences; b++)
+        memcpy(fences[b], v[b * LNAME_FENCE_EVERY].lname, LNAME_KEY_SZ);
+
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, mode);
+    if (fd == -1) {
+        free(fences);
+        return ERR_DB_FILE;
+    }
+
+    rc = write_all(fd, &hdr, sizeof(hdr));
+    if (rc == NO_ERROR)
+        rc = write_all(fd, fences, hdr.nfences * LNAME_KEY_SZ);
+    if (rc == NO_ERROR)
+        rc = write_all(fd, v, n * sizeof(*v));
+    free(fences);
+    close(fd);
+
+    if (rc != NO_ERROR || rename(tmp, path) != 0) {
+        unlink(tmp);
+        return ERR_DB_FILE;
+    }
+
+    //the run now includes everything the log had
+    log_fd = open(log_path, O_WRONLY | O_CREAT | O_TRUNC, mode);
+    if (log_fd == -1)
+        return ERR_DB_FILE;
+    close(log_fd);
+    return NO_ERROR;
+}
+
+/*
+ *  load_index
+ *      h:  database handle
+ *
+ *  Opens the run and the log and reads the header and fence pointers.
+ *  Fails if the run is missing, damaged, or was built for another file.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ */
+static int load_index(db_handle_t *h)
+{
+    char path[PATH_MAX], log_path[PATH_MAX];
+    lname_index_t *idx;
+    struct stat st, log_st;
+
+    if (db_sidecar_path(h, LNAME_RUN_SUFFIX, path, sizeof(path)) != NO_ERROR ||
+        db_sidecar_path(h, LNAME_LOG_SUFFIX, log_path, sizeof(log_path)) != NO_ERROR ||
+        fstat(h->fd, &st) == -1)
+        return ERR_DB_FILE;
+
+    idx = calloc(1, sizeof(*idx));
+    if (idx == NULL)
+        return ERR_DB_FILE;
+    idx->log_fd = -1;
+
+    idx->run_fd = open(path, O_RDONLY);
+    if (idx->run_fd == -1 ||
+        read_all(idx->run_fd, &idx->hdr, sizeof(idx->hdr), 0) != NO_ERROR ||
+        memcmp(idx->hdr.magic, LNAME_MAGIC, sizeof(idx->hdr.magic)) != 0 ||
+        idx->hdr.fence_every != LNAME_FENCE_EVERY ||
+        idx->hdr.db_dev != (uint64_t)st.st_dev ||
+        idx->hdr.db_ino != (uint64_t)st.st_ino)
+        goto fail;
+
+    idx->fences = malloc((idx->hdr.nfences ? idx->hdr.nfences : 1) * LNAME_KEY_SZ);
+    if (idx->fences == NULL ||
+        read_all(idx->run_fd, idx->fences, idx->hdr.nfences * LNAME_KEY_SZ,
+                 sizeof(idx->hdr)) != NO_ERROR)
+        goto fail;
+
+    idx->log_fd = open(log_path, O_RDWR | O_CREAT | O_APPEND,
+                       S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP);
+    if (idx->log_fd == -1 || fstat(idx->log_fd, &log_st) == -1)
+        goto fail;
+    idx->log_count = log_st.st_size / (off_t)sizeof(lname_log_rec_t);
+
+    h->lname = idx;
+    return NO_ERROR;
+
+fail:
+    if (idx->run_fd != -1)
+        close(idx->run_fd);
+    if (idx->log_fd != -1)
+        close(idx->log_fd);
+    free(idx->fences);
+    free(idx);
+    return ERR_DB_FILE;
+}
+
+/*
+ *  index_current
+ *      h:  database handle with the index open
+ *
+ *  Checks that the run we have open is still the one at the path (another
+ *  process may have merged or rebuilt it) and picks up log records other
+ *  processes appended.
+ *
+ *  returns:  true if the open index can be used as is
+ */
+static bool index_current(db_handle_t *h)
+{
+    char path[PATH_MAX];
+    struct stat now, mine, log_st;
+
+    if (db_sidecar_path(h, LNAME_RUN_SUFFIX, path, sizeof(path)) != NO_ERROR ||
+        stat(path, &now) == -1 || fstat(h->lname->run_fd, &mine) == -1 ||
+        now.st_dev != mine.st_dev || now.st_ino != mine.st_ino ||
+        fstat(h->lname->log_fd, &log_st) == -1)
+        return false;
+
+    h->lname->log_count = log_st.st_size / (off_t)sizeof(lname_log_rec_t);
+    return true;
+}
+
+static int open_index(db_handle_t *h)
+{
+    if (h->lname != NULL) {
+        if (index_current(h))
+            return NO_ERROR;
+        lname_on_close(h);
+    }
+    if (load_index(h) == NO_ERROR)
+        return NO_ERROR;
+
+    //missing or stale, regenerate it from the records
+    if (lname_on_rebuild(h) != NO_ERROR || h->lname == NULL)
+        return ERR_DB_FILE;
+    return NO_ERROR;
+}
+
+/*
+ *  open_shared
+ *      h:  database handle
+ *
+ *  Takes the meta lock shared and opens the index for a lookup.  When the
+ *  index has to be regenerated first the lock is dropped and retaken
+ *  exclusive (upgrading in place could deadlock two readers).  Either way
+ *  the caller releases the meta lock.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ */
+static int open_shared(db_handle_t *h)
+{
+    if (db_lock_range(h, LOCK_META_OFF, 1, false) != NO_ERROR)
+        return ERR_DB_FILE;
+    if (h->lname != NULL && index_current(h))
+        return NO_ERROR;
+
+    lname_on_close(h);
+    if (load_index(h) == NO_ERROR)
+        return NO_ERROR;
+
+    db_unlock_range(h, LOCK_META_OFF, 1);
+    if (db_lock_range(h, LOCK_META_OFF, 1, true) != NO_ERROR)
+        return ERR_DB_FILE;
+    return open_index(h);
+}
+
+static int read_log(lname_index_t *idx, lname_log_rec_t **out)
+{
+    size_t len = idx->log_count * sizeof(lname_log_rec_t);
+
+    *out = malloc(len ? len : 1);
+    if (*out == NULL || read_all(idx->log_fd, *out, len, 0) != NO_ERROR) {
+        free(*out);
+        *out = NULL;
+        return ERR_DB_FILE;
+    }
+    qsort(*out, idx->log_count, sizeof(**out), cmp_log);
+    return NO_ERROR;
+}
+
+static off_t entry_offset(lname_index_t *idx, long i)
+{
+    return (off_t)sizeof(lname_hdr_t) + idx->hdr.nfences * LNAME_KEY_SZ +
+           (off_t)i * sizeof(lname_entry_t);
+}
+
+/*
+ *  merge_log
+ *      h:  database handle with the index open
+ *
+ *  Folds the change log into a new sorted run.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ */
+static int merge_log(db_handle_t *h)
+{
+    lname_index_t *idx = h->lname;
+    long nrun = idx->hdr.nentries;
+    lname_entry_t *run = malloc((nrun ? nrun : 1) * sizeof(*run));
+    lname_log_rec_t *log = NULL;
+    entry_vec_t out = {0};
+    int rc = ERR_DB_FILE;
+
+    if (run != NULL &&
+        read_all(idx->run_fd, run, nrun * sizeof(*run), entry_offset(idx, 0)) == NO_ERROR &&
+        read_log(idx, &log) == NO_ERROR &&
+        combine(run, nrun, log, idx->log_count, &out) == NO_ERROR)
+        rc = write_run(h, out.v, out.n);
+
+    free(run);
+    free(log);
+    free(out.v);
+
+    lname_on_close(h);
+    if (rc == NO_ERROR)
+        rc = load_index(h);
+    return rc;
+}
+
+/*
+ *  lname_on_change
+ *      h:    database handle
+ *      old:  record before the change
+ *      rec:  record after the change
+ *
+ *  Sidecar hook called by db_notify_change().  Appends the change to the
+ *  log and merges the log into the run when it gets long.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE (the caller then rebuilds the index)
+ */
+int lname_on_change(db_handle_t *h, const student_t *old, const student_t *rec)
+{
+    lname_log_rec_t log[2];
+    int n = 0;
+
+    if (h->path[0] == '\0')
+        return NO_ERROR;   //no path, no sidecar
+
+    if (old->id != 0 && rec->id == old->id &&
+        strncmp(old->lname, rec->lname, LNAME_KEY_SZ) == 0)
+        return NO_ERROR;   //key did not change
+
+    if (open_index(h) != NO_ERROR)
+        return ERR_DB_FILE;
+
+    if (old->id != 0) {
+        log[n].delta = -1;
+        make_entry(&log[n++].e, old);
+    }
+    if (rec->id != 0) {
+        log[n].delta = 1;
+        make_entry(&log[n++].e, rec);
+    }
+    if (n == 0)
+        return NO_ERROR;
+
+    if (write_all(h->lname->log_fd, log, n * sizeof(log[0])) != NO_ERROR)
+        return ERR_DB_FILE;
+    h->lname->log_count += n;
+
+    if (h->lname->log_count > LNAME_LOG_MAX)
+        return merge_log(h);
+    return NO_ERROR;
+}
+
+/*
+ *  lname_on_rebuild
+ *      h:  database handle
+ *
+ *  Sidecar hook called by db_notify_rebuild().  Scans the database and
+ *  writes a fresh run with an empty log.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ */
+int lname_on_rebuild(db_handle_t *h)
+{
+    entry_vec_t ev = {0};
+    int rc;
+
+    lname_on_close(h);
+    if (h->path[0] == '\0')
+        return NO_ERROR;
+
+    rc = scan_db(h, collect_page, &ev);
+    if (rc == NO_ERROR) {
+        qsort(ev.v, ev.n, sizeof(*ev.v), cmp_entry);
+        rc = write_run(h, ev.v, ev.n);
+    }
+    free(ev.v);
+
+    if (rc != NO_ERROR)
+        return ERR_DB_FILE;
+    return load_index(h);
+}
+
+/*
+ *  lname_on_close
+ *      h:  database handle
+ *
+ *  Sidecar hook, releases the open index.
+ */
+void lname_on_close(db_handle_t *h)
+{
+    lname_index_t *idx = h->lname;
+
+    if (idx == NULL)
+        return;
+
+    close(idx->run_fd);
+    close(idx->log_fd);
+    free(idx->fences);
+    free(idx);
+    h->lname = NULL;
+}
+
+/*
+ *  lname_lookup
+ *      h:       database handle
+ *      key:     last name, or last name prefix, to look for
+ *      prefix:  match names starting with key instead of equal to it
+ *      out:     receives a malloc()ed array of matching entries, sorted
+ *               by (lname, id); the caller frees it
+ *      n:       receives the number of entries
+ *
+ *  returns:  NO_ERROR, ERR_DB_FILE on index I/O errors, or ERR_DB_OP when
+ *            out of memory
+ */
+int lname_lookup(db_handle_t *h, const char *key, bool prefix,
+                 lname_entry_t **out, long *n)
+{
+    char k[LNAME_KEY_SZ] = {0};
+    entry_vec_t run = {0}, res = {0};
+    lname_entry_t block[LNAME_FENCE_EVERY];
+    lname_log_rec_t *log = NULL;
+    lname_index_t *idx;
+    size_t cmp_len;
+    long lo, hi, nlog = 0;
+    int rc = NO_ERROR;
+    bool done = false;
+
+    *out = NULL;
+    *n = 0;
+    if (open_shared(h) != NO_ERROR) {
+        db_unlock_range(h, LOCK_META_OFF, 1);
+        return ERR_DB_FILE;
+    }
+    idx = h->lname;
+
+    strncpy(k, key, LNAME_KEY_SZ - 1);
+    cmp_len = prefix ? strlen(k) : LNAME_KEY_SZ;
+
+    //first fence >= key; matches may start in the block before it
+    lo = 0;
+    hi = idx->hdr.nfences;
+    while (lo < hi) {
+        long mid = (lo + hi) / 2;
+
+        if (strncmp(idx->fences[mid], k, cmp_len) < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    for (long b = (lo > 0 ? lo - 1 : 0); !done && b < idx->hdr.nfences; b++) {
+        long first = b * LNAME_FENCE_EVERY;
+        long cnt = idx->hdr.nentries - first;
+
+        if (cnt > LNAME_FENCE_EVERY)
+            cnt = LNAME_FENCE_EVERY;
+        if (read_all(idx->run_fd, block, cnt * sizeof(block[0]),
+                     entry_offset(idx, first)) != NO_ERROR) {
+            rc = ERR_DB_FILE;
+            goto out;
+        }
+
+        for (long i = 0; i < cnt; i++) {
+            int c = strncmp(block[i].lname, k, cmp_len);
+
+            if (c > 0) {
+                done = true;
+                break;
+            }
+            if (c == 0 && vec_push(&run, &block[i]) != NO_ERROR) {
+                rc = ERR_DB_OP;
+                goto out;
+            }
+        }
+    }
+
+    //keep only the log changes for matching names
+    if (read_log(idx, &log) != NO_ERROR) {
+        rc = ERR_DB_FILE;
+        goto out;
+    }
+    for (long i = 0; i < idx->log_count; i++) {
+        if (strncmp(log[i].e.lname, k, cmp_len) == 0)
+            log[nlog++] = log[i];
+    }
+
+    rc = combine(run.v, run.n, log, nlog, &res);
+    if (rc == NO_ERROR) {
+        *out = res.v;
+        *n = res.n;
+        res.v = NULL;
+    }
+
+out:
+    db_unlock_range(h, LOCK_META_OFF, 1);
+    free(run.v);
+    free(res.v);
+    free(log);
+    return rc;
+}
+
+/*
+ *  find_by_lname
+ *      fd:      linux file descriptor
+ *      lname:   last name (or prefix) to search for
+ *      prefix:  true to list every student whose last name starts with lname
+ *
+ *  Looks the name up in the last name index and prints the matching
+ *  students in the same format as print_db(), ordered by last name then id.
+ *
+ *  returns:  NO_ERROR       at least one student printed
+ *            SRCH_NOT_FOUND no student matched
+ *            ERR_DB_FILE    database or index I/O issue
+ *
+ *  console:  the matching students, M_LNAME_NOT_FND if there are none,
+ *            M_ERR_LNAME_INDEX if the index could not be read
+ */
+int find_by_lname(int fd, char *lname, bool prefix)
+{
+    db_handle_t *h = db_handle_get(fd);
+    lname_entry_t *hits;
+    long nhits;
+    int printed = 0;
+
+    if (h == NULL || db_gate_enter(h, false) != NO_ERROR) {
+        printf(M_ERR_LNAME_INDEX);
+        return ERR_DB_FILE;
+    }
+    if (lname_lookup(h, lname, prefix, &hits, &nhits) != NO_ERROR) {
+        db_gate_leave(h);
+        printf(M_ERR_LNAME_INDEX);
+        return ERR_DB_FILE;
+    }
+
+    for (long i = 0; i < nhits; i++) {
+        student_t s;
+
+        //the record is the source of truth, skip anything out of date
+        if (get_student(fd, hits[i].id, &s) != NO_ERROR ||
+            strncmp(s.lname, hits[i].lname, LNAME_KEY_SZ - 1) != 0)
+            continue;
+
+        if (!printed)
+            printf(STUDENT_PRINT_HDR_STRING, "ID", "FIRST_NAME", "LAST_NAME", "GPA");
+        printed++;
+        printf(STUDENT_PRINT_FMT_STRING, s.id, s.fname, s.lname, s.gpa / 100.0f);
+    }
+    free(hits);
+    db_gate_leave(h);
+
+    if (!printed) {
+        printf(M_LNAME_NOT_FND, lname, prefix ? "*" : "");
+        return SRCH_NOT_FOUND;
+    }
+    return NO_ERROR;
+}
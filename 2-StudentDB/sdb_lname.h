@@ -0,0 +1,70 @@
+#ifndef __SDB_LNAME_H__
+    #define __SDB_LNAME_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "db.h"
+#include "sdb_handle.h"
+
+//Secondary index on last name, see sdb_lname.c.  It is made of two sidecar
+//files next to the database:
+//
+//  .student.db.lname       a sorted run of (lname, id) entries, preceded by
+//                          a header and one fence pointer (the first key)
+//                          per block of LNAME_FENCE_EVERY entries
+//  .student.db.lname.log   unsorted +1/-1 changes made since the run was
+//                          written, merged into the run once it holds more
+//                          than LNAME_LOG_MAX entries
+
+#define LNAME_KEY_SZ        32      //same as student_t.lname
+#define LNAME_FENCE_EVERY   64      //entries per block / fence pointer
+#define LNAME_LOG_MAX       4096    //log entries before a merge
+#define LNAME_MAGIC         "SDBLNAM1"
+#define LNAME_RUN_SUFFIX    ".lname"
+#define LNAME_LOG_SUFFIX    ".lname.log"
+
+typedef struct lname_entry {
+    char    lname[LNAME_KEY_SZ];
+    int32_t id;
+} lname_entry_t;
+
+//one change in the log, delta is +1 for an add and -1 for a delete
+typedef struct lname_log_rec {
+    int32_t       delta;
+    lname_entry_t e;
+} lname_log_rec_t;
+
+typedef struct lname_hdr {
+    char     magic[8];
+    uint32_t fence_every;
+    uint32_t pad0;
+    uint64_t db_dev;        //identity of the database the run was built
+    uint64_t db_ino;        //from, a mismatch forces a rebuild
+    int64_t  nentries;
+    int64_t  nfences;
+    char     pad[16];
+} lname_hdr_t;
+
+//in memory state hung off of db_handle_t.lname
+typedef struct lname_index {
+    int         run_fd;
+    int         log_fd;
+    lname_hdr_t hdr;
+    char      (*fences)[LNAME_KEY_SZ];
+    long        log_count;
+} lname_index_t;
+
+//Output messages
+#define M_LNAME_NOT_FND     "No students with last name %s%s found in database.\n"
+#define M_ERR_LNAME_INDEX   "Error reading the last name index, exiting!\n"
+
+//prototypes for sdb_lname.c
+int lname_on_change(db_handle_t *h, const student_t *old, const student_t *rec);
+int lname_on_rebuild(db_handle_t *h);
+void lname_on_close(db_handle_t *h);
+int lname_lookup(db_handle_t *h, const char *key, bool prefix,
+                 lname_entry_t **out, long *n);
+int find_by_lname(int fd, char *lname, bool prefix);
+
+#endif
@@ -0,0 +1,237 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "db.h"
+#include "sdbsc.h"
+#include "sdb_handle.h"
+#include "sdb_mmap.h"
+#include "sdb_lock.h"
+#include "sdb_engine.h"
+#include "sdb_cache.h"
+
+//OFD locks (F_OFD_SETLKW) belong to the open file description rather than
+//the process, so two handles in the same process exclude each other too,
+//and closing some other fd on the same file does not drop them.  Readers
+//only ever take read locks, so any number of reader processes run in
+//parallel; writers lock just the 64 bytes of the record they change.
+
+/*
+ *  db_lock_range / db_unlock_range
+ *      h:          database handle
+ *      off, len:   byte range to lock
+ *      exclusive:  write lock instead of read lock
+ *
+ *  Blocks until the lock is granted.  Whether the kernel has OFD locks
+ *  was settled by db_lock_probe(), so any failure here is an error.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ */
+int db_lock_range(db_handle_t *h, off_t off, off_t len, bool exclusive)
+{
+    struct flock fl = {0};
+
+    if (!h->locking)
+        return NO_ERROR;
+    if (off < 0 || len <= 0)
+        return ERR_DB_FILE;
+
+    fl.l_type = exclusive ? F_WRLCK : F_RDLCK;
+    fl.l_whence = SEEK_SET;
+    fl.l_start = off;
+    fl.l_len = len;
+
+    while (fcntl(h->fd, F_OFD_SETLKW, &fl) == -1) {
+        if (errno != EINTR)
+            return ERR_DB_FILE;
+    }
+    return NO_ERROR;
+}
+
+/*
+ *  db_lock_probe
+ *      h:  database handle, just opened
+ *
+ *  Asks once whether the kernel has OFD locks.  Kernels without them
+ *  (EINVAL) are treated as if locking were turned off.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ */
+int db_lock_probe(db_handle_t *h)
+{
+    struct flock fl = {0};
+
+    if (!h->locking)
+        return NO_ERROR;
+
+    fl.l_type = F_RDLCK;
+    fl.l_whence = SEEK_SET;
+    fl.l_start = LOCK_GATE_OFF;
+    fl.l_len = 1;
+    if (fcntl(h->fd, F_OFD_GETLK, &fl) == 0)
+        return NO_ERROR;
+    if (errno != EINVAL)
+        return ERR_DB_FILE;
+    h->locking = false;
+    return NO_ERROR;
+}
+
+void db_unlock_range(db_handle_t *h, off_t off, off_t len)
+{
+    struct flock fl = {0};
+
+    if (!h->locking)
+        return;
+
+    fl.l_type = F_UNLCK;
+    fl.l_whence = SEEK_SET;
+    fl.l_start = off;
+    fl.l_len = len;
+    fcntl(h->fd, F_OFD_SETLK, &fl);
+}
+
+//true if the path now names a different file than the one we have open,
+//which is what compress_db() leaves behind after its rename()
+static bool file_replaced(db_handle_t *h)
+{
+    struct stat mine, now;
+
+    if (h->path[0] == '\0' || fstat(h->fd, &mine) == -1 ||
+        stat(h->path, &now) == -1)
+        return false;
+
+    return mine.st_dev != now.st_dev || mine.st_ino != now.st_ino;
+}
+
+/*
+ *  db_gate_enter
+ *      h:          database handle
+ *      exclusive:  true for operations that rewrite the file as a whole
+ *
+ *  Takes the gate lock at the start of an operation.  Calls nest; only the
+ *  outermost one locks, and a nested call cannot upgrade a shared gate to
+ *  an exclusive one.  Once the gate is held the handle is checked against
+ *  the path: if the file was replaced, h->fd is switched over to the new
+ *  file (keeping the same descriptor number) and the gate retaken there.
+ *  The mapping is refreshed so it covers the current file size.  All of
+ *  that is skipped while the shared layout generation (sdb_cache.h) has
+ *  not moved since the last check, which leaves one fcntl() per entry.
+ *
+ *  returns:  NO_ERROR, ERR_DB_FILE on lock or reopen errors, ERR_DB_OP for
+ *            an attempted upgrade
+ */
+int db_gate_enter(db_handle_t *h, bool exclusive)
+{
+    if (h->gate_depth > 0) {
+        if (exclusive && !h->gate_excl)
+            return ERR_DB_OP;
+        h->gate_depth++;
+        return NO_ERROR;
+    }
+
+    uint64_t layout = 0;
+    bool known;
+
+    for (;;) {
+        if (db_lock_range(h, LOCK_GATE_OFF, 1, exclusive) != NO_ERROR)
+            return ERR_DB_FILE;
+        known = cache_layout(h, &layout);
+        if (known && h->layout_ok && layout == h->layout) {
+            h->gate_depth = 1;
+            h->gate_excl = exclusive;
+            return NO_ERROR;
+        }
+        if (!h->locking || !file_replaced(h))
+            break;
+
+        db_unlock_range(h, LOCK_GATE_OFF, 1);
+        h->layout_ok = false;
+        if (db_handle_reopen(h) != NO_ERROR)
+            return ERR_DB_FILE;
+    }
+
+    h->gate_depth = 1;
+    h->gate_excl = exclusive;
+
+    if (map_refresh(h) != NO_ERROR) {
+        db_gate_leave(h);
+        return ERR_DB_FILE;
+    }
+    engine_check(h);
+    h->layout = layout;
+    h->layout_ok = known;
+    return NO_ERROR;
+}
+
+/*
+ *  db_gate_leave
+ *      h:  database handle
+ *
+ *  Undoes one db_gate_enter(), releasing the gate after the outermost one.
+ *  An exclusive gate may have been held to replace, truncate or reformat
+ *  the file, so the layout generation is bumped before it is released.
+ */
+void db_gate_leave(db_handle_t *h)
+{
+    if (h->gate_depth == 0)
+        return;
+    if (--h->gate_depth == 0) {
+        if (h->gate_excl)
+            cache_layout_changed(h, true);
+        db_unlock_range(h, LOCK_GATE_OFF, 1);
+    }
+}
+
+/*
+ *  db_lock_record / db_unlock_record
+ *      h:          database handle
+ *      id:         record to lock
+ *      exclusive:  write lock instead of read lock
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ */
+int db_lock_record(db_handle_t *h, int id, bool exclusive)
+{
+    return db_lock_range(h, (off_t)id * STUDENT_RECORD_SIZE,
+                         STUDENT_RECORD_SIZE, exclusive);
+}
+
+void db_unlock_record(db_handle_t *h, int id)
+{
+    db_unlock_range(h, (off_t)id * STUDENT_RECORD_SIZE, STUDENT_RECORD_SIZE);
+}
+
+/*
+ *  db_lock_change / db_unlock_change
+ *      h:   database handle, gate held
+ *      id:  record about to be changed
+ *
+ *  A change holds the meta lock exclusive from before its record lock
+ *  until the sidecars were told, so two writers of one id reach the
+ *  change log and the indexes in the order of their stores.  Sidecar
+ *  rebuilds scan the records under the meta lock, hence meta comes
+ *  first.  A change whose store could not be made safe for the lockless
+ *  readers fails here, before anything is logged (cache_may_store()).
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ */
+int db_lock_change(db_handle_t *h, int id)
+{
+    if (!cache_may_store(h) || db_lock_range(h, LOCK_META_OFF, 1, true) != NO_ERROR)
+        return ERR_DB_FILE;
+    if (db_lock_record(h, id, true) != NO_ERROR) {
+        db_unlock_range(h, LOCK_META_OFF, 1);
+        return ERR_DB_FILE;
+    }
+    return NO_ERROR;
+}
+
+void db_unlock_change(db_handle_t *h, int id)
+{
+    db_unlock_record(h, id);
+    db_unlock_range(h, LOCK_META_OFF, 1);
+}
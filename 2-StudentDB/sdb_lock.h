@@ -0,0 +1,46 @@
+#ifndef __SDB_LOCK_H__
+    #define __SDB_LOCK_H__
+
+#include <stdbool.h>
+#include <sys/types.h>
+
+#include "sdb_handle.h"
+
+//Multi-process access to one database, see sdb_lock.c.  All locks are
+//fcntl() open file description (OFD) byte range locks on the database fd:
+//
+//  gate      one byte far past any record.  Every operation holds it
+//            shared; operations that replace, truncate or shrink the file
+//            (compress, -z, crash recovery) hold it exclusive.
+//  records   the 64 bytes of a record (or a page range for scans).  Read
+//            locks for lookups and scans, write locks for add/delete.
+//  wal       serializes appends to and checkpoints of the write-ahead log
+//  meta      serializes updates to sidecar files (indexes, filters, ...)
+//  dir       the dense engine's header and directory, see sdb_dense.c,
+//            and the var engine's name heap, see sdb_var.c
+//  size      serializes growing the file with ftruncate()
+//
+//Locks are taken in the order gate, meta, records, wal, dir, size.  Sidecar
+//rebuilds scan, taking record read locks under meta, and a change takes
+//meta before its record write lock (db_lock_change) and keeps both until
+//the sidecars were told, so they see one id's changes in store order.
+//SDB_LOCKS=0 turns locking off for single-process use.
+
+#define LOCK_GATE_OFF       ((off_t)1 << 62)
+#define LOCK_WAL_OFF        (LOCK_GATE_OFF + 1)
+#define LOCK_META_OFF       (LOCK_GATE_OFF + 2)
+#define LOCK_SIZE_OFF       (LOCK_GATE_OFF + 3)
+#define LOCK_DIR_OFF        (LOCK_GATE_OFF + 4)
+
+//prototypes for sdb_lock.c
+int db_lock_range(db_handle_t *h, off_t off, off_t len, bool exclusive);
+int db_lock_probe(db_handle_t *h);
+void db_unlock_range(db_handle_t *h, off_t off, off_t len);
+int db_gate_enter(db_handle_t *h, bool exclusive);
+void db_gate_leave(db_handle_t *h);
+int db_lock_record(db_handle_t *h, int id, bool exclusive);
+void db_unlock_record(db_handle_t *h, int id);
+int db_lock_change(db_handle_t *h, int id);
+void db_unlock_change(db_handle_t *h, int id);
+
+#endif
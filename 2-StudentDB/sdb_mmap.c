@@ -0,0 +1,290 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "db.h"
+#include "sdbsc.h"
+#include "sdb_handle.h"
+#include "sdb_mmap.h"
+#include "sdb_cache.h"
+#include "sdb_lock.h"
+
+//The memory mapped storage engine.  The whole database file is mapped
+//MAP_SHARED once in open_db(), so lookups and updates are plain loads and
+//stores into the page cache instead of an lseek()+read()/write() pair per
+//record.  Since a student_t is exactly 64 bytes and the mapping is page
+//aligned, every record sits inside a single cache line.
+//
+//The mapping is usually larger than the file.  Only bytes below file_len are
+//ever touched, the rest is just reserved address space so the file can grow
+//without remapping on every add.
+
+static size_t page_size(void)
+{
+    static size_t pg = 0;
+
+    if (pg == 0)
+        pg = (size_t)sysconf(_SC_PAGESIZE);
+    return pg;
+}
+
+static size_t round_to_page(off_t len)
+{
+    size_t pg = page_size();
+
+    return ((size_t)len + pg - 1) & ~(pg - 1);
+}
+
+/*
+ *  remap
+ *      h:     database handle
+ *      need:  minimum number of bytes the mapping must cover
+ *
+ *  Creates the mapping, or grows it with mremap() when the file outgrew it.
+ *  The reservation at least doubles each time to keep remaps rare.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE if the mapping could not be created
+ */
+static int remap(db_handle_t *h, off_t need)
+{
+    size_t len = round_to_page(need);
+    void *p;
+
+    if (len <= h->map_len)
+        return NO_ERROR;
+    if (len < MAP_MIN_RESERVE)
+        len = MAP_MIN_RESERVE;
+    if (len < 2 * h->map_len)
+        len = 2 * h->map_len;
+
+    if (h->base == NULL) {
+        int prot = PROT_READ | (h->read_only ? 0 : PROT_WRITE);
+
+        p = mmap(NULL, len, prot, MAP_SHARED, h->fd, 0);
+    } else {
+        p = mremap(h->base, h->map_len, len, MREMAP_MAYMOVE);
+    }
+
+    if (p == MAP_FAILED)
+        return ERR_DB_FILE;
+
+    h->base = p;
+    h->map_len = len;
+    return NO_ERROR;
+}
+
+/*
+ *  map_attach
+ *      h:  handle whose fd should be mapped
+ *
+ *  Maps the database file.  An empty file is not mapped yet, the mapping
+ *  is created by the first map_reserve() call.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ */
+int map_attach(db_handle_t *h)
+{
+    int flags = fcntl(h->fd, F_GETFL);
+
+    if (flags == -1)
+        return ERR_DB_FILE;
+
+    h->read_only = ((flags & O_ACCMODE) == O_RDONLY);
+    h->base = NULL;
+    h->map_len = 0;
+    h->file_len = 0;
+    h->dirty_lo = h->dirty_hi = 0;
+
+    return map_refresh(h);
+}
+
+/*
+ *  map_detach
+ *      h:  handle to unmap
+ *
+ *  Drops the mapping.  Dirty pages stay in the page cache and are written
+ *  back by the kernel, call map_flush() first if they must be on disk.
+ */
+void map_detach(db_handle_t *h)
+{
+    if (h->base != NULL)
+        munmap(h->base, h->map_len);
+
+    h->base = NULL;
+    h->map_len = 0;
+    h->file_len = 0;
+}
+
+/*
+ *  map_refresh
+ *      h:  database handle
+ *
+ *  Picks up the current file size, which other processes (or a plain
+ *  write() on the same fd) may have changed, and grows the mapping to
+ *  cover it.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ */
+int map_refresh(db_handle_t *h)
+{
+    struct stat st;
+
+    if (fstat(h->fd, &st) == -1)
+        return ERR_DB_FILE;
+
+    h->file_len = st.st_size;
+    if (h->file_len == 0)
+        return NO_ERROR;
+
+    return remap(h, h->file_len);
+}
+
+/*
+ *  map_reserve
+ *      h:    database handle
+ *      len:  the file must be at least this many bytes long
+ *
+ *  Extends the file with ftruncate() (which leaves a hole, so no disk space
+ *  is used for the gap) and the mapping with mremap().  Never shrinks.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ */
+int map_reserve(db_handle_t *h, off_t len)
+{
+    if (len <= h->file_len)
+        return NO_ERROR;
+
+    //someone else may already have grown it, and a process growing it
+    //less far must not ftruncate() it back down, hence the size lock
+    if (db_lock_range(h, LOCK_SIZE_OFF, 1, true) != NO_ERROR)
+        return ERR_DB_FILE;
+    if (map_refresh(h) != NO_ERROR) {
+        db_unlock_range(h, LOCK_SIZE_OFF, 1);
+        return ERR_DB_FILE;
+    }
+
+    if (len > h->file_len) {
+        if (h->read_only || ftruncate(h->fd, len) == -1) {
+            db_unlock_range(h, LOCK_SIZE_OFF, 1);
+            return ERR_DB_FILE;
+        }
+        h->file_len = len;
+        cache_layout_changed(h, false);
+    }
+    db_unlock_range(h, LOCK_SIZE_OFF, 1);
+
+    return remap(h, h->file_len);
+}
+
+/*
+ *  map_slot
+ *      h:   database handle
+ *      id:  student id, which is also the record index in the file
+ *
+ *  returns:  pointer to the 64 byte record for id inside the mapping, or
+ *            NULL if that record lies beyond the end of the file
+ */
+student_t *map_slot(db_handle_t *h, int id)
+{
+    off_t end;
+
+    if (id < 0)
+        return NULL;
+
+    end = ((off_t)id + 1) * STUDENT_RECORD_SIZE;
+    if (end > h->file_len) {
+        if (map_refresh(h) != NO_ERROR || end > h->file_len)
+            return NULL;
+    }
+
+    return (student_t *)(h->base + (off_t)id * STUDENT_RECORD_SIZE);
+}
+
+/*
+ *  map_store
+ *      h:    database handle
+ *      id:   slot to write
+ *      rec:  64 byte record to store there
+ *
+ *  Grows the file if needed, copies the record into the mapping and marks
+ *  it dirty.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ */
+int map_store(db_handle_t *h, int id, const student_t *rec)
+{
+    off_t off = (off_t)id * STUDENT_RECORD_SIZE;
+
+    if (id < 0 || map_reserve(h, off + STUDENT_RECORD_SIZE) != NO_ERROR)
+        return ERR_DB_FILE;
+
+    *map_slot(h, id) = *rec;
+    map_dirty(h, off, STUDENT_RECORD_SIZE);
+    return NO_ERROR;
+}
+
+static int sync_range(db_handle_t *h, off_t lo, off_t hi)
+{
+    off_t start = lo & ~((off_t)page_size() - 1);
+
+    if (h->base == NULL || hi <= lo)
+        return NO_ERROR;
+
+    if (msync(h->base + start, (size_t)(hi - start), MS_SYNC) == -1)
+        return ERR_DB_FILE;
+    return NO_ERROR;
+}
+
+/*
+ *  map_dirty
+ *      h:    database handle
+ *      off:  file offset of the bytes that were just stored to
+ *      len:  number of bytes
+ *
+ *  Records a write through the mapping.  With the per-op msync policy the
+ *  page is flushed right away, otherwise the range is remembered for
+ *  map_flush().
+ */
+void map_dirty(db_handle_t *h, off_t off, size_t len)
+{
+    off_t end = off + (off_t)len;
+
+    if (h->msync_policy == MSYNC_PER_OP) {
+        sync_range(h, off, end);
+        return;
+    }
+
+    if (h->dirty_lo == h->dirty_hi) {
+        h->dirty_lo = off;
+        h->dirty_hi = end;
+        return;
+    }
+    if (off < h->dirty_lo)
+        h->dirty_lo = off;
+    if (end > h->dirty_hi)
+        h->dirty_hi = end;
+}
+
+/*
+ *  map_flush
+ *      h:  database handle
+ *
+ *  Synchronously writes back everything stored through the mapping since
+ *  the last flush.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE if msync() failed
+ */
+int map_flush(db_handle_t *h)
+{
+    int rc = sync_range(h, h->dirty_lo, h->dirty_hi);
+
+    if (rc == NO_ERROR)
+        h->dirty_lo = h->dirty_hi = 0;
+    return rc;
+}
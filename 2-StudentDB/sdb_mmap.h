@@ -0,0 +1,21 @@
+#ifndef __SDB_MMAP_H__
+    #define __SDB_MMAP_H__
+
+#include "db.h"
+#include "sdb_handle.h"
+
+//Smallest mapping we bother creating, the mapping then doubles as the file
+//grows so mremap() is only called O(log n) times
+#define MAP_MIN_RESERVE     (1024 * 1024)
+
+//prototypes for sdb_mmap.c
+int map_attach(db_handle_t *h);
+void map_detach(db_handle_t *h);
+int map_refresh(db_handle_t *h);
+int map_reserve(db_handle_t *h, off_t len);
+student_t *map_slot(db_handle_t *h, int id);
+int map_store(db_handle_t *h, int id, const student_t *rec);
+void map_dirty(db_handle_t *h, off_t off, size_t len);
+int map_flush(db_handle_t *h);
+
+#endif
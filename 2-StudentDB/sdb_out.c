@@ -0,0 +1,478 @@
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "db.h"
+#include "sdbsc.h"
+#include "sdb_engine.h"
+#include "sdb_out.h"
+
+//printf() parses its format string and walks its varargs for every row,
+//and that was most of the time -p spent on a large database.  The rows
+//here are built with memcpy() and a two digits at a time integer
+//formatter.  GPAs are stored in hundredths, so the fixed point text is
+//just the integer with a dot before the last two digits; that is the
+//same text "%.2f" prints for gpa / 100.0f over the range we accept, and
+//anything outside it (a damaged record) still goes through snprintf().
+
+#define TABLE_ID_W      6
+#define TABLE_FNAME_W   24
+#define TABLE_LNAME_W   32
+
+static const char digit_pairs[] =
+    "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+    "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+
+static const char *const format_names[] = {
+    [OUT_TABLE]  = "table",
+    [OUT_TSV]    = "tsv",
+    [OUT_JSONL]  = "jsonl",
+    [OUT_BINARY] = "binary",
+};
+
+/*
+ *  put_int
+ *      p:  where to write
+ *      v:  value
+ *
+ *  returns:  the end of the decimal text of v, no terminator
+ */
+static char *put_int(char *p, int v)
+{
+    char tmp[12];
+    char *t = tmp + sizeof(tmp);
+    uint32_t u = v < 0 ? 0u - (uint32_t)v : (uint32_t)v;
+
+    while (u >= 100) {
+        t -= 2;
+        memcpy(t, &digit_pairs[(u % 100) * 2], 2);
+        u /= 100;
+    }
+    if (u >= 10) {
+        t -= 2;
+        memcpy(t, &digit_pairs[u * 2], 2);
+    } else {
+        *--t = '0' + u;
+    }
+    if (v < 0)
+        *--t = '-';
+
+    memcpy(p, t, tmp + sizeof(tmp) - t);
+    return p + (tmp + sizeof(tmp) - t);
+}
+
+/*
+ *  put_gpa
+ *      p:    where to write
+ *      gpa:  GPA in hundredths
+ *
+ *  returns:  the end of gpa as "%.2f" prints gpa / 100.0f
+ */
+static char *put_gpa(char *p, int gpa)
+{
+    if (gpa < 0 || gpa > 100 * MAX_STD_GPA)
+        return p + snprintf(p, 16, "%.2f", gpa / 100.0f);
+
+    p = put_int(p, gpa / 100);
+    *p++ = '.';
+    memcpy(p, &digit_pairs[(gpa % 100) * 2], 2);
+    return p + 2;
+}
+
+/*
+ *  put_padded
+ *      p:      where to write
+ *      s:      field, not necessarily NUL terminated
+ *      max:    size of the field
+ *
+ *  returns:  the end of s, cut at max and padded with spaces to max, as
+ *            "%-max.maxs" prints it
+ */
+static char *put_padded(char *p, const char *s, size_t max)
+{
+    size_t n = strnlen(s, max);
+
+    memcpy(p, s, n);
+    memset(p + n, ' ', max - n);
+    return p + max;
+}
+
+/*
+ *  put_escaped
+ *      p:      where to write
+ *      s:      field, not necessarily NUL terminated
+ *      max:    size of the field
+ *      json:   escape for a JSON string, otherwise for a TSV field
+ *
+ *  Names are copied a run at a time up to the next byte that needs an
+ *  escape, which for real names is the end of the name.  At most 6 bytes
+ *  are written per input byte.
+ *
+ *  returns:  the end of the escaped text
+ */
+static char *put_escaped(char *p, const char *s, size_t max, bool json)
+{
+    size_t n = strnlen(s, max);
+    size_t i = 0;
+
+    while (i < n) {
+        size_t run = i;
+        unsigned char c;
+
+        while (run < n && (unsigned char)s[run] >= 0x20 && s[run] != '\\' &&
+               s[run] != (json ? '"' : '\t') && s[run] != 0x7f)
+            run++;
+        memcpy(p, s + i, run - i);
+        p += run - i;
+        if (run == n)
+            break;
+
+        c = s[run];
+        *p++ = '\\';
+        if (c == '\\' || c == '"')
+            *p++ = c;
+        else if (c == '\t')
+            *p++ = 't';
+        else if (c == '\n')
+            *p++ = 'n';
+        else if (c == '\r')
+            *p++ = 'r';
+        else if (json)
+            p += sprintf(p, "u%04x", c);
+        else
+            p += sprintf(p, "x%02x", c);
+        i = run + 1;
+    }
+    return p;
+}
+
+/*
+ *  put_json
+ *      p:      where to write
+ *      s:      student
+ *      names:  full names of s, NULL to use the ones s holds
+ *
+ *  returns:  the end of the "id":..,"fname":..,"lname":..,"gpa":.. members
+ *            of s's JSON object, without the braces
+ */
+static char *put_json(char *p, const student_t *s, const student_names_t *names)
+{
+    memcpy(p, "\"id\":", 5);
+    p = put_int(p + 5, s->id);
+    memcpy(p, ",\"fname\":\"", 10);
+    if (names != NULL)
+        p = put_escaped(p + 10, names->fname, sizeof(names->fname), true);
+    else
+        p = put_escaped(p + 10, s->fname, sizeof(s->fname), true);
+    memcpy(p, "\",\"lname\":\"", 11);
+    if (names != NULL)
+        p = put_escaped(p + 11, names->lname, sizeof(names->lname), true);
+    else
+        p = put_escaped(p + 11, s->lname, sizeof(s->lname), true);
+    memcpy(p, "\",\"gpa\":", 8);
+    return put_gpa(p + 8, s->gpa);
+}
+
+/*
+ *  write_all
+ *      fd:   where to write
+ *      buf:  bytes to write
+ *      len:  how many
+ *
+ *  Writes all of buf, retrying short writes.
+ *
+ *  returns:  0, or 1 when a write failed
+ */
+static int write_all(int fd, const char *buf, size_t len)
+{
+    size_t done = 0;
+
+    while (done < len) {
+        ssize_t w = write(fd, buf + done, len - done);
+
+        if (w < 0 && errno == EINTR)
+            continue;
+        if (w <= 0)
+            return 1;
+        done += w;
+    }
+    return 0;
+}
+
+/*
+ *  out_flush
+ *      o:  output buffer
+ *
+ *  Writes the buffered bytes.  A memory buffer is doubled in size instead
+ *  (rows are dropped and err set if that fails).
+ */
+void out_flush(sdb_out_t *o)
+{
+    if (o->fd == -1) {
+        size_t cap = o->cap ? o->cap * 2 : OUT_BUF_SZ;
+        char *buf = o->err ? NULL : realloc(o->buf, cap);
+
+        if (buf == NULL) {
+            o->err = 1;
+            o->len = 0;
+            return;
+        }
+        o->buf = buf;
+        o->cap = cap;
+        return;
+    }
+
+    if (!o->err)
+        o->err = write_all(o->fd, o->buf, o->len);
+    o->len = 0;
+}
+
+/*
+ *  out_format_named
+ *      name:    "table", "tsv", "jsonl" or "binary"
+ *      format:  set to the encoding name stands for
+ *
+ *  returns:  NO_ERROR, or ERR_DB_OP for an unknown name
+ */
+int out_format_named(const char *name, out_format_t *format)
+{
+    for (size_t i = 0; i < sizeof(format_names) / sizeof(format_names[0]); i++) {
+        if (strcmp(name, format_names[i]) == 0) {
+            *format = i;
+            return NO_ERROR;
+        }
+    }
+    return ERR_DB_OP;
+}
+
+/*
+ *  out_open
+ *      fd:      where the rows go, usually STDOUT_FILENO
+ *      format:  encoding of the rows
+ *
+ *  Anything already printed to stdout is flushed first, so the rows land
+ *  after it.  The tsv header goes out even when no rows follow; the table
+ *  header waits for the first row, like print_db() always did.
+ *
+ *  returns:  the output buffer, or NULL when out of memory
+ */
+sdb_out_t *out_open(int fd, out_format_t format)
+{
+    sdb_out_t *o = malloc(sizeof(*o));
+
+    if (o == NULL)
+        return NULL;
+    o->buf = fd == -1 ? NULL : malloc(OUT_BUF_SZ);
+    if (fd != -1 && o->buf == NULL) {
+        free(o);
+        return NULL;
+    }
+    if (fd != -1)
+        fflush(stdout);
+
+    o->fd = fd;
+    o->format = format;
+    o->rows = 0;
+    o->err = 0;
+    o->len = 0;
+    o->cap = fd == -1 ? 0 : OUT_BUF_SZ;
+    if (format == OUT_TSV && fd != -1) {
+        static const char hdr[] = "id\tfname\tlname\tgpa\n";
+
+        memcpy(o->buf, hdr, sizeof(hdr) - 1);
+        o->len = sizeof(hdr) - 1;
+    }
+    return o;
+}
+
+/*
+ *  out_open_mem
+ *      format:  encoding of the rows
+ *
+ *  An output buffer that keeps its rows in memory until out_drain() hands
+ *  them on.  No header is ever written into it.
+ *
+ *  returns:  the buffer, or NULL when out of memory
+ */
+sdb_out_t *out_open_mem(out_format_t format)
+{
+    return out_open(-1, format);
+}
+
+/*
+ *  out_student
+ *      o:  output buffer
+ *      s:  student to write
+ */
+void out_student(sdb_out_t *o, const student_t *s)
+{
+    char *p;
+
+    if (o->len + OUT_ROW_MAX > o->cap) {
+        out_flush(o);
+        if (o->len + OUT_ROW_MAX > o->cap)
+            return;
+    }
+    p = o->buf + o->len;
+
+    switch (o->format) {
+    case OUT_TABLE:
+        if (o->rows == 0 && o->fd != -1)
+            p += sprintf(p, STUDENT_PRINT_HDR_STRING, "ID", "FIRST_NAME",
+                         "LAST_NAME", "GPA");
+        {
+            char *id = p;
+
+            p = put_int(p, s->id);
+            if (p - id < TABLE_ID_W) {
+                memset(p, ' ', TABLE_ID_W - (p - id));
+                p = id + TABLE_ID_W;
+            }
+        }
+        *p++ = ' ';
+        p = put_padded(p, s->fname, TABLE_FNAME_W);
+        *p++ = ' ';
+        p = put_padded(p, s->lname, TABLE_LNAME_W);
+        *p++ = ' ';
+        p = put_gpa(p, s->gpa);
+        *p++ = '\n';
+        break;
+
+    case OUT_TSV:
+        p = put_int(p, s->id);
+        *p++ = '\t';
+        p = put_escaped(p, s->fname, sizeof(s->fname), false);
+        *p++ = '\t';
+        p = put_escaped(p, s->lname, sizeof(s->lname), false);
+        *p++ = '\t';
+        p = put_gpa(p, s->gpa);
+        *p++ = '\n';
+        break;
+
+    case OUT_JSONL:
+        *p++ = '{';
+        p = put_json(p, s, NULL);
+        memcpy(p, "}\n", 2);
+        p += 2;
+        break;
+
+    case OUT_BINARY:
+        memcpy(p, s, sizeof(*s));
+        p += sizeof(*s);
+        break;
+    }
+
+    o->len = p - o->buf;
+    o->rows++;
+}
+
+/*
+ *  out_change
+ *      o:      output buffer, written as JSON lines whatever its format
+ *      seq:    sequence number of the change
+ *      op:     "add", "del", "update" or "reset"
+ *      s:      the student the change left (the deleted one for "del"),
+ *              NULL for "reset"
+ *      names:  full names of s, NULL to print the ones s holds
+ *
+ *  One {"seq":..,"op":..,"id":..,"fname":..,"lname":..,"gpa":..} line of
+ *  the change log, see sdb_cdc.h.
+ */
+void out_change(sdb_out_t *o, uint64_t seq, const char *op, const student_t *s,
+                const student_names_t *names)
+{
+    char *p;
+
+    if (o->len + OUT_CHANGE_MAX > o->cap) {
+        out_flush(o);
+        if (o->len + OUT_CHANGE_MAX > o->cap)
+            return;
+    }
+    p = o->buf + o->len;
+
+    p += sprintf(p, "{\"seq\":%llu,\"op\":\"%s\"", (unsigned long long)seq, op);
+    if (s != NULL) {
+        *p++ = ',';
+        p = put_json(p, s, names);
+    }
+    memcpy(p, "}\n", 2);
+    p += 2;
+
+    o->len = p - o->buf;
+    o->rows++;
+}
+
+/*
+ *  out_page
+ *      o:         output buffer
+ *      recs:      a page of records, as handed to a scan_page_fn
+ *      occupied:  bit i set when recs[i] is a student
+ */
+void out_page(sdb_out_t *o, const student_t *recs, uint64_t occupied)
+{
+    while (occupied) {
+        out_student(o, &recs[__builtin_ctzll(occupied)]);
+        occupied &= occupied - 1;
+    }
+}
+
+/*
+ *  out_drain
+ *      o:     output buffer
+ *      from:  memory buffer of rows in the same encoding, emptied
+ *
+ *  Appends the rows of from to o, writing them straight out when they do
+ *  not fit in o's buffer.  The table header goes first if o has had no
+ *  rows yet.
+ */
+void out_drain(sdb_out_t *o, sdb_out_t *from)
+{
+    if (from->err)
+        o->err = 1;
+    if (from->rows > 0 && o->rows == 0 && o->format == OUT_TABLE) {
+        if (o->len + OUT_ROW_MAX > o->cap)
+            out_flush(o);
+        o->len += sprintf(o->buf + o->len, STUDENT_PRINT_HDR_STRING, "ID",
+                          "FIRST_NAME", "LAST_NAME", "GPA");
+    }
+
+    if (o->len + from->len > o->cap) {
+        out_flush(o);
+        if (!o->err && o->fd != -1)
+            o->err = write_all(o->fd, from->buf, from->len);
+    } else {
+        memcpy(o->buf + o->len, from->buf, from->len);
+        o->len += from->len;
+    }
+    o->rows += from->rows;
+    from->rows = 0;
+    from->err = 0;
+    from->len = 0;
+}
+
+/*
+ *  out_close
+ *      o:  output buffer, freed
+ *
+ *  returns:  NO_ERROR, or ERR_DB_FILE if any write failed
+ *
+ *  console:  M_ERR_OUT_WRITE on stderr when a write failed
+ */
+int out_close(sdb_out_t *o)
+{
+    int rc;
+
+    if (o->fd != -1)
+        out_flush(o);
+    rc = o->err ? ERR_DB_FILE : NO_ERROR;
+    if (o->err && o->fd != -1)
+        fprintf(stderr, M_ERR_OUT_WRITE);
+    free(o->buf);
+    free(o);
+    return rc;
+}
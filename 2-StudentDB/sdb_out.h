@@ -0,0 +1,63 @@
+#ifndef __SDB_OUT_H__
+    #define __SDB_OUT_H__
+
+#include <stdint.h>
+
+#include "db.h"
+
+typedef struct student_names student_names_t;     //see sdb_engine.h
+
+//Bulk output of student records, see sdb_out.c.  Rows are formatted by
+//hand into one large buffer that goes out with write() when it fills, so
+//printing millions of students costs a few hundred system calls and no
+//printf() parsing.  The table encoding is byte for byte what
+//STUDENT_PRINT_HDR_STRING and STUDENT_PRINT_FMT_STRING produce.
+//
+//  table   the -p table, header first
+//  tsv     id, fname, lname, gpa separated by tabs, with a header line
+//  jsonl   one {"id":..,"fname":..,"lname":..,"gpa":..} object per line
+//  binary  the 64 byte student_t records as stored, no header
+//
+//A parallel scan formats rows on every worker into a memory buffer from
+//out_open_mem(), which grows instead of being written, and out_drain()
+//passes each one on to the real output in id order.
+
+#define OUT_BUF_SZ          (256 * 1024)
+#define OUT_ROW_MAX         512     //longest row any encoding can produce
+#define OUT_CHANGE_MAX      (OUT_ROW_MAX + 3072)    //a change with full names,
+                                                    //6 bytes per name byte
+
+typedef enum {
+    OUT_TABLE,
+    OUT_TSV,
+    OUT_JSONL,
+    OUT_BINARY,
+} out_format_t;
+
+typedef struct sdb_out {
+    int          fd;            //-1 for a memory buffer
+    out_format_t format;
+    long         rows;          //records written so far
+    int          err;           //set once a write() or realloc() failed
+    size_t       len;
+    size_t       cap;
+    char        *buf;
+} sdb_out_t;
+
+//Output messages
+#define M_ERR_OUT_FORMAT    "Unknown output format %s, use table, tsv, jsonl or binary.\n"
+#define M_ERR_OUT_WRITE     "Error writing output, exiting!\n"
+
+//prototypes for sdb_out.c
+int out_format_named(const char *name, out_format_t *format);
+sdb_out_t *out_open(int fd, out_format_t format);
+sdb_out_t *out_open_mem(out_format_t format);
+void out_student(sdb_out_t *o, const student_t *s);
+void out_change(sdb_out_t *o, uint64_t seq, const char *op, const student_t *s,
+                const student_names_t *names);
+void out_page(sdb_out_t *o, const student_t *recs, uint64_t occupied);
+void out_drain(sdb_out_t *o, sdb_out_t *from);
+void out_flush(sdb_out_t *o);
+int out_close(sdb_out_t *o);
+
+#endif
@@ -0,0 +1,471 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "db.h"
+#include "sdbsc.h"
+#include "sdb_handle.h"
+#include "sdb_lock.h"
+#include "sdb_scan.h"
+#include "sdb_out.h"
+#include "sdb_cols.h"
+#include "sdb_rank.h"
+
+//With a few hundred possible GPAs a sorted structure over (gpa, id) is
+//nothing but a bucket per GPA: the counts answer rank and range
+//questions with at most RANK_LEVELS additions, and a bucket's bitmap
+//hands its ids out already in id order.  The summary words let a walk
+//skip the empty parts of a bucket 4096 ids at a time, so top 100 reads
+//a few pages of the index however many students there are.
+//
+//The index is shared by every process and changed under the meta lock
+//like the other sidecars; readers take the meta lock shared.  Adding an
+//id that is already set or removing one that is not changes nothing, so
+//a change that a rebuild's scan already saw can be applied again after
+//it safely.  A build starts from an empty (sparse) file and writes the
+//magic last; until then the index is not current and the next user
+//builds it again.
+
+typedef struct rank_index {
+    int         ffd;            //the sidecar, -1 when not open
+    rank_hdr_t *hdr;            //mapped sidecar, NULL when not mapped
+    uint32_t   *counts;
+    uint64_t   *summary;
+    uint64_t   *bits;
+    bool        asked;          //on_change() already asked for a build
+    uint64_t    dev, ino;       //identity of the database we have open
+} rank_index_t;
+
+/*
+ *  rank_map
+ *      h:       database handle
+ *      r:       index state to map the sidecar into
+ *      create:  create the sidecar when it does not exist
+ *
+ *  Leaves r->hdr NULL when there is no sidecar or it cannot be mapped.
+ */
+static void rank_map(db_handle_t *h, rank_index_t *r, bool create)
+{
+    char path[PATH_MAX];
+    struct stat st;
+    void *p;
+
+    if (fstat(h->fd, &st) == -1 ||
+        db_sidecar_path(h, RANK_SUFFIX, path, sizeof(path)) != NO_ERROR)
+        return;
+    r->dev = st.st_dev;
+    r->ino = st.st_ino;
+
+    if (h->read_only)
+        r->ffd = open(path, O_RDONLY | O_CLOEXEC);
+    else
+        r->ffd = open(path, (create ? O_RDWR | O_CREAT : O_RDWR) | O_CLOEXEC, 0644);
+    if (r->ffd == -1)
+        return;
+    if (fstat(r->ffd, &st) == -1 ||
+        (st.st_size < (off_t)RANK_FILE_SZ &&
+         (!create || h->read_only || ftruncate(r->ffd, RANK_FILE_SZ) == -1))) {
+        close(r->ffd);
+        r->ffd = -1;
+        return;
+    }
+    p = mmap(NULL, RANK_FILE_SZ, PROT_READ | (h->read_only ? 0 : PROT_WRITE),
+             MAP_SHARED, r->ffd, 0);
+    if (p == MAP_FAILED) {
+        close(r->ffd);
+        r->ffd = -1;
+        return;
+    }
+
+    r->hdr = p;
+    r->counts = (uint32_t *)(r->hdr + 1);
+    r->summary = (uint64_t *)((char *)p + RANK_SUM_OFF);
+    r->bits = (uint64_t *)((char *)p + RANK_BITS_OFF);
+}
+
+//the index of h, mapped if the sidecar exists, or NULL
+static rank_index_t *rank_get(db_handle_t *h)
+{
+    rank_index_t *r = h->rank;
+
+    if (r == NULL) {
+        r = calloc(1, sizeof(*r));
+        if (r == NULL)
+            return NULL;
+        r->ffd = -1;
+        h->rank = r;
+    }
+    if (r->hdr == NULL)
+        rank_map(h, r, false);
+    return r->hdr != NULL ? r : NULL;
+}
+
+//true when the index is whole and was built for the database r was
+//mapped for, meta lock held
+static bool rank_current(const rank_index_t *r)
+{
+    return memcmp(r->hdr->magic, RANK_MAGIC, sizeof(r->hdr->magic)) == 0 &&
+           r->hdr->version == RANK_VERSION &&
+           r->hdr->db_dev == r->dev && r->hdr->db_ino == r->ino;
+}
+
+static uint64_t *level_bits(const rank_index_t *r, int level)
+{
+    return r->bits + (size_t)level * RANK_WORDS;
+}
+
+static uint64_t *level_summary(const rank_index_t *r, int level)
+{
+    return r->summary + (size_t)level * RANK_SUM_WORDS;
+}
+
+static void set_id(rank_index_t *r, int gpa, int id)
+{
+    int level = gpa - MIN_STD_GPA, w = id / 64;
+    uint64_t *bits, m = 1ULL << (id % 64);
+
+    if (level < 0 || level >= RANK_LEVELS || id < MIN_STD_ID || id > MAX_STD_ID)
+        return;
+    bits = level_bits(r, level);
+    if (bits[w] & m)
+        return;
+    bits[w] |= m;
+    level_summary(r, level)[w / 64] |= 1ULL << (w % 64);
+    r->counts[level]++;
+    r->hdr->nstudents++;
+}
+
+static void clear_id(rank_index_t *r, int gpa, int id)
+{
+    int level = gpa - MIN_STD_GPA, w = id / 64;
+    uint64_t *bits, m = 1ULL << (id % 64);
+
+    if (level < 0 || level >= RANK_LEVELS || id < MIN_STD_ID || id > MAX_STD_ID)
+        return;
+    bits = level_bits(r, level);
+    if (!(bits[w] & m))
+        return;
+    bits[w] &= ~m;
+    if (bits[w] == 0)
+        level_summary(r, level)[w / 64] &= ~(1ULL << (w % 64));
+    r->counts[level]--;
+    r->hdr->nstudents--;
+}
+
+/*
+ *  rank_on_change
+ *      h:    database handle, meta lock held exclusive
+ *      old:  record before the change
+ *      rec:  record after the change
+ *
+ *  Sidecar hook.  Moves the id to its new GPA.  A missing or stale index
+ *  is built, once per handle.
+ *
+ *  returns:  NO_ERROR, or ERR_DB_FILE to have the index built
+ */
+int rank_on_change(db_handle_t *h, const student_t *old, const student_t *rec)
+{
+    rank_index_t *r = rank_get(h);
+
+    if (r == NULL || !rank_current(r)) {
+        if (h->rank == NULL || h->rank->asked || h->read_only)
+            return NO_ERROR;
+        h->rank->asked = true;
+        return ERR_DB_FILE;
+    }
+    if (old->id != 0)
+        clear_id(r, old->gpa, old->id);
+    if (rec->id != 0)
+        set_id(r, rec->gpa, rec->id);
+    return NO_ERROR;
+}
+
+static int add_page(void *arg, int first, const student_t *recs, int n,
+                    uint64_t occupied)
+{
+    rank_index_t *r = arg;
+    (void)first; (void)n;
+
+    while (occupied) {
+        const student_t *s = &recs[__builtin_ctzll(occupied)];
+
+        set_id(r, s->gpa, s->id);
+        occupied &= occupied - 1;
+    }
+    return NO_ERROR;
+}
+
+/*
+ *  rank_on_rebuild
+ *      h:  database handle, gate and meta lock held
+ *
+ *  Sidecar hook.  Creates the index if needed and builds it from a scan
+ *  of the records.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ */
+int rank_on_rebuild(db_handle_t *h)
+{
+    rank_index_t *r;
+
+    if (h->read_only)
+        return NO_ERROR;
+    if (rank_get(h) == NULL && h->rank != NULL)
+        rank_map(h, h->rank, true);
+    r = h->rank;
+    if (r == NULL || r->hdr == NULL)
+        return ERR_DB_FILE;
+
+    //back to holes, the build only touches the pages of the ids it sets
+    if (ftruncate(r->ffd, 0) == -1 || ftruncate(r->ffd, RANK_FILE_SZ) == -1 ||
+        scan_db(h, add_page, r) != NO_ERROR)
+        return ERR_DB_FILE;
+
+    r->hdr->version = RANK_VERSION;
+    r->hdr->db_dev = r->dev;
+    r->hdr->db_ino = r->ino;
+    memcpy(r->hdr->magic, RANK_MAGIC, sizeof(r->hdr->magic));
+    return NO_ERROR;
+}
+
+/*
+ *  rank_on_close
+ *      h:  database handle
+ *
+ *  Sidecar hook.  Unmaps the index.
+ */
+void rank_on_close(db_handle_t *h)
+{
+    rank_index_t *r = h->rank;
+
+    if (r == NULL)
+        return;
+    if (r->hdr != NULL)
+        munmap(r->hdr, RANK_FILE_SZ);
+    if (r->ffd != -1)
+        close(r->ffd);
+    free(r);
+    h->rank = NULL;
+}
+
+/*
+ *  open_index
+ *      h:  database handle, gate held
+ *
+ *  Takes the meta lock shared, or exclusive when the index has to be
+ *  built first (upgrading in place could deadlock two readers).
+ *
+ *  returns:  the index with the meta lock held, or NULL with it released
+ */
+static rank_index_t *open_index(db_handle_t *h)
+{
+    rank_index_t *r;
+
+    if (db_lock_range(h, LOCK_META_OFF, 1, false) != NO_ERROR)
+        return NULL;
+    r = rank_get(h);
+    if (r != NULL && rank_current(r))
+        return r;
+
+    db_unlock_range(h, LOCK_META_OFF, 1);
+    if (db_lock_range(h, LOCK_META_OFF, 1, true) != NO_ERROR)
+        return NULL;
+    r = rank_get(h);
+    if ((r == NULL || !rank_current(r)) && rank_on_rebuild(h) == NO_ERROR)
+        r = h->rank;
+    if (r == NULL || r->hdr == NULL || !rank_current(r)) {
+        db_unlock_range(h, LOCK_META_OFF, 1);
+        return NULL;
+    }
+    return r;
+}
+
+//the ids with GPA level in id order, at most max of them
+static int level_ids(const rank_index_t *r, int level, int *ids, int max)
+{
+    const uint64_t *sum = level_summary(r, level), *bits = level_bits(r, level);
+    int n = 0;
+
+    for (int sw = 0; sw < RANK_SUM_WORDS && n < max; sw++) {
+        for (uint64_t s = sum[sw]; s != 0 && n < max; s &= s - 1) {
+            int w = sw * 64 + __builtin_ctzll(s);
+
+            for (uint64_t b = bits[w]; b != 0 && n < max; b &= b - 1)
+                ids[n++] = w * 64 + __builtin_ctzll(b);
+        }
+    }
+    return n;
+}
+
+/*
+ *  rank_top
+ *      fd:    linux file descriptor
+ *      best:  highest GPAs first instead of lowest
+ *      k:     number of students to print
+ *
+ *  Prints the k students with the highest (-k top) or lowest (-k bottom)
+ *  GPAs, ties in id order, in the same format as print_db().  The ids
+ *  come from the index, the records are read afterwards, so a student
+ *  changed in between is printed as it is now.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ *
+ *  console:  the table, M_GPA_NONE, M_ERR_RANK or M_ERR_DB_READ
+ */
+int rank_top(int fd, bool best, int k)
+{
+    db_handle_t *h = db_handle_get(fd);
+    rank_index_t *r;
+    student_t *recs = NULL;
+    int *ids = NULL, *rcs = NULL, n = 0, rc = NO_ERROR;
+    sdb_out_t *o;
+
+    if (h == NULL || db_gate_enter(h, false) != NO_ERROR) {
+        printf(M_ERR_DB_READ);
+        return ERR_DB_FILE;
+    }
+    r = open_index(h);
+    if (r == NULL) {
+        db_gate_leave(h);
+        printf(M_ERR_RANK);
+        return ERR_DB_FILE;
+    }
+    if (k > r->hdr->nstudents)
+        k = (int)r->hdr->nstudents;
+    ids = malloc((size_t)(k ? k : 1) * sizeof(*ids));
+    for (int i = 0; ids != NULL && i < RANK_LEVELS && n < k; i++) {
+        int level = best ? RANK_LEVELS - 1 - i : i;
+
+        if (r->counts[level] != 0)
+            n += level_ids(r, level, ids + n, k - n);
+    }
+    db_unlock_range(h, LOCK_META_OFF, 1);
+
+    recs = malloc((size_t)(n ? n : 1) * sizeof(*recs));
+    rcs = malloc((size_t)(n ? n : 1) * sizeof(*rcs));
+    if (ids == NULL || recs == NULL || rcs == NULL ||
+        (n > 0 && get_students(fd, ids, n, recs, rcs) != NO_ERROR))
+        rc = ERR_DB_FILE;
+    db_gate_leave(h);
+
+    if (rc == NO_ERROR && n == 0) {
+        printf(M_GPA_NONE);
+    } else if (rc == NO_ERROR) {
+        o = out_open(STDOUT_FILENO, OUT_TABLE);
+        for (int i = 0; o != NULL && i < n; i++) {
+            if (rcs[i] == NO_ERROR)
+                out_student(o, &recs[i]);
+        }
+        if (o == NULL || out_close(o) != NO_ERROR)
+            rc = ERR_DB_FILE;
+    }
+    if (rc != NO_ERROR)
+        printf(M_ERR_DB_READ);
+    free(ids);
+    free(recs);
+    free(rcs);
+    return rc;
+}
+
+/*
+ *  rank_of
+ *      fd:  linux file descriptor
+ *      id:  student to rank
+ *
+ *  Prints where student id stands by GPA (-k rank), 1 being the highest
+ *  GPA and ties ranked in id order, and the share of students with a
+ *  lower GPA.
+ *
+ *  returns:  NO_ERROR, SRCH_NOT_FOUND or ERR_DB_FILE
+ *
+ *  console:  M_RANK_OF, M_STD_NOT_FND_MSG, M_ERR_RANK or M_ERR_DB_READ
+ */
+int rank_of(int fd, int id)
+{
+    db_handle_t *h = db_handle_get(fd);
+    rank_index_t *r;
+    student_t s;
+    long above = 0, within = 0, total, below;
+    int level, rc;
+
+    if (h == NULL || db_gate_enter(h, false) != NO_ERROR) {
+        printf(M_ERR_DB_READ);
+        return ERR_DB_FILE;
+    }
+    rc = get_student(fd, id, &s);
+    if (rc != NO_ERROR) {
+        db_gate_leave(h);
+        if (rc == SRCH_NOT_FOUND)
+            printf(M_STD_NOT_FND_MSG, id);
+        else
+            printf(M_ERR_DB_READ);
+        return rc;
+    }
+    r = open_index(h);
+    if (r == NULL) {
+        db_gate_leave(h);
+        printf(M_ERR_RANK);
+        return ERR_DB_FILE;
+    }
+
+    level = s.gpa - MIN_STD_GPA;
+    for (int l = level + 1; l < RANK_LEVELS; l++)
+        above += r->counts[l];
+    if (level >= 0 && level < RANK_LEVELS) {
+        const uint64_t *bits = level_bits(r, level);
+
+        for (int w = 0; w < id / 64; w++)
+            within += __builtin_popcountll(bits[w]);
+        within += __builtin_popcountll(bits[id / 64] & ((1ULL << (id % 64)) - 1));
+    }
+    total = r->hdr->nstudents;
+    below = total - above - (level >= 0 && level < RANK_LEVELS ? r->counts[level] : 0);
+    db_unlock_range(h, LOCK_META_OFF, 1);
+    db_gate_leave(h);
+
+    printf(M_RANK_OF, id, above + within + 1, total, s.gpa / 100.0,
+           total > 0 ? 100.0 * below / total : 0.0);
+    return NO_ERROR;
+}
+
+/*
+ *  rank_count
+ *      fd:      linux file descriptor
+ *      lo, hi:  GPA range, inclusive, as 3 digit ints like -a takes
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ *
+ *  console:  M_RANK_COUNT, M_ERR_RANK or M_ERR_DB_READ
+ */
+int rank_count(int fd, int lo, int hi)
+{
+    db_handle_t *h = db_handle_get(fd);
+    rank_index_t *r;
+    long n = 0;
+
+    if (h == NULL || db_gate_enter(h, false) != NO_ERROR) {
+        printf(M_ERR_DB_READ);
+        return ERR_DB_FILE;
+    }
+    r = open_index(h);
+    if (r == NULL) {
+        db_gate_leave(h);
+        printf(M_ERR_RANK);
+        return ERR_DB_FILE;
+    }
+    for (int g = lo; g <= hi; g++)
+        n += r->counts[g - MIN_STD_GPA];
+    db_unlock_range(h, LOCK_META_OFF, 1);
+    db_gate_leave(h);
+
+    printf(M_RANK_COUNT, n, lo / 100.0, hi / 100.0);
+    return NO_ERROR;
+}
@@ -0,0 +1,63 @@
+#ifndef __SDB_RANK_H__
+    #define __SDB_RANK_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "db.h"
+#include "sdb_handle.h"
+
+//GPA index, see sdb_rank.c.  The sidecar .student.db.gpa orders the
+//students by (gpa, id).  GPAs are whole numbers from MIN_STD_GPA to
+//MAX_STD_GPA, so the index is one bucket per GPA, each a bitmap of the
+//ids that have it:
+//
+//  [rank_hdr_t]
+//  uint32_t counts[RANK_LEVELS]                   students per GPA
+//  uint64_t summary[RANK_LEVELS][RANK_SUM_WORDS]  at RANK_SUM_OFF, bit w
+//                                                 set when bits word w is
+//                                                 not zero
+//  uint64_t bits[RANK_LEVELS][RANK_WORDS]         at RANK_BITS_OFF, bit id
+//                                                 set when id has the GPA
+//
+//The file is sparse, only the bitmap pages that hold ids take up disk.
+//Every writer keeps it up to date and the first one builds it.  -k top N
+//and -k bottom N print the N best or worst students (ties in id order),
+//-k rank id where a student stands and -k count lo hi how many students
+//have a GPA in a range, none of them reading the records to do it.
+
+#define RANK_MAGIC          "SDBGPA01"
+#define RANK_VERSION        1
+#define RANK_SUFFIX         ".gpa"
+#define RANK_LEVELS         (MAX_STD_GPA - MIN_STD_GPA + 1)
+#define RANK_WORDS          ((MAX_STD_ID + 64) / 64)
+#define RANK_SUM_WORDS      ((RANK_WORDS + 63) / 64)
+#define RANK_SUM_OFF        4096
+#define RANK_BITS_OFF       (RANK_SUM_OFF + ((RANK_LEVELS * RANK_SUM_WORDS * 8 + 4095) / 4096) * 4096)
+#define RANK_FILE_SZ        (RANK_BITS_OFF + (size_t)RANK_LEVELS * RANK_WORDS * 8)
+
+typedef struct rank_hdr {
+    char     magic[8];          //written last by a build
+    uint32_t version;
+    uint32_t pad0;
+    uint64_t db_dev;            //identity of the database the index
+    uint64_t db_ino;            //was built for
+    int64_t  nstudents;
+    uint8_t  pad[24];
+} rank_hdr_t;
+
+//Output messages
+#define M_RANK_OF           "Student %d is ranked %ld of %ld by GPA (%.2f), above %.1f%% of students.\n"
+#define M_RANK_COUNT        "%ld student(s) have a GPA from %.2f to %.2f.\n"
+#define M_ERR_RANK_QUERY    "Unknown GPA index query %s, use top N|bottom N|rank id|count lo hi\n"
+#define M_ERR_RANK          "Error reading the GPA index, exiting!\n"
+
+//prototypes for sdb_rank.c
+int rank_on_change(db_handle_t *h, const student_t *old, const student_t *rec);
+int rank_on_rebuild(db_handle_t *h);
+void rank_on_close(db_handle_t *h);
+int rank_top(int fd, bool best, int k);
+int rank_of(int fd, int id);
+int rank_count(int fd, int lo, int hi);
+
+#endif
@@ -0,0 +1,728 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <signal.h>
+#include <time.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/prctl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "db.h"
+#include "sdbsc.h"
+#include "sdb_handle.h"
+#include "sdb_lock.h"
+#include "sdb_engine.h"
+#include "sdb_filter.h"
+#include "sdb_wal.h"
+#include "sdb_sum.h"
+#include "sdb_snap.h"
+#include "sdb_server.h"
+#include "sdb_cdc.h"
+#include "sdb_repl.h"
+
+//The primary needs nothing but its change log: a follower is a reader of
+//the log like -t follow, each in a process of its own forked off the
+//accepting one.  The child opens the database again, record locks taken
+//through the parent's open file would belong to the parent as well.
+//
+//The follower applies changes the way -a and -d store them (record lock,
+//id filter, write-ahead log, sidecars), one batch per gate entry, and
+//commits the log before it moves its position on.  A crash in between
+//only means the batch is applied once more.  Syncing patches a copy of
+//the standby and renames it into place, like compress_db() does, so
+//readers of the standby see either the old file or the new one.
+
+static volatile sig_atomic_t stopping = 0;
+
+static void on_stop(int sig)
+{
+    (void)sig;
+    stopping = 1;
+}
+
+//where the follower and the primary report, stdout unless it is the
+//connection itself
+static FILE *msgs;
+
+static int64_t now_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static int xfer(int fd, void *buf, size_t len, bool out)
+{
+    char *p = buf;
+
+    while (len > 0) {
+        ssize_t r = out ? write(fd, p, len) : read(fd, p, len);
+
+        if (r < 0 && errno == EINTR && !stopping)
+            continue;
+        if (r <= 0)
+            return ERR_DB_FILE;
+        p += r;
+        len -= (size_t)r;
+    }
+    return NO_ERROR;
+}
+
+static int send_msg(int fd, uint32_t type, const void *data, size_t len)
+{
+    repl_msg_t m = { .type = type, .len = (uint32_t)len };
+
+    if (xfer(fd, &m, sizeof(m), true) != NO_ERROR)
+        return ERR_DB_FILE;
+    return len == 0 ? NO_ERROR : xfer(fd, (void *)data, len, true);
+}
+
+/*
+ *  recv_msg
+ *      fd:   connection
+ *      m:    receives the message header
+ *      buf:  payload buffer, grown with realloc() as needed
+ *      cap:  size of *buf
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE (connection lost, or a message too
+ *            big to be one)
+ */
+static int recv_msg(int fd, repl_msg_t *m, void **buf, size_t *cap)
+{
+    if (xfer(fd, m, sizeof(*m), false) != NO_ERROR || m->len > REPL_MSG_MAX)
+        return ERR_DB_FILE;
+    if (m->len > *cap) {
+        void *nb = realloc(*buf, m->len);
+
+        if (nb == NULL)
+            return ERR_DB_FILE;
+        *buf = nb;
+        *cap = m->len;
+    }
+    return m->len == 0 ? NO_ERROR : xfer(fd, *buf, m->len, false);
+}
+
+/*
+ *  page_sums
+ *      fd:   file to checksum
+ *      out:  receives a malloc()ed array, page_sum() of each page
+ *      n:    receives the number of pages
+ *
+ *  A short last page is summed as if zero filled, as in sdb_sum.c.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ */
+static int page_sums(int fd, uint32_t **out, size_t *n)
+{
+    uint8_t page[REPL_PAGE_SZ];
+    struct stat st;
+
+    if (fstat(fd, &st) == -1)
+        return ERR_DB_FILE;
+    *n = (size_t)((st.st_size + REPL_PAGE_SZ - 1) / REPL_PAGE_SZ);
+    *out = malloc((*n ? *n : 1) * sizeof(**out));
+    if (*out == NULL)
+        return ERR_DB_FILE;
+    for (size_t i = 0; i < *n; i++) {
+        ssize_t got = pread(fd, page, sizeof(page), (off_t)i * REPL_PAGE_SZ);
+
+        if (got < 0) {
+            free(*out);
+            return ERR_DB_FILE;
+        }
+        memset(page + got, 0, sizeof(page) - (size_t)got);
+        (*out)[i] = page_sum(page, sizeof(page));
+    }
+    return NO_ERROR;
+}
+
+/*
+ *  send_sync
+ *      h:        database handle of the primary
+ *      in, out:  connection to the follower
+ *      r:        the primary's log reader, moved past the copy
+ *
+ *  The primary's half of a SYNC, see sdb_repl.h.  Every change up to the
+ *  log's last entry before the copy starts was stored before it was
+ *  logged, so it is in the copy.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ */
+static int send_sync(db_handle_t *h, int in, int out, cdc_reader_t *r)
+{
+    char suffix[32], path[PATH_MAX];
+    void *buf = NULL;
+    size_t cap = 0, nsums;
+    uint32_t *sums;
+    repl_page_t *pg = NULL;
+    repl_done_t done;
+    repl_msg_t m;
+    struct stat st;
+    bool cloned;
+    int cfd = -1, rc = ERR_DB_FILE;
+
+    snprintf(suffix, sizeof(suffix), "%s%d", REPL_COPY_SUFFIX, (int)getpid());
+    if (send_msg(out, REPL_SYNC, NULL, 0) != NO_ERROR ||
+        recv_msg(in, &m, &buf, &cap) != NO_ERROR ||
+        m.type != REPL_SUMS || m.len % sizeof(*sums) != 0 ||
+        cdc_last(h, &done.log_id, &done.seq) != NO_ERROR ||
+        db_sidecar_path(h, suffix, path, sizeof(path)) != NO_ERROR ||
+        snap_copy(h->fd, path, S_IRUSR | S_IWUSR, &cloned) != NO_ERROR)
+        goto out;
+    sums = buf;
+    nsums = m.len / sizeof(*sums);
+
+    //the copy is only needed open
+    cfd = open(path, O_RDONLY | O_CLOEXEC);
+    unlink(path);
+    pg = malloc(sizeof(*pg));
+    if (cfd == -1 || pg == NULL || fstat(cfd, &st) == -1)
+        goto out;
+
+    //a page the follower does not have is all zero to it
+    for (off_t off = 0; off < st.st_size; off += REPL_PAGE_SZ) {
+        size_t i = (size_t)(off / REPL_PAGE_SZ);
+        ssize_t got = pread(cfd, pg->data, sizeof(pg->data), off);
+
+        if (got < 0)
+            goto out;
+        memset(pg->data + got, 0, sizeof(pg->data) - (size_t)got);
+        if (page_sum(pg->data, sizeof(pg->data)) == (i < nsums ? sums[i] : 0))
+            continue;
+        pg->off = (uint64_t)off;
+        if (send_msg(out, REPL_PAGE, pg, sizeof(*pg)) != NO_ERROR)
+            goto out;
+    }
+    done.size = (uint64_t)st.st_size;
+    if (send_msg(out, REPL_DONE, &done, sizeof(done)) != NO_ERROR)
+        goto out;
+    cdc_reader_seek(r, done.seq + 1);
+    rc = NO_ERROR;
+
+out:
+    if (cfd != -1)
+        close(cfd);
+    free(pg);
+    free(buf);
+    return rc;
+}
+
+/*
+ *  ship
+ *      h:        database handle of the primary
+ *      in, out:  connection to the follower
+ *
+ *  Serves one follower until it goes away, see sdb_repl.h.
+ *
+ *  returns:  NO_ERROR when the follower left or SIGTERM came, ERR_DB_FILE
+ *            if the log could not be read
+ */
+static int ship(db_handle_t *h, int in, int out)
+{
+    repl_hello_t hello;
+    repl_msg_t m;
+    void *buf = NULL;
+    size_t cap = 0;
+    uint64_t log_id, last, from = 1;
+    cdc_reader_t r;
+    cdc_rec_t *recs;
+    int rc = NO_ERROR;
+
+    if (recv_msg(in, &m, &buf, &cap) != NO_ERROR || m.type != REPL_HELLO ||
+        m.len != sizeof(hello)) {
+        free(buf);
+        return NO_ERROR;
+    }
+    memcpy(&hello, buf, sizeof(hello));
+    free(buf);
+    if (memcmp(hello.magic, REPL_MAGIC, sizeof(hello.magic)) != 0)
+        return NO_ERROR;
+    if (cdc_last(h, &log_id, &last) != NO_ERROR)
+        return ERR_DB_FILE;
+
+    //anywhere else the follower starts at the RESET the log begins with
+    if (hello.log_id == log_id && hello.seq <= last)
+        from = hello.seq + 1;
+    recs = malloc(REPL_BATCH * sizeof(*recs));
+    if (recs == NULL || cdc_reader_open(h, &r, from, true) != NO_ERROR) {
+        free(recs);
+        return ERR_DB_FILE;
+    }
+
+    while (!stopping) {
+        int n = cdc_read(&r, recs, REPL_BATCH), k = 0;
+        repl_beat_t beat;
+
+        if (n == SRCH_NOT_FOUND)
+            n = 0;
+        if (n < 0) {
+            rc = ERR_DB_FILE;
+            break;
+        }
+        while (k < n && recs[k].op != CDC_RESET)
+            k++;
+        if (k > 0 && send_msg(out, REPL_CHANGES, recs, k * sizeof(*recs)) != NO_ERROR)
+            break;
+        if (k < n) {
+            if (send_sync(h, in, out, &r) != NO_ERROR)
+                break;
+            continue;
+        }
+        if (n == REPL_BATCH)
+            continue;
+
+        //the follower learns how far the log goes, and a follower that
+        //went away is noticed within REPL_BEAT_MS
+        beat.seq = r.next - 1;
+        if (send_msg(out, REPL_BEAT, &beat, sizeof(beat)) != NO_ERROR ||
+            cdc_wait(&r, REPL_BEAT_MS) != NO_ERROR)
+            break;
+    }
+
+    cdc_reader_close(&r);
+    free(recs);
+    return rc;
+}
+
+/*
+ *  repl_serve
+ *      fd:         linux file descriptor of the primary
+ *      sock_path:  socket to listen on, NULL for the default, "-" to serve
+ *                  one follower on stdin and stdout
+ *
+ *  Starts the change log if there is none and ships it to followers (-R)
+ *  until SIGINT or SIGTERM.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ *
+ *  console:  M_REPL_SERVE once listening, M_ERR_REPL
+ */
+int repl_serve(int fd, const char *sock_path)
+{
+    db_handle_t *h = db_handle_get(fd);
+    char path[PATH_MAX];
+    struct sigaction sa = {0};
+    int lsock;
+
+    msgs = sock_path != NULL && strcmp(sock_path, "-") == 0 ? stderr : stdout;
+    if (h == NULL || cdc_start(h) != NO_ERROR) {
+        fprintf(msgs, M_ERR_REPL);
+        return ERR_DB_FILE;
+    }
+
+    sa.sa_handler = on_stop;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    if (msgs == stderr) {
+        if (ship(h, STDIN_FILENO, STDOUT_FILENO) != NO_ERROR) {
+            fprintf(msgs, M_ERR_REPL);
+            return ERR_DB_FILE;
+        }
+        return NO_ERROR;
+    }
+
+    if (sock_path != NULL)
+        snprintf(path, sizeof(path), "%s", sock_path);
+    else if (db_sidecar_path(h, REPL_SOCK_SUFFIX, path, sizeof(path)) != NO_ERROR)
+        path[0] = '\0';
+    lsock = path[0] ? server_listen(path) : -1;
+    if (lsock == -1) {
+        printf(M_ERR_SERVER, path);
+        return ERR_DB_FILE;
+    }
+    signal(SIGCHLD, SIG_IGN);
+
+    printf(M_REPL_SERVE, h->path, path);
+    fflush(stdout);
+
+    while (!stopping) {
+        struct pollfd p = { .fd = lsock, .events = POLLIN };
+        int c;
+
+        if (poll(&p, 1, -1) <= 0)
+            continue;
+        c = accept4(lsock, NULL, NULL, SOCK_CLOEXEC);
+        if (c == -1)
+            continue;
+        if (fork() == 0) {
+            int rc;
+
+            close(lsock);
+            prctl(PR_SET_PDEATHSIG, SIGTERM);
+            rc = db_handle_reopen(h) == NO_ERROR ? ship(h, c, c) : ERR_DB_FILE;
+            close(c);
+            close_db(fd);
+            _exit(rc == NO_ERROR ? EXIT_OK : EXIT_FAIL_DB);
+        }
+        close(c);
+    }
+
+    close(lsock);
+    unlink(path);
+    return NO_ERROR;
+}
+
+static int state_path(db_handle_t *h, char *buf, size_t len)
+{
+    return db_sidecar_path(h, REPL_SUFFIX, buf, len);
+}
+
+static int save_state(int sfd, repl_state_t *st)
+{
+    memcpy(st->magic, REPL_STATE_MAGIC, sizeof(st->magic));
+    return pwrite(sfd, st, sizeof(*st), 0) == (ssize_t)sizeof(*st) ? NO_ERROR : ERR_DB_FILE;
+}
+
+/*
+ *  apply
+ *      h:      database handle of the standby, gate held
+ *      c:      change from the primary
+ *      names:  full names its NAMES entries carried, or NULL
+ *
+ *  Stores the change as -a or -d would.  An add of a record that is
+ *  there already overwrites it, a delete of one that is not is skipped.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ */
+static int apply(db_handle_t *h, const cdc_rec_t *c, const student_names_t *names)
+{
+    const student_t *rec = c->op == CDC_DEL ? &EMPTY_STUDENT_RECORD : &c->rec;
+    student_t old = EMPTY_STUDENT_RECORD;
+    int id = c->rec.id, rc;
+
+    if (id < MIN_STD_ID || id > MAX_STD_ID)
+        return NO_ERROR;
+    if (db_lock_change(h, id) != NO_ERROR)
+        return ERR_DB_FILE;
+    rc = filter_absent(h, id) ? SRCH_NOT_FOUND : db_get(h, id, &old);
+    if (rc == SRCH_NOT_FOUND)
+        old = EMPTY_STUDENT_RECORD;
+    if ((rc != NO_ERROR && rc != SRCH_NOT_FOUND) ||
+        (memcmp(&old, rec, sizeof(old)) == 0 &&
+         (names == NULL || db_has_names(h, id, names)))) {
+        db_unlock_change(h, id);
+        return rc == NO_ERROR || rc == SRCH_NOT_FOUND ? NO_ERROR : ERR_DB_FILE;
+    }
+
+    rc = wal_begin(h);
+    if (rc == NO_ERROR)
+        rc = wal_log(h, id, rec, names);
+    if (rc == NO_ERROR) {
+        if (c->op != CDC_DEL)
+            filter_add(h, id);
+        rc = db_put_names(h, id, rec, names);
+        if (rc == NO_ERROR && c->op == CDC_DEL)
+            filter_del(h, id);
+        if (wal_end(h) != NO_ERROR)
+            rc = ERR_DB_FILE;
+    }
+    if (rc == NO_ERROR)
+        db_notify_change(h, &old, rec);
+    db_unlock_change(h, id);
+    return rc == NO_ERROR ? NO_ERROR : ERR_DB_FILE;
+}
+
+/*
+ *  recv_sync
+ *      fd:       linux file descriptor of the standby
+ *      in, out:  connection to the primary
+ *      st:       follower state, updated once the new file is in place
+ *      lost:     set when the connection, not the standby, failed
+ *
+ *  The follower's half of a SYNC, see sdb_repl.h.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ */
+static int recv_sync(int fd, int in, int out, repl_state_t *st, bool *lost)
+{
+    db_handle_t *h = db_handle_get(fd);
+    char path[PATH_MAX];
+    uint32_t *sums = NULL;
+    size_t nsums, cap = 0;
+    uint64_t pages = 0;
+    void *buf = NULL;
+    repl_done_t done;
+    repl_msg_t m;
+    struct stat dst;
+    bool cloned;
+    int nfd = -1, rc = ERR_DB_FILE;
+
+    *lost = false;
+    if (db_sidecar_path(h, REPL_NEW_SUFFIX, path, sizeof(path)) != NO_ERROR ||
+        fstat(h->fd, &dst) == -1 ||
+        snap_copy(fd, path, dst.st_mode & 0777, &cloned) != NO_ERROR)
+        return ERR_DB_FILE;
+    nfd = open(path, O_RDWR | O_CLOEXEC);
+    if (nfd == -1 || page_sums(nfd, &sums, &nsums) != NO_ERROR)
+        goto out;
+    if (send_msg(out, REPL_SUMS, sums, nsums * sizeof(*sums)) != NO_ERROR) {
+        *lost = true;
+        goto out;
+    }
+
+    for (;;) {
+        if (recv_msg(in, &m, &buf, &cap) != NO_ERROR) {
+            *lost = true;
+            goto out;
+        }
+        if (m.type == REPL_DONE && m.len == sizeof(done))
+            break;
+        if (m.type != REPL_PAGE || m.len != sizeof(repl_page_t)) {
+            *lost = true;
+            goto out;
+        }
+        repl_page_t *pg = buf;
+
+        if (pwrite(nfd, pg->data, sizeof(pg->data), (off_t)pg->off) != (ssize_t)sizeof(pg->data))
+            goto out;
+        pages++;
+    }
+    memcpy(&done, buf, sizeof(done));
+    if (ftruncate(nfd, (off_t)done.size) == -1 || fsync(nfd) == -1)
+        goto out;
+
+    //nothing logged for the old file may be replayed into the new one
+    if (db_gate_enter(h, true) != NO_ERROR)
+        goto out;
+    if (wal_checkpoint(h) != NO_ERROR || rename(path, h->path) == -1) {
+        db_gate_leave(h);
+        goto out;
+    }
+    db_gate_leave(h);
+    if (db_handle_reopen(h) != NO_ERROR || db_gate_enter(h, true) != NO_ERROR)
+        goto out;
+    db_notify_rebuild(h);
+    db_gate_leave(h);
+
+    st->log_id = done.log_id;
+    st->applied = done.seq;
+    if (st->primary < done.seq)
+        st->primary = done.seq;
+    st->current_us = now_us();
+    st->syncs++;
+    st->pages += pages;
+    st->pages_total += (done.size + REPL_PAGE_SZ - 1) / REPL_PAGE_SZ;
+    fprintf(msgs, M_REPL_SYNCED, (unsigned long long)done.seq, (unsigned long long)pages,
+            (unsigned long long)((done.size + REPL_PAGE_SZ - 1) / REPL_PAGE_SZ));
+    fflush(msgs);
+    rc = NO_ERROR;
+
+out:
+    if (nfd != -1)
+        close(nfd);
+    if (rc != NO_ERROR)
+        unlink(path);
+    free(sums);
+    free(buf);
+    return rc;
+}
+
+/*
+ *  follow
+ *      fd:       linux file descriptor of the standby
+ *      sfd:      the follower state sidecar
+ *      st:       follower state
+ *      in, out:  connection to the primary
+ *
+ *  Applies what the primary sends until the connection ends.
+ *
+ *  returns:  NO_ERROR when the connection ended or SIGTERM came,
+ *            ERR_DB_FILE if the standby could not be written
+ */
+static int follow(int fd, int sfd, repl_state_t *st, int in, int out)
+{
+    db_handle_t *h = db_handle_get(fd);
+    repl_hello_t hello = {0};
+    names_run_t run = {0};
+    void *buf = NULL;
+    size_t cap = 0;
+    int rc = NO_ERROR;
+
+    memcpy(hello.magic, REPL_MAGIC, sizeof(hello.magic));
+    hello.log_id = st->log_id;
+    hello.seq = st->applied;
+    if (send_msg(out, REPL_HELLO, &hello, sizeof(hello)) != NO_ERROR)
+        return NO_ERROR;
+
+    while (!stopping && rc == NO_ERROR) {
+        repl_msg_t m;
+        bool lost;
+
+        if (recv_msg(in, &m, &buf, &cap) != NO_ERROR)
+            break;
+        st->heard_us = now_us();
+
+        if (m.type == REPL_CHANGES && m.len % sizeof(cdc_rec_t) == 0 && m.len > 0) {
+            const cdc_rec_t *c = buf;
+            size_t n = m.len / sizeof(*c);
+            uint64_t applied = st->applied;
+
+            if (db_gate_enter(h, false) != NO_ERROR) {
+                rc = ERR_DB_FILE;
+                break;
+            }
+            //NAMES entries go with the change after them, which may come
+            //in the next message; the position only moves past changes so
+            //after a reconnect they are sent again
+            for (size_t i = 0; i < n && rc == NO_ERROR; i++) {
+                student_names_t names;
+
+                if (c[i].op == CDC_NAMES) {
+                    names_join(&run, &c[i].names);
+                    continue;
+                }
+                rc = apply(h, &c[i], names_joined(&run, c[i].rec.id, &names) ? &names : NULL);
+                applied = c[i].seq;
+            }
+            db_gate_leave(h);
+            if (rc != NO_ERROR || sync_db(fd) != NO_ERROR) {
+                rc = ERR_DB_FILE;
+                break;
+            }
+            st->applied = applied;
+            st->changes += n;
+            if (st->primary < st->applied)
+                st->primary = st->applied;
+        } else if (m.type == REPL_BEAT && m.len == sizeof(repl_beat_t)) {
+            st->primary = ((repl_beat_t *)buf)->seq;
+        } else if (m.type == REPL_SYNC && m.len == 0) {
+            if (recv_sync(fd, in, out, st, &lost) != NO_ERROR) {
+                if (!lost)
+                    rc = ERR_DB_FILE;
+                break;
+            }
+        } else {
+            break;
+        }
+
+        if (st->applied >= st->primary)
+            st->current_us = st->heard_us;
+        if (save_state(sfd, st) != NO_ERROR)
+            rc = ERR_DB_FILE;
+    }
+
+    free(buf);
+    return rc;
+}
+
+/*
+ *  repl_follow
+ *      fd:         linux file descriptor of the standby
+ *      sock_path:  the primary's -R socket, "-" to talk over stdin and
+ *                  stdout
+ *
+ *  Keeps the standby a copy of the primary (-F socket) until SIGINT or
+ *  SIGTERM, connecting again whenever the primary goes away.  Over
+ *  stdin and stdout there is one connection only.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ *
+ *  console:  M_REPL_FOLLOW, M_REPL_SYNCED after each sync,
+ *            M_ERR_REPL_LOST, M_ERR_REPL (stderr over stdin and stdout)
+ */
+int repl_follow(int fd, const char *sock_path)
+{
+    db_handle_t *h = db_handle_get(fd);
+    char path[PATH_MAX];
+    repl_state_t st = {0};
+    struct sigaction sa = {0};
+    bool piped = strcmp(sock_path, "-") == 0, was_up = false;
+    int sfd, rc = NO_ERROR;
+
+    msgs = piped ? stderr : stdout;
+    if (h == NULL || state_path(h, path, sizeof(path)) != NO_ERROR ||
+        (sfd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644)) == -1) {
+        fprintf(msgs, M_ERR_REPL);
+        return ERR_DB_FILE;
+    }
+    if (pread(sfd, &st, sizeof(st), 0) != (ssize_t)sizeof(st) ||
+        memcmp(st.magic, REPL_STATE_MAGIC, sizeof(st.magic)) != 0)
+        memset(&st, 0, sizeof(st));
+
+    sa.sa_handler = on_stop;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    if (piped) {
+        rc = follow(fd, sfd, &st, STDIN_FILENO, STDOUT_FILENO);
+    } else {
+        fprintf(msgs, M_REPL_FOLLOW, sock_path);
+        fflush(msgs);
+        while (!stopping && rc == NO_ERROR) {
+            struct timespec wait = { REPL_RETRY_MS / 1000, (REPL_RETRY_MS % 1000) * 1000000L };
+            int s = client_connect(sock_path);
+
+            if (s != -1) {
+                was_up = true;
+                rc = follow(fd, sfd, &st, s, s);
+                close(s);
+            }
+            if (stopping || rc != NO_ERROR)
+                break;
+            if (was_up) {
+                fprintf(msgs, M_ERR_REPL_LOST, sock_path);
+                fflush(msgs);
+                was_up = false;
+            }
+            nanosleep(&wait, NULL);
+        }
+    }
+
+    close(sfd);
+    if (rc != NO_ERROR)
+        fprintf(msgs, M_ERR_REPL);
+    return rc;
+}
+
+/*
+ *  repl_status
+ *      fd:  linux file descriptor of the standby
+ *
+ *  Prints the follower's position and lag (-F with no socket).
+ *
+ *  returns:  NO_ERROR or SRCH_NOT_FOUND when the database never followed
+ *            a primary
+ *
+ *  console:  M_REPL_STATUS and M_REPL_TOTALS, or M_REPL_NONE
+ */
+int repl_status(int fd)
+{
+    db_handle_t *h = db_handle_get(fd);
+    char path[PATH_MAX];
+    repl_state_t st;
+    int64_t now = now_us();
+    int sfd;
+
+    if (h == NULL || state_path(h, path, sizeof(path)) != NO_ERROR ||
+        (sfd = open(path, O_RDONLY | O_CLOEXEC)) == -1) {
+        printf(M_REPL_NONE);
+        return SRCH_NOT_FOUND;
+    }
+    if (pread(sfd, &st, sizeof(st), 0) != (ssize_t)sizeof(st) ||
+        memcmp(st.magic, REPL_STATE_MAGIC, sizeof(st.magic)) != 0) {
+        close(sfd);
+        printf(M_REPL_NONE);
+        return SRCH_NOT_FOUND;
+    }
+    close(sfd);
+
+    bool behind = st.primary > st.applied;
+    printf(M_REPL_STATUS, (unsigned long long)st.applied, (unsigned long long)st.primary,
+           (unsigned long long)(behind ? st.primary - st.applied : 0),
+           behind ? (now - st.current_us) / 1e6 : 0.0, (now - st.heard_us) / 1e6);
+    printf(M_REPL_TOTALS, (unsigned long long)st.changes, (unsigned long long)st.syncs,
+           (unsigned long long)st.pages, (unsigned long long)st.pages_total);
+    return NO_ERROR;
+}
@@ -0,0 +1,120 @@
+#ifndef __SDB_REPL_H__
+    #define __SDB_REPL_H__
+
+#include <stdint.h>
+
+#include "db.h"
+#include "sdb_cdc.h"
+
+//Hot standby replication, see sdb_repl.c.  "sdbsc -R [socket]" on the
+//primary ships its change log (sdb_cdc.h) to followers on a Unix domain
+//stream socket, .student.db.repl.sock next to the database unless a path
+//is given.  "sdbsc -F socket" run where the standby's student.db is
+//applies every change to it, and keeps reconnecting until SIGINT or
+//SIGTERM; stop it and the standby is ready to be used as the primary.
+//Its position and lag counters are kept in .student.db.repl, -F on its
+//own prints them.  With "-" as the socket both ends talk over stdin and
+//stdout instead (two pipes, socat, ssh, ...).
+//
+//Protocol: each message is a repl_msg_t followed by len bytes.
+//
+//  follower                          primary
+//  HELLO   repl_hello_t      ->
+//                            <-      CHANGES  cdc_rec_t...
+//                            <-      BEAT     repl_beat_t, when idle
+//
+//CHANGES holds the log's NAMES entries too; the follower stores the full
+//names with the change that follows them.
+//
+//When the follower cannot go on from where it is (a new standby, a RESET
+//in the log, a log it has not followed before) the primary sends SYNC.
+//The follower copies its own file as -s does and answers SUMS, page_sum()
+//of each 4K page of the copy.  The primary copies its database the same
+//way, sends a PAGE for each page of its copy whose sum differs, then DONE
+//with the copy's size and the sequence number it is current to, and
+//carries on with CHANGES from there.  The follower renames its patched
+//copy over student.db, so the standby is never half synced.  The
+//primary's copy may already hold some later changes; applying a change
+//again stores the same record, so that does no harm.
+//
+//All integers are in host byte order.
+
+#define REPL_MAGIC          "SDBREPL1"
+#define REPL_STATE_MAGIC    "SDBRST01"
+#define REPL_SUFFIX         ".repl"         //follower position and counters
+#define REPL_SOCK_SUFFIX    ".repl.sock"
+#define REPL_COPY_SUFFIX    ".repl.copy."   //primary's copy during a SYNC,
+                                            //one per follower (by pid)
+#define REPL_NEW_SUFFIX     ".repl.new"     //follower's file being synced
+#define REPL_PAGE_SZ        4096
+#define REPL_BATCH          256             //changes per CHANGES message
+#define REPL_BEAT_MS        1000
+#define REPL_RETRY_MS       1000            //follower reconnect interval
+#define REPL_MSG_MAX        (64 * 1024 * 1024)
+
+enum {
+    REPL_HELLO = 1,
+    REPL_CHANGES,
+    REPL_BEAT,
+    REPL_SYNC,
+    REPL_SUMS,
+    REPL_PAGE,
+    REPL_DONE,
+};
+
+typedef struct repl_msg {
+    uint32_t type;              //REPL_*
+    uint32_t len;               //bytes of payload that follow
+} repl_msg_t;
+
+typedef struct repl_hello {
+    char     magic[8];
+    uint64_t log_id;            //log the follower is current to, 0 if none
+    uint64_t seq;               //last change it applied
+} repl_hello_t;
+
+typedef struct repl_beat {
+    uint64_t seq;               //last change in the primary's log
+} repl_beat_t;
+
+typedef struct repl_page {
+    uint64_t off;
+    uint8_t  data[REPL_PAGE_SZ];
+} repl_page_t;
+
+typedef struct repl_done {
+    uint64_t log_id;
+    uint64_t seq;               //the copy holds every change up to seq
+    uint64_t size;              //of the primary's file
+} repl_done_t;
+
+//.student.db.repl, rewritten after every batch the follower applies
+typedef struct repl_state {
+    char     magic[8];
+    uint64_t log_id;            //primary's log being followed
+    uint64_t applied;           //last change applied
+    uint64_t primary;           //last change the primary has
+    int64_t  heard_us;          //when the primary last sent anything
+    int64_t  current_us;        //when the standby was last current
+    uint64_t changes;           //changes applied
+    uint64_t syncs;             //SYNCs done
+    uint64_t pages;             //pages received in them
+    uint64_t pages_total;       //pages the primary's copies had
+} repl_state_t;
+
+//Output messages
+#define M_REPL_SERVE        "Shipping changes of %s on %s\n"
+#define M_REPL_FOLLOW       "Following %s\n"
+#define M_REPL_SYNCED       "Synced to change %llu, %llu of %llu page(s) received.\n"
+#define M_REPL_STATUS       "Applied change %llu of %llu, %llu behind (%.1f s), primary heard %.1f s ago.\n"
+#define M_REPL_TOTALS       "%llu change(s) applied, %llu sync(s), %llu of %llu page(s) received.\n"
+#define M_REPL_NONE         "This database is not a standby.\n"
+#define M_ERR_REPL_LOST     "Lost the primary at %s, retrying.\n"
+#define M_ERR_REPL          "Error replicating the database, exiting!\n"
+
+//prototypes for sdb_repl.c
+int repl_serve(int fd, const char *sock_path);
+int repl_follow(int fd, const char *sock_path);
+int repl_status(int fd);
+
+#endif
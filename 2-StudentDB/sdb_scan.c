@@ -0,0 +1,549 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "db.h"
+#include "sdbsc.h"
+#include "sdb_handle.h"
+#include "sdb_mmap.h"
+#include "sdb_scan.h"
+#include "sdb_lock.h"
+#include "sdb_engine.h"
+
+//Because add_student() puts record N at offset N*64, a database holding
+//only id 99999 is a 6.4MB file that is almost entirely hole.  Scanning it
+//record by record reads (and zero fills) every empty slot.  scan_db() asks
+//the file system where the data actually is and only reads those extents,
+//in SCAN_CHUNK_SZ sized pread() calls.
+//
+//One thread doing that leaves most of a fast disk idle, so count and
+//print use scan_parallel(): workers claim SCAN_PART_SZ parts of the file
+//in order and walk them as above, each into its own state.  A merge
+//callback puts the results back in id order, one part at a time; a worker
+//holds on to its part's results until every earlier part is merged, so
+//memory stays at one part per thread.
+
+/*
+ *  page_occupancy
+ *      recs:  records of one page
+ *      n:     number of records, at most RECS_PER_PAGE
+ *
+ *  returns:  bitmap with bit i set if recs[i] is not all zero bytes
+ */
+uint64_t page_occupancy(const student_t *recs, int n)
+{
+    uint64_t occupied = 0;
+
+    for (int i = 0; i < n; i++) {
+        const uint64_t *w = (const uint64_t *)&recs[i];
+        uint64_t any = 0;
+
+        for (size_t j = 0; j < sizeof(student_t) / sizeof(uint64_t); j++)
+            any |= w[j];
+        if (any)
+            occupied |= (uint64_t)1 << i;
+    }
+    return occupied;
+}
+
+/*
+ *  next_extent
+ *      fd:     database file
+ *      pos:    where to start looking
+ *      len:    file size
+ *      start:  set to the start of the next populated extent
+ *      end:    set to its end
+ *
+ *  Uses SEEK_DATA/SEEK_HOLE.  File systems that do not support them
+ *  report the whole rest of the file as one extent.
+ *
+ *  returns:  true if an extent was found
+ */
+bool next_extent(int fd, off_t pos, off_t len, off_t *start, off_t *end)
+{
+    off_t s, e;
+
+    if (pos >= len)
+        return false;
+
+    s = lseek(fd, pos, SEEK_DATA);
+    if (s == -1) {
+        if (errno == ENXIO)
+            return false;   //only a hole left
+        *start = pos;       //no SEEK_DATA support, read everything
+        *end = len;
+        return true;
+    }
+    if (s >= len)
+        return false;
+
+    e = lseek(fd, s, SEEK_HOLE);
+    if (e == -1 || e > len)
+        e = len;
+
+    //extents are block aligned, keep them record aligned as well
+    *start = s - (s % STUDENT_RECORD_SIZE);
+    *end = e;
+    return true;
+}
+
+/*
+ *  scan_db
+ *      h:    database handle
+ *      fn:   callback run for every page of live records
+ *      arg:  passed through to fn
+ *
+ *  Walks every record of the database in id order through the engine's
+ *  scan, holding the gate so the file cannot be replaced under the scan.
+ *
+ *  returns:  NO_ERROR, ERR_DB_FILE on I/O errors, or the first value other
+ *            than NO_ERROR returned by fn
+ */
+int scan_db(db_handle_t *h, scan_page_fn fn, void *arg)
+{
+    int rc;
+
+    if (db_gate_enter(h, false) != NO_ERROR)
+        return ERR_DB_FILE;
+    rc = h->engine->scan(h, fn, arg);
+    db_gate_leave(h);
+    return rc;
+}
+
+/*
+ *  walk_extents
+ *      h:     database handle in the legacy format, gate held
+ *      from:  first byte to look at, a multiple of the record size
+ *      to:    end of the bytes to look at
+ *      buf:   SCAN_CHUNK_SZ bytes of scratch space
+ *      fn:    callback run for every page of populated data
+ *      arg:   passed through to fn
+ *
+ *  Walks the populated extents of [from, to) in file order.  Pages that
+ *  are holes are never read and never passed to fn; a page cut by from
+ *  or to is passed with just the records inside the range.
+ *
+ *  returns:  NO_ERROR, ERR_DB_FILE on I/O errors or a file that is not a
+ *            whole number of records long, or the first value other than
+ *            NO_ERROR returned by fn
+ */
+static int walk_extents(db_handle_t *h, off_t from, off_t to, char *buf,
+                        scan_page_fn fn, void *arg)
+{
+    off_t pos = from, start, end;
+    int rc = NO_ERROR;
+
+    if (h->file_len % STUDENT_RECORD_SIZE != 0)
+        return ERR_DB_FILE;
+
+    while (rc == NO_ERROR && next_extent(h->fd, pos, to, &start, &end)) {
+        if (start < pos)
+            start = pos;
+        for (pos = start; rc == NO_ERROR && pos < end; ) {
+            size_t want = SCAN_CHUNK_SZ;
+            ssize_t got;
+
+            //stay page aligned so every callback sees whole pages
+            want -= (size_t)(pos % SCAN_PAGE_SZ);
+            if ((off_t)want > end - pos)
+                want = (size_t)(end - pos);
+
+            //a read lock on the chunk keeps half written records out
+            if (db_lock_range(h, pos, (off_t)want, false) != NO_ERROR) {
+                rc = ERR_DB_FILE;
+                break;
+            }
+            got = pread(h->fd, buf, want, pos);
+            db_unlock_range(h, pos, (off_t)want);
+            if (got <= 0 || got % STUDENT_RECORD_SIZE != 0) {
+                rc = ERR_DB_FILE;
+                break;
+            }
+
+            for (ssize_t off = 0; rc == NO_ERROR && off < got; ) {
+                off_t abs = pos + off;
+                ssize_t in_page = SCAN_PAGE_SZ - (abs % SCAN_PAGE_SZ);
+                const student_t *recs = (const student_t *)(buf + off);
+                int n;
+                uint64_t occupied;
+
+                if (in_page > got - off)
+                    in_page = got - off;
+                n = (int)(in_page / STUDENT_RECORD_SIZE);
+
+                occupied = page_occupancy(recs, n);
+                if (occupied)
+                    rc = fn(arg, (int)(abs / STUDENT_RECORD_SIZE), recs, n, occupied);
+                off += in_page;
+            }
+            pos += got;
+        }
+    }
+    return rc;
+}
+
+/*
+ *  walk_alloc
+ *      h, from, to, fn, arg:  see walk_extents()
+ *
+ *  walk_extents() with a scratch buffer of its own.
+ *
+ *  returns:  see walk_extents()
+ */
+static int walk_alloc(db_handle_t *h, off_t from, off_t to,
+                      scan_page_fn fn, void *arg)
+{
+    char *buf = malloc(SCAN_CHUNK_SZ);
+    int rc;
+
+    if (buf == NULL)
+        return ERR_DB_FILE;
+    rc = walk_extents(h, from, to, buf, fn, arg);
+    free(buf);
+    return rc;
+}
+
+/*
+ *  scan_extents
+ *      h:    database handle in the legacy format, gate held
+ *      fn:   callback run for every page of populated data
+ *      arg:  passed through to fn
+ *
+ *  The legacy engine's scan, the whole file through walk_extents().
+ *
+ *  returns:  see walk_extents()
+ */
+int scan_extents(db_handle_t *h, scan_page_fn fn, void *arg)
+{
+    return walk_alloc(h, 0, h->file_len, fn, arg);
+}
+
+/*
+ *  range_extents
+ *      h:    database handle in the legacy format, gate held
+ *      lo:   smallest id to visit
+ *      hi:   largest id to visit
+ *      fn:   callback run for every page of populated data
+ *      arg:  passed through to fn
+ *
+ *  The legacy engine's range scan.  Ids lo..hi are one contiguous byte
+ *  range of the file, so the kernel is asked to read all of it ahead in
+ *  one go before walk_extents() reads it in SCAN_CHUNK_SZ pieces.
+ *
+ *  returns:  see walk_extents()
+ */
+int range_extents(db_handle_t *h, int lo, int hi, scan_page_fn fn, void *arg)
+{
+    off_t from = (off_t)(lo > 0 ? lo : 0) * STUDENT_RECORD_SIZE;
+    off_t to = ((off_t)hi + 1) * STUDENT_RECORD_SIZE;
+
+    if (to > h->file_len)
+        to = h->file_len;
+    if (from >= to)
+        return NO_ERROR;
+
+    posix_fadvise(h->fd, from, to - from, POSIX_FADV_WILLNEED);
+    return walk_alloc(h, from, to, fn, arg);
+}
+
+/*
+ *  scan_range
+ *      h:    database handle
+ *      lo:   smallest id to visit
+ *      hi:   largest id to visit
+ *      fn:   callback run for every page of live records
+ *      arg:  passed through to fn
+ *
+ *  scan_db() restricted to ids lo..hi, through the engine's range scan.
+ *  Pages may hold fewer than RECS_PER_PAGE records at either end.
+ *
+ *  returns:  see scan_db()
+ */
+int scan_range(db_handle_t *h, int lo, int hi, scan_page_fn fn, void *arg)
+{
+    int rc;
+
+    if (db_gate_enter(h, false) != NO_ERROR)
+        return ERR_DB_FILE;
+    rc = h->engine->range(h, lo, hi, fn, arg);
+    db_gate_leave(h);
+    return rc;
+}
+
+/*
+ *  scan_workers
+ *      nthreads:  threads to run fn on, the caller's own included
+ *      fn:        thread function
+ *      arg:       passed to every call of fn
+ *
+ *  Runs fn on nthreads threads at once (at most SCAN_MAX_THREADS) and
+ *  waits for all of them.  When a thread cannot be started the ones that
+ *  did start carry on without it, so fn must share the work out itself.
+ */
+void scan_workers(int nthreads, void *(*fn)(void *), void *arg)
+{
+    pthread_t tids[SCAN_MAX_THREADS];
+
+    if (nthreads > SCAN_MAX_THREADS)
+        nthreads = SCAN_MAX_THREADS;
+    for (int i = 1; i < nthreads; i++) {
+        if (pthread_create(&tids[i], NULL, fn, arg) != 0) {
+            nthreads = i;
+            break;
+        }
+    }
+    fn(arg);
+    for (int i = 1; i < nthreads; i++)
+        pthread_join(tids[i], NULL);
+}
+
+/*
+ *  scan_threads
+ *      h:  database handle
+ *
+ *  returns:  how many workers scan_parallel() would use right now, so the
+ *            caller knows how many states to set up: SDB_SCAN_THREADS (one
+ *            per CPU by default) but no more than there are parts, and 1
+ *            for engines that are scanned in one go
+ */
+int scan_threads(db_handle_t *h)
+{
+    long nparts = (h->file_len + SCAN_PART_SZ - 1) / SCAN_PART_SZ;
+    int n = db_config_int("SDB_SCAN_THREADS", (int)sysconf(_SC_NPROCESSORS_ONLN));
+
+    if (h->engine != &legacy_engine)
+        return 1;
+    if (n > SCAN_MAX_THREADS)
+        n = SCAN_MAX_THREADS;
+    if (n > nparts)
+        n = (int)nparts;
+    return n < 1 ? 1 : n;
+}
+
+//state shared by the workers of scan_parallel()
+typedef struct par_job {
+    db_handle_t     *h;
+    scan_page_fn     fn;
+    scan_merge_fn    merge;
+    void            *arg;
+    void           **states;
+    int              next_worker;   //claimed with an atomic add
+    long             nparts;
+    long             next_part;     //claimed with an atomic add
+    pthread_mutex_t  mu;
+    pthread_cond_t   turn_cv;
+    long             turn;          //next part to merge, under mu
+    int              rc;            //first failure, under mu
+} par_job_t;
+
+/*
+ *  par_worker
+ *      arg:  the par_job_t
+ *
+ *  Claims parts until none are left or the scan failed.  Each part is
+ *  walked into the worker's state and then merged when its turn comes.
+ */
+static void *par_worker(void *arg)
+{
+    par_job_t *job = arg;
+    int w = __atomic_fetch_add(&job->next_worker, 1, __ATOMIC_RELAXED);
+    char *buf = malloc(SCAN_CHUNK_SZ);
+    int rc = buf == NULL ? ERR_DB_FILE : NO_ERROR;
+    bool stop = false;
+
+    while (!stop) {
+        long part = __atomic_fetch_add(&job->next_part, 1, __ATOMIC_RELAXED);
+        off_t lo = (off_t)part * SCAN_PART_SZ;
+        off_t hi = lo + SCAN_PART_SZ;
+
+        if (part >= job->nparts)
+            break;
+        if (hi > job->h->file_len)
+            hi = job->h->file_len;
+        if (rc == NO_ERROR)
+            rc = walk_extents(job->h, lo, hi, buf, job->fn, job->states[w]);
+
+        pthread_mutex_lock(&job->mu);
+        while (job->turn != part && job->rc == NO_ERROR)
+            pthread_cond_wait(&job->turn_cv, &job->mu);
+        if (job->rc == NO_ERROR) {
+            if (rc == NO_ERROR && job->merge != NULL)
+                rc = job->merge(job->arg, job->states[w]);
+            job->rc = rc;
+        }
+        job->turn++;
+        stop = job->rc != NO_ERROR;
+        pthread_cond_broadcast(&job->turn_cv);
+        pthread_mutex_unlock(&job->mu);
+    }
+    free(buf);
+    return NULL;
+}
+
+//runs a parallel scan's callbacks over a sequential engine scan, merging
+//after every SCAN_PART_SZ worth of pages
+typedef struct seq_job {
+    scan_page_fn   fn;
+    scan_merge_fn  merge;
+    void          *arg;
+    void          *state;
+    long           pages;
+} seq_job_t;
+
+static int seq_page(void *arg, int first, const student_t *recs, int n,
+                    uint64_t occupied)
+{
+    seq_job_t *job = arg;
+    int rc = job->fn(job->state, first, recs, n, occupied);
+
+    if (rc == NO_ERROR && job->merge != NULL &&
+        ++job->pages % (SCAN_PART_SZ / SCAN_PAGE_SZ) == 0)
+        rc = job->merge(job->arg, job->state);
+    return rc;
+}
+
+/*
+ *  scan_parallel
+ *      h:         database handle
+ *      nthreads:  most workers to use, see scan_threads()
+ *      fn:        page callback, run on the workers
+ *      states:    nthreads callback states; a worker passes its own one
+ *                 to fn and merge, so fn needs no locking
+ *      merge:     run after every part, in id order, may be NULL
+ *      arg:       passed through to merge
+ *
+ *  scan_db() on several threads.  fn sees every page once, but pages of
+ *  different parts are visited at the same time and in no particular
+ *  order; whatever has to come out in id order is collected in the state
+ *  and passed on by merge.  Engines other than legacy are scanned by one
+ *  worker with states[0], merging every SCAN_PART_SZ of pages.
+ *
+ *  returns:  see scan_db()
+ */
+int scan_parallel(db_handle_t *h, int nthreads, scan_page_fn fn, void **states,
+                  scan_merge_fn merge, void *arg)
+{
+    int rc;
+
+    if (db_gate_enter(h, false) != NO_ERROR)
+        return ERR_DB_FILE;
+
+    if (h->engine != &legacy_engine) {
+        seq_job_t job = { fn, merge, arg, states[0], 0 };
+
+        rc = h->engine->scan(h, seq_page, &job);
+        if (rc == NO_ERROR && merge != NULL)
+            rc = merge(arg, states[0]);
+    } else {
+        par_job_t job = {
+            .h = h, .fn = fn, .merge = merge, .arg = arg, .states = states,
+            .nparts = (h->file_len + SCAN_PART_SZ - 1) / SCAN_PART_SZ,
+            .mu = PTHREAD_MUTEX_INITIALIZER,
+            .turn_cv = PTHREAD_COND_INITIALIZER,
+        };
+
+        if (nthreads > job.nparts)
+            nthreads = (int)job.nparts;
+        if (nthreads < 1)
+            nthreads = 1;
+        posix_fadvise(h->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+        scan_workers(nthreads, par_worker, &job);
+        rc = job.rc;
+    }
+
+    db_gate_leave(h);
+    return rc;
+}
+
+//a cursor, see sdbsc.h
+struct db_cursor {
+    int       fd;
+    int       next;             //first id the next batch starts at
+    int       hi;
+    bool      done;             //the last batch reached hi
+    int       n;                //records in batch
+    int       pos;              //next record of batch to return
+    student_t batch[CURSOR_BATCH];
+};
+
+static int fill_batch(void *arg, int first, const student_t *recs, int n,
+                      uint64_t occupied)
+{
+    db_cursor_t *c = arg;
+    (void)first; (void)n;
+
+    while (occupied) {
+        if (c->n == CURSOR_BATCH)
+            return SCAN_STOP;
+        c->batch[c->n++] = recs[__builtin_ctzll(occupied)];
+        occupied &= occupied - 1;
+    }
+    return NO_ERROR;
+}
+
+/*
+ *  cursor_open
+ *      fd:  linux file descriptor of the database
+ *      lo:  smallest id to return
+ *      hi:  largest id to return
+ *
+ *  returns:  the cursor, NULL when out of memory
+ */
+db_cursor_t *cursor_open(int fd, int lo, int hi)
+{
+    db_cursor_t *c = calloc(1, sizeof(*c));
+
+    if (c == NULL)
+        return NULL;
+    c->fd = fd;
+    c->next = lo < MIN_STD_ID ? MIN_STD_ID : lo;
+    c->hi = hi > MAX_STD_ID ? MAX_STD_ID : hi;
+    c->done = c->next > c->hi;
+    return c;
+}
+
+/*
+ *  cursor_next
+ *      c:  cursor
+ *      s:  receives the next student
+ *
+ *  Hands out the current batch; once it is used up the next one is read
+ *  with one scan_range() that stops as soon as the batch is full.
+ *
+ *  returns:  NO_ERROR, SRCH_NOT_FOUND at the end, or ERR_DB_FILE
+ */
+int cursor_next(db_cursor_t *c, student_t *s)
+{
+    db_handle_t *h;
+    int rc;
+
+    if (c->pos == c->n) {
+        if (c->done)
+            return SRCH_NOT_FOUND;
+        h = db_handle_get(c->fd);
+        c->n = c->pos = 0;
+        rc = h ? scan_range(h, c->next, c->hi, fill_batch, c) : ERR_DB_FILE;
+        if (rc != NO_ERROR && rc != SCAN_STOP)
+            return ERR_DB_FILE;
+        c->done = rc == NO_ERROR || c->n == 0 || c->batch[c->n - 1].id >= c->hi;
+        if (c->n > 0)
+            c->next = c->batch[c->n - 1].id + 1;
+        if (c->n == 0)
+            return SRCH_NOT_FOUND;
+    }
+
+    *s = c->batch[c->pos++];
+    return NO_ERROR;
+}
+
+void cursor_close(db_cursor_t *c)
+{
+    free(c);
+}
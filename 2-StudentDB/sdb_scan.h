@@ -0,0 +1,60 @@
+#ifndef __SDB_SCAN_H__
+    #define __SDB_SCAN_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "db.h"
+#include "sdb_handle.h"
+
+//Full table scans, see sdb_scan.c.  Records are handed to a callback up
+//to 64 at a time (one 4K page) together with an occupancy bitmap: bit i
+//is set when record i is not empty.  The legacy engine walks the file one
+//populated extent at a time (holes are skipped with SEEK_DATA/SEEK_HOLE)
+//and passes its pages straight through; other engines copy their records
+//into pages in id order.
+//
+//scan_parallel() cuts a legacy file into parts of SCAN_PART_SZ bytes and
+//walks them on up to SDB_SCAN_THREADS threads (one per CPU by default),
+//each with its own pread() buffer and its own callback state.  Results
+//are put back together by reduction (sum the states afterwards) or in id
+//order, by a merge callback that is run for each part in file order.
+
+#define SCAN_PAGE_SZ        4096
+#define RECS_PER_PAGE       (SCAN_PAGE_SZ / 64)
+#define SCAN_CHUNK_SZ       (1024 * 1024)   //bytes per pread() of an extent
+#define SCAN_STOP           1               //callback return that ends a
+                                            //scan early without an error
+#define SCAN_PART_SZ        (256 * 1024)    //bytes per part of a parallel scan
+#define SCAN_MAX_THREADS    32
+#define CURSOR_BATCH        (4 * RECS_PER_PAGE) //records a cursor fetches
+                                                //per scan_range()
+
+//called for every page holding live records.  first is the slot number
+//(id) of recs[0] in the legacy format and -1 for engines that do not store
+//records at their id, n is the number of records in the page.  Return
+//NO_ERROR to keep going, anything else stops the scan and is returned by
+//scan_db()
+typedef int (*scan_page_fn)(void *arg, int first, const student_t *recs,
+                            int n, uint64_t occupied);
+
+//called by scan_parallel() when a worker is done with a part, with the
+//state that worker passed to its page callbacks.  Calls come one at a
+//time and in file (id) order; the worker waits for its turn.  Return
+//NO_ERROR to keep going, anything else stops the scan
+typedef int (*scan_merge_fn)(void *arg, void *state);
+
+//prototypes for sdb_scan.c
+int scan_db(db_handle_t *h, scan_page_fn fn, void *arg);
+int scan_threads(db_handle_t *h);
+int scan_parallel(db_handle_t *h, int nthreads, scan_page_fn fn, void **states,
+                  scan_merge_fn merge, void *arg);
+void scan_workers(int nthreads, void *(*fn)(void *), void *arg);
+int scan_range(db_handle_t *h, int lo, int hi, scan_page_fn fn, void *arg);
+int scan_extents(db_handle_t *h, scan_page_fn fn, void *arg);
+int range_extents(db_handle_t *h, int lo, int hi, scan_page_fn fn, void *arg);
+uint64_t page_occupancy(const student_t *recs, int n);
+bool next_extent(int fd, off_t pos, off_t len, off_t *start, off_t *end);
+
+#endif
@@ -0,0 +1,706 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "db.h"
+#include "sdbsc.h"
+#include "sdb_handle.h"
+#include "sdb_scan.h"
+#include "sdb_server.h"
+#include "sdb_out.h"
+#include "sdb_lock.h"
+#include "sdb_cache.h"
+
+//The server is one thread around poll().  Database operations are short
+//and the mapping stays warm, so running them one after the other on the
+//event loop is cheaper than handing them to threads.  Each round reads
+//every request that has arrived on any connection, runs them, commits
+//the write-ahead log once for the whole round (group commit), and only
+//then sends the responses, so an acknowledged add is durable.
+//
+//Other sdbsc processes can keep using the database directly while the
+//server runs; it takes the same locks they do.  The gate is held shared
+//for a whole round instead of per request, so a lookup the record cache
+//(sdb_cache.c) answers is made without a single system call.  A compress
+//needs the gate exclusive and lets go of the round's hold first.
+
+#define SERVER_IN_SZ        (64 * sizeof(sdb_req_t))
+
+typedef struct conn {
+    int       fd;               //-1 when the slot is free
+    bool      eof;              //client closed its end, flush then close
+    char      in[SERVER_IN_SZ];
+    size_t    in_len;
+    char     *out;
+    size_t    out_len;
+    size_t    out_off;          //bytes of out already written
+    size_t    out_cap;
+} conn_t;
+
+static volatile sig_atomic_t stopping = 0;
+
+//the handle whose gate the current round holds, NULL if none
+static db_handle_t *round_gate = NULL;
+
+static void round_begin(int fd)
+{
+    db_handle_t *h = fd >= 0 ? db_handle_get(fd) : NULL;
+
+    if (h != NULL && db_gate_enter(h, false) == NO_ERROR)
+        round_gate = h;
+}
+
+static void round_end(void)
+{
+    if (round_gate != NULL)
+        db_gate_leave(round_gate);
+    round_gate = NULL;
+}
+
+static void on_stop(int sig)
+{
+    (void)sig;
+    stopping = 1;
+}
+
+//appends len bytes to the connection's output, NULL data reserves them
+static char *out_put(conn_t *c, const void *data, size_t len)
+{
+    if (c->out_len + len > c->out_cap) {
+        size_t cap = c->out_cap ? c->out_cap : 4096;
+        char *p;
+
+        while (cap < c->out_len + len)
+            cap *= 2;
+        p = realloc(c->out, cap);
+        if (p == NULL)
+            return NULL;
+        c->out = p;
+        c->out_cap = cap;
+    }
+    if (data != NULL)
+        memcpy(c->out + c->out_len, data, len);
+    c->out_len += len;
+    return c->out + c->out_len - len;
+}
+
+static int put_page(void *arg, int first, const student_t *recs, int n,
+                    uint64_t occupied)
+{
+    (void)first; (void)n;
+
+    while (occupied) {
+        if (out_put(arg, &recs[__builtin_ctzll(occupied)], sizeof(student_t)) == NULL)
+            return ERR_DB_OP;
+        occupied &= occupied - 1;
+    }
+    return NO_ERROR;
+}
+
+/*
+ *  run_req
+ *      fd:       the database, updated if compress_db() hands back another
+ *      db_file:  path of the database, to reopen it after a failed compress
+ *      c:        connection the request came in on
+ *      req:      the request
+ *
+ *  Runs one request and queues its response.
+ *
+ *  returns:  true if the request changed the database
+ */
+static bool run_req(int *fd, char *db_file, conn_t *c, const sdb_req_t *req)
+{
+    sdb_resp_t resp = { SDB_PROTO_MAGIC, ERR_DB_OP, 0, 0 };
+    size_t at = c->out_len;
+    bool wrote = false;
+    student_t s;
+
+    if (out_put(c, &resp, sizeof(resp)) == NULL)
+        return false;
+
+    switch (req->magic == SDB_PROTO_MAGIC ? req->op : 0) {
+    case SDB_OP_ADD: {
+        char fname[sizeof(req->fname) + 1] = {0};
+        char lname[sizeof(req->lname) + 1] = {0};
+
+        memcpy(fname, req->fname, sizeof(req->fname));
+        memcpy(lname, req->lname, sizeof(req->lname));
+        if (validate_range(req->id, req->gpa) != NO_ERROR)
+            break;
+        resp.rc = add_student(*fd, req->id, fname, lname, req->gpa);
+        wrote = resp.rc == NO_ERROR;
+        break;
+    }
+    case SDB_OP_GET:
+        resp.rc = get_student(*fd, req->id, &s);
+        if (resp.rc == NO_ERROR) {
+            resp.len = sizeof(s);
+            if (out_put(c, &s, sizeof(s)) == NULL)
+                resp = (sdb_resp_t){ SDB_PROTO_MAGIC, ERR_DB_FILE, 0, 0 };
+        }
+        break;
+    case SDB_OP_DEL:
+        resp.rc = del_student(*fd, req->id);
+        wrote = resp.rc == NO_ERROR;
+        break;
+    case SDB_OP_COUNT:
+        resp.rc = count_db_records(*fd);
+        if (resp.rc < 0)
+            resp.rc = ERR_DB_FILE;
+        break;
+    case SDB_OP_PRINT:
+        resp.rc = scan_db(db_handle_get(*fd), put_page, c) == NO_ERROR ? NO_ERROR : ERR_DB_FILE;
+        if (resp.rc == NO_ERROR)
+            resp.len = (uint32_t)(c->out_len - at - sizeof(resp));
+        else
+            c->out_len = at + sizeof(resp);
+        break;
+    case SDB_OP_COMPRESS: {
+        int nfd;
+
+        round_end();
+        nfd = compress_db(*fd);
+        resp.rc = nfd < 0 ? ERR_DB_FILE : NO_ERROR;
+        *fd = nfd < 0 ? open_db(db_file, false) : nfd;
+        if (*fd < 0)
+            stopping = 1;
+        round_begin(*fd);
+        wrote = true;
+        break;
+    }
+    case SDB_OP_STATS: {
+        cache_stats_t st;
+        db_handle_t *h = db_handle_get(*fd);
+
+        resp.rc = h != NULL ? cache_stats(h, &st) : ERR_DB_FILE;
+        if (resp.rc == NO_ERROR) {
+            resp.len = sizeof(st);
+            if (out_put(c, &st, sizeof(st)) == NULL)
+                resp = (sdb_resp_t){ SDB_PROTO_MAGIC, ERR_DB_FILE, 0, 0 };
+        }
+        break;
+    }
+    default:
+        break;
+    }
+
+    memcpy(c->out + at, &resp, sizeof(resp));
+    return wrote;
+}
+
+//reads what the client sent and runs every complete request in it
+static bool read_conn(int *fd, char *db_file, conn_t *c)
+{
+    bool wrote = false;
+    size_t used = 0;
+    ssize_t r;
+
+    r = read(c->fd, c->in + c->in_len, sizeof(c->in) - c->in_len);
+    if (r == 0 || (r < 0 && errno != EAGAIN && errno != EINTR)) {
+        c->eof = true;
+        return false;
+    }
+    if (r < 0)
+        return false;
+    c->in_len += (size_t)r;
+
+    while (c->in_len - used >= sizeof(sdb_req_t) && *fd >= 0) {
+        sdb_req_t req;
+
+        memcpy(&req, c->in + used, sizeof(req));
+        used += sizeof(req);
+        wrote |= run_req(fd, db_file, c, &req);
+    }
+    memmove(c->in, c->in + used, c->in_len - used);
+    c->in_len -= used;
+    return wrote;
+}
+
+//sends as much queued output as the socket takes
+static void write_conn(conn_t *c)
+{
+    while (c->out_off < c->out_len) {
+        ssize_t w = write(c->fd, c->out + c->out_off, c->out_len - c->out_off);
+
+        if (w < 0) {
+            if (errno != EAGAIN && errno != EINTR) {
+                c->eof = true;      //client is gone, drop what is left
+                c->out_off = c->out_len;
+            }
+            return;
+        }
+        c->out_off += (size_t)w;
+    }
+    c->out_off = c->out_len = 0;
+}
+
+static void close_conn(conn_t *c)
+{
+    close(c->fd);
+    free(c->out);
+    memset(c, 0, sizeof(*c));
+    c->fd = -1;
+}
+
+/*
+ *  server_listen
+ *      path:  socket path
+ *
+ *  Creates the listening socket.  A socket file left behind by a server
+ *  that died is replaced, one that a live server answers on is not.
+ *
+ *  returns:  the socket, or -1
+ */
+int server_listen(const char *path)
+{
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    int s, probe;
+
+    if (strlen(path) >= sizeof(addr.sun_path))
+        return -1;
+    strcpy(addr.sun_path, path);
+
+    probe = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (probe != -1 && connect(probe, (struct sockaddr *)&addr, sizeof(addr)) == 0) {
+        close(probe);
+        return -1;
+    }
+    if (probe != -1)
+        close(probe);
+    unlink(path);
+
+    s = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+    if (s == -1)
+        return -1;
+    if (bind(s, (struct sockaddr *)&addr, sizeof(addr)) == -1 ||
+        listen(s, SERVER_BACKLOG) == -1) {
+        close(s);
+        return -1;
+    }
+    return s;
+}
+
+/*
+ *  serve_db
+ *      fd:         open database, closed by the time this returns
+ *      db_file:    path the database was opened from
+ *      sock_path:  socket to listen on, NULL for the default
+ *
+ *  Runs the server until SIGINT or SIGTERM.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ *
+ *  console:  M_SERVER_START once listening (stdout is then sent to
+ *            /dev/null, the API's messages are not for the server's
+ *            terminal), M_ERR_SERVER if the socket cannot be set up
+ */
+int serve_db(int fd, char *db_file, char *sock_path)
+{
+    static conn_t conns[SERVER_MAX_CONNS];
+    struct pollfd pfd[SERVER_MAX_CONNS + 1];
+    int who[SERVER_MAX_CONNS + 1];      //connection behind each pfd entry
+    char path[PATH_MAX];
+    struct sigaction sa = {0};
+    int lsock, rc = NO_ERROR;
+
+    if (sock_path != NULL)
+        snprintf(path, sizeof(path), "%s", sock_path);
+    else if (db_sidecar_path(db_handle_get(fd), SERVER_SUFFIX, path, sizeof(path)) != NO_ERROR)
+        path[0] = '\0';
+
+    lsock = path[0] ? server_listen(path) : -1;
+    if (lsock == -1) {
+        printf(M_ERR_SERVER, path);
+        close_db(fd);
+        return ERR_DB_FILE;
+    }
+
+    sa.sa_handler = on_stop;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    printf(M_SERVER_START, db_file, path);
+    fflush(stdout);
+    if (freopen("/dev/null", "w", stdout) == NULL)
+        rc = ERR_DB_FILE;
+
+    for (int i = 0; i < SERVER_MAX_CONNS; i++)
+        conns[i].fd = -1;
+
+    while (!stopping && rc == NO_ERROR) {
+        bool wrote = false;
+        int n = 1;
+
+        pfd[0] = (struct pollfd){ lsock, POLLIN, 0 };
+        for (int i = 0; i < SERVER_MAX_CONNS; i++) {
+            conn_t *c = &conns[i];
+
+            if (c->fd == -1)
+                continue;
+            who[n] = i;
+            pfd[n].fd = c->fd;
+            pfd[n].events = (c->out_len - c->out_off < SERVER_OUT_MAX && !c->eof ? POLLIN : 0) |
+                            (c->out_off < c->out_len ? POLLOUT : 0);
+            pfd[n++].revents = 0;
+        }
+        if (poll(pfd, n, -1) == -1) {
+            if (errno != EINTR)
+                rc = ERR_DB_FILE;
+            continue;
+        }
+
+        if (pfd[0].revents & POLLIN) {
+            int cfd = accept4(lsock, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+
+            for (int i = 0; cfd != -1 && i < SERVER_MAX_CONNS; i++) {
+                if (conns[i].fd == -1) {
+                    conns[i].fd = cfd;
+                    cfd = -1;
+                }
+            }
+            if (cfd != -1)
+                close(cfd);     //full, the client sees the connection drop
+        }
+
+        round_begin(fd);
+        for (int k = 1; k < n && fd >= 0; k++) {
+            if (pfd[k].revents & (POLLIN | POLLHUP | POLLERR))
+                wrote |= read_conn(&fd, db_file, &conns[who[k]]);
+        }
+
+        //one log commit covers every update of the round
+        if (wrote && fd >= 0 && sync_db(fd) != NO_ERROR)
+            rc = ERR_DB_FILE;
+        round_end();
+
+        for (int i = 0; i < SERVER_MAX_CONNS; i++) {
+            conn_t *c = &conns[i];
+
+            if (c->fd == -1)
+                continue;
+            write_conn(c);
+            if (c->eof && c->out_off >= c->out_len)
+                close_conn(c);
+        }
+        if (fd < 0)
+            rc = ERR_DB_FILE;
+    }
+
+    for (int i = 0; i < SERVER_MAX_CONNS; i++) {
+        if (conns[i].fd != -1)
+            close_conn(&conns[i]);
+    }
+    close(lsock);
+    unlink(path);
+    if (fd >= 0 && close_db(fd) != NO_ERROR)
+        rc = ERR_DB_FILE;
+    return rc;
+}
+
+static int xfer(int sock, void *buf, size_t len, bool out)
+{
+    char *p = buf;
+
+    while (len > 0) {
+        ssize_t r = out ? write(sock, p, len) : read(sock, p, len);
+
+        if (r < 0 && errno == EINTR)
+            continue;
+        if (r <= 0)
+            return ERR_DB_FILE;
+        p += r;
+        len -= (size_t)r;
+    }
+    return NO_ERROR;
+}
+
+/*
+ *  client_connect
+ *      sock_path:  the server's socket
+ *
+ *  returns:  connected socket, or -1
+ */
+int client_connect(const char *sock_path)
+{
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    int s;
+
+    if (strlen(sock_path) >= sizeof(addr.sun_path))
+        return -1;
+    strcpy(addr.sun_path, sock_path);
+
+    s = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (s != -1 && connect(s, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+        close(s);
+        return -1;
+    }
+    return s;
+}
+
+static int send_req(int sock, const sdb_req_t *req)
+{
+    return xfer(sock, (void *)req, sizeof(*req), true);
+}
+
+static int recv_resp(int sock, sdb_resp_t *resp, void **payload)
+{
+    *payload = NULL;
+    if (xfer(sock, resp, sizeof(*resp), false) != NO_ERROR ||
+        resp->magic != SDB_PROTO_MAGIC)
+        return ERR_DB_FILE;
+    if (resp->len == 0)
+        return NO_ERROR;
+
+    *payload = malloc(resp->len);
+    if (*payload == NULL || xfer(sock, *payload, resp->len, false) != NO_ERROR) {
+        free(*payload);
+        *payload = NULL;
+        return ERR_DB_FILE;
+    }
+    return NO_ERROR;
+}
+
+/*
+ *  client_call
+ *      sock:     connected socket
+ *      req:      request to send
+ *      resp:     receives the response header
+ *      payload:  receives a malloc()ed copy of the payload (NULL if there
+ *                is none), the caller frees it
+ *
+ *  One request and its response.  Pipelining clients write several
+ *  requests first and then read the responses in the same order, see
+ *  client_batch().
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE if the exchange failed
+ */
+int client_call(int sock, const sdb_req_t *req, sdb_resp_t *resp, void **payload)
+{
+    *payload = NULL;
+    if (send_req(sock, req) != NO_ERROR)
+        return ERR_DB_FILE;
+    return recv_resp(sock, resp, payload);
+}
+
+/*
+ *  client_batch
+ *      sock_path:  the server's socket
+ *      opt:        'd' or 'f'
+ *      args:       the ids on the command line
+ *      n:          number of ids
+ *
+ *  -d and -f with several ids.  One request per id, CLIENT_WINDOW of them
+ *  written before their responses are read, and the output of
+ *  del_students() or find_db().
+ *
+ *  returns:  exit code for the shell
+ */
+static int client_batch(const char *sock_path, char opt, char **args, int n)
+{
+    sdb_req_t req = { .magic = SDB_PROTO_MAGIC };
+    sdb_resp_t resp;
+    void *payload;
+    int *ids = malloc((size_t)n * sizeof(*ids));
+    int *rcs = malloc((size_t)n * sizeof(*rcs));
+    student_t *recs = opt == 'f' ? malloc((size_t)n * sizeof(*recs)) : NULL;
+    int sock = client_connect(sock_path);
+    int rc = sock == -1 || ids == NULL || rcs == NULL ||
+             (opt == 'f' && recs == NULL) ? ERR_DB_FILE : NO_ERROR;
+    int exit_code = EXIT_OK;
+
+    req.op = opt == 'f' ? SDB_OP_GET : SDB_OP_DEL;
+    for (int i = 0; rc == NO_ERROR && i < n; i++)
+        ids[i] = atoi(args[i]);
+    for (int done = 0; rc == NO_ERROR && done < n; ) {
+        int k = n - done < CLIENT_WINDOW ? n - done : CLIENT_WINDOW;
+
+        for (int i = done; rc == NO_ERROR && i < done + k; i++) {
+            req.id = ids[i];
+            rc = send_req(sock, &req);
+        }
+        for (int i = done; rc == NO_ERROR && i < done + k; i++) {
+            rc = recv_resp(sock, &resp, &payload);
+            rcs[i] = rc == NO_ERROR ? resp.rc : ERR_DB_FILE;
+            if (rc == NO_ERROR && opt == 'f' && resp.rc == NO_ERROR) {
+                if (resp.len == sizeof(student_t))
+                    recs[i] = *(student_t *)payload;
+                else
+                    rcs[i] = ERR_DB_FILE;
+            }
+            free(payload);
+        }
+        done += k;
+    }
+    if (sock != -1)
+        close(sock);
+    if (rc != NO_ERROR) {
+        printf(M_ERR_CLIENT, sock_path);
+        exit_code = EXIT_FAIL_DB;
+    } else if (opt == 'f') {
+        if (print_found(ids, n, recs, rcs) != NO_ERROR)
+            exit_code = EXIT_FAIL_DB;
+    } else {
+        for (int i = 0; i < n; i++) {
+            if (rcs[i] == NO_ERROR) {
+                printf(M_STD_DEL_MSG, ids[i]);
+                continue;
+            }
+            exit_code = EXIT_FAIL_DB;
+            if (rcs[i] != SRCH_NOT_FOUND) {
+                printf(M_ERR_DB_WRITE);
+                break;
+            }
+            printf(M_STD_NOT_FND_MSG, ids[i]);
+        }
+    }
+    free(ids);
+    free(rcs);
+    free(recs);
+    return exit_code;
+}
+
+/*
+ *  client_main
+ *      sock_path:  the server's socket
+ *      argc, argv: sdbsc's arguments, the option is one of a c d f i p x
+ *
+ *  The thin client: same arguments, output and exit codes as the local
+ *  operation in main().
+ *
+ *  returns:  exit code for the shell
+ */
+int client_main(const char *sock_path, int argc, char *argv[])
+{
+    sdb_req_t req = { .magic = SDB_PROTO_MAGIC };
+    sdb_resp_t resp;
+    void *payload;
+    char opt = argv[1][1];
+    int need = opt == 'a' ? 6 : (opt == 'd' || opt == 'f') ? 3 : 2;
+    out_format_t format = OUT_TABLE;
+    int sock, exit_code = EXIT_OK;
+
+    if (opt == 'p' && argc == 3) {
+        if (out_format_named(argv[2], &format) != NO_ERROR) {
+            printf(M_ERR_OUT_FORMAT, argv[2]);
+            return EXIT_FAIL_ARGS;
+        }
+        need = 3;
+    }
+    if ((opt == 'd' || opt == 'f') && argc > 3)
+        return client_batch(sock_path, opt, argv + 2, argc - 2);
+    if (argc != need) {
+        usage(argv[0]);
+        return EXIT_FAIL_ARGS;
+    }
+
+    switch (opt) {
+    case 'a':
+        req.op = SDB_OP_ADD;
+        req.id = atoi(argv[2]);
+        req.gpa = atoi(argv[5]);
+        if (validate_range(req.id, req.gpa) == EXIT_FAIL_ARGS) {
+            printf(M_ERR_STD_RNG);
+            return EXIT_FAIL_ARGS;
+        }
+        strncpy(req.fname, argv[3], sizeof(req.fname) - 1);
+        strncpy(req.lname, argv[4], sizeof(req.lname) - 1);
+        break;
+    case 'd': req.op = SDB_OP_DEL; req.id = atoi(argv[2]); break;
+    case 'f': req.op = SDB_OP_GET; req.id = atoi(argv[2]); break;
+    case 'c': req.op = SDB_OP_COUNT; break;
+    case 'p': req.op = SDB_OP_PRINT; break;
+    case 'x': req.op = SDB_OP_COMPRESS; break;
+    case 'i': req.op = SDB_OP_STATS; break;
+    }
+
+    sock = client_connect(sock_path);
+    if (sock == -1 || client_call(sock, &req, &resp, &payload) != NO_ERROR) {
+        if (sock != -1)
+            close(sock);
+        printf(M_ERR_CLIENT, sock_path);
+        return EXIT_FAIL_DB;
+    }
+    close(sock);
+
+    if (resp.rc < 0)
+        exit_code = EXIT_FAIL_DB;
+
+    switch (opt) {
+    case 'a':
+        if (resp.rc == NO_ERROR)
+            printf(M_STD_ADDED, req.id);
+        else if (resp.rc == ERR_DB_OP)
+            printf(M_ERR_DB_ADD_DUP, req.id);
+        else
+            printf(M_ERR_DB_WRITE);
+        break;
+    case 'd':
+        if (resp.rc == NO_ERROR)
+            printf(M_STD_DEL_MSG, req.id);
+        else if (resp.rc == SRCH_NOT_FOUND)
+            printf(M_STD_NOT_FND_MSG, req.id);
+        else
+            printf(M_ERR_DB_WRITE);
+        break;
+    case 'f':
+        if (resp.rc == NO_ERROR && resp.len == sizeof(student_t))
+            print_student(payload);
+        else if (resp.rc == SRCH_NOT_FOUND)
+            printf(M_STD_NOT_FND_MSG, req.id);
+        else
+            printf(M_ERR_DB_READ);
+        break;
+    case 'c':
+        if (resp.rc == 0)
+            printf(M_DB_EMPTY);
+        else if (resp.rc > 0)
+            printf(M_DB_RECORD_CNT, resp.rc);
+        else
+            printf(M_ERR_DB_READ);
+        break;
+    case 'p':
+        if (resp.rc != NO_ERROR) {
+            printf(M_ERR_DB_READ);
+        } else if (resp.len == 0 && format == OUT_TABLE) {
+            printf(M_DB_EMPTY);
+        } else {
+            student_t *s = payload;
+            sdb_out_t *o = out_open(STDOUT_FILENO, format);
+
+            if (o == NULL) {
+                printf(M_ERR_DB_READ);
+                exit_code = EXIT_FAIL_DB;
+                break;
+            }
+            for (size_t i = 0; i < resp.len / sizeof(*s); i++)
+                out_student(o, &s[i]);
+            if (out_close(o) != NO_ERROR)
+                exit_code = EXIT_FAIL_DB;
+        }
+        break;
+    case 'x':
+        printf(resp.rc == NO_ERROR ? M_DB_COMPRESSED_OK : M_ERR_DB_WRITE);
+        break;
+    case 'i':
+        if (resp.rc == NO_ERROR && resp.len == sizeof(cache_stats_t))
+            print_cache_stats(payload);
+        else
+            printf(M_ERR_DB_READ);
+        break;
+    }
+
+    free(payload);
+    return exit_code;
+}
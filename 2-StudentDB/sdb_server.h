@@ -0,0 +1,84 @@
+#ifndef __SDB_SERVER_H__
+    #define __SDB_SERVER_H__
+
+#include <stdint.h>
+
+#include "db.h"
+
+//Database server and thin client, see sdb_server.c.  "sdbsc -D [socket]"
+//keeps the database open (mapped and cached) and answers requests on a
+//Unix domain stream socket, .student.db.sock next to the database unless
+//a path is given.  With SDB_SERVER=<socket> in the environment sdbsc -a,
+//-c, -d, -f, -i, -p and -x send their request to the server instead of
+//opening the database, and print exactly what they would print locally
+//(for -i, the server's record cache counters instead of its own).  -d
+//and -f with several ids send one request per id, pipelined.
+//
+//Protocol: a client writes fixed size sdb_req_t requests, as many as it
+//likes without waiting (pipelining).  The server answers each one, in
+//order, with an sdb_resp_t followed by len bytes of payload:
+//
+//  op                  rc                                   payload
+//  SDB_OP_ADD          NO_ERROR, ERR_DB_OP (duplicate or    -
+//                      out of range), ERR_DB_FILE
+//  SDB_OP_GET          NO_ERROR, SRCH_NOT_FOUND, ERR_*      student_t if found
+//  SDB_OP_DEL          NO_ERROR, SRCH_NOT_FOUND, ERR_*      -
+//  SDB_OP_COUNT        number of students, or ERR_*         -
+//  SDB_OP_PRINT        NO_ERROR or ERR_*                    student_t per
+//                                                           student, id order
+//  SDB_OP_COMPRESS     NO_ERROR or ERR_*                    -
+//  SDB_OP_STATS        NO_ERROR or ERR_*                    cache_stats_t
+//
+//Requests that arrive together are run back to back and share one write
+//ahead log commit before their responses go out.  All integers are in
+//host byte order, the socket never leaves the machine.
+
+#define SDB_PROTO_MAGIC     0x53444231u     //"SDB1"
+#define SERVER_SUFFIX       ".sock"
+#define SERVER_BACKLOG      64
+#define SERVER_MAX_CONNS    256
+#define SERVER_OUT_MAX      (16 * 1024 * 1024)  //stop reading a client whose
+                                                //responses pile up past this
+#define CLIENT_WINDOW       1024                //requests a client writes
+                                                //before reading responses
+
+enum {
+    SDB_OP_ADD = 1,
+    SDB_OP_GET,
+    SDB_OP_DEL,
+    SDB_OP_COUNT,
+    SDB_OP_PRINT,
+    SDB_OP_COMPRESS,
+    SDB_OP_STATS,
+};
+
+typedef struct sdb_req {
+    uint32_t magic;
+    uint32_t op;
+    int32_t  id;
+    int32_t  gpa;
+    char     fname[24];
+    char     lname[32];
+} sdb_req_t;
+
+typedef struct sdb_resp {
+    uint32_t magic;
+    int32_t  rc;
+    uint32_t len;               //bytes of payload that follow
+    uint32_t pad;
+} sdb_resp_t;
+
+//Output messages
+#define M_SERVER_START      "Serving %s on %s\n"
+#define M_ERR_SERVER        "Error starting the database server on %s, exiting!\n"
+#define M_ERR_CLIENT        "Error talking to the database server at %s, exiting!\n"
+
+//prototypes for sdb_server.c
+int serve_db(int fd, char *db_file, char *sock_path);
+int server_listen(const char *path);
+int client_connect(const char *sock_path);
+int client_call(int sock, const sdb_req_t *req, sdb_resp_t *resp,
+                void **payload);
+int client_main(const char *sock_path, int argc, char *argv[]);
+
+#endif
@@ -0,0 +1,338 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <time.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <linux/fs.h>
+
+#include "db.h"
+#include "sdbsc.h"
+#include "sdb_handle.h"
+#include "sdb_lock.h"
+#include "sdb_snap.h"
+
+//A snapshot is a copy of the database file taken while no change is in
+//flight.  Writers change records under their record write lock (and the
+//dense and var engines their structures under the dir lock), so holding
+//read locks on every record and on the dir is enough: other readers go
+//on, writers wait only for the copy.
+//
+//Where the file system can share extents (btrfs, XFS, ...) the copy is a
+//FICLONE reflink, which takes about as long as a stat() whatever the
+//size, and the blocks are copied later, only as writers change them.
+//Elsewhere the data extents are copied with copy_file_range(), holes
+//stay holes, so writers wait about as long as a sequential read of the
+//live records.  Reports then read the snapshot with locks of their own.
+
+#define COPY_BUF        (1024 * 1024)
+
+static bool valid_name(const char *name)
+{
+    size_t n = strlen(name);
+
+    if (n == 0 || n > SNAP_NAME_MAX)
+        return false;
+    for (size_t i = 0; i < n; i++) {
+        char c = name[i];
+
+        if (!(c >= 'a' && c <= 'z') && !(c >= 'A' && c <= 'Z') &&
+            !(c >= '0' && c <= '9') && c != '-' && c != '_')
+            return false;
+    }
+    return true;
+}
+
+static int snap_path(const char *db_file, const char *name, char *buf, size_t len)
+{
+    char suffix[sizeof(SNAP_SUFFIX) + SNAP_NAME_MAX];
+
+    snprintf(suffix, sizeof(suffix), "%s%s", SNAP_SUFFIX, name);
+    return db_file_sidecar(db_file, suffix, buf, len);
+}
+
+/*
+ *  copy_range
+ *      src, dst:  file descriptors
+ *      off:       where the bytes start, in both files
+ *      len:       number of bytes
+ *
+ *  Copies in the kernel when it can, with a read/write loop otherwise.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ */
+static int copy_range(int src, int dst, off_t off, off_t len)
+{
+    off_t in = off, out = off, end = off + len;
+    char *buf;
+
+    while (in < end) {
+        ssize_t n = copy_file_range(src, &in, dst, &out, (size_t)(end - in), 0);
+
+        if (n <= 0)
+            break;
+    }
+    if (in == end)
+        return NO_ERROR;
+
+    buf = malloc(COPY_BUF);
+    if (buf == NULL)
+        return ERR_DB_FILE;
+    while (in < end) {
+        size_t want = end - in < COPY_BUF ? (size_t)(end - in) : COPY_BUF;
+        ssize_t n = pread(src, buf, want, in);
+
+        if (n <= 0 || pwrite(dst, buf, (size_t)n, in) != n) {
+            free(buf);
+            return ERR_DB_FILE;
+        }
+        in += n;
+    }
+    free(buf);
+    return NO_ERROR;
+}
+
+/*
+ *  copy_file
+ *      src, dst:  file descriptors, dst empty
+ *      size:      length of src
+ *      cloned:    set to true when dst shares src's extents
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ */
+static int copy_file(int src, int dst, off_t size, bool *cloned)
+{
+    *cloned = ioctl(dst, FICLONE, src) == 0;
+    if (*cloned)
+        return NO_ERROR;
+
+    if (ftruncate(dst, size) == -1)
+        return ERR_DB_FILE;
+    for (off_t pos = 0; pos < size; ) {
+        off_t data = lseek(src, pos, SEEK_DATA);
+        off_t hole;
+
+        if (data == -1 || data >= size)
+            break;              //ENXIO, nothing but holes after pos
+        hole = lseek(src, data, SEEK_HOLE);
+        if (hole == -1 || hole > size)
+            hole = size;
+        if (copy_range(src, dst, data, hole - data) != NO_ERROR)
+            return ERR_DB_FILE;
+        pos = hole;
+    }
+    return NO_ERROR;
+}
+
+/*
+ *  snap_copy
+ *      fd:      linux file descriptor
+ *      path:    where the copy goes, an older file there is replaced
+ *      mode:    permissions of the copy
+ *      cloned:  set to true when the copy shares the database's extents
+ *
+ *  Copies the database with every record and the dir read locked, then
+ *  renames the copy into place.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ */
+int snap_copy(int fd, const char *path, mode_t mode, bool *cloned)
+{
+    db_handle_t *h = db_handle_get(fd);
+    char tmp[PATH_MAX];
+    struct stat st;
+    int out = -1, rc = ERR_DB_FILE;
+
+    *cloned = false;
+    if (h == NULL || snprintf(tmp, sizeof(tmp), "%s.tmp", path) >= (int)sizeof(tmp) ||
+        db_gate_enter(h, false) != NO_ERROR)
+        return ERR_DB_FILE;
+
+    if (db_lock_range(h, 0, LOCK_GATE_OFF, false) == NO_ERROR) {
+        if (db_lock_range(h, LOCK_DIR_OFF, 1, false) == NO_ERROR) {
+            out = open(tmp, O_RDWR | O_CREAT | O_TRUNC, mode);
+            if (out != -1 && fstat(h->fd, &st) == 0)
+                rc = copy_file(h->fd, out, st.st_size, cloned);
+            db_unlock_range(h, LOCK_DIR_OFF, 1);
+        }
+        db_unlock_range(h, 0, LOCK_GATE_OFF);
+    }
+    db_gate_leave(h);
+
+    if (rc == NO_ERROR && (fsync(out) == -1 || rename(tmp, path) == -1))
+        rc = ERR_DB_FILE;
+    if (out != -1)
+        close(out);
+    if (rc != NO_ERROR)
+        unlink(tmp);
+    return rc;
+}
+
+/*
+ *  snap_create
+ *      fd:    linux file descriptor
+ *      name:  name of the snapshot, an older one of that name is replaced
+ *
+ *  Copies the database with snap_copy().  The snapshot is made read-only.
+ *
+ *  returns:  NO_ERROR, ERR_DB_OP for a bad name, or ERR_DB_FILE
+ *
+ *  console:  M_SNAP_CREATED, M_ERR_SNAP_NAME or M_ERR_SNAP
+ */
+int snap_create(int fd, const char *name)
+{
+    db_handle_t *h = db_handle_get(fd);
+    char path[PATH_MAX];
+    bool cloned;
+
+    if (!valid_name(name)) {
+        printf(M_ERR_SNAP_NAME);
+        return ERR_DB_OP;
+    }
+    if (h == NULL || snap_path(h->path, name, path, sizeof(path)) != NO_ERROR ||
+        snap_copy(fd, path, S_IRUSR | S_IRGRP, &cloned) != NO_ERROR) {
+        printf(M_ERR_SNAP);
+        return ERR_DB_FILE;
+    }
+
+    printf(M_SNAP_CREATED, name, cloned ? "cloned" : "copied");
+    return NO_ERROR;
+}
+
+/*
+ *  snap_drop
+ *      db_file:  database the snapshot was taken of
+ *      name:     snapshot to remove
+ *
+ *  returns:  NO_ERROR, SRCH_NOT_FOUND, or ERR_DB_OP for a bad name
+ *
+ *  console:  M_SNAP_DROPPED, M_SNAP_NOT_FND or M_ERR_SNAP_NAME
+ */
+int snap_drop(const char *db_file, const char *name)
+{
+    char path[PATH_MAX];
+
+    if (!valid_name(name) || snap_path(db_file, name, path, sizeof(path)) != NO_ERROR) {
+        printf(M_ERR_SNAP_NAME);
+        return ERR_DB_OP;
+    }
+    if (unlink(path) == -1) {
+        printf(M_SNAP_NOT_FND, name);
+        return SRCH_NOT_FOUND;
+    }
+    printf(M_SNAP_DROPPED, name);
+    return NO_ERROR;
+}
+
+static int cmp_names(const void *a, const void *b)
+{
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+/*
+ *  snap_list
+ *      db_file:  database whose snapshots to list
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ *
+ *  console:  M_SNAP_HDR and an M_SNAP_ENTRY line per snapshot in name
+ *            order, or M_SNAP_NONE
+ */
+int snap_list(const char *db_file)
+{
+    char prefix[PATH_MAX], path[PATH_MAX];
+    const char *dir = ".", *base = prefix;
+    char **names = NULL;
+    size_t plen, n = 0, cap = 0;
+    struct dirent *de;
+    char *slash;
+    DIR *d;
+
+    if (db_file_sidecar(db_file, SNAP_SUFFIX, prefix, sizeof(prefix)) != NO_ERROR)
+        return ERR_DB_FILE;
+    slash = strrchr(prefix, '/');
+    if (slash != NULL) {
+        *slash = '\0';
+        dir = prefix;
+        base = slash + 1;
+    }
+    plen = strlen(base);
+
+    d = opendir(dir);
+    if (d == NULL)
+        return ERR_DB_FILE;
+    while ((de = readdir(d)) != NULL) {
+        if (strncmp(de->d_name, base, plen) != 0 || !valid_name(de->d_name + plen))
+            continue;
+        if (n == cap) {
+            char **nn = realloc(names, (cap = cap ? 2 * cap : 16) * sizeof(*names));
+
+            if (nn == NULL)
+                break;
+            names = nn;
+        }
+        names[n] = strdup(de->d_name + plen);
+        if (names[n] != NULL)
+            n++;
+    }
+    closedir(d);
+
+    if (n == 0)
+        printf(M_SNAP_NONE);
+    else
+        printf(M_SNAP_HDR, "SNAPSHOT", "TAKEN", "BYTES");
+    qsort(names, n, sizeof(*names), cmp_names);
+    for (size_t i = 0; i < n; i++) {
+        struct stat st;
+        char when[32] = "?";
+
+        if (snap_path(db_file, names[i], path, sizeof(path)) == NO_ERROR &&
+            stat(path, &st) == 0) {
+            strftime(when, sizeof(when), "%Y-%m-%d %H:%M:%S", localtime(&st.st_mtime));
+            printf(M_SNAP_ENTRY, names[i], when, (long long)st.st_size);
+        }
+        free(names[i]);
+    }
+    free(names);
+    return NO_ERROR;
+}
+
+/*
+ *  snap_open
+ *      db_file:  database the snapshot was taken of
+ *      name:     snapshot to open
+ *
+ *  Opens the snapshot read-only in place of the database; close it with
+ *  close_db().
+ *
+ *  returns:  the fd, or ERR_DB_FILE
+ *
+ *  console:  M_SNAP_NOT_FND or M_ERR_SNAP_NAME
+ */
+int snap_open(const char *db_file, const char *name)
+{
+    char path[PATH_MAX];
+    int fd;
+
+    if (!valid_name(name) || snap_path(db_file, name, path, sizeof(path)) != NO_ERROR) {
+        printf(M_ERR_SNAP_NAME);
+        return ERR_DB_FILE;
+    }
+    fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        printf(M_SNAP_NOT_FND, name);
+        return ERR_DB_FILE;
+    }
+    if (db_handle_open(fd, path) == NULL) {
+        close(fd);
+        printf(M_ERR_DB_OPEN);
+        return ERR_DB_FILE;
+    }
+    return fd;
+}
@@ -0,0 +1,37 @@
+#ifndef __SDB_SNAP_H__
+    #define __SDB_SNAP_H__
+
+#include <stdbool.h>
+#include <sys/types.h>
+
+#include "db.h"
+
+//Point-in-time copies of the database, see sdb_snap.c.  -s name saves one
+//as the hidden file .student.db.snap.name, and with SDB_SNAPSHOT=name the
+//read-only operations (count, find, print, range) run against it
+//instead of the live file, so a long report neither waits for writers
+//nor sees their changes half way.
+
+#define SNAP_SUFFIX         ".snap."
+#define SNAP_NAME_MAX       64
+#define SNAP_OPS            "cfpr"      //operations allowed on a snapshot
+
+//Output messages
+#define M_SNAP_CREATED      "Snapshot %s created (%s).\n"
+#define M_SNAP_DROPPED      "Snapshot %s removed.\n"
+#define M_SNAP_ENTRY        "%-24s %s %12lld\n"
+#define M_SNAP_HDR          "%-24s %-19s %12s\n"
+#define M_SNAP_NONE         "No snapshots.\n"
+#define M_SNAP_NOT_FND      "Snapshot %s was not found.\n"
+#define M_ERR_SNAP_NAME     "Snapshot names are 1 to 64 letters, digits, '-' or '_'.\n"
+#define M_ERR_SNAP_OP       "Snapshots are read-only, -%c cannot run with SDB_SNAPSHOT.\n"
+#define M_ERR_SNAP          "Error writing the snapshot, exiting!\n"
+
+//prototypes for sdb_snap.c
+int snap_copy(int fd, const char *path, mode_t mode, bool *cloned);
+int snap_create(int fd, const char *name);
+int snap_drop(const char *db_file, const char *name);
+int snap_list(const char *db_file);
+int snap_open(const char *db_file, const char *name);
+
+#endif
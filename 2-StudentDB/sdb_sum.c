@@ -0,0 +1,558 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "db.h"
+#include "sdbsc.h"
+#include "sdb_handle.h"
+#include "sdb_scan.h"
+#include "sdb_lock.h"
+#include "sdb_engine.h"
+#include "sdb_crc.h"
+#include "sdb_sum.h"
+
+//Page checksums.  A record change rereads its 4K page from the file and
+//rewrites that page's sum, under the meta lock like every sidecar update.
+//The page is read after the record was stored, and the last writer to
+//get the meta lock sees every store that came before it, so two writers
+//in one page always leave the sum of the final page.
+//
+//Verify reads the sums once and then the database in large chunks, with
+//no locks held, on as many threads as there are CPUs; CRC32C runs at
+//several GB/s per core so the disk is the limit.  A writer can be half
+//way through a change while we read, so a page that fails is read again
+//with the gate held exclusive, when no change is in flight, before it is
+//reported.
+
+#define RECS_PER_SUM_PAGE   (SUM_PAGE_SZ / STUDENT_RECORD_SIZE)
+
+//state shared by the verify workers
+typedef struct verify_job {
+    int              fd;
+    off_t            file_len;
+    long             npages;
+    uint32_t        *sums;          //NULL when the database has none
+    long             next_chunk;    //claimed with an atomic add
+    pthread_mutex_t  mu;
+    long            *bad;           //pages that failed, in no order
+    long             nbad;
+    long             cap;
+    int              err;
+} verify_job_t;
+
+/*
+ *  page_sum
+ *      page:  a page of the database
+ *      len:   its size, SUM_PAGE_SZ
+ *
+ *  returns:  the value stored for page, 0 for an all zero page
+ */
+uint32_t page_sum(const void *page, size_t len)
+{
+    return crc32c(0, page, len) ^ SUM_ZERO_PAGE;
+}
+
+/*
+ *  read_pages
+ *      fd:    database file
+ *      pg:    first page
+ *      n:     number of pages
+ *      buf:   n * SUM_PAGE_SZ bytes, zero filled past the end of the file
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ */
+static int read_pages(int fd, long pg, long n, char *buf)
+{
+    size_t want = (size_t)n * SUM_PAGE_SZ, got = 0;
+
+    while (got < want) {
+        ssize_t r = pread(fd, buf + got, want - got, (off_t)pg * SUM_PAGE_SZ + got);
+
+        if (r < 0 && errno == EINTR)
+            continue;
+        if (r < 0)
+            return ERR_DB_FILE;
+        if (r == 0)
+            break;
+        got += r;
+    }
+    memset(buf + got, 0, want - got);
+    return NO_ERROR;
+}
+
+/*
+ *  page_ok
+ *      page:  a page read with read_pages()
+ *      pg:    its page number
+ *      sum:   its stored sum, ignored when have_sum is false
+ *
+ *  A page is good when it matches its sum and every record in it is
+ *  either empty or sits in the slot of its own id.
+ *
+ *  returns:  true for a good page
+ */
+static bool page_ok(const char *page, long pg, uint32_t sum, bool have_sum)
+{
+    const student_t *recs = (const student_t *)page;
+    uint64_t occupied;
+
+    if (have_sum && page_sum(page, SUM_PAGE_SZ) != sum)
+        return false;
+
+    occupied = page_occupancy(recs, RECS_PER_SUM_PAGE);
+    while (occupied) {
+        int i = __builtin_ctzll(occupied);
+
+        if (recs[i].id != pg * RECS_PER_SUM_PAGE + i)
+            return false;
+        occupied &= occupied - 1;
+    }
+    return true;
+}
+
+/*
+ *  open_sums
+ *      h:       database handle
+ *      create:  create the sidecar if it does not exist
+ *
+ *  returns:  an open descriptor for the sidecar, or -1 (errno ENOENT when
+ *            there is none)
+ */
+static int open_sums(db_handle_t *h, bool create)
+{
+    char path[PATH_MAX];
+
+    if (h->path[0] == '\0' ||
+        db_sidecar_path(h, SUM_SUFFIX, path, sizeof(path)) != NO_ERROR) {
+        errno = ENOENT;
+        return -1;
+    }
+    return open(path, create ? O_RDWR | O_CREAT : O_RDWR, 0644);
+}
+
+/*
+ *  sums_current
+ *      h:    database handle
+ *      sfd:  the sidecar
+ *
+ *  returns:  true when the sidecar was written for the file h has open
+ */
+static bool sums_current(db_handle_t *h, int sfd)
+{
+    sum_hdr_t hdr;
+    struct stat st;
+
+    return pread(sfd, &hdr, sizeof(hdr), 0) == (ssize_t)sizeof(hdr) &&
+           fstat(h->fd, &st) == 0 &&
+           memcmp(hdr.magic, SUM_MAGIC, sizeof(hdr.magic)) == 0 &&
+           hdr.version == SUM_VERSION && hdr.page_sz == SUM_PAGE_SZ &&
+           hdr.db_dev == (uint64_t)st.st_dev && hdr.db_ino == (uint64_t)st.st_ino;
+}
+
+/*
+ *  write_sums
+ *      h:       database handle, meta lock held exclusive
+ *      sfd:     the sidecar, rewritten in place
+ *      npages:  receives the number of pages of the database
+ *
+ *  Only the populated extents are read; the sums of holes are 0, which is
+ *  what the sparse sidecar reads back there anyway.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ */
+static int write_sums(db_handle_t *h, int sfd, long *npages)
+{
+    sum_hdr_t hdr = { .version = SUM_VERSION, .page_sz = SUM_PAGE_SZ };
+    uint32_t sums[VERIFY_CHUNK_PAGES];
+    off_t pos = 0, start, end;
+    struct stat st;
+    char *buf;
+    int rc = NO_ERROR;
+
+    if (fstat(h->fd, &st) == -1)
+        return ERR_DB_FILE;
+    memcpy(hdr.magic, SUM_MAGIC, sizeof(hdr.magic));
+    hdr.db_dev = st.st_dev;
+    hdr.db_ino = st.st_ino;
+    *npages = (st.st_size + SUM_PAGE_SZ - 1) / SUM_PAGE_SZ;
+
+    //an invalid header until the sums are all in
+    if (ftruncate(sfd, 0) == -1 || ftruncate(sfd, SUM_ENTRY_OFF(*npages)) == -1)
+        return ERR_DB_FILE;
+
+    buf = malloc((size_t)VERIFY_CHUNK_PAGES * SUM_PAGE_SZ);
+    if (buf == NULL)
+        return ERR_DB_FILE;
+
+    while (rc == NO_ERROR && next_extent(h->fd, pos, st.st_size, &start, &end)) {
+        long pg = start / SUM_PAGE_SZ, last = (end + SUM_PAGE_SZ - 1) / SUM_PAGE_SZ;
+
+        while (rc == NO_ERROR && pg < last) {
+            long n = last - pg < VERIFY_CHUNK_PAGES ? last - pg : VERIFY_CHUNK_PAGES;
+            size_t bytes = (size_t)n * sizeof(uint32_t);
+
+            rc = read_pages(h->fd, pg, n, buf);
+            for (long i = 0; rc == NO_ERROR && i < n; i++)
+                sums[i] = page_sum(buf + i * SUM_PAGE_SZ, SUM_PAGE_SZ);
+            if (rc == NO_ERROR &&
+                pwrite(sfd, sums, bytes, SUM_ENTRY_OFF(pg)) != (ssize_t)bytes)
+                rc = ERR_DB_FILE;
+            pg += n;
+        }
+        pos = last * SUM_PAGE_SZ;
+    }
+    free(buf);
+
+    if (rc == NO_ERROR &&
+        pwrite(sfd, &hdr, sizeof(hdr), 0) != (ssize_t)sizeof(hdr))
+        rc = ERR_DB_FILE;
+    return rc;
+}
+
+/*
+ *  sum_on_change
+ *      h:    database handle, meta lock held exclusive
+ *      old:  record before the change
+ *      rec:  record after the change
+ *
+ *  Sidecar hook.  Recomputes the sum of the page the record is in.  With
+ *  no sidecar there is nothing to do, unless SDB_CHECKSUM asks for one:
+ *  failing then has it built by sum_on_rebuild().
+ *
+ *  returns:  NO_ERROR, or ERR_DB_FILE to have the sidecar rebuilt
+ */
+int sum_on_change(db_handle_t *h, const student_t *old, const student_t *rec)
+{
+    long pg = (long)(rec->id ? rec->id : old->id) / RECS_PER_SUM_PAGE;
+    char page[SUM_PAGE_SZ];
+    uint32_t sum;
+    int sfd, rc = NO_ERROR;
+
+    if (h->engine != &legacy_engine)
+        return NO_ERROR;
+
+    sfd = open_sums(h, false);
+    if (sfd == -1)
+        return db_config_int("SDB_CHECKSUM", 0) ? ERR_DB_FILE : NO_ERROR;
+
+    if (!sums_current(h, sfd) || read_pages(h->fd, pg, 1, page) != NO_ERROR) {
+        rc = ERR_DB_FILE;
+    } else {
+        sum = page_sum(page, sizeof(page));
+        if (pwrite(sfd, &sum, sizeof(sum), SUM_ENTRY_OFF(pg)) != (ssize_t)sizeof(sum))
+            rc = ERR_DB_FILE;
+    }
+    close(sfd);
+    return rc;
+}
+
+/*
+ *  sum_on_rebuild
+ *      h:  database handle, meta lock held exclusive
+ *
+ *  Sidecar hook.  Recomputes every sum, creating the sidecar first when
+ *  SDB_CHECKSUM is set.  A database that is no longer in the legacy
+ *  format loses its sidecar.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ */
+int sum_on_rebuild(db_handle_t *h)
+{
+    char path[PATH_MAX];
+    long npages;
+    int sfd, rc;
+
+    if (h->engine != &legacy_engine) {
+        if (h->path[0] != '\0' &&
+            db_sidecar_path(h, SUM_SUFFIX, path, sizeof(path)) == NO_ERROR)
+            unlink(path);
+        return NO_ERROR;
+    }
+
+    sfd = open_sums(h, db_config_int("SDB_CHECKSUM", 0) != 0);
+    if (sfd == -1)
+        return errno == ENOENT ? NO_ERROR : ERR_DB_FILE;
+    rc = write_sums(h, sfd, &npages);
+    close(sfd);
+    return rc;
+}
+
+/*
+ *  sum_on_close
+ *      h:  database handle
+ *
+ *  Sidecar hook, the sums keep no per-handle state.
+ */
+void sum_on_close(db_handle_t *h)
+{
+    (void)h;
+}
+
+/*
+ *  load_sums
+ *      h:       database handle, gate held
+ *      npages:  number of pages of the database
+ *      sums:    receives npages sums, or NULL when there are none
+ *
+ *  With SDB_CHECKSUM set a database without sums gets them first.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ *
+ *  console:  M_SUM_BUILT when the sums were just written
+ */
+static int load_sums(db_handle_t *h, long npages, uint32_t **sums)
+{
+    bool build = false;
+    long built = 0;
+    int sfd, rc = NO_ERROR;
+
+    *sums = NULL;
+    if (db_lock_range(h, LOCK_META_OFF, 1, false) != NO_ERROR)
+        return ERR_DB_FILE;
+    sfd = open_sums(h, false);
+    if (sfd != -1 && !sums_current(h, sfd)) {
+        close(sfd);
+        sfd = -1;
+    }
+
+    if (sfd == -1 && db_config_int("SDB_CHECKSUM", 0)) {
+        db_unlock_range(h, LOCK_META_OFF, 1);
+        if (db_lock_range(h, LOCK_META_OFF, 1, true) != NO_ERROR)
+            return ERR_DB_FILE;
+        sfd = open_sums(h, true);
+        if (sfd == -1 || write_sums(h, sfd, &built) != NO_ERROR)
+            rc = ERR_DB_FILE;
+        build = true;
+    }
+
+    if (rc == NO_ERROR && sfd != -1) {
+        size_t want = (size_t)npages * sizeof(uint32_t);
+        ssize_t got;
+
+        *sums = calloc(npages ? npages : 1, sizeof(uint32_t));
+        got = *sums ? pread(sfd, *sums, want, SUM_ENTRY_OFF(0)) : -1;
+        if (got < 0) {
+            free(*sums);
+            *sums = NULL;
+            rc = ERR_DB_FILE;
+        }
+    }
+    if (sfd != -1)
+        close(sfd);
+    db_unlock_range(h, LOCK_META_OFF, 1);
+
+    if (rc == NO_ERROR && build)
+        printf(M_SUM_BUILT, built);
+    return rc;
+}
+
+static void add_bad(verify_job_t *job, long pg)
+{
+    pthread_mutex_lock(&job->mu);
+    if (job->nbad == job->cap) {
+        long cap = job->cap ? job->cap * 2 : 64;
+        long *bad = realloc(job->bad, cap * sizeof(*bad));
+
+        if (bad == NULL) {
+            job->err = 1;
+            pthread_mutex_unlock(&job->mu);
+            return;
+        }
+        job->bad = bad;
+        job->cap = cap;
+    }
+    job->bad[job->nbad++] = pg;
+    pthread_mutex_unlock(&job->mu);
+}
+
+/*
+ *  verify_worker
+ *      arg:  the verify_job_t
+ *
+ *  Claims chunks of VERIFY_CHUNK_PAGES pages until none are left, reads
+ *  each with one pread() and checks its pages.
+ */
+static void *verify_worker(void *arg)
+{
+    verify_job_t *job = arg;
+    char *buf = malloc((size_t)VERIFY_CHUNK_PAGES * SUM_PAGE_SZ);
+
+    if (buf == NULL) {
+        __atomic_store_n(&job->err, 1, __ATOMIC_RELAXED);
+        return NULL;
+    }
+
+    for (;;) {
+        long pg = __atomic_fetch_add(&job->next_chunk, 1, __ATOMIC_RELAXED) *
+                  VERIFY_CHUNK_PAGES;
+        long n = job->npages - pg < VERIFY_CHUNK_PAGES ? job->npages - pg
+                                                       : VERIFY_CHUNK_PAGES;
+
+        if (n <= 0)
+            break;
+        if (read_pages(job->fd, pg, n, buf) != NO_ERROR) {
+            __atomic_store_n(&job->err, 1, __ATOMIC_RELAXED);
+            break;
+        }
+        for (long i = 0; i < n; i++) {
+            if (!page_ok(buf + i * SUM_PAGE_SZ, pg + i,
+                         job->sums ? job->sums[pg + i] : 0, job->sums != NULL))
+                add_bad(job, pg + i);
+        }
+    }
+    free(buf);
+    return NULL;
+}
+
+/*
+ *  recheck
+ *      h:    database handle, gate held exclusive
+ *      job:  the finished job, bad pages are dropped from it if they turn
+ *            out good
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ */
+static int recheck(db_handle_t *h, verify_job_t *job)
+{
+    char page[SUM_PAGE_SZ];
+    long kept = 0;
+    int sfd = -1;
+
+    if (job->sums != NULL) {
+        sfd = open_sums(h, false);
+        if (sfd == -1)
+            return ERR_DB_FILE;
+    }
+
+    for (long i = 0; i < job->nbad; i++) {
+        long pg = job->bad[i];
+        uint32_t sum = 0;
+
+        if (read_pages(h->fd, pg, 1, page) != NO_ERROR ||
+            (sfd != -1 && pread(sfd, &sum, sizeof(sum), SUM_ENTRY_OFF(pg)) < 0)) {
+            if (sfd != -1)
+                close(sfd);
+            return ERR_DB_FILE;
+        }
+        if (!page_ok(page, pg, sum, sfd != -1))
+            job->bad[kept++] = pg;
+    }
+    job->nbad = kept;
+    if (sfd != -1)
+        close(sfd);
+    return NO_ERROR;
+}
+
+static int cmp_long(const void *a, const void *b)
+{
+    long x = *(const long *)a, y = *(const long *)b;
+
+    return (x > y) - (x < y);
+}
+
+/*
+ *  verify_db
+ *      fd:  linux file descriptor
+ *
+ *  Checks every page of the database against its checksum, and that every
+ *  record is in the slot of its id (-v).  Runs alongside other readers
+ *  and writers; only pages that fail hold up writers, while they are read
+ *  again.
+ *
+ *  returns:  NO_ERROR, ERR_DB_OP when corrupt pages were found, or
+ *            ERR_DB_FILE
+ *
+ *  console:  a line per corrupt page and M_VERIFY_OK or M_VERIFY_FAILED,
+ *            M_SUM_NONE first when the database has no sums, M_SUM_DENSE
+ *            for a dense database, M_ERR_SUM on error
+ */
+int verify_db(int fd)
+{
+    db_handle_t *h = db_handle_get(fd);
+    verify_job_t job = { .mu = PTHREAD_MUTEX_INITIALIZER };
+    pthread_t tids[VERIFY_MAX_THREADS];
+    long nthreads, nchunks;
+    struct stat st;
+    int rc = NO_ERROR;
+
+    if (h == NULL || db_gate_enter(h, false) != NO_ERROR) {
+        printf(M_ERR_SUM);
+        return ERR_DB_FILE;
+    }
+    if (h->engine != &legacy_engine) {
+        db_gate_leave(h);
+        printf(M_SUM_DENSE);
+        return NO_ERROR;
+    }
+    if (fstat(h->fd, &st) == -1) {
+        db_gate_leave(h);
+        printf(M_ERR_SUM);
+        return ERR_DB_FILE;
+    }
+
+    job.fd = h->fd;
+    job.file_len = st.st_size;
+    job.npages = (st.st_size + SUM_PAGE_SZ - 1) / SUM_PAGE_SZ;
+    if (load_sums(h, job.npages, &job.sums) != NO_ERROR) {
+        db_gate_leave(h);
+        printf(M_ERR_SUM);
+        return ERR_DB_FILE;
+    }
+    if (job.sums == NULL)
+        printf(M_SUM_NONE);
+
+    nchunks = (job.npages + VERIFY_CHUNK_PAGES - 1) / VERIFY_CHUNK_PAGES;
+    nthreads = db_config_int("SDB_VERIFY_THREADS", (int)sysconf(_SC_NPROCESSORS_ONLN));
+    if (nthreads > VERIFY_MAX_THREADS)
+        nthreads = VERIFY_MAX_THREADS;
+    if (nthreads > nchunks)
+        nthreads = nchunks;
+    if (nthreads < 1)
+        nthreads = 1;
+
+    posix_fadvise(h->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    for (long i = 1; i < nthreads; i++) {
+        if (pthread_create(&tids[i], NULL, verify_worker, &job) != 0)
+            nthreads = i;
+    }
+    verify_worker(&job);
+    for (long i = 1; i < nthreads; i++)
+        pthread_join(tids[i], NULL);
+    db_gate_leave(h);
+
+    if (!job.err && job.nbad > 0) {
+        if (db_gate_enter(h, true) != NO_ERROR || recheck(h, &job) != NO_ERROR)
+            job.err = 1;
+        db_gate_leave(h);
+    }
+
+    if (job.err) {
+        printf(M_ERR_SUM);
+        rc = ERR_DB_FILE;
+    } else {
+        qsort(job.bad, job.nbad, sizeof(*job.bad), cmp_long);
+        for (long i = 0; i < job.nbad; i++)
+            printf(M_VERIFY_BAD_PAGE, job.bad[i],
+                   job.bad[i] * RECS_PER_SUM_PAGE,
+                   job.bad[i] * RECS_PER_SUM_PAGE + RECS_PER_SUM_PAGE - 1);
+        if (job.nbad == 0) {
+            printf(M_VERIFY_OK, job.npages);
+        } else {
+            printf(M_VERIFY_FAILED, job.npages, job.nbad);
+            rc = ERR_DB_OP;
+        }
+    }
+
+    free(job.sums);
+    free(job.bad);
+    return rc;
+}
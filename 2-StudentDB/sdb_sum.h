@@ -0,0 +1,61 @@
+#ifndef __SDB_SUM_H__
+    #define __SDB_SUM_H__
+
+#include <stdint.h>
+
+#include "db.h"
+#include "sdb_handle.h"
+
+//Page checksums, see sdb_sum.c.  The sidecar .student.db.sum holds one
+//CRC32C for every 4K page of a legacy format database:
+//
+//  [sum_hdr_t]
+//  uint32_t sums[npages]       CRC32C of page i xor SUM_ZERO_PAGE
+//
+//Pages are checksummed as if zero filled past the end of the file, and
+//each sum is stored xor the CRC of an all zero page so an empty page
+//(a hole) has a sum of 0.  The sidecar can then be sparse and shorter
+//than the database: sums past its end read as 0.
+//
+//Checksums are opt in.  A writer run with SDB_CHECKSUM=1 creates the
+//sidecar; once it exists every writer keeps it up to date whatever the
+//setting, so the database stays checksummed.  -v verifies the file.
+
+#define SUM_MAGIC           "SDBSUM01"
+#define SUM_VERSION         1
+#define SUM_SUFFIX          ".sum"
+#define SUM_PAGE_SZ         4096
+#define SUM_ZERO_PAGE       0x98F94189u     //crc32c() of SUM_PAGE_SZ zeros
+#define SUM_ENTRY_OFF(pg)   ((off_t)sizeof(sum_hdr_t) + (off_t)(pg) * sizeof(uint32_t))
+
+//verify reads the file in chunks of this many pages, handed out to up to
+//VERIFY_MAX_THREADS workers (SDB_VERIFY_THREADS, one per CPU by default)
+#define VERIFY_CHUNK_PAGES  256
+#define VERIFY_MAX_THREADS  32
+
+typedef struct sum_hdr {
+    char     magic[8];
+    uint32_t version;
+    uint32_t page_sz;
+    uint64_t db_dev;            //identity of the database the sums
+    uint64_t db_ino;            //were computed for
+    uint8_t  pad[32];
+} sum_hdr_t;
+
+//Output messages
+#define M_SUM_BUILT         "Page checksums written for %ld page(s).\n"
+#define M_SUM_NONE          "Database has no page checksums, checking record placement only.\n"
+#define M_SUM_DENSE         "Page checksums are only kept for the legacy format.\n"
+#define M_VERIFY_BAD_PAGE   "Page %ld (ids %ld to %ld) is corrupt.\n"
+#define M_VERIFY_OK         "Verified %ld page(s), no errors found.\n"
+#define M_VERIFY_FAILED     "Verified %ld page(s), %ld corrupt.\n"
+#define M_ERR_SUM           "Error reading or writing the page checksums, exiting!\n"
+
+//prototypes for sdb_sum.c
+uint32_t page_sum(const void *page, size_t len);
+int verify_db(int fd);
+int sum_on_change(db_handle_t *h, const student_t *old, const student_t *rec);
+int sum_on_rebuild(db_handle_t *h);
+void sum_on_close(db_handle_t *h);
+
+#endif
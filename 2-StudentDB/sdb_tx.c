@@ -0,0 +1,461 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+
+#include "db.h"
+#include "sdbsc.h"
+#include "sdb_handle.h"
+#include "sdb_wal.h"
+#include "sdb_lock.h"
+#include "sdb_engine.h"
+#include "sdb_filter.h"
+#include "sdb_tx.h"
+
+//A transaction is read and parsed whole before the database is touched,
+//then run with the gate held exclusive, so nobody sees it half done and
+//nobody waits on a slow writer of the input.  The operations only change
+//an in-memory copy of the slots they touch (tx_slot_t); get answers from
+//that copy first.  A failed operation rolls back by throwing the copies
+//away.
+//
+//At the end the changed slots are logged with wal_log_tx(), one write and
+//one fdatasync(), and only then stored, like recovery would store them,
+//and the sidecars told.  A crash before the log write leaves nothing of
+//the transaction, one after it is redone when the database is opened
+//next.  With SDB_WAL=0 there is no log: the file is fsync()ed once at
+//the end instead, and a crash in the middle can leave part of it.
+
+enum {
+    TX_ADD = 1,
+    TX_DEL,
+    TX_UPDATE,
+    TX_GET,
+};
+
+typedef struct tx_op {
+    int             op;             //TX_*
+    int             id;
+    int             gpa;            //add and update
+    long            line;
+    student_names_t names;          //add
+} tx_op_t;
+
+//one per id the transaction touches
+typedef struct tx_slot {
+    int             id;
+    student_t       old;            //in the database before
+    student_t       rec;            //after the operations so far
+    bool            named;          //names holds the full names of an add
+    student_names_t names;
+} tx_slot_t;
+
+typedef struct tx {
+    tx_op_t   *ops;
+    long       nops;
+    long       cap;
+    tx_slot_t *slots;
+    int        nslots;
+    int        slot_cap;
+    int       *slot_of;             //[id] index into slots + 1, 0 if none
+} tx_t;
+
+static void tx_free(tx_t *t)
+{
+    free(t->ops);
+    free(t->slots);
+    free(t->slot_of);
+}
+
+static bool parse_int(const char *s, int *out)
+{
+    char *end;
+    long v;
+
+    if (s == NULL || *s == '\0')
+        return false;
+    v = strtol(s, &end, 10);
+    if (*end != '\0' || v < INT_MIN || v > INT_MAX)
+        return false;
+    *out = (int)v;
+    return true;
+}
+
+/*
+ *  parse_op
+ *      line:  one line of input, modified in place
+ *      op:    operation to fill in
+ *
+ *  returns:  NO_ERROR, ERR_DB_OP if the line is malformed, SRCH_NOT_FOUND
+ *            if it holds no operation (blank or a comment)
+ */
+static int parse_op(char *line, tx_op_t *op)
+{
+    char *save, *arg[6];
+    int n = 0;
+
+    line += strspn(line, " \t");
+    if (*line == '#')
+        return SRCH_NOT_FOUND;
+    for (char *t = strtok_r(line, " \t\r\n", &save); t != NULL;
+         t = strtok_r(NULL, " \t\r\n", &save)) {
+        if (n == 6)
+            return ERR_DB_OP;
+        arg[n++] = t;
+    }
+    if (n == 0)
+        return SRCH_NOT_FOUND;
+
+    memset(op, 0, sizeof(*op));
+    op->gpa = MIN_STD_GPA;
+    if (strcmp(arg[0], "add") == 0 && n == 5 && parse_int(arg[4], &op->gpa)) {
+        op->op = TX_ADD;
+        strncpy(op->names.fname, arg[2], sizeof(op->names.fname) - 1);
+        strncpy(op->names.lname, arg[3], sizeof(op->names.lname) - 1);
+    } else if (strcmp(arg[0], "del") == 0 && n == 2) {
+        op->op = TX_DEL;
+    } else if (strcmp(arg[0], "update") == 0 && n == 3 &&
+               parse_int(arg[2], &op->gpa)) {
+        op->op = TX_UPDATE;
+    } else if (strcmp(arg[0], "get") == 0 && n == 2) {
+        op->op = TX_GET;
+    } else {
+        return ERR_DB_OP;
+    }
+    return parse_int(arg[1], &op->id) ? NO_ERROR : ERR_DB_OP;
+}
+
+/*
+ *  read_ops
+ *      in:  stream to read
+ *      t:   where the operations are collected
+ *
+ *  returns:  NO_ERROR, or ERR_DB_OP after printing what is wrong
+ *
+ *  console:  M_TX_BAD_LINE, M_TX_RANGE or M_ERR_TX_MEM
+ */
+static int read_ops(FILE *in, tx_t *t)
+{
+    char line[TX_LINE_MAX];
+    long lineno = 0;
+    tx_op_t op;
+
+    while (fgets(line, sizeof(line), in) != NULL) {
+        size_t len = strlen(line);
+        int rc;
+
+        lineno++;
+        rc = len == sizeof(line) - 1 && line[len - 1] != '\n' ?
+             ERR_DB_OP : parse_op(line, &op);
+        if (rc == SRCH_NOT_FOUND)
+            continue;
+        if (rc != NO_ERROR) {
+            printf(M_TX_BAD_LINE, lineno);
+            return ERR_DB_OP;
+        }
+        if (validate_range(op.id, op.gpa) != NO_ERROR) {
+            printf(M_TX_RANGE, lineno);
+            return ERR_DB_OP;
+        }
+
+        if (t->nops == t->cap) {
+            long cap = t->cap ? t->cap * 2 : 64;
+            tx_op_t *ops = realloc(t->ops, cap * sizeof(*ops));
+
+            if (ops == NULL) {
+                printf(M_ERR_TX_MEM);
+                return ERR_DB_OP;
+            }
+            t->ops = ops;
+            t->cap = cap;
+        }
+        op.line = lineno;
+        t->ops[t->nops++] = op;
+    }
+    return NO_ERROR;
+}
+
+/*
+ *  slot_get
+ *      h:   database handle, gate held exclusive
+ *      t:   transaction
+ *      id:  student id
+ *
+ *  The transaction's copy of slot id, read from the database the first
+ *  time the transaction touches it.
+ *
+ *  returns:  the copy, or NULL on I/O or memory errors
+ */
+static tx_slot_t *slot_get(db_handle_t *h, tx_t *t, int id)
+{
+    tx_slot_t *s;
+    int rc;
+
+    if (t->slot_of[id] != 0)
+        return &t->slots[t->slot_of[id] - 1];
+
+    if (t->nslots == t->slot_cap) {
+        int cap = t->slot_cap ? t->slot_cap * 2 : 64;
+        tx_slot_t *slots = realloc(t->slots, cap * sizeof(*slots));
+
+        if (slots == NULL)
+            return NULL;
+        t->slots = slots;
+        t->slot_cap = cap;
+    }
+
+    s = &t->slots[t->nslots];
+    memset(s, 0, sizeof(*s));
+    s->id = id;
+    rc = filter_absent(h, id) ? SRCH_NOT_FOUND : db_get(h, id, &s->old);
+    if (rc == SRCH_NOT_FOUND)
+        s->old = EMPTY_STUDENT_RECORD;
+    else if (rc != NO_ERROR)
+        return NULL;
+    s->rec = s->old;
+    t->slot_of[id] = ++t->nslots;
+    return s;
+}
+
+static void print_slot(db_handle_t *h, tx_slot_t *s)
+{
+    student_names_t names;
+
+    if (s->named)
+        print_student_names(&s->rec, &s->names);
+    else if (db_get_names(h, s->id, &names) == NO_ERROR)
+        print_student_names(&s->rec, &names);
+    else
+        print_student(&s->rec);
+}
+
+/*
+ *  run_ops
+ *      h:  database handle, gate held exclusive
+ *      t:  transaction
+ *
+ *  Applies the operations to the transaction's copies of the slots.
+ *
+ *  returns:  NO_ERROR, ERR_DB_OP when an operation cannot be done, or
+ *            ERR_DB_FILE
+ *
+ *  console:  get output, M_STD_NOT_FND_MSG, M_TX_DUP, M_TX_NOT_FOUND or
+ *            M_ERR_DB_READ
+ */
+static int run_ops(db_handle_t *h, tx_t *t)
+{
+    for (long i = 0; i < t->nops; i++) {
+        tx_op_t *op = &t->ops[i];
+        tx_slot_t *s = slot_get(h, t, op->id);
+
+        if (s == NULL) {
+            printf(M_ERR_DB_READ);
+            return ERR_DB_FILE;
+        }
+
+        switch (op->op) {
+        case TX_ADD:
+            if (s->rec.id != 0) {
+                printf(M_TX_DUP, op->line, op->id);
+                return ERR_DB_OP;
+            }
+            memset(&s->rec, 0, sizeof(s->rec));
+            s->rec.id = op->id;
+            strncpy(s->rec.fname, op->names.fname, sizeof(s->rec.fname) - 1);
+            strncpy(s->rec.lname, op->names.lname, sizeof(s->rec.lname) - 1);
+            s->rec.gpa = op->gpa;
+            s->names = op->names;
+            s->named = true;
+            break;
+
+        case TX_DEL:
+        case TX_UPDATE:
+            if (s->rec.id == 0) {
+                printf(M_TX_NOT_FOUND, op->line, op->id);
+                return ERR_DB_OP;
+            }
+            if (op->op == TX_UPDATE) {
+                s->rec.gpa = op->gpa;
+            } else {
+                s->rec = EMPTY_STUDENT_RECORD;
+                s->named = false;
+            }
+            break;
+
+        case TX_GET:
+            if (s->rec.id == 0)
+                printf(M_STD_NOT_FND_MSG, op->id);
+            else
+                print_slot(h, s);
+            break;
+        }
+    }
+    return NO_ERROR;
+}
+
+/*
+ *  commit
+ *      h:  database handle, gate held exclusive
+ *      t:  transaction whose operations all succeeded
+ *      n:  receives the number of slots changed
+ *
+ *  Logs the changed slots as one transaction, stores them and tells the
+ *  sidecars.  Once the log write is done the transaction is committed; a
+ *  store that fails after it is redone by recovery at the next open.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ */
+static int commit(db_handle_t *h, tx_t *t, long *n)
+{
+    int *ids = malloc((t->nslots ? t->nslots : 1) * sizeof(*ids));
+    student_t *recs = malloc((t->nslots ? t->nslots : 1) * sizeof(*recs));
+    const student_names_t **names = malloc((t->nslots ? t->nslots : 1) * sizeof(*names));
+    int lo = MAX_STD_ID, hi = 0, rc = NO_ERROR;
+    off_t off, len;
+
+    *n = 0;
+    for (int i = 0; ids != NULL && recs != NULL && names != NULL && i < t->nslots; i++) {
+        tx_slot_t *s = &t->slots[i];
+
+        if (!s->named && memcmp(&s->old, &s->rec, sizeof(s->rec)) == 0)
+            continue;   //read only, or changed back
+        ids[*n] = s->id;
+        names[*n] = s->named ? &s->names : NULL;
+        recs[(*n)++] = s->rec;
+        if (s->id < lo)
+            lo = s->id;
+        if (s->id > hi)
+            hi = s->id;
+    }
+    if (ids == NULL || recs == NULL || names == NULL || (*n > 0 && h->read_only)) {
+        free(ids);
+        free(recs);
+        free(names);
+        return ERR_DB_FILE;
+    }
+    if (*n == 0) {
+        free(ids);
+        free(recs);
+        free(names);
+        return NO_ERROR;
+    }
+
+    //lock order: records, then wal.  The wal lock is held until the slots
+    //are stored so no other process checkpoints the log in between
+    off = (off_t)lo * STUDENT_RECORD_SIZE;
+    len = (off_t)(hi - lo + 1) * STUDENT_RECORD_SIZE;
+    if (db_lock_range(h, off, len, true) != NO_ERROR) {
+        free(ids);
+        free(recs);
+        free(names);
+        return ERR_DB_FILE;
+    }
+    if (wal_begin(h) != NO_ERROR) {
+        db_unlock_range(h, off, len);
+        free(ids);
+        free(recs);
+        free(names);
+        return ERR_DB_FILE;
+    }
+
+    rc = wal_log_tx(h, ids, recs, names, (int)*n);
+    for (int i = 0; rc == NO_ERROR && i < t->nslots; i++) {
+        tx_slot_t *s = &t->slots[i];
+
+        if (!s->named && memcmp(&s->old, &s->rec, sizeof(s->rec)) == 0)
+            continue;
+        if (s->rec.id != 0) {
+            filter_add(h, s->id);
+            rc = db_put_names(h, s->id, &s->rec, s->named ? &s->names : NULL);
+        } else {
+            rc = db_put(h, s->id, &EMPTY_STUDENT_RECORD);
+            if (rc == NO_ERROR)
+                filter_del(h, s->id);
+        }
+    }
+    if (wal_end(h) != NO_ERROR)
+        rc = ERR_DB_FILE;
+    db_unlock_range(h, off, len);
+    free(ids);
+    free(recs);
+    free(names);
+    if (rc != NO_ERROR)
+        return ERR_DB_FILE;
+
+    if (db_lock_range(h, LOCK_META_OFF, 1, true) != NO_ERROR)
+        return ERR_DB_FILE;
+    for (int i = 0; i < t->nslots; i++) {
+        tx_slot_t *s = &t->slots[i];
+
+        if (s->named || memcmp(&s->old, &s->rec, sizeof(s->rec)) != 0)
+            db_notify_change(h, &s->old, &s->rec);
+    }
+    db_unlock_range(h, LOCK_META_OFF, 1);
+
+    //without a log the file itself is the commit
+    if (h->wal == NULL)
+        return fsync(h->fd) == -1 ? ERR_DB_FILE : NO_ERROR;
+    if (h->wal->size > WAL_CHECKPOINT_SZ)
+        return wal_checkpoint(h);
+    return NO_ERROR;
+}
+
+/*
+ *  tx_run
+ *      fd:   linux file descriptor
+ *      src:  file to read the operations from, "-" for stdin
+ *
+ *  Runs the operations of src as one transaction, see sdb_tx.h.
+ *
+ *  returns:  NO_ERROR, ERR_DB_OP when the transaction was rolled back, or
+ *            ERR_DB_FILE
+ *
+ *  console:  get output, M_TX_DONE, or what went wrong and M_TX_ROLLBACK
+ */
+int tx_run(int fd, char *src)
+{
+    bool use_stdin = (strcmp(src, "-") == 0);
+    FILE *in = use_stdin ? stdin : fopen(src, "r");
+    db_handle_t *h = db_handle_get(fd);
+    tx_t t = {0};
+    long changed = 0;
+    int rc;
+
+    if (in == NULL) {
+        printf(M_ERR_TX_OPEN, src);
+        return ERR_DB_FILE;
+    }
+    rc = read_ops(in, &t);
+    if (!use_stdin)
+        fclose(in);
+    if (rc != NO_ERROR) {
+        tx_free(&t);
+        printf(M_TX_ROLLBACK);
+        return ERR_DB_OP;
+    }
+
+    t.slot_of = calloc(MAX_STD_ID + 1, sizeof(*t.slot_of));
+    if (h == NULL || t.slot_of == NULL || db_gate_enter(h, true) != NO_ERROR) {
+        tx_free(&t);
+        printf(M_ERR_DB_READ);
+        return ERR_DB_FILE;
+    }
+
+    rc = run_ops(h, &t);
+    if (rc != NO_ERROR) {
+        printf(M_TX_ROLLBACK);
+    } else if (commit(h, &t, &changed) != NO_ERROR) {
+        printf(M_ERR_DB_WRITE);
+        rc = ERR_DB_FILE;
+    }
+    db_gate_leave(h);
+
+    if (rc == NO_ERROR)
+        printf(M_TX_DONE, t.nops, changed);
+    tx_free(&t);
+    return rc;
+}
@@ -0,0 +1,35 @@
+#ifndef __SDB_TX_H__
+    #define __SDB_TX_H__
+
+#include "db.h"
+
+//Transactions, see sdb_tx.c.  "sdbsc -T [file|-]" reads one operation
+//per line and runs them all against one open database:
+//
+//  add id first_name last_name gpa     as -a
+//  del id                              as -d
+//  update id gpa                       sets the GPA of a student
+//  get id                              as -f, sees the changes before it
+//
+//Blank lines and lines starting with # are skipped.  Either every change
+//is made or none is: an unknown or malformed line, an add of an id that
+//exists or a del/update of one that does not rolls the whole transaction
+//back.  The changes are made durable together, with one log write and
+//one fdatasync(), and a crash leaves all of them or none.
+
+#define TX_LINE_MAX         512             //longest input line accepted
+
+//Output messages
+#define M_TX_DONE           "Committed %ld operation(s), %ld change(s).\n"
+#define M_TX_ROLLBACK       "Rolled back, nothing was changed.\n"
+#define M_TX_BAD_LINE       "Line %ld: expected add id first last gpa|del id|update id gpa|get id\n"
+#define M_TX_RANGE          "Line %ld: ID or GPA out of allowable range\n"
+#define M_TX_NOT_FOUND      "Line %ld: student %d was not found in database.\n"
+#define M_TX_DUP            "Line %ld: student with ID=%d already exists\n"
+#define M_ERR_TX_OPEN       "Error opening input file %s\n"
+#define M_ERR_TX_MEM        "Out of memory while reading the transaction\n"
+
+//prototypes for sdb_tx.c
+int tx_run(int fd, char *src);
+
+#endif
@@ -0,0 +1,545 @@
+#include <stdio.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "db.h"
+#include "sdbsc.h"
+#include "sdb_handle.h"
+#include "sdb_mmap.h"
+#include "sdb_lock.h"
+#include "sdb_wal.h"
+#include "sdb_engine.h"
+#include "sdb_var.h"
+
+//The var engine stores names at their real length.  Like the legacy
+//format a record sits at its id, so get_student() is one slot read under
+//the record lock, but a slot is 16 bytes and the names are appended to a
+//heap at the end of the file, so short names no longer take 56 bytes and
+//long ones are no longer cut.
+//
+//Everything above the storage layer still deals in student_t: get() and
+//scans cut the names to fit, and put() of a student_t whose names are the
+//stored ones cut to fit keeps the stored ones, so WAL replay, copies and
+//archives restored into the same file lose nothing.  Only add_student()
+//and -f go through put_names()/get_names() and see the full names.
+//
+//A slot is only written under its record's write lock, as in the legacy
+//format.  Appends to the heap and its counters are serialized with the
+//dir lock.  Names are written before the slot that points at them and
+//never move afterwards.  Compaction writes a new file with a packed heap
+//and renames it over the database, with the gate held exclusive.
+
+#define SLOT_SZ         ((off_t)sizeof(var_slot_t))
+#define LOCK_IDS        4096    //ids per record lock taken by scans
+
+static const var_field_t schema[] = {
+    { "id",    VAR_T_INT32, offsetof(var_slot_t, id)  },
+    { "gpa",   VAR_T_INT32, offsetof(var_slot_t, gpa) },
+    { "fname", VAR_T_STR,   0 },
+    { "lname", VAR_T_STR,   1 },
+};
+#define NFIELDS         ((uint32_t)(sizeof(schema) / sizeof(schema[0])))
+
+static off_t heap_start(void)
+{
+    off_t end = VAR_HDR_SZ + ((off_t)MAX_STD_ID + 1) * SLOT_SZ;
+
+    return (end + VAR_HDR_SZ - 1) / VAR_HDR_SZ * VAR_HDR_SZ;
+}
+
+static var_hdr_t *hdr(db_handle_t *h)
+{
+    return (var_hdr_t *)h->base;
+}
+
+static off_t slot_off(int id)
+{
+    return VAR_HDR_SZ + (off_t)id * SLOT_SZ;
+}
+
+static var_slot_t *slot_at(db_handle_t *h, int id)
+{
+    return (var_slot_t *)(h->base + slot_off(id));
+}
+
+static bool is_empty(const student_t *rec)
+{
+    return memcmp(rec, &EMPTY_STUDENT_RECORD, STUDENT_RECORD_SIZE) == 0;
+}
+
+/*
+ *  mapped
+ *      h:  database handle
+ *
+ *  Makes sure the mapping covers the header and every slot.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ */
+static int mapped(db_handle_t *h)
+{
+    if ((h->base == NULL || h->file_len < heap_start()) && map_refresh(h) != NO_ERROR)
+        return ERR_DB_FILE;
+    if (h->base == NULL || h->file_len < heap_start() ||
+        hdr(h)->heap_off != (uint64_t)heap_start())
+        return ERR_DB_FILE;
+    return NO_ERROR;
+}
+
+/*
+ *  names_at
+ *      h:  database handle
+ *      s:  live slot
+ *
+ *  returns:  the slot's names inside the mapping, or NULL if they lie
+ *            outside the heap (a damaged slot)
+ */
+static const char *names_at(db_handle_t *h, const var_slot_t *s)
+{
+    uint64_t end = (uint64_t)s->name_off + s->flen + s->llen;
+    off_t file_end = hdr(h)->heap_off + end;
+
+    if (end > __atomic_load_n(&hdr(h)->heap_end, __ATOMIC_ACQUIRE))
+        return NULL;
+    if (file_end > h->file_len &&
+        (map_refresh(h) != NO_ERROR || file_end > h->file_len))
+        return NULL;
+    return h->base + hdr(h)->heap_off + s->name_off;
+}
+
+//copy at most size - 1 bytes of a name and terminate it
+static void cut(char *dst, size_t size, const char *src, size_t len)
+{
+    if (len > size - 1)
+        len = size - 1;
+    memcpy(dst, src, len);
+    memset(dst + len, 0, size - len);
+}
+
+static int to_student(db_handle_t *h, const var_slot_t *s, student_t *out)
+{
+    const char *names = names_at(h, s);
+
+    if (names == NULL)
+        return ERR_DB_FILE;
+    out->id = s->id;
+    out->gpa = s->gpa;
+    cut(out->fname, sizeof(out->fname), names, s->flen);
+    cut(out->lname, sizeof(out->lname), names + s->flen, s->llen);
+    return NO_ERROR;
+}
+
+//true when name is what cut() makes of the stored name
+static bool same_cut(const char *stored, size_t len, const char *name, size_t size)
+{
+    if (len > size - 1)
+        len = size - 1;
+    return strnlen(name, size) == len && memcmp(stored, name, len) == 0;
+}
+
+/*
+ *  heap_append
+ *      h:     database handle, dir lock held exclusive
+ *      a, b:  first and last name
+ *      alen:  length of a
+ *      blen:  length of b
+ *      off:   receives the heap offset of a
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ */
+static int heap_append(db_handle_t *h, const char *a, size_t alen,
+                       const char *b, size_t blen, uint32_t *off)
+{
+    uint64_t end = hdr(h)->heap_end;
+    off_t at = hdr(h)->heap_off + end;
+
+    if (end + alen + blen > UINT32_MAX ||
+        map_reserve(h, at + (off_t)(alen + blen)) != NO_ERROR)
+        return ERR_DB_FILE;
+
+    memcpy(h->base + at, a, alen);
+    memcpy(h->base + at + alen, b, blen);
+    map_dirty(h, at, alen + blen);
+    __atomic_store_n(&hdr(h)->heap_end, end + alen + blen, __ATOMIC_RELEASE);
+    map_dirty(h, 0, sizeof(var_hdr_t));
+    *off = (uint32_t)end;
+    return NO_ERROR;
+}
+
+/*
+ *  put_locked
+ *      h:      database handle, write lock on record id and dir lock held
+ *              exclusive
+ *      id:     student id
+ *      rec:    new contents, EMPTY_STUDENT_RECORD to delete
+ *      names:  full names of the student, NULL to take them from rec
+ *
+ *  Without full names, names that match the stored ones cut to fit keep
+ *  the stored ones.  New names go to the end of the heap and the old ones
+ *  are counted as dead until compaction.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ */
+static int put_locked(db_handle_t *h, int id, const student_t *rec,
+                      const student_names_t *names)
+{
+    var_slot_t s = {0};
+    var_slot_t *old;
+    const char *stored = NULL;
+    const char *fname, *lname;
+    size_t flen, llen;
+    bool kept = false;
+
+    if (id < MIN_STD_ID || id > (int)hdr(h)->max_id)
+        return ERR_DB_FILE;
+    old = slot_at(h, id);
+    if (old->id == id)
+        stored = names_at(h, old);
+
+    if (!is_empty(rec)) {
+        if (names != NULL) {
+            fname = names->fname;
+            lname = names->lname;
+            flen = strnlen(fname, STUDENT_NAME_MAX);
+            llen = strnlen(lname, STUDENT_NAME_MAX);
+        } else {
+            fname = rec->fname;
+            lname = rec->lname;
+            flen = strnlen(fname, sizeof(rec->fname));
+            llen = strnlen(lname, sizeof(rec->lname));
+        }
+
+        s.id = id;
+        s.gpa = rec->gpa;
+        if (names == NULL && stored != NULL &&
+            same_cut(stored, old->flen, fname, sizeof(rec->fname)) &&
+            same_cut(stored + old->flen, old->llen, lname, sizeof(rec->lname))) {
+            s.name_off = old->name_off;
+            s.flen = old->flen;
+            s.llen = old->llen;
+            kept = true;
+        } else {
+            if (heap_append(h, fname, flen, lname, llen, &s.name_off) != NO_ERROR)
+                return ERR_DB_FILE;
+            s.flen = (uint8_t)flen;
+            s.llen = (uint8_t)llen;
+        }
+        old = slot_at(h, id);       //the append may have moved the mapping
+    }
+
+    if (stored != NULL && !kept)
+        hdr(h)->heap_dead += old->flen + old->llen;
+    *old = s;
+    map_dirty(h, slot_off(id), SLOT_SZ);
+    map_dirty(h, 0, sizeof(var_hdr_t));
+    return NO_ERROR;
+}
+
+static int var_attach(db_handle_t *h)
+{
+    var_hdr_t hd;
+    struct stat st;
+
+    if (pread(h->fd, &hd, sizeof(hd), 0) != (ssize_t)sizeof(hd) ||
+        fstat(h->fd, &st) == -1 ||
+        memcmp(hd.magic, VAR_MAGIC, sizeof(hd.magic)) != 0 ||
+        hd.version != VAR_VERSION || hd.nfields != NFIELDS ||
+        memcmp(hd.fields, schema, sizeof(schema)) != 0 ||
+        hd.slot_sz != SLOT_SZ || hd.max_id != MAX_STD_ID ||
+        hd.heap_off != (uint64_t)heap_start() ||
+        st.st_size < (off_t)(hd.heap_off + hd.heap_end))
+        return ERR_DB_FILE;
+
+    return map_refresh(h);
+}
+
+static int var_format(db_handle_t *h)
+{
+    var_hdr_t hd = {0};
+
+    memcpy(hd.magic, VAR_MAGIC, sizeof(hd.magic));
+    hd.version = VAR_VERSION;
+    hd.nfields = NFIELDS;
+    hd.slot_sz = SLOT_SZ;
+    hd.max_id = MAX_STD_ID;
+    hd.heap_off = heap_start();
+    memcpy(hd.fields, schema, sizeof(schema));
+
+    if (pwrite(h->fd, &hd, sizeof(hd), 0) != (ssize_t)sizeof(hd) ||
+        ftruncate(h->fd, heap_start()) == -1)
+        return ERR_DB_FILE;
+    return map_refresh(h);
+}
+
+static int var_get(db_handle_t *h, int id, student_t *out)
+{
+    var_slot_t *s;
+
+    if (mapped(h) != NO_ERROR)
+        return ERR_DB_FILE;
+    if (id < MIN_STD_ID || id > (int)hdr(h)->max_id)
+        return SRCH_NOT_FOUND;
+
+    s = slot_at(h, id);
+    if (s->id != id)
+        return SRCH_NOT_FOUND;
+    memset(out, 0, sizeof(*out));
+    return to_student(h, s, out);
+}
+
+static int var_get_names(db_handle_t *h, int id, student_names_t *out)
+{
+    const char *names;
+    var_slot_t *s;
+
+    if (mapped(h) != NO_ERROR)
+        return ERR_DB_FILE;
+    if (id < MIN_STD_ID || id > (int)hdr(h)->max_id)
+        return SRCH_NOT_FOUND;
+
+    s = slot_at(h, id);
+    if (s->id != id)
+        return SRCH_NOT_FOUND;
+    names = names_at(h, s);
+    if (names == NULL)
+        return ERR_DB_FILE;
+    cut(out->fname, sizeof(out->fname), names, s->flen);
+    cut(out->lname, sizeof(out->lname), names + s->flen, s->llen);
+    return NO_ERROR;
+}
+
+static int var_put_names(db_handle_t *h, int id, const student_t *rec,
+                         const student_names_t *names)
+{
+    int rc;
+
+    if (mapped(h) != NO_ERROR ||
+        db_lock_range(h, LOCK_DIR_OFF, 1, true) != NO_ERROR)
+        return ERR_DB_FILE;
+    rc = put_locked(h, id, rec, names);
+    db_unlock_range(h, LOCK_DIR_OFF, 1);
+    return rc;
+}
+
+static int var_put(db_handle_t *h, int id, const student_t *rec)
+{
+    return var_put_names(h, id, rec, NULL);
+}
+
+static int var_bulk_put(db_handle_t *h, student_t *recs, long n)
+{
+    int rc = NO_ERROR;
+
+    if (mapped(h) != NO_ERROR ||
+        db_lock_range(h, LOCK_DIR_OFF, 1, true) != NO_ERROR)
+        return ERR_DB_FILE;
+    for (long i = 0; rc == NO_ERROR && i < n; i++)
+        rc = put_locked(h, recs[i].id, &recs[i], NULL);
+    db_unlock_range(h, LOCK_DIR_OFF, 1);
+    return rc;
+}
+
+/*
+ *  var_range
+ *      h:    database handle, gate held
+ *      lo:   smallest id to visit
+ *      hi:   largest id to visit
+ *      fn:   scan_db() callback
+ *      arg:  passed through to fn
+ *
+ *  Walks the slots LOCK_IDS ids at a time under one record read lock and
+ *  hands the live ones to fn as pages of students at their ids, the same
+ *  pages a legacy file gives.  Slot pages that were never written are
+ *  holes and read as zeros.
+ *
+ *  returns:  NO_ERROR, ERR_DB_FILE, or the first error returned by fn
+ */
+static int var_range(db_handle_t *h, int lo, int hi, scan_page_fn fn, void *arg)
+{
+    student_t page[RECS_PER_PAGE];
+    int rc = NO_ERROR;
+
+    if (mapped(h) != NO_ERROR)
+        return ERR_DB_FILE;
+    if (lo < MIN_STD_ID)
+        lo = MIN_STD_ID;
+    if (hi > (int)hdr(h)->max_id)
+        hi = hdr(h)->max_id;
+
+    for (int from = lo; rc == NO_ERROR && from <= hi; ) {
+        int to = (from / LOCK_IDS + 1) * LOCK_IDS - 1;
+
+        if (to > hi)
+            to = hi;
+        if (db_lock_range(h, (off_t)from * STUDENT_RECORD_SIZE,
+                          (off_t)(to - from + 1) * STUDENT_RECORD_SIZE,
+                          false) != NO_ERROR)
+            return ERR_DB_FILE;
+
+        for (int first = from; rc == NO_ERROR && first <= to; ) {
+            int last = (first / RECS_PER_PAGE + 1) * RECS_PER_PAGE - 1;
+            uint64_t occupied = 0;
+
+            if (last > to)
+                last = to;
+            for (int id = first; rc == NO_ERROR && id <= last; id++) {
+                var_slot_t *s = slot_at(h, id);
+                student_t *r = &page[id - first];
+
+                memset(r, 0, sizeof(*r));
+                if (s->id != id)
+                    continue;
+                rc = to_student(h, s, r);
+                occupied |= (uint64_t)1 << (id - first);
+            }
+            if (rc == NO_ERROR && occupied)
+                rc = fn(arg, first, page, last - first + 1, occupied);
+            first = last + 1;
+        }
+
+        db_unlock_range(h, (off_t)from * STUDENT_RECORD_SIZE,
+                        (off_t)(to - from + 1) * STUDENT_RECORD_SIZE);
+        from = to + 1;
+    }
+    return rc;
+}
+
+static int var_scan(db_handle_t *h, scan_page_fn fn, void *arg)
+{
+    return var_range(h, MIN_STD_ID, INT_MAX, fn, arg);
+}
+
+/*
+ *  copy_slots
+ *      h:     database handle, gate held exclusive
+ *      out:   the compacted copy
+ *      heap:  receives the live names, in id order
+ *      used:  receives the bytes of heap in use
+ *
+ *  Writes every page of slots to out with the names moved to where they
+ *  sit in the new heap.  Pages with no live slot stay holes.  Nothing in
+ *  the mapping is changed.
+ *
+ *  returns:  NO_ERROR, or ERR_DB_FILE if a slot is damaged or out cannot
+ *            be written
+ */
+static int copy_slots(db_handle_t *h, int out, char *heap, uint64_t *used)
+{
+    var_slot_t page[VAR_HDR_SZ / sizeof(var_slot_t)];
+    int per_page = (int)(sizeof(page) / sizeof(page[0]));
+
+    *used = 0;
+    for (int first = 0; first <= (int)hdr(h)->max_id; first += per_page) {
+        bool live = false;
+
+        memcpy(page, slot_at(h, first), sizeof(page));
+        for (int i = 0; i < per_page; i++) {
+            var_slot_t *s = &page[i];
+            const char *names;
+
+            if (s->id == 0 || s->id != first + i)
+                continue;
+            names = names_at(h, s);
+            if (names == NULL)
+                return ERR_DB_FILE;
+            memcpy(heap + *used, names, s->flen + s->llen);
+            s->name_off = (uint32_t)*used;
+            *used += s->flen + s->llen;
+            live = true;
+        }
+        if (live && pwrite(out, page, sizeof(page), slot_off(first)) != (ssize_t)sizeof(page))
+            return ERR_DB_FILE;
+    }
+    return NO_ERROR;
+}
+
+/*
+ *  var_compact
+ *      h:    database handle
+ *      fn:   progress callback, may be NULL
+ *      arg:  passed through to fn
+ *      st:   receives the totals
+ *
+ *  Writes a copy of the file whose heap holds only the names live slots
+ *  point to, in id order, and renames it over the database the way
+ *  compress_db() does.  A damaged slot or a failed write leaves the
+ *  database as it was.  This holds the gate exclusive, for a time
+ *  proportional to the live records.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ */
+static int var_compact(db_handle_t *h, compact_progress_fn fn, void *arg,
+                       compact_stats_t *st)
+{
+    char path[PATH_MAX];
+    char *heap = NULL;
+    uint64_t used = 0;
+    var_hdr_t hd;
+    int out = -1, rc = ERR_DB_FILE;
+
+    if (db_sidecar_path(h, VAR_COMPACT_SUFFIX, path, sizeof(path)) != NO_ERROR ||
+        db_gate_enter(h, true) != NO_ERROR)
+        return ERR_DB_FILE;
+    //nothing logged for the old file may be replayed into the new one
+    if (mapped(h) != NO_ERROR || wal_checkpoint(h) != NO_ERROR) {
+        db_gate_leave(h);
+        return ERR_DB_FILE;
+    }
+
+    st->total = st->scanned = h->file_len;
+    heap = malloc(hdr(h)->heap_end ? hdr(h)->heap_end : 1);
+    out = open(path, O_RDWR | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP);
+    if (heap == NULL || out == -1 || copy_slots(h, out, heap, &used) != NO_ERROR)
+        goto out;
+
+    hd = *hdr(h);
+    hd.heap_end = used;
+    hd.heap_dead = 0;
+    if (pwrite(out, &hd, sizeof(hd), 0) != (ssize_t)sizeof(hd) ||
+        pwrite(out, heap, used, hd.heap_off) != (ssize_t)used ||
+        ftruncate(out, hd.heap_off + used) == -1 || fsync(out) == -1 ||
+        rename(path, h->path) == -1)
+        goto out;
+    st->reclaimed = st->total - (hd.heap_off + used);
+    rc = NO_ERROR;
+
+out:
+    free(heap);
+    if (out != -1)
+        close(out);
+    if (rc != NO_ERROR)
+        unlink(path);
+    db_gate_leave(h);
+    if (rc != NO_ERROR)
+        return rc;
+
+    if (db_handle_reopen(h) != NO_ERROR || db_gate_enter(h, true) != NO_ERROR)
+        return ERR_DB_FILE;
+    db_notify_rebuild(h);
+    db_gate_leave(h);
+
+    if (fn != NULL)
+        fn(arg, st);
+    return NO_ERROR;
+}
+
+const db_engine_t var_engine = {
+    "var",
+    var_attach,
+    var_format,
+    var_get,
+    NULL,
+    var_get_names,
+    var_put,
+    var_put_names,
+    var_bulk_put,
+    var_scan,
+    var_range,
+    var_compact,
+};
@@ -0,0 +1,57 @@
+#ifndef __SDB_VAR_H__
+    #define __SDB_VAR_H__
+
+#include <stdint.h>
+
+#include "db.h"
+
+//Variable length name format, see sdb_var.c.  Layout of the file:
+//
+//  [var_hdr_t, one 4K page][MAX_STD_ID+1 var_slot_t][name heap]
+//
+//Slot id holds the fixed width fields of student id inline, 16 bytes
+//instead of 64, so lookups and scans stay one array index away.  The
+//names live in the heap, first and last name back to back, each up to
+//STUDENT_NAME_MAX bytes with no terminator or padding.  The header
+//describes the slot layout (the schema); a file whose schema or version
+//differs from the one compiled in is not opened.
+
+#define VAR_MAGIC           "SDBVAR01"
+#define VAR_VERSION         1
+#define VAR_HDR_SZ          4096
+#define VAR_MAX_FIELDS      8
+#define VAR_COMPACT_SUFFIX  ".compact"    //copy being written by compaction
+
+//field types of the schema
+#define VAR_T_INT32         1
+#define VAR_T_STR           2       //length in the slot, bytes in the heap
+
+typedef struct var_field {
+    char     name[12];
+    uint16_t type;              //VAR_T_*
+    uint16_t off;               //offset in the slot, or for strings the
+                                //position in the slot's run of names
+} var_field_t;
+
+typedef struct var_hdr {
+    char     magic[8];
+    uint32_t version;
+    uint32_t nfields;
+    uint32_t slot_sz;
+    uint32_t max_id;            //slots [0, max_id]
+    uint64_t heap_off;          //file offset of the name heap
+    uint64_t heap_end;          //heap bytes in use, appended to at the end
+    uint64_t heap_dead;         //bytes of names no slot points to
+    var_field_t fields[VAR_MAX_FIELDS];
+} var_hdr_t;
+
+typedef struct var_slot {
+    int32_t  id;                //0 when the slot is free
+    int32_t  gpa;
+    uint32_t name_off;          //heap offset of the first name
+    uint8_t  flen;              //first name bytes, the last name follows
+    uint8_t  llen;
+    uint16_t pad;
+} var_slot_t;
+
+#endif
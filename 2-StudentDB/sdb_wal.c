@@ -0,0 +1,732 @@
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "db.h"
+#include "sdbsc.h"
+#include "sdb_handle.h"
+#include "sdb_mmap.h"
+#include "sdb_crc.h"
+#include "sdb_wal.h"
+#include "sdb_lock.h"
+#include "sdb_engine.h"
+
+//The log holds redo images only: a record says "slot id now contains
+//these 64 bytes".  Replaying a record twice is harmless, so recovery can
+//simply re-apply everything after the last checkpoint.  Records carry a
+//sequence number (lsn) that must follow on from the header's base_lsn;
+//the first record that breaks the sequence or fails its crc marks the
+//torn end of the log.
+//
+//Group commit: wal_log() appends a record as its slot is stored, and one
+//fdatasync() makes a whole group durable.  The group is committed when
+//it is full, at sync_db() and at close_db().
+//
+//A writer holds the slot's record write lock and the wal lock while it
+//appends the image and stores the slot (wal_begin() .. wal_end()), so
+//the log is written ahead of the store and in the same order as the
+//stores, and everything a checkpoint drops is already in the file.
+//
+//Transactions (sdbsc -T) log all of their images and a commit record
+//with wal_log_tx() before a single slot is stored, so a crash leaves
+//either all of a transaction in the log or none of it.
+//
+//An image whose names do not fit student_t is preceded by WAL_OP_NAMES
+//records, written with it in one write().  Records after a torn one are
+//never read, so an image that is read always has its names before it.
+
+static uint32_t rec_crc(wal_rec_t *r)
+{
+    uint32_t saved = r->crc;
+    uint32_t crc;
+
+    r->crc = 0;
+    crc = crc32c(0, r, sizeof(*r));
+    r->crc = saved;
+    return crc;
+}
+
+static int write_at(int fd, const void *buf, size_t len, off_t off)
+{
+    const char *p = buf;
+
+    while (len > 0) {
+        ssize_t w = pwrite(fd, p, len, off);
+
+        if (w <= 0)
+            return ERR_DB_FILE;
+        p += w;
+        off += w;
+        len -= (size_t)w;
+    }
+    return NO_ERROR;
+}
+
+/*
+ *  init_log
+ *      h:     database handle
+ *      w:     log state
+ *      base:  lsn the next record will get
+ *
+ *  Empties the log and writes a fresh header bound to the current
+ *  database file.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ */
+static int init_log(db_handle_t *h, wal_t *w, uint64_t base)
+{
+    struct stat st;
+
+    if (fstat(h->fd, &st) == -1)
+        return ERR_DB_FILE;
+
+    memset(&w->hdr, 0, sizeof(w->hdr));
+    memcpy(w->hdr.magic, WAL_MAGIC, sizeof(w->hdr.magic));
+    w->hdr.db_dev = (uint64_t)st.st_dev;
+    w->hdr.db_ino = (uint64_t)st.st_ino;
+    w->hdr.base_lsn = base;
+
+    if (write_at(w->fd, &w->hdr, sizeof(w->hdr), 0) != NO_ERROR ||
+        ftruncate(w->fd, sizeof(w->hdr)) == -1 ||
+        fdatasync(w->fd) == -1)
+        return ERR_DB_FILE;
+
+    w->size = sizeof(w->hdr);
+    w->next_lsn = base;
+    return NO_ERROR;
+}
+
+static int cmp_id_lsn(const void *a, const void *b)
+{
+    const wal_rec_t *x = a;
+    const wal_rec_t *y = b;
+
+    if (x->id != y->id)
+        return (x->id > y->id) - (x->id < y->id);
+    return (x->lsn > y->lsn) - (x->lsn < y->lsn);
+}
+
+/*
+ *  drop_uncommitted
+ *      recs:  valid log records in log order
+ *      n:     number of records
+ *
+ *  The records of a transaction are written together, so they are one
+ *  run of the same txid that ends with its WAL_OP_COMMIT record.  The
+ *  images of a run that does not (the writer died before its write was
+ *  complete) are marked op 0 so nothing applies them.
+ */
+static void drop_uncommitted(wal_rec_t *recs, long n)
+{
+    long i = 0;
+
+    while (i < n) {
+        long end = i;
+
+        if (recs[i].txid == 0) {
+            i++;
+            continue;
+        }
+        while (end < n && recs[end].txid == recs[i].txid &&
+               recs[end].op != WAL_OP_COMMIT)
+            end++;
+        if (end == n || recs[end].txid != recs[i].txid) {
+            for (long j = i; j < end; j++)
+                recs[j].op = 0;
+            i = end;
+        } else {
+            i = end + 1;
+        }
+    }
+}
+
+/*
+ *  read_log
+ *      w:    log state
+ *      out:  receives a malloc()ed array of the valid records
+ *      n:    receives the number of valid records
+ *
+ *  Loads the header and reads records until the end of the file or the
+ *  first one that is torn (short, bad crc, or out of sequence).  Caller
+ *  holds the wal lock.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ */
+static int read_log(wal_t *w, wal_rec_t **out, long *n)
+{
+    struct stat st;
+    size_t len;
+    long max;
+    wal_rec_t *recs;
+
+    *out = NULL;
+    *n = 0;
+    if (pread(w->fd, &w->hdr, sizeof(w->hdr), 0) != (ssize_t)sizeof(w->hdr) ||
+        fstat(w->fd, &st) == -1)
+        return ERR_DB_FILE;
+    if (st.st_size <= (off_t)sizeof(w->hdr))
+        return NO_ERROR;
+
+    max = (long)((st.st_size - sizeof(w->hdr)) / sizeof(wal_rec_t));
+    len = max * sizeof(wal_rec_t);
+    recs = malloc(len ? len : 1);
+    if (recs == NULL)
+        return ERR_DB_FILE;
+    if (len > 0 && pread(w->fd, recs, len, sizeof(w->hdr)) != (ssize_t)len) {
+        free(recs);
+        return ERR_DB_FILE;
+    }
+
+    while (*n < max && recs[*n].lsn == w->hdr.base_lsn + (uint64_t)*n &&
+           recs[*n].crc == rec_crc(&recs[*n]))
+        (*n)++;
+    drop_uncommitted(recs, *n);
+
+    *out = recs;
+    return NO_ERROR;
+}
+
+/*
+ *  logged_names
+ *      recs:  valid log records, sorted by cmp_id_lsn
+ *      i:     an image
+ *      out:   receives the student's full names
+ *
+ *  The WAL_OP_NAMES records of an image were written with it, so they
+ *  are the ones of the same id with the lsns just before it.
+ *
+ *  returns:  true when the image was logged with its full names
+ */
+static bool logged_names(const wal_rec_t *recs, long i, student_names_t *out)
+{
+    names_run_t run = {0};
+    long first = i;
+
+    while (first > 0 && recs[first - 1].op == WAL_OP_NAMES &&
+           recs[first - 1].id == recs[i].id &&
+           recs[first - 1].lsn + 1 == recs[first].lsn) {
+        first--;
+        if (recs[first].names.off == 0)
+            break;
+    }
+    for (long j = first; j < i; j++)
+        names_join(&run, &recs[j].names);
+    return names_joined(&run, recs[i].id, out);
+}
+
+/*
+ *  pending_images
+ *      h:     database handle
+ *      recs:  valid log records, sorted by cmp_id_lsn
+ *      n:     number of records
+ *      apply: store the images instead of just counting them
+ *
+ *  For every id only the newest image matters; it needs applying when the
+ *  slot does not already hold it, or its full names.
+ *
+ *  returns:  number of slots that differ (or were written), or ERR_DB_FILE
+ */
+static long pending_images(db_handle_t *h, wal_rec_t *recs, long n, bool apply)
+{
+    long count = 0;
+
+    for (long i = 0; i < n; i++) {
+        long next = i + 1;
+
+        if (recs[i].op != WAL_OP_PUT)
+            continue;   //names, commit records, uncommitted transactions
+        while (next < n && recs[next].id == recs[i].id &&
+               recs[next].op != WAL_OP_PUT)
+            next++;
+        if (next < n && recs[next].id == recs[i].id)
+            continue;   //a newer image of this slot follows
+
+        student_t have = EMPTY_STUDENT_RECORD;
+        student_names_t names;
+        bool named = logged_names(recs, i, &names);
+
+        if (db_get(h, recs[i].id, &have) == ERR_DB_FILE)
+            return ERR_DB_FILE;
+        if (memcmp(&have, &recs[i].rec, STUDENT_RECORD_SIZE) == 0 &&
+            (!named || db_has_names(h, recs[i].id, &names)))
+            continue;
+        if (apply && db_put_names(h, recs[i].id, &recs[i].rec,
+                                  named ? &names : NULL) != NO_ERROR)
+            return ERR_DB_FILE;
+        count++;
+    }
+    return count;
+}
+
+/*
+ *  scan_log
+ *      h:      database handle
+ *      w:      log state
+ *      apply:  store the images that differ from the database
+ *
+ *  Reads the log under the wal lock, drops a torn tail so new records
+ *  follow the last good one, and counts (or applies) the images that are
+ *  not in the database yet.
+ *
+ *  returns:  number of differing slots, or ERR_DB_FILE
+ */
+static long scan_log(db_handle_t *h, wal_t *w, bool apply)
+{
+    wal_rec_t *recs;
+    long n, count = ERR_DB_FILE;
+
+    if (db_lock_range(h, LOCK_WAL_OFF, 1, true) != NO_ERROR)
+        return ERR_DB_FILE;
+
+    if (read_log(w, &recs, &n) == NO_ERROR) {
+        w->next_lsn = w->hdr.base_lsn + (uint64_t)n;
+        w->size = (off_t)(sizeof(w->hdr) + n * sizeof(wal_rec_t));
+
+        if (ftruncate(w->fd, w->size) == 0) {
+            qsort(recs, n, sizeof(*recs), cmp_id_lsn);
+            count = pending_images(h, recs, n, apply);
+        }
+        free(recs);
+    }
+
+    db_unlock_range(h, LOCK_WAL_OFF, 1);
+    return count;
+}
+
+/*
+ *  recover
+ *      h:  database handle with the log open
+ *
+ *  Brings the database up to date with the log.  The check runs with the
+ *  gate shared, so opening a healthy database never waits on other
+ *  processes.  Only when images are missing is the gate taken exclusive
+ *  (nobody may be reading a half recovered file), the log read again and
+ *  applied, the sidecars rebuilt and the log checkpointed.  Entering the
+ *  gate can switch the handle to a replaced file, which also reopens the
+ *  log, so h->wal is looked up again each time.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ */
+static int recover(db_handle_t *h)
+{
+    long missing = 0;
+    int rc;
+
+    if (db_gate_enter(h, false) != NO_ERROR)
+        return ERR_DB_FILE;
+    if (h->wal != NULL)
+        missing = scan_log(h, h->wal, false);
+    db_gate_leave(h);
+
+    if (missing <= 0)
+        return missing < 0 ? ERR_DB_FILE : NO_ERROR;
+
+    if (db_gate_enter(h, true) != NO_ERROR)
+        return ERR_DB_FILE;
+    rc = NO_ERROR;
+    if (h->wal != NULL && scan_log(h, h->wal, true) < 0)
+        rc = ERR_DB_FILE;
+    if (rc == NO_ERROR) {
+        db_notify_rebuild(h);
+        rc = wal_checkpoint(h);
+    }
+    db_gate_leave(h);
+    return rc;
+}
+
+/*
+ *  upgrade_log
+ *      h:  database handle
+ *      w:  log state, the log replayed
+ *
+ *  Relabels a format 1 log as format 2.  The records are the same, with
+ *  txid 0, so only the magic changes.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ */
+static int upgrade_log(db_handle_t *h, wal_t *w)
+{
+    int rc = NO_ERROR;
+
+    if (db_lock_range(h, LOCK_WAL_OFF, 1, true) != NO_ERROR)
+        return ERR_DB_FILE;
+    if (pread(w->fd, &w->hdr, sizeof(w->hdr), 0) != (ssize_t)sizeof(w->hdr))
+        rc = ERR_DB_FILE;
+    else if (memcmp(w->hdr.magic, WAL_MAGIC_V1, sizeof(w->hdr.magic)) == 0) {
+        memcpy(w->hdr.magic, WAL_MAGIC, sizeof(w->hdr.magic));
+        if (write_at(w->fd, w->hdr.magic, sizeof(w->hdr.magic), 0) != NO_ERROR ||
+            fdatasync(w->fd) == -1)
+            rc = ERR_DB_FILE;
+    }
+    db_unlock_range(h, LOCK_WAL_OFF, 1);
+    return rc;
+}
+
+/*
+ *  wal_open
+ *      h:      database handle
+ *      reset:  true when the database was just truncated, the old log
+ *              must then be thrown away rather than replayed
+ *
+ *  Opens (creating if needed) the log for h and runs crash recovery.  A
+ *  log that was written for a different database file (the file was
+ *  replaced since) is discarded.  Does nothing when SDB_WAL=0, the
+ *  handle has no path, or the database is a (read-only) archive.  With
+ *  reset the caller holds the gate exclusive.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ */
+int wal_open(db_handle_t *h, bool reset)
+{
+    char path[PATH_MAX];
+    struct stat st;
+    wal_t *w;
+    int rc;
+
+    h->wal = NULL;
+    if (db_config_int("SDB_WAL", 1) == 0 || h->engine == &archive_engine ||
+        db_sidecar_path(h, WAL_SUFFIX, path, sizeof(path)) != NO_ERROR)
+        return NO_ERROR;
+
+    w = calloc(1, sizeof(*w));
+    if (w == NULL)
+        return ERR_DB_FILE;
+
+    w->group = db_config_int("SDB_WAL_GROUP", WAL_GROUP_DEFAULT);
+    if (w->group < 1)
+        w->group = 1;
+    if (w->group > WAL_GROUP_MAX)
+        w->group = WAL_GROUP_MAX;
+
+    w->fd = open(path, O_RDWR | O_CREAT, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP);
+    if (w->fd == -1 || fstat(h->fd, &st) == -1) {
+        if (w->fd != -1)
+            close(w->fd);
+        free(w);
+        return ERR_DB_FILE;
+    }
+    h->wal = w;
+
+    db_lock_range(h, LOCK_WAL_OFF, 1, true);
+    if (pread(w->fd, &w->hdr, sizeof(w->hdr), 0) != (ssize_t)sizeof(w->hdr) ||
+        (memcmp(w->hdr.magic, WAL_MAGIC, sizeof(w->hdr.magic)) != 0 &&
+         memcmp(w->hdr.magic, WAL_MAGIC_V1, sizeof(w->hdr.magic)) != 0) ||
+        w->hdr.db_dev != (uint64_t)st.st_dev ||
+        w->hdr.db_ino != (uint64_t)st.st_ino)
+        rc = init_log(h, w, 1);
+    else if (reset)
+        rc = init_log(h, w, w->hdr.base_lsn);
+    else
+        rc = 1;
+    db_unlock_range(h, LOCK_WAL_OFF, 1);
+
+    if (rc == 1)
+        rc = recover(h);
+    if (rc == NO_ERROR)
+        rc = upgrade_log(h, w);
+
+    if (rc != NO_ERROR)
+        wal_close(h);
+    return rc;
+}
+
+/*
+ *  log_end
+ *      w:  log state, caller holds the wal lock
+ *
+ *  Another process may have appended or checkpointed since we looked:
+ *  reloads the header and finds where the next record goes.  A torn
+ *  partial record at the end is overwritten by the next append.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ */
+static int log_end(wal_t *w)
+{
+    struct stat st;
+
+    if (pread(w->fd, &w->hdr, sizeof(w->hdr), 0) != (ssize_t)sizeof(w->hdr) ||
+        fstat(w->fd, &st) == -1 || st.st_size < (off_t)sizeof(w->hdr))
+        return ERR_DB_FILE;
+
+    w->next_lsn = w->hdr.base_lsn +
+                  (uint64_t)((st.st_size - sizeof(w->hdr)) / sizeof(wal_rec_t));
+    w->size = (off_t)(sizeof(w->hdr) +
+                      (w->next_lsn - w->hdr.base_lsn) * sizeof(wal_rec_t));
+    return NO_ERROR;
+}
+
+/*
+ *  checkpoint
+ *      h:  database handle, caller holds the wal lock
+ *      w:  log state
+ *
+ *  Forces the database file to disk and then empties the log.  The new
+ *  header is written before the truncate so a crash in between leaves
+ *  records whose lsn no longer matches, which recovery ignores.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ */
+static int checkpoint(db_handle_t *h, wal_t *w)
+{
+    if (log_end(w) != NO_ERROR || fsync(h->fd) == -1)
+        return ERR_DB_FILE;
+    w->npending = 0;
+    return init_log(h, w, w->next_lsn);
+}
+
+/*
+ *  sync_log
+ *      h:  database handle, caller holds the wal lock
+ *      w:  log state
+ *
+ *  Makes the records appended so far durable with one fdatasync(), which
+ *  covers other processes' appends too, and checkpoints when the log got
+ *  big.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ */
+static int sync_log(db_handle_t *h, wal_t *w)
+{
+    if (w->npending > 0 && fdatasync(w->fd) == -1)
+        return ERR_DB_FILE;
+    w->npending = 0;
+    if (w->size > WAL_CHECKPOINT_SZ)
+        return checkpoint(h, w);
+    return NO_ERROR;
+}
+
+/*
+ *  wal_begin
+ *      h:  database handle, caller holds the write locks of the slots it
+ *          is about to change
+ *
+ *  Takes the wal lock for wal_log() and the stores that follow it.
+ *  Holding it across both keeps the log in the same order as the stores,
+ *  and keeps a checkpoint from emptying the log between them.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ */
+int wal_begin(db_handle_t *h)
+{
+    if (h->wal == NULL)
+        return NO_ERROR;
+    return db_lock_range(h, LOCK_WAL_OFF, 1, true);
+}
+
+/*
+ *  log_image
+ *      h:      database handle
+ *      w:      log state
+ *      out:    room for NAMES_CHUNK_MAX + 1 records
+ *      id:     slot that is about to be written
+ *      rec:    its new contents
+ *      names:  full names of the student, may be NULL
+ *      txid:   transaction of the image, 0 outside one
+ *
+ *  Fills in the records that log one image: WAL_OP_NAMES records when
+ *  rec cannot hold the names whole and the format keeps them, then the
+ *  image.
+ *
+ *  returns:  number of records
+ */
+static int log_image(db_handle_t *h, wal_t *w, wal_rec_t *out, int id,
+                     const student_t *rec, const student_names_t *names,
+                     uint32_t txid)
+{
+    names_chunk_t chunks[NAMES_CHUNK_MAX];
+    int n = h->engine->put_names != NULL ? names_split(rec, names, chunks) : 0;
+
+    memset(out, 0, ((size_t)n + 1) * sizeof(*out));
+    for (int i = 0; i <= n; i++) {
+        out[i].lsn = w->next_lsn++;
+        out[i].op = i < n ? WAL_OP_NAMES : WAL_OP_PUT;
+        out[i].id = id;
+        out[i].txid = txid;
+        if (i < n)
+            out[i].names = chunks[i];
+        else
+            out[i].rec = *rec;
+        out[i].crc = rec_crc(&out[i]);
+    }
+    return n + 1;
+}
+
+/*
+ *  wal_log
+ *      h:      database handle, between wal_begin() and wal_end()
+ *      id:     slot that is about to be written
+ *      rec:    its new contents
+ *      names:  full names of the student, NULL when rec holds all of them
+ *
+ *  Appends the image to the log before the slot is stored.  It is made
+ *  durable with the rest of its group, by wal_end() once the group is
+ *  full or by wal_commit().
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ */
+int wal_log(db_handle_t *h, int id, const student_t *rec,
+            const student_names_t *names)
+{
+    wal_t *w = h->wal;
+    wal_rec_t r[NAMES_CHUNK_MAX + 1];
+    int n;
+
+    if (w == NULL)
+        return NO_ERROR;
+    if (log_end(w) != NO_ERROR)
+        return ERR_DB_FILE;
+
+    n = log_image(h, w, r, id, rec, names, 0);
+    if (write_at(w->fd, r, (size_t)n * sizeof(*r), w->size) != NO_ERROR)
+        return ERR_DB_FILE;
+    w->size += (off_t)((size_t)n * sizeof(*r));
+    w->npending += n;
+    return NO_ERROR;
+}
+
+/*
+ *  wal_log_tx
+ *      h:      database handle, caller holds the gate exclusive, write
+ *              locks over the slots and is between wal_begin() and
+ *              wal_end()
+ *      ids:    slots the transaction writes
+ *      recs:   their new contents
+ *      names:  names[i] holds the full names of recs[i] or is NULL, the
+ *              whole array may be NULL
+ *      n:      number of slots
+ *
+ *  Logs a transaction before any of its slots are stored: the images,
+ *  tagged with a txid, and a WAL_OP_COMMIT record go out with one write()
+ *  and are made durable, with anything appended before them, by one
+ *  fdatasync().
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ */
+int wal_log_tx(db_handle_t *h, const int *ids, const student_t *recs,
+               const student_names_t *const *names, int n)
+{
+    wal_t *w = h->wal;
+    wal_rec_t *tx;
+    uint32_t txid;
+    size_t len = 0;
+    int rc = NO_ERROR;
+
+    if (w == NULL)
+        return NO_ERROR;
+    if (log_end(w) != NO_ERROR)
+        return ERR_DB_FILE;
+    tx = calloc((size_t)n * (NAMES_CHUNK_MAX + 1) + 1, sizeof(*tx));
+    if (tx == NULL)
+        return ERR_DB_FILE;
+
+    txid = (uint32_t)w->next_lsn ? (uint32_t)w->next_lsn : 1;
+    for (int i = 0; i < n; i++)
+        len += (size_t)log_image(h, w, tx + len, ids[i], &recs[i],
+                                 names != NULL ? names[i] : NULL, txid);
+    tx[len].op = WAL_OP_COMMIT;
+    tx[len].txid = txid;
+    tx[len].lsn = w->next_lsn++;
+    tx[len].crc = rec_crc(&tx[len]);
+    len++;
+
+    if (write_at(w->fd, tx, len * sizeof(*tx), w->size) != NO_ERROR ||
+        fdatasync(w->fd) == -1) {
+        rc = ERR_DB_FILE;
+    } else {
+        w->size += (off_t)(len * sizeof(*tx));
+        w->npending = 0;
+    }
+    free(tx);
+    return rc;
+}
+
+/*
+ *  wal_end
+ *      h:  database handle, after wal_begin()
+ *
+ *  Commits the group if it is full and releases the wal lock.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ */
+int wal_end(db_handle_t *h)
+{
+    wal_t *w = h->wal;
+    int rc = NO_ERROR;
+
+    if (w == NULL)
+        return NO_ERROR;
+    if (w->npending >= w->group)
+        rc = sync_log(h, w);
+    db_unlock_range(h, LOCK_WAL_OFF, 1);
+    return rc;
+}
+
+/*
+ *  wal_commit
+ *      h:  database handle
+ *
+ *  Commits the records appended so far and checkpoints when the log got
+ *  big.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ */
+int wal_commit(db_handle_t *h)
+{
+    wal_t *w = h->wal;
+    int rc;
+
+    if (w == NULL || w->npending == 0)
+        return NO_ERROR;
+    if (db_lock_range(h, LOCK_WAL_OFF, 1, true) != NO_ERROR)
+        return ERR_DB_FILE;
+    rc = sync_log(h, w);
+    db_unlock_range(h, LOCK_WAL_OFF, 1);
+    return rc;
+}
+
+/*
+ *  wal_checkpoint
+ *      h:  database handle
+ *
+ *  Forces the database file to disk and then empties the log.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ */
+int wal_checkpoint(db_handle_t *h)
+{
+    wal_t *w = h->wal;
+    int rc;
+
+    if (w == NULL)
+        return NO_ERROR;
+    if (db_lock_range(h, LOCK_WAL_OFF, 1, true) != NO_ERROR)
+        return ERR_DB_FILE;
+    rc = checkpoint(h, w);
+    db_unlock_range(h, LOCK_WAL_OFF, 1);
+    return rc;
+}
+
+/*
+ *  wal_close
+ *      h:  database handle
+ *
+ *  Commits whatever is still pending and closes the log.
+ */
+void wal_close(db_handle_t *h)
+{
+    wal_t *w = h->wal;
+
+    if (w == NULL)
+        return;
+
+    wal_commit(h);
+    close(w->fd);
+    free(w);
+    h->wal = NULL;
+}
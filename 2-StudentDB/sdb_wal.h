@@ -0,0 +1,85 @@
+#ifndef __SDB_WAL_H__
+    #define __SDB_WAL_H__
+
+#include <stdint.h>
+
+#include "db.h"
+#include "sdb_handle.h"
+#include "sdb_engine.h"
+
+//Write-ahead log in front of the database file, see sdb_wal.c.  Every
+//add/delete is logged as the full 64 byte image of the slot it writes.
+//Records are appended ahead of the stores and made durable with one
+//fdatasync() per group, the log is checkpointed into the database once it grows past
+//WAL_CHECKPOINT_SZ, and open_db() replays it after a crash.
+//
+//Format 2 (WAL_MAGIC) adds transactions (sdb_tx.c): their images carry a
+//txid and are followed by a WAL_OP_COMMIT record, and recovery skips them
+//when that record is missing.  A format 1 log is replayed as before and
+//then relabelled, its records are format 2 records outside transactions.
+//
+//Names a student_t cannot hold whole (the var format) are logged as
+//WAL_OP_NAMES records just ahead of the image, see names_split(), and
+//replayed with db_put_names().
+//
+//Settings (environment):
+//  SDB_WAL=0            turn the log off
+//  SDB_WAL_GROUP=n      records per group commit (default WAL_GROUP_DEFAULT)
+
+#define WAL_SUFFIX          ".wal"
+#define WAL_MAGIC           "SDBWAL02"
+#define WAL_MAGIC_V1        "SDBWAL01"      //same records, no transactions
+#define WAL_GROUP_DEFAULT   64
+#define WAL_GROUP_MAX       4096
+#define WAL_CHECKPOINT_SZ   (4 * 1024 * 1024)
+
+//log record operations
+#define WAL_OP_PUT          1       //slot id now holds rec
+#define WAL_OP_COMMIT       2       //ends the records of transaction txid
+#define WAL_OP_NAMES        3       //part of the full names of the image of
+                                    //slot id that follows
+
+typedef struct wal_hdr {
+    char     magic[8];
+    uint64_t db_dev;            //database the log belongs to
+    uint64_t db_ino;
+    uint64_t base_lsn;          //lsn of the first record after a checkpoint
+    char     pad[32];
+} wal_hdr_t;
+
+typedef struct wal_rec {
+    uint64_t  lsn;
+    uint32_t  op;
+    int32_t   id;
+    uint32_t  txid;             //transaction of the record, 0 outside one
+                                //(format 2; a reserved 0 in format 1)
+    uint32_t  crc;              //crc32c of the record with crc set to 0
+    union {
+        student_t     rec;
+        names_chunk_t names;    //WAL_OP_NAMES
+    };
+} wal_rec_t;
+
+//in memory state hung off of db_handle_t.wal
+typedef struct wal {
+    int        fd;
+    wal_hdr_t  hdr;
+    uint64_t   next_lsn;
+    off_t      size;            //bytes in the log file
+    int        group;           //records per group commit
+    int        npending;        //records appended since the last fdatasync()
+} wal_t;
+
+//prototypes for sdb_wal.c
+int wal_open(db_handle_t *h, bool reset);
+int wal_begin(db_handle_t *h);
+int wal_log(db_handle_t *h, int id, const student_t *rec,
+            const student_names_t *names);
+int wal_log_tx(db_handle_t *h, const int *ids, const student_t *recs,
+               const student_names_t *const *names, int n);
+int wal_end(db_handle_t *h);
+int wal_commit(db_handle_t *h);
+int wal_checkpoint(db_handle_t *h);
+void wal_close(db_handle_t *h);
+
+#endif
@@ -5,10 +5,32 @@
 #include <sys/stat.h>
 #include <unistd.h>
 #include <stdbool.h>
+#include <errno.h>
 
 // database include files
 #include "db.h"
 #include "sdbsc.h"
+#include "sdb_handle.h"
+#include "sdb_mmap.h"
+#include "sdb_ingest.h"
+#include "sdb_scan.h"
+#include "sdb_lname.h"
+#include "sdb_cols.h"
+#include "sdb_wal.h"
+#include "sdb_lock.h"
+#include "sdb_compact.h"
+#include "sdb_engine.h"
+#include "sdb_server.h"
+#include "sdb_out.h"
+#include "sdb_sum.h"
+#include "sdb_archive.h"
+#include "sdb_cache.h"
+#include "sdb_filter.h"
+#include "sdb_snap.h"
+#include "sdb_cdc.h"
+#include "sdb_repl.h"
+#include "sdb_rank.h"
+#include "sdb_tx.h"
 
 /*
  *  open_db
@@ -28,12 +50,11 @@ int open_db(char *dbFile, bool should_truncate)
     mode_t mode = S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP;
 
     // open the file if it exists for Read and Write,
-    // create it if it does not exist
+    // create it if it does not exist.  Truncating is done below with the
+    // gate held exclusive, O_TRUNC would pull the file out from under
+    // other processes that are using it
     int flags = O_RDWR | O_CREAT;
 
-    if (should_truncate)
-        flags += O_TRUNC;
-
     // Now open file
     int fd = open(dbFile, flags, mode);
 
@@ -44,9 +65,107 @@ int open_db(char *dbFile, bool should_truncate)
         return ERR_DB_FILE;
     }
 
+    // map the file, all record access after this goes through memory
+    db_handle_t *h = db_handle_open(fd, dbFile);
+    if (h == NULL)
+    {
+        close(fd);
+        printf(M_ERR_DB_OPEN);
+        return ERR_DB_FILE;
+    }
+
+    if (should_truncate &&
+        (db_gate_enter(h, true) != NO_ERROR || ftruncate(fd, 0) == -1 ||
+         map_refresh(h) != NO_ERROR || engine_reset(h) != NO_ERROR))
+    {
+        db_handle_release(h);
+        close(fd);
+        printf(M_ERR_DB_OPEN);
+        return ERR_DB_FILE;
+    }
+
+    // replay the write-ahead log if the last run did not finish cleanly,
+    // a truncated database starts with an empty log instead
+    if (wal_open(h, should_truncate) != NO_ERROR)
+    {
+        db_handle_release(h);
+        close(fd);
+        printf(M_ERR_DB_OPEN);
+        return ERR_DB_FILE;
+    }
+
+    // indexes of a truncated file would be stale
+    if (should_truncate)
+    {
+        db_notify_rebuild(h);
+        db_gate_leave(h);
+    }
+
     return fd;
 }
 
+/*
+ *  close_db
+ *      fd:  linux file descriptor returned by open_db()
+ *
+ *  Commits the last write-ahead log group, then unmaps and closes the
+ *  database.  With the "close" or "batch" msync policy (see SDB_MSYNC in
+ *  sdb_handle.h) outstanding writes are flushed to disk first.
+ *
+ *  returns:  NO_ERROR       on success
+ *            ERR_DB_FILE    flushing or closing the file failed
+ *
+ *  console:  Does not produce any console I/O
+ */
+int close_db(int fd)
+{
+    int rc = NO_ERROR;
+    db_handle_t *h = db_handle_get(fd);
+
+    if (h != NULL)
+    {
+        rc = wal_commit(h);
+        if (h->msync_policy == MSYNC_ON_CLOSE ||
+            h->msync_policy == MSYNC_PER_BATCH)
+        {
+            if (map_flush(h) != NO_ERROR)
+                rc = ERR_DB_FILE;
+        }
+        db_handle_release(h);
+    }
+
+    if (close(fd) == -1)
+        rc = ERR_DB_FILE;
+
+    return rc;
+}
+
+/*
+ *  sync_db
+ *      fd:  linux file descriptor returned by open_db()
+ *
+ *  Marks the end of a batch of updates.  Commits the pending write-ahead
+ *  log group so every update so far is durable.  With the "batch" msync
+ *  policy the database pages written since the previous call are flushed
+ *  as well.
+ *
+ *  returns:  NO_ERROR       on success
+ *            ERR_DB_FILE    database file I/O issue
+ *
+ *  console:  Does not produce any console I/O
+ */
+int sync_db(int fd)
+{
+    db_handle_t *h = db_handle_get(fd);
+
+    if (h == NULL || wal_commit(h) != NO_ERROR)
+        return ERR_DB_FILE;
+    if (h->msync_policy != MSYNC_PER_BATCH)
+        return NO_ERROR;
+
+    return map_flush(h);
+}
+
 /*
  *  get_student
  *      fd:  linux file descriptor
@@ -61,19 +180,79 @@ int open_db(char *dbFile, bool should_truncate)
  *  console:  Does not produce any console I/O used by other functions
  */
 int get_student(int fd, int id, student_t *s) {
-    off_t offset = (off_t)id * STUDENT_RECORD_SIZE;
-    if (lseek(fd, offset, SEEK_SET) == -1) {
+    db_handle_t *h = db_handle_get(fd);
+    if (h == NULL || db_gate_enter(h, false) != NO_ERROR) {
+        return ERR_DB_FILE;
+    }
+
+    // no record can hold such an id, and it has no record lock either
+    if (id < MIN_STD_ID || id > MAX_STD_ID) {
+        db_gate_leave(h);
         return SRCH_NOT_FOUND;
     }
 
-    student_t buffer;
-    ssize_t bytes_read = read(fd, &buffer, STUDENT_RECORD_SIZE);
-    if (bytes_read != STUDENT_RECORD_SIZE || buffer.id != id) {
+    // ids the filter (sdb_filter.c) rules out, ids the record cache
+    // (sdb_cache.c) holds, and legacy slots no store got in the way of
+    // are answered without the record lock
+    if (filter_absent(h, id)) {
+        db_gate_leave(h);
         return SRCH_NOT_FOUND;
     }
+    int rc = cache_get(h, id, s, true);
+    if (rc == CACHE_MISS)
+        rc = cache_peek(h, id, s);
+    if (rc != CACHE_MISS) {
+        db_gate_leave(h);
+        return rc;
+    }
 
-    *s = buffer;
-    return NO_ERROR;
+    if (db_lock_record(h, id, false) != NO_ERROR) {
+        rc = ERR_DB_FILE;
+    } else {
+        rc = db_get(h, id, s);
+        db_unlock_record(h, id);
+    }
+
+    db_gate_leave(h);
+    return rc;
+}
+
+/*
+ *  get_student_names
+ *      fd:  linux file descriptor
+ *      id:  the student id we are looking for
+ *      *n:  receives the full names of the student
+ *
+ *  Like get_student(), but for the names only, at their full length.
+ *  Only formats that store names longer than student_t holds have them.
+ *
+ *  returns:  NO_ERROR       student located and names copied into *n
+ *            ERR_DB_FILE    database file I/O issue
+ *            ERR_DB_OP      the format keeps no longer names
+ *            SRCH_NOT_FOUND student was not located in the database
+ *
+ *  console:  Does not produce any console I/O used by other functions
+ */
+int get_student_names(int fd, int id, student_names_t *n) {
+    db_handle_t *h = db_handle_get(fd);
+    if (h == NULL || db_gate_enter(h, false) != NO_ERROR) {
+        return ERR_DB_FILE;
+    }
+
+    int rc = ERR_DB_OP;
+    if (h->engine->get_names == NULL) {
+        // nothing to look up
+    } else if (id < MIN_STD_ID || id > MAX_STD_ID) {
+        rc = SRCH_NOT_FOUND;
+    } else if (db_lock_record(h, id, false) != NO_ERROR) {
+        rc = ERR_DB_FILE;
+    } else {
+        rc = db_get_names(h, id, n);
+        db_unlock_record(h, id);
+    }
+
+    db_gate_leave(h);
+    return rc;
 }
 
 /*
@@ -92,29 +271,44 @@ int get_student(int fd, int id, student_t *s) {
  *  returns:  NO_ERROR       student added to database
  *            ERR_DB_FILE    database file I/O issue
  *            ERR_DB_OP      database operation logically failed (aka student
- *                           already exists)
+ *                           already exists, or id out of range)
  *
  *
  *  console:  M_STD_ADDED       on success
  *            M_ERR_DB_ADD_DUP  student already exists
+ *            M_ERR_STD_RNG     id out of range
  *            M_ERR_DB_READ     error reading or seeking the database file
  *            M_ERR_DB_WRITE    error writing to db file (adding student)
  *
  */
 int add_student(int fd, int id, char *fname, char *lname, int gpa) {
-    off_t offset = (off_t)id * STUDENT_RECORD_SIZE;
-    if (lseek(fd, offset, SEEK_SET) == -1) {
+    db_handle_t *h = db_handle_get(fd);
+    if (h != NULL && (id < MIN_STD_ID || id > MAX_STD_ID)) {
+        printf(M_ERR_STD_RNG);
+        return ERR_DB_OP;
+    }
+    if (h == NULL || db_gate_enter(h, false) != NO_ERROR ||
+        db_lock_change(h, id) != NO_ERROR) {
+        if (h != NULL)
+            db_gate_leave(h);
         printf(M_ERR_DB_READ);
         return ERR_DB_FILE;
     }
 
-    student_t existing;
-    ssize_t bytes_read = read(fd, &existing, STUDENT_RECORD_SIZE);
-    if (bytes_read == STUDENT_RECORD_SIZE) {
-        if (existing.id == id) {
+    // the duplicate check and the store happen under one record lock so
+    // two processes cannot both add the same id.  Under that lock a clear
+    // filter bit is the final word, and the bit is set before the store
+    student_t old = EMPTY_STUDENT_RECORD;
+    int rc = filter_absent(h, id) ? SRCH_NOT_FOUND : db_get(h, id, &old);
+    if (rc != SRCH_NOT_FOUND) {
+        db_unlock_change(h, id);
+        db_gate_leave(h);
+        if (rc == NO_ERROR) {
             printf(M_ERR_DB_ADD_DUP, id);
             return ERR_DB_OP;
         }
+        printf(M_ERR_DB_READ);
+        return ERR_DB_FILE;
     }
 
     student_t new_student = {0};
@@ -123,13 +317,26 @@ int add_student(int fd, int id, char *fname, char *lname, int gpa) {
     strncpy(new_student.lname, lname, sizeof(new_student.lname) - 1);
     new_student.gpa = gpa;
 
-    if (lseek(fd, offset, SEEK_SET) == -1) {
-        printf(M_ERR_DB_WRITE);
-        return ERR_DB_FILE;
+    // formats that keep names at full length (sdb_var.c) get them whole
+    student_names_t names = {0};
+    strncpy(names.fname, fname, sizeof(names.fname) - 1);
+    strncpy(names.lname, lname, sizeof(names.lname) - 1);
+
+    // log, then store into the mapping (growing the file if needed)
+    rc = wal_begin(h);
+    if (rc == NO_ERROR)
+        rc = wal_log(h, id, &new_student, &names);
+    if (rc == NO_ERROR) {
+        filter_add(h, id);
+        rc = db_put_names(h, id, &new_student, &names);
+        if (wal_end(h) != NO_ERROR)
+            rc = ERR_DB_FILE;
     }
-
-    ssize_t bytes_written = write(fd, &new_student, STUDENT_RECORD_SIZE);
-    if (bytes_written != STUDENT_RECORD_SIZE) {
+    if (rc == NO_ERROR)
+        db_notify_change(h, &old, &new_student);
+    db_unlock_change(h, id);
+    db_gate_leave(h);
+    if (rc != NO_ERROR) {
         printf(M_ERR_DB_WRITE);
         return ERR_DB_FILE;
     }
@@ -162,21 +369,49 @@ int add_student(int fd, int id, char *fname, char *lname, int gpa) {
  *
  */
 int del_student(int fd, int id) {
-    student_t s;
-    int rc = get_student(fd, id, &s);
-    if (rc != NO_ERROR) {
+    db_handle_t *h = db_handle_get(fd);
+    if (h != NULL && (id < MIN_STD_ID || id > MAX_STD_ID)) {
         printf(M_STD_NOT_FND_MSG, id);
         return SRCH_NOT_FOUND;
     }
+    if (h == NULL || db_gate_enter(h, false) != NO_ERROR ||
+        db_lock_change(h, id) != NO_ERROR) {
+        if (h != NULL)
+            db_gate_leave(h);
+        printf(M_ERR_DB_READ);
+        return ERR_DB_FILE;
+    }
 
-    off_t offset = (off_t)id * STUDENT_RECORD_SIZE;
-    if (lseek(fd, offset, SEEK_SET) == -1) {
+    // same lookup as get_student(), but under the write lock so the
+    // record cannot change between the check and the delete
+    student_t s;
+    int rc = filter_absent(h, id) ? SRCH_NOT_FOUND : db_get(h, id, &s);
+    if (rc != NO_ERROR) {
+        db_unlock_change(h, id);
+        db_gate_leave(h);
+        if (rc == SRCH_NOT_FOUND) {
+            printf(M_STD_NOT_FND_MSG, id);
+            return SRCH_NOT_FOUND;
+        }
         printf(M_ERR_DB_READ);
         return ERR_DB_FILE;
     }
 
-    ssize_t bytes_written = write(fd, &EMPTY_STUDENT_RECORD, STUDENT_RECORD_SIZE);
-    if (bytes_written != STUDENT_RECORD_SIZE) {
+    rc = wal_begin(h);
+    if (rc == NO_ERROR)
+        rc = wal_log(h, id, &EMPTY_STUDENT_RECORD, NULL);
+    if (rc == NO_ERROR) {
+        rc = db_put(h, id, &EMPTY_STUDENT_RECORD);
+        if (rc == NO_ERROR)
+            filter_del(h, id);
+        if (wal_end(h) != NO_ERROR)
+            rc = ERR_DB_FILE;
+    }
+    if (rc == NO_ERROR)
+        db_notify_change(h, &s, &EMPTY_STUDENT_RECORD);
+    db_unlock_change(h, id);
+    db_gate_leave(h);
+    if (rc != NO_ERROR) {
         printf(M_ERR_DB_WRITE);
         return ERR_DB_FILE;
     }
@@ -185,18 +420,145 @@ int del_student(int fd, int id) {
     return NO_ERROR;
 }
 
+/*
+ *  get_students
+ *      fd:   linux file descriptor
+ *      ids:  the student ids we are looking for
+ *      n:    number of ids
+ *      out:  out[i] receives student ids[i] if found
+ *      rcs:  rcs[i] is set to what get_student() returns for ids[i]
+ *
+ *  get_student() for a batch of ids.  One read lock covers the slots of
+ *  all the ids (a lock per record costs more than the reads once there
+ *  are thousands), then they are read together through the I/O backend
+ *  (sdb_io.c), so cold lookups run at the IOPS of the device instead of
+ *  one read latency after another.  The batch is one consistent read.
+ *
+ *  returns:  NO_ERROR       every id was looked up, see rcs
+ *            ERR_DB_FILE    database file I/O issue
+ *
+ *  console:  Does not produce any console I/O used by other functions
+ */
+int get_students(int fd, const int *ids, int n, student_t *out, int *rcs) {
+    db_handle_t *h = db_handle_get(fd);
+    if (h == NULL || n < 1 || db_gate_enter(h, false) != NO_ERROR) {
+        return h != NULL && n == 0 ? NO_ERROR : ERR_DB_FILE;
+    }
+
+    // ids whose pages are cached are answered from there, only the rest
+    // go to the file (without filling the cache, that would read them one
+    // page at a time)
+    int *miss = malloc((size_t)n * (3 * sizeof(int) + sizeof(student_t)));
+    if (miss == NULL) {
+        db_gate_leave(h);
+        return ERR_DB_FILE;
+    }
+    int *mids = miss + n, *mrcs = mids + n;
+    student_t *mout = (student_t *)(mrcs + n);
+    int nmiss = 0;
+    for (int i = 0; i < n; i++) {
+        if (ids[i] < MIN_STD_ID || ids[i] > MAX_STD_ID || filter_absent(h, ids[i]))
+            rcs[i] = SRCH_NOT_FOUND;
+        else
+            rcs[i] = cache_get(h, ids[i], &out[i], false);
+        if (rcs[i] == CACHE_MISS) {
+            miss[nmiss] = i;
+            mids[nmiss++] = ids[i];
+        }
+    }
+
+    int rc = NO_ERROR;
+    if (nmiss > 0) {
+        int lo = mids[0], hi = mids[0];
+        for (int k = 1; k < nmiss; k++) {
+            if (mids[k] < lo)
+                lo = mids[k];
+            if (mids[k] > hi)
+                hi = mids[k];
+        }
+        off_t off = (off_t)lo * STUDENT_RECORD_SIZE;
+        off_t len = ((off_t)hi - lo + 1) * STUDENT_RECORD_SIZE;
+
+        rc = ERR_DB_FILE;
+        if (db_lock_range(h, off, len, false) == NO_ERROR) {
+            rc = db_get_batch(h, mids, nmiss, mout, mrcs);
+            db_unlock_range(h, off, len);
+        }
+        for (int k = 0; rc == NO_ERROR && k < nmiss; k++) {
+            out[miss[k]] = mout[k];
+            rcs[miss[k]] = mrcs[k];
+        }
+    }
+
+    free(miss);
+    db_gate_leave(h);
+    return rc;
+}
+
+/*
+ *  del_students
+ *      fd:   linux file descriptor
+ *      ids:  students to delete
+ *      n:    number of ids
+ *
+ *  del_student() for a batch of ids.  The records are read in one batch
+ *  first, without locks, just so their pages are in memory; the deletes
+ *  themselves (checks, log and sidecars) then go one by one as usual and
+ *  no longer wait on the disk.
+ *
+ *  returns:  <number>       students deleted
+ *            ERR_DB_FILE    database file I/O issue
+ *
+ *  console:  what del_student() prints, for every id
+ */
+int del_students(int fd, const int *ids, int n) {
+    db_handle_t *h = db_handle_get(fd);
+    student_t *recs = malloc((size_t)n * sizeof(*recs));
+    int *rcs = malloc((size_t)n * 2 * sizeof(*rcs));
+    int deleted = 0;
+
+    if (h != NULL && recs != NULL && rcs != NULL &&
+        db_gate_enter(h, false) == NO_ERROR) {
+        // ids the filter rules out have nothing to read
+        int *want = rcs + n, m = 0;
+        for (int i = 0; i < n; i++) {
+            if (!filter_absent(h, ids[i]))
+                want[m++] = ids[i];
+        }
+        db_get_batch(h, want, m, recs, rcs);
+        db_gate_leave(h);
+    }
+    free(recs);
+    free(rcs);
+
+    for (int i = 0; i < n; i++) {
+        int rc = del_student(fd, ids[i]);
+
+        if (rc == ERR_DB_FILE)
+            return ERR_DB_FILE;
+        if (rc == NO_ERROR)
+            deleted++;
+    }
+    return deleted;
+}
+
+
+static int count_page(void *arg, int first, const student_t *recs, int n,
+                      uint64_t occupied) {
+    (void)first; (void)recs; (void)n;
+    *(int *)arg += __builtin_popcountll(occupied);
+    return NO_ERROR;
+}
 
 /*
  *  count_db_records
  *      fd:     linux file descriptor
  *
- *  Counts the number of records in the database.  Start by reading the
- *  database at the beginning, and continue reading individual records
- *  until you it EOF.  EOF is when the read() syscall returns 0. Check
- *  if a slot is empty or previously deleted by investigating if all of
- *  the bytes in the record read are zeros - I would suggest using memory
- *  compare memcmp() for this. Create a counter variable and initialize it
- *  to zero, every time a non-zero record is read increment the counter.
+ *  Counts the number of records in the database.  The file is scanned
+ *  with scan_parallel(), which only reads the extents that hold data
+ *  (holes are skipped with SEEK_DATA), and every page is counted with a
+ *  popcount of its occupancy bitmap instead of comparing each record
+ *  against an empty one.
  *
  *  returns:  <number>       returns the number of records in db on success
  *            ERR_DB_FILE    database file I/O issue
@@ -211,25 +573,24 @@ int del_student(int fd, int id) {
  *
  */
 int count_db_records(int fd) {
-    lseek(fd, 0, SEEK_SET);
-    student_t s;
+    db_handle_t *h = db_handle_get(fd);
+    // one counter per scan worker, a cache line apart so the workers do
+    // not keep stealing it from each other
+    struct { int n; } __attribute__((aligned(64))) counts[SCAN_MAX_THREADS] = {0};
+    void *states[SCAN_MAX_THREADS];
     int count = 0;
-    ssize_t bytes_read;
-
-    while ((bytes_read = read(fd, &s, STUDENT_RECORD_SIZE)) > 0) {
-        if (bytes_read != STUDENT_RECORD_SIZE) {
-            printf(M_ERR_DB_READ);
-            return ERR_DB_OP;
-        }
-        if (memcmp(&s, &EMPTY_STUDENT_RECORD, STUDENT_RECORD_SIZE) != 0) {
-            count++;
-        }
-    }
 
-    if (bytes_read == -1) {
+    // only populated pages are read, each one is counted with a popcount
+    // of its occupancy bitmap, on as many threads as scan_parallel() likes
+    for (int i = 0; i < SCAN_MAX_THREADS; i++)
+        states[i] = &counts[i].n;
+    if (h == NULL ||
+        scan_parallel(h, scan_threads(h), count_page, states, NULL, NULL) != NO_ERROR) {
         printf(M_ERR_DB_READ);
         return ERR_DB_OP;
     }
+    for (int i = 0; i < SCAN_MAX_THREADS; i++)
+        count += counts[i].n;
 
     if (count == 0) {
         printf(M_DB_EMPTY);
@@ -241,30 +602,28 @@ int count_db_records(int fd) {
 }
 
 
+static int print_page(void *arg, int first, const student_t *recs, int n,
+                      uint64_t occupied) {
+    (void)first; (void)n;
+
+    out_page(arg, recs, occupied);
+    return NO_ERROR;
+}
+
 /*
  *  print_db
  *      fd:     linux file descriptor
  *
- *  Prints all records in the database.  Start by reading the
- *  database at the beginning, and continue reading individual records
- *  until you it EOF.  EOF is when the read() syscall returns 0. Check
- *  if a slot is empty or previously deleted by investigating if all of
- *  the bytes in the record read are zeros - I would suggest using memory
- *  compare memcmp() for this. Be careful as the database might be empty.
- *  on the first real row encountered print the header for the required output:
+ *  Prints all records in the database as a table, see export_db().  On
+ *  the first student the header is printed:
  *
  *     printf(STUDENT_PRINT_HDR_STRING, "ID",
  *                  "FIRST_NAME", "LAST_NAME", "GPA");
  *
- *  then for each valid record encountered print the required output:
- *
- *     printf(STUDENT_PRINT_FMT_STRING, student.id, student.fname,
- *                    student.lname, calculated_gpa_from_student);
- *
- *  The code above assumes you are reading student records into a local
- *  variable named student that is of type student_t. Also dont forget that
- *  the GPA in the student structure is an int, to convert it into a real
- *  gpa divide by 100.0 and store in a float variable.
+ *  then one row per student in id order, with the GPA (an int in
+ *  student_t) divided by 100.0.  Like count_db_records() only the
+ *  extents that hold data are read, and the students of a page are found
+ *  from its occupancy bitmap.
  *
  *  returns:  NO_ERROR       on success
  *            ERR_DB_FILE    database file I/O issue
@@ -275,33 +634,195 @@ int count_db_records(int fd) {
  *
  */
 int print_db(int fd) {
-    lseek(fd, 0, SEEK_SET);
-    student_t s;
-    int header_printed = 0;
-    ssize_t bytes_read;
+    return export_db(fd, OUT_TABLE);
+}
 
-    while ((bytes_read = read(fd, &s, STUDENT_RECORD_SIZE)) > 0) {
-        if (bytes_read != STUDENT_RECORD_SIZE) {
-            printf(M_ERR_DB_READ);
-            return ERR_DB_FILE;
-        }
 
-        if (memcmp(&s, &EMPTY_STUDENT_RECORD, STUDENT_RECORD_SIZE) != 0) {
-            if (!header_printed) {
-                printf(STUDENT_PRINT_HDR_STRING, "ID", "FIRST_NAME", "LAST_NAME", "GPA");
-                header_printed = 1;
-            }
-            float gpa = s.gpa / 100.0f;
-            printf(STUDENT_PRINT_FMT_STRING, s.id, s.fname, s.lname, gpa);
-        }
+static int print_merge(void *arg, void *state) {
+    out_drain(arg, state);
+    return NO_ERROR;
+}
+
+/*
+ *  export_db
+ *      fd:      linux file descriptor
+ *      format:  out_format_t encoding of the output
+ *
+ *  print_db() in any of the encodings of sdb_out.h.  Rows are formatted
+ *  into a large buffer and written in big blocks instead of one printf()
+ *  per student.  The file is read and formatted on several threads, see
+ *  scan_parallel(), and the rows still come out in id order.  Only the
+ *  table says so when the database is empty; the other encodings are for
+ *  programs and just produce no rows.
+ *
+ *  returns:  NO_ERROR       on success
+ *            ERR_DB_FILE    database file or output I/O issue
+ *
+ *  console:  the students, M_DB_EMPTY, or M_ERR_DB_READ
+ */
+int export_db(int fd, int format) {
+    db_handle_t *h = db_handle_get(fd);
+    sdb_out_t *o = out_open(STDOUT_FILENO, format);
+    void *parts[SCAN_MAX_THREADS] = {0};
+    int nthreads = h == NULL ? 0 : scan_threads(h);
+    int rc = o == NULL || h == NULL ? ERR_DB_FILE : NO_ERROR;
+
+    // every scan worker formats its part of the file into a buffer of its
+    // own, print_merge() writes the buffers out in id order
+    for (int i = 0; rc == NO_ERROR && i < nthreads; i++) {
+        parts[i] = out_open_mem(format);
+        if (parts[i] == NULL)
+            rc = ERR_DB_FILE;
+    }
+    if (rc == NO_ERROR)
+        rc = scan_parallel(h, nthreads, print_page, parts, print_merge, o);
+    for (int i = 0; i < nthreads; i++) {
+        if (parts[i] != NULL)
+            out_close(parts[i]);
     }
 
-    if (!header_printed) {
+    if (o == NULL) {
+        printf(M_ERR_DB_READ);
+        return ERR_DB_FILE;
+    }
+    if (rc == NO_ERROR && o->rows == 0 && format == OUT_TABLE) {
+        out_close(o);
         printf(M_DB_EMPTY);
+        return NO_ERROR;
     }
+    if (out_close(o) != NO_ERROR)
+        return ERR_DB_FILE;
+    if (rc != NO_ERROR) {
+        printf(M_ERR_DB_READ);
+        return ERR_DB_FILE;
+    }
+    return NO_ERROR;
+}
+
+/*
+ *  range_db
+ *      fd:  linux file descriptor
+ *      lo:  smallest id to print
+ *      hi:  largest id to print
+ *
+ *  Prints the students with ids from lo to hi, in the same format as
+ *  print_db().  The rows are streamed from a cursor, so only one batch of
+ *  records is in memory at a time; the legacy format reads the whole id
+ *  range as one extent and skips empty slots a page at a time.
+ *
+ *  returns:  NO_ERROR       on success
+ *            SRCH_NOT_FOUND no student has an id in the range
+ *            ERR_DB_FILE    database file I/O issue
+ *
+ *  console:  the table, M_RANGE_NOT_FND, or M_ERR_DB_READ
+ */
+int range_db(int fd, int lo, int hi) {
+    db_cursor_t *c = cursor_open(fd, lo, hi);
+    sdb_out_t *o = out_open(STDOUT_FILENO, OUT_TABLE);
+    student_t s;
+    long printed;
+    int rc;
+
+    if (c == NULL || o == NULL) {
+        if (c != NULL)
+            cursor_close(c);
+        if (o != NULL)
+            out_close(o);
+        printf(M_ERR_DB_READ);
+        return ERR_DB_FILE;
+    }
+
+    while ((rc = cursor_next(c, &s)) == NO_ERROR)
+        out_student(o, &s);
+    cursor_close(c);
+    printed = o->rows;
+    if (out_close(o) != NO_ERROR)
+        return ERR_DB_FILE;
 
+    if (rc == ERR_DB_FILE) {
+        printf(M_ERR_DB_READ);
+        return ERR_DB_FILE;
+    }
+    if (!printed) {
+        printf(M_RANGE_NOT_FND, lo, hi);
+        return SRCH_NOT_FOUND;
+    }
     return NO_ERROR;
 }
+
+/*
+ *  find_db
+ *      fd:   linux file descriptor
+ *      ids:  the student ids to look up
+ *      n:    number of ids
+ *
+ *  Looks up all ids with one get_students() batch and prints them with
+ *  print_found().
+ *
+ *  returns:  NO_ERROR       on success, all ids found
+ *            SRCH_NOT_FOUND some id was not found
+ *            ERR_DB_FILE    database file I/O issue
+ *
+ *  console:  see print_found(), or M_ERR_DB_READ
+ */
+int find_db(int fd, const int *ids, int n) {
+    student_t *recs = malloc((size_t)n * sizeof(*recs));
+    int *rcs = malloc((size_t)n * sizeof(*rcs));
+    int rc = recs == NULL || rcs == NULL ? ERR_DB_FILE
+                                         : get_students(fd, ids, n, recs, rcs);
+
+    if (rc == NO_ERROR)
+        rc = print_found(ids, n, recs, rcs);
+    else
+        printf(M_ERR_DB_READ);
+    free(recs);
+    free(rcs);
+    return rc;
+}
+
+/*
+ *  print_found
+ *      ids:   the student ids looked up
+ *      n:     number of ids
+ *      recs:  recs[i] is student ids[i] where rcs[i] is NO_ERROR
+ *      rcs:   what get_student() returned for ids[i]
+ *
+ *  The output of find_db(): the students found as one table, in the
+ *  order of ids, in the same format as print_db(); then a line for every
+ *  id that was not found.  The thin client prints the server's answers
+ *  with it as well.
+ *
+ *  returns:  NO_ERROR       all ids found
+ *            SRCH_NOT_FOUND some id was not found
+ *            ERR_DB_FILE    some lookup failed, or the output did
+ *
+ *  console:  the table, M_STD_NOT_FND_MSG per missing id, or M_ERR_DB_READ
+ */
+int print_found(const int *ids, int n, const student_t *recs, const int *rcs) {
+    sdb_out_t *o = out_open(STDOUT_FILENO, OUT_TABLE);
+    int rc = NO_ERROR;
+
+    for (int i = 0; o != NULL && i < n; i++) {
+        if (rcs[i] == ERR_DB_FILE)
+            rc = ERR_DB_FILE;
+        else if (rcs[i] == NO_ERROR)
+            out_student(o, &recs[i]);
+    }
+    if (o == NULL || out_close(o) != NO_ERROR || rc != NO_ERROR) {
+        if (o == NULL || rc != NO_ERROR)
+            printf(M_ERR_DB_READ);
+        return ERR_DB_FILE;
+    }
+
+    for (int i = 0; i < n; i++) {
+        if (rcs[i] == SRCH_NOT_FOUND) {
+            printf(M_STD_NOT_FND_MSG, ids[i]);
+            rc = SRCH_NOT_FOUND;
+        }
+    }
+    return rc;
+}
+
 /*
  *  print_student
  *      *s:   a pointer to a student_t structure that should
@@ -341,6 +862,26 @@ void print_student(student_t *s) {
     printf(STUDENT_PRINT_FMT_STRING, s->id, s->fname, s->lname, gpa);
 }
 
+/*
+ *  print_student_names
+ *      *s:  student to print
+ *      *n:  the student's full names, see get_student_names()
+ *
+ *  print_student() with names that do not fit the columns printed whole.
+ *
+ *  console:  the same as print_student()
+ */
+void print_student_names(student_t *s, const student_names_t *n) {
+    if (s == NULL || s->id == 0) {
+        printf(M_ERR_STD_PRINT);
+        return;
+    }
+
+    printf(STUDENT_PRINT_HDR_STRING, "ID", "FIRST NAME", "LAST_NAME", "GPA");
+    float gpa = s->gpa / 100.0f;
+    printf(STUDENT_PRINT_FULL_FMT_STRING, s->id, n->fname, n->lname, gpa);
+}
+
 
 /*
  *  NOTE IMPLEMENTING THIS FUNCTION IS EXTRA CREDIT
@@ -374,6 +915,14 @@ void print_student(student_t *s) {
  *  compressed file after you create it, it is a good design to return the fd
  *  of the new compressed file from this function
  *
+ *  Deleted records never have to move (a record's offset is its id), so
+ *  the file is compacted in place instead: compact_db() punches the pages
+ *  without live records back into holes, one slice at a time, while other
+ *  processes keep reading and writing, then trims the empty tail.  Only
+ *  on file systems without hole punching is the file copied as described
+ *  above, with copy_file_range() per run of live pages.  Progress is shown
+ *  on stderr when it is a terminal.
+ *
  *  returns:  <number>       returns the fd of the compressed database file
  *            ERR_DB_FILE    database file I/O issue
  *
@@ -390,57 +939,46 @@ void print_student(student_t *s) {
  *            M_ERR_DB_WRITE   error writing to db or tempdb file (adding student)
  *
  */
-int compress_db(int fd) {
-    close(fd);
-
-    int orig_fd = open(DB_FILE, O_RDONLY);
-    if (orig_fd < 0) {
-        printf(M_ERR_DB_OPEN);
+static int compress_copy(int fd, db_handle_t *h) {
+    // nobody may touch the old file from here until it has been replaced,
+    // other processes find the new file when they get the gate back.
+    // Everything logged so far must be in the file we are about to copy
+    if (db_gate_enter(h, true) != NO_ERROR || wal_checkpoint(h) != NO_ERROR) {
+        close_db(fd);
+        printf(M_ERR_DB_WRITE);
         return ERR_DB_FILE;
     }
 
     int tmp_fd = open(TMP_DB_FILE, O_RDWR | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP);
     if (tmp_fd < 0) {
-        close(orig_fd);
+        close_db(fd);
         printf(M_ERR_DB_OPEN);
         return ERR_DB_FILE;
     }
 
-    student_t s;
-    ssize_t bytes_read;
-    off_t offset;
-
-    lseek(orig_fd, 0, SEEK_SET);
-    while ((bytes_read = read(orig_fd, &s, STUDENT_RECORD_SIZE)) > 0) {
-        if (bytes_read != STUDENT_RECORD_SIZE) {
-            close(orig_fd);
-            close(tmp_fd);
-            printf(M_ERR_DB_READ);
-            return ERR_DB_FILE;
-        }
-
-        if (memcmp(&s, &EMPTY_STUDENT_RECORD, STUDENT_RECORD_SIZE) != 0) {
-            offset = (off_t)s.id * STUDENT_RECORD_SIZE;
-            if (lseek(tmp_fd, offset, SEEK_SET) == -1 || write(tmp_fd, &s, STUDENT_RECORD_SIZE) != STUDENT_RECORD_SIZE) {
-                close(orig_fd);
-                close(tmp_fd);
-                printf(M_ERR_DB_WRITE);
-                return ERR_DB_FILE;
-            }
-        }
+    // copy the pages holding live records, holes in the old file are
+    // never read
+    int rc = compact_copy(h, tmp_fd);
+    if (rc != NO_ERROR) {
+        close_db(fd);
+        close(tmp_fd);
+        printf(rc == ERR_DB_OP ? M_ERR_DB_WRITE : M_ERR_DB_READ);
+        return ERR_DB_FILE;
     }
 
-    if (bytes_read == -1) {
-        close(orig_fd);
+    if (fsync(tmp_fd) == -1) {
+        close_db(fd);
         close(tmp_fd);
-        printf(M_ERR_DB_READ);
+        printf(M_ERR_DB_WRITE);
         return ERR_DB_FILE;
     }
-
-    close(orig_fd);
     close(tmp_fd);
 
-    if (rename(TMP_DB_FILE, DB_FILE) != 0) {
+    // rename while still holding the old file's gate, closing it first
+    // would let a writer in whose update the copy does not have
+    rc = rename(TMP_DB_FILE, DB_FILE);
+    close_db(fd);
+    if (rc != 0) {
         printf(M_ERR_DB_CREATE);
         return ERR_DB_FILE;
     }
@@ -449,11 +987,38 @@ int compress_db(int fd) {
     if (new_fd < 0) {
         return ERR_DB_FILE;
     }
+    db_notify_rebuild(db_handle_get(new_fd));
 
     printf(M_DB_COMPRESSED_OK);
     return new_fd;
 }
 
+int compress_db(int fd) {
+    db_handle_t *h = db_handle_get(fd);
+    if (h == NULL) {
+        close_db(fd);
+        printf(M_ERR_DB_READ);
+        return ERR_DB_FILE;
+    }
+
+    // punch the empty pages out in place, slice by slice, while other
+    // processes keep using the file
+    compact_stats_t st;
+    int rc = compact_db(h, compact_report, NULL, &st);
+    if (rc == ERR_DB_OP) {
+        // the file system cannot punch holes, rewrite the file instead
+        return compress_copy(fd, h);
+    }
+    if (rc != NO_ERROR) {
+        close_db(fd);
+        printf(M_ERR_DB_WRITE);
+        return ERR_DB_FILE;
+    }
+
+    printf(M_DB_COMPRESSED_OK);
+    return fd;
+}
+
 
 /*
  *  validate_range
@@ -495,18 +1060,38 @@ int validate_range(int id, int gpa)
  */
 void usage(char *exename)
 {
-    printf("usage: %s -[h|a|c|d|f|p|z] options.  Where:\n", exename);
+    printf("usage: %s -[h|a|A|c|d|D|f|F|g|i|k|l|L|p|r|R|s|S|t|T|U|v|x|X|z] options.  Where:\n", exename);
     printf("\t-h:  prints help\n");
     printf("\t-a id first_name last_name gpa(as 3 digit int):  adds a student\n");
+    printf("\t-A file|-:  bulk loads id,first_name,last_name,gpa lines (CSV or TSV)\n");
     printf("\t-c:  counts the records in the database\n");
-    printf("\t-d id:  deletes a student\n");
-    printf("\t-f id:  finds and prints a student in the database\n");
-    printf("\t-p:  prints all records in the student database\n");
+    printf("\t-d id [id ...]:  deletes students\n");
+    printf("\t-D [socket]:  serves the database to SDB_SERVER=socket clients\n");
+    printf("\t-f id [id ...]:  finds and prints students in the database\n");
+    printf("\t-F [socket|-]:  keeps this database a hot standby of the -R primary, or prints its lag\n");
+    printf("\t-g avg|min|max|hist|p<0-100> [lo_id hi_id]:  GPA statistics\n");
+    printf("\t-i:  prints the record cache counters (of the SDB_SERVER server)\n");
+    printf("\t-k top N|bottom N|rank id|count lo hi:  answers from the GPA index\n");
+    printf("\t-l last_name:  finds students by last name\n");
+    printf("\t-L prefix:  finds students whose last name starts with prefix\n");
+    printf("\t-p [table|tsv|jsonl|binary]:  prints all records in the student database\n");
+    printf("\t-r lo_id hi_id:  prints the students with ids from lo_id to hi_id\n");
+    printf("\t-R [socket|-]:  ships the change log to -F standbys\n");
+    printf("\t-s [name | -d name]:  saves, lists or removes snapshots, read with SDB_SNAPSHOT=name\n");
+    printf("\t-S:  writes a columnar snapshot of the database for -g\n");
+    printf("\t-t seq [follow] | compact:  prints the changes from seq on (SDB_CDC=1 logs them), or compacts the log\n");
+    printf("\t-T [file|-]:  runs add/del/update/get lines (default stdin) as one transaction\n");
+    printf("\t-U:  turns an archived database back into a writable one\n");
+    printf("\t-v:  verifies the page checksums of the database file\n");
     printf("\t-x:  compress the database file [EXTRA CREDIT]\n");
+    printf("\t-X [file]:  archives the database, read-only and compressed, to file or in place\n");
     printf("\t-z:  zero db file (remove all records)\n");
 }
 
 // Welcome to main()
+// (left out with -DSDB_NO_MAIN when the database is linked into another
+// program, see bench/sdb_bench.c)
+#ifndef SDB_NO_MAIN
 int main(int argc, char *argv[])
 {
     char opt;      // user selected option
@@ -515,11 +1100,14 @@ int main(int argc, char *argv[])
     int exit_code; // exit code to shell
     int id;        // userid from argv[2]
     int gpa;       // gpa from argv[5]
+    unsigned long long seq = 0; // change number from argv[2] of -t
+    char *end = NULL;           // where the number in argv[2] stopped
 
     // space for a student structure which we will get back from
     // some of the functions we will be writing such as get_student(),
     // and print_student().
     student_t student = {0};
+    student_names_t names;
 
     // This function must have at least one arg, and the arg must start
     // with a dash
@@ -540,10 +1128,46 @@ int main(int argc, char *argv[])
         exit(EXIT_OK);
     }
 
+    // with SDB_SNAPSHOT=name the read-only operations run against that
+    // snapshot (see sdb_snap.h) instead of the live database
+    const char *snap = db_config_str("SDB_SNAPSHOT", NULL);
+    if (snap != NULL && opt != 's' && strchr(SNAP_OPS, opt) == NULL)
+    {
+        printf(M_ERR_SNAP_OP, opt);
+        exit(EXIT_FAIL_ARGS);
+    }
+
+    // with a server running, -a -c -d -f -i -p and -x are sent to it
+    // instead of opening the database here, see sdb_server.h
+    const char *server = db_config_str("SDB_SERVER", NULL);
+    if (server != NULL && snap == NULL && opt != '\0' &&
+        strchr("acdfipx", opt) != NULL)
+    {
+        exit(client_main(server, argc, argv));
+    }
+
+    // -s with no name or -d name manages snapshots without the database
+    if (opt == 's' && argc != 3)
+    {
+        if (argc == 2)
+            rc = snap_list(DB_FILE);
+        else if (argc == 4 && strcmp(argv[2], "-d") == 0)
+            rc = snap_drop(DB_FILE, argv[3]);
+        else
+        {
+            usage(argv[0]);
+            exit(EXIT_FAIL_ARGS);
+        }
+        exit(rc == NO_ERROR ? EXIT_OK : EXIT_FAIL_DB);
+    }
+
     // now lets open the file and continue if there is no error
     // note we are not truncating the file using the second
     // parameter
-    fd = open_db(DB_FILE, false);
+    if (snap != NULL && opt != 's')
+        fd = snap_open(DB_FILE, snap);
+    else
+        fd = open_db(DB_FILE, false);
     if (fd < 0)
     {
         exit(EXIT_FAIL_DB);
@@ -586,6 +1210,23 @@ int main(int argc, char *argv[])
 
         break;
 
+    case 'A':
+        //   arv[0] arv[1]  arv[2]
+        // prog_name     -A    file
+        //-------------------------
+        // example:  prog_name -A roster.csv
+        //           cat roster.tsv | prog_name -A -
+        if (argc != 3)
+        {
+            usage(argv[0]);
+            exit_code = EXIT_FAIL_ARGS;
+            break;
+        }
+        rc = ingest_students(fd, argv[2]);
+        if (rc < 0)
+            exit_code = EXIT_FAIL_DB;
+        break;
+
     case 'c':
         //    arv[0] arv[1]
         // prog_name     -c
@@ -597,16 +1238,30 @@ int main(int argc, char *argv[])
         break;
 
     case 'd':
-        //   arv[0]  arv[1]  arv[2]
-        // prog_name     -d      id
+        //   arv[0]  arv[1]  arv[2] [arv[3] ...]
+        // prog_name     -d      id [id ...]
         //-------------------------
         // example:  prog_name -d 100
-        if (argc != 3)
+        //           prog_name -d 100 200 300
+        if (argc < 3)
         {
             usage(argv[0]);
             exit_code = EXIT_FAIL_ARGS;
             break;
         }
+        if (argc > 3)
+        {
+            int *ids = malloc((argc - 2) * sizeof(int));
+            for (int i = 2; ids != NULL && i < argc; i++)
+                ids[i - 2] = atoi(argv[i]);
+            rc = ids == NULL ? ERR_DB_FILE : del_students(fd, ids, argc - 2);
+            if (ids == NULL)
+                printf(M_ERR_DB_READ);
+            free(ids);
+            if (rc != argc - 2)
+                exit_code = EXIT_FAIL_DB;
+            break;
+        }
         id = atoi(argv[2]);
         rc = del_student(fd, id);
         if (rc < 0)
@@ -614,24 +1269,81 @@ int main(int argc, char *argv[])
 
         break;
 
+    case 'D':
+        //    arv[0] arv[1]  [arv[2]]
+        // prog_name     -D  [socket]
+        //---------------------------
+        // example:  prog_name -D
+        //           prog_name -D /run/sdb.sock
+        if (argc > 3)
+        {
+            usage(argv[0]);
+            exit_code = EXIT_FAIL_ARGS;
+            break;
+        }
+
+        // runs until SIGINT/SIGTERM, the database is closed on return
+        rc = serve_db(fd, DB_FILE, argc == 3 ? argv[2] : NULL);
+        fd = -1;
+        if (rc < 0)
+            exit_code = EXIT_FAIL_DB;
+        break;
+
+    case 'F':
+        //    arv[0] arv[1]  [arv[2]]
+        // prog_name     -F  [socket | -]
+        //---------------------------
+        // example:  cd standby && prog_name -F ../primary/.student.db.repl.sock
+        //           prog_name -F
+        if (argc > 3)
+        {
+            usage(argv[0]);
+            exit_code = EXIT_FAIL_ARGS;
+            break;
+        }
+
+        // runs until SIGINT/SIGTERM, then the standby can take over
+        rc = argc == 3 ? repl_follow(fd, argv[2]) : repl_status(fd);
+        if (rc < 0)
+            exit_code = EXIT_FAIL_DB;
+        break;
+
     case 'f':
-        //    arv[0] arv[1]  arv[2]
-        // prog_name     -f      id
+        //    arv[0] arv[1]  arv[2] [arv[3] ...]
+        // prog_name     -f      id [id ...]
         //-------------------------
         // example:  prog_name -f 100
-        if (argc != 3)
+        //           prog_name -f 100 200 300
+        if (argc < 3)
         {
             usage(argv[0]);
             exit_code = EXIT_FAIL_ARGS;
             break;
         }
+        if (argc > 3)
+        {
+            // several ids are looked up in one batch
+            int *ids = malloc((argc - 2) * sizeof(int));
+            for (int i = 2; ids != NULL && i < argc; i++)
+                ids[i - 2] = atoi(argv[i]);
+            rc = ids == NULL ? ERR_DB_FILE : find_db(fd, ids, argc - 2);
+            if (ids == NULL)
+                printf(M_ERR_DB_READ);
+            free(ids);
+            if (rc != NO_ERROR)
+                exit_code = EXIT_FAIL_DB;
+            break;
+        }
         id = atoi(argv[2]);
         rc = get_student(fd, id, &student);
 
         switch (rc)
         {
         case NO_ERROR:
-            print_student(&student);
+            if (get_student_names(fd, id, &names) == NO_ERROR)
+                print_student_names(&student, &names);
+            else
+                print_student(&student);
             break;
         case SRCH_NOT_FOUND:
             printf(M_STD_NOT_FND_MSG, id);
@@ -644,12 +1356,241 @@ int main(int argc, char *argv[])
         }
         break;
 
+    case 'g':
+        //    arv[0] arv[1]  arv[2]  [arv[3]  arv[4]]
+        // prog_name     -g    stat  [lo_id   hi_id]
+        //-------------------------------------------
+        // example:  prog_name -g avg
+        //           prog_name -g p90 1000 1999
+        if (argc != 3 && argc != 5)
+        {
+            usage(argv[0]);
+            exit_code = EXIT_FAIL_ARGS;
+            break;
+        }
+        rc = gpa_report(fd, argv[2],
+                        argc == 5 ? atoi(argv[3]) : MIN_STD_ID,
+                        argc == 5 ? atoi(argv[4]) : MAX_STD_ID);
+        if (rc == ERR_DB_OP)
+            exit_code = EXIT_FAIL_ARGS;
+        else if (rc < 0)
+            exit_code = EXIT_FAIL_DB;
+        break;
+
+    case 'i':
+        //    arv[0] arv[1]
+        // prog_name     -i
+        //-----------------
+        // example:  SDB_SERVER=.student.db.sock prog_name -i
+        if (argc != 2)
+        {
+            usage(argv[0]);
+            exit_code = EXIT_FAIL_ARGS;
+            break;
+        }
+        {
+            // without a server these are the counters of this process
+            cache_stats_t st;
+            db_handle_t *h = db_handle_get(fd);
+
+            if (h == NULL || cache_stats(h, &st) != NO_ERROR)
+            {
+                printf(M_ERR_DB_READ);
+                exit_code = EXIT_FAIL_DB;
+                break;
+            }
+            print_cache_stats(&st);
+        }
+        break;
+
+    case 'k':
+        //    arv[0] arv[1]  arv[2]  arv[3] [arv[4]]
+        // prog_name     -k   query  arg    [arg]
+        //-------------------------------------------
+        // example:  prog_name -k top 10
+        //           prog_name -k rank 1
+        //           prog_name -k count 300 400
+        if (argc < 4 || argc > 5)
+        {
+            usage(argv[0]);
+            exit_code = EXIT_FAIL_ARGS;
+            break;
+        }
+        if ((strcmp(argv[2], "top") == 0 || strcmp(argv[2], "bottom") == 0) &&
+            argc == 4 && atoi(argv[3]) > 0)
+        {
+            rc = rank_top(fd, argv[2][0] == 't', atoi(argv[3]));
+        }
+        else if (strcmp(argv[2], "rank") == 0 && argc == 4)
+        {
+            id = atoi(argv[3]);
+            if (validate_range(id, MIN_STD_GPA) == EXIT_FAIL_ARGS)
+            {
+                printf(M_ERR_STD_RNG);
+                exit_code = EXIT_FAIL_ARGS;
+                break;
+            }
+            rc = rank_of(fd, id);
+        }
+        else if (strcmp(argv[2], "count") == 0 && argc == 5 &&
+                 validate_range(MIN_STD_ID, atoi(argv[3])) == EXIT_OK &&
+                 validate_range(MIN_STD_ID, atoi(argv[4])) == EXIT_OK &&
+                 atoi(argv[3]) <= atoi(argv[4]))
+        {
+            rc = rank_count(fd, atoi(argv[3]), atoi(argv[4]));
+        }
+        else
+        {
+            printf(M_ERR_RANK_QUERY, argv[2]);
+            exit_code = EXIT_FAIL_ARGS;
+            break;
+        }
+        if (rc < 0)
+            exit_code = EXIT_FAIL_DB;
+        break;
+
+    case 'l':
+    case 'L':
+        //    arv[0] arv[1]  arv[2]
+        // prog_name  -l|-L   lname
+        //-------------------------
+        // example:  prog_name -l doe
+        //           prog_name -L do
+        if (argc != 3)
+        {
+            usage(argv[0]);
+            exit_code = EXIT_FAIL_ARGS;
+            break;
+        }
+        rc = find_by_lname(fd, argv[2], opt == 'L');
+        if (rc < 0)
+            exit_code = EXIT_FAIL_DB;
+        break;
+
     case 'p':
         //    arv[0] arv[1]
-        // prog_name     -p
+        // prog_name     -p  [format]
+        //---------------------------
+        // example:  prog_name -p jsonl
+        {
+            out_format_t format = OUT_TABLE;
+
+            if (argc > 3) {
+                usage(argv[0]);
+                exit_code = EXIT_FAIL_ARGS;
+                break;
+            }
+            if (argc == 3 && out_format_named(argv[2], &format) != NO_ERROR) {
+                printf(M_ERR_OUT_FORMAT, argv[2]);
+                exit_code = EXIT_FAIL_ARGS;
+                break;
+            }
+            rc = export_db(fd, format);
+            if (rc < 0)
+                exit_code = EXIT_FAIL_DB;
+        }
+        break;
+
+    case 'r':
+        //    arv[0] arv[1]  arv[2]  arv[3]
+        // prog_name     -r   lo_id   hi_id
+        //---------------------------------
+        // example:  prog_name -r 1000 1999
+        if (argc != 4)
+        {
+            usage(argv[0]);
+            exit_code = EXIT_FAIL_ARGS;
+            break;
+        }
+        rc = range_db(fd, atoi(argv[2]), atoi(argv[3]));
+        if (rc < 0)
+            exit_code = EXIT_FAIL_DB;
+        break;
+
+    case 'S':
+        //    arv[0] arv[1]
+        // prog_name     -S
+        //-----------------
+        // example:  prog_name -S
+        rc = snapshot_db(fd);
+        if (rc < 0)
+            exit_code = EXIT_FAIL_DB;
+        break;
+
+    case 'R':
+        //    arv[0] arv[1]  [arv[2]]
+        // prog_name     -R  [socket | -]
+        //---------------------------
+        // example:  prog_name -R
+        if (argc > 3)
+        {
+            usage(argv[0]);
+            exit_code = EXIT_FAIL_ARGS;
+            break;
+        }
+
+        // runs until SIGINT/SIGTERM
+        rc = repl_serve(fd, argc == 3 ? argv[2] : NULL);
+        if (rc < 0)
+            exit_code = EXIT_FAIL_DB;
+        break;
+
+    case 's':
+        //    arv[0] arv[1]  [arv[2]  [arv[3]]]
+        // prog_name     -s  [name | -d name]
+        //-----------------------------------
+        // example:  prog_name -s monday
+        //           SDB_SNAPSHOT=monday prog_name -p
+        // listing and removing were handled before the database was opened
+        rc = snap_create(fd, argv[2]);
+        if (rc == ERR_DB_OP)
+            exit_code = EXIT_FAIL_ARGS;
+        else if (rc < 0)
+            exit_code = EXIT_FAIL_DB;
+        break;
+
+    case 't':
+        //    arv[0] arv[1]  arv[2]  [arv[3]]
+        // prog_name     -t     seq  [follow]
+        // prog_name     -t compact
+        //-----------------------------------
+        // example:  SDB_CDC=1 prog_name -a 1 John Doe 341
+        //           prog_name -t 0 follow
+        if (argc >= 3 && strcmp(argv[2], "compact") != 0)
+        {
+            errno = 0;
+            seq = strtoull(argv[2], &end, 10);
+        }
+        if (argc < 3 || argc > 4 ||
+            (argc == 4 && strcmp(argv[3], "follow") != 0) ||
+            (argc == 4 && strcmp(argv[2], "compact") == 0) ||
+            (end != NULL && (argv[2][0] < '0' || argv[2][0] > '9' ||
+                             *end != '\0' || errno == ERANGE)))
+        {
+            usage(argv[0]);
+            exit_code = EXIT_FAIL_ARGS;
+            break;
+        }
+        if (strcmp(argv[2], "compact") == 0)
+            rc = compact_cdc(fd);
+        else
+            rc = tail_db(fd, seq, argc == 4);
+        if (rc < 0)
+            exit_code = EXIT_FAIL_DB;
+        break;
+
+    case 'v':
+        //    arv[0] arv[1]
+        // prog_name     -v
         //-----------------
-        // example:  prog_name -p
-        rc = print_db(fd);
+        // example:  SDB_CHECKSUM=1 prog_name -v
+        if (argc != 2)
+        {
+            usage(argv[0]);
+            exit_code = EXIT_FAIL_ARGS;
+            break;
+        }
+        rc = verify_db(fd);
         if (rc < 0)
             exit_code = EXIT_FAIL_DB;
         break;
@@ -667,6 +1608,51 @@ int main(int argc, char *argv[])
             exit_code = EXIT_FAIL_DB;
         break;
 
+    case 'X':
+        //    arv[0] arv[1]  [arv[2]]
+        // prog_name     -X   [file]
+        //--------------------------
+        // example:  prog_name -X fall2025.sdb
+        // like -x this returns the fd of the database, a new one when
+        // it was archived in place
+        if (argc > 3)
+        {
+            usage(argv[0]);
+            exit_code = EXIT_FAIL_ARGS;
+            break;
+        }
+        fd = archive_db(fd, argc == 3 ? argv[2] : NULL);
+        if (fd < 0)
+            exit_code = EXIT_FAIL_DB;
+        break;
+
+    case 'T':
+        //   arv[0] arv[1]  [arv[2]]
+        // prog_name     -T  [file]
+        //-------------------------
+        // example:  prog_name -T < changes.txt
+        //           prog_name -T changes.txt
+        if (argc > 3)
+        {
+            usage(argv[0]);
+            exit_code = EXIT_FAIL_ARGS;
+            break;
+        }
+        rc = tx_run(fd, argc == 3 ? argv[2] : "-");
+        if (rc < 0)
+            exit_code = EXIT_FAIL_DB;
+        break;
+
+    case 'U':
+        //    arv[0] arv[1]
+        // prog_name     -U
+        //-----------------
+        // example:  SDB_FORMAT=dense prog_name -U
+        fd = unarchive_db(fd);
+        if (fd < 0)
+            exit_code = EXIT_FAIL_DB;
+        break;
+
     case 'z':
         //    arv[0] arv[1]
         // prog_name     -x
@@ -674,7 +1660,7 @@ int main(int argc, char *argv[])
         // example:  prog_name -x
         // HINT:  close the db file, we already have fd
         //       and reopen db indicating truncate=true
-        close(fd);
+        close_db(fd);
         fd = open_db(DB_FILE, true);
         if (fd < 0)
         {
@@ -691,6 +1677,8 @@ int main(int argc, char *argv[])
 
     // dont forget to close the file before exiting, and setting the
     // proper exit code - see the header file for expected values
-    close(fd);
+    if (fd >= 0)
+        close_db(fd);
     exit(exit_code);
 }
+#endif
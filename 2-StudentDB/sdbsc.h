@@ -1,19 +1,47 @@
 #ifndef __SDB_H__
+    #define __SDB_H__
 
 #include "db.h" //get student record type
 
 //prototypes for functions go below for this assignment
 int open_db(char *dbFile, bool should_truncate);
+int close_db(int fd);
+int sync_db(int fd);
 int add_student(int fd, int id, char *fname, char *lname, int gpa);
 int get_student(int fd, int id, student_t *s);
 int del_student(int fd, int id);
+int get_students(int fd, const int *ids, int n, student_t *out, int *rcs);
+int del_students(int fd, const int *ids, int n);
+int find_db(int fd, const int *ids, int n);
+int print_found(const int *ids, int n, const student_t *recs, const int *rcs);
 int compress_db(int fd);
 void print_student(student_t *s);
+typedef struct student_names student_names_t;     //see sdb_engine.h
+int get_student_names(int fd, int id, student_names_t *n);
+void print_student_names(student_t *s, const student_names_t *n);
 int validate_range(int id, int gpa);
 int count_db_records(int fd);
 int print_db(int fd);
+int export_db(int fd, int format);    //format is an out_format_t
+int range_db(int fd, int lo, int hi);
 void usage(char *);
 
+//Cursor over the students with ids in [lo, hi], in id order.  Records are
+//fetched a batch at a time, each batch is a consistent read; students
+//added or deleted between batches may or may not be seen.
+//
+//  db_cursor_t *c = cursor_open(fd, 1000, 1999);
+//  while (cursor_next(c, &s) == NO_ERROR)
+//      ...
+//  cursor_close(c);
+//
+//cursor_next() returns NO_ERROR with the next student in *s, SRCH_NOT_FOUND
+//past the last one, or ERR_DB_FILE.
+typedef struct db_cursor db_cursor_t;
+db_cursor_t *cursor_open(int fd, int lo, int hi);
+int cursor_next(db_cursor_t *c, student_t *s);
+void cursor_close(db_cursor_t *c);
+
 //error codes to be returned from individual functions
 // NO_ERROR is returned if there are no errors
 // ERR_DB_FILE is returned if there is are any issues with the database file itself
@@ -52,6 +80,7 @@ void usage(char *);
 #define M_DB_ZERO_OK      "All database records removed!\n"
 #define M_DB_EMPTY        "Database contains no student records.\n"
 #define M_DB_RECORD_CNT   "Database contains %d student record(s).\n"
+#define M_RANGE_NOT_FND   "No students with ids %d to %d found in database.\n"
 #define M_NOT_IMPL        "The requested operation is not implemented yet!\n"
 
 //useful format strings for print students
@@ -60,5 +89,6 @@ void usage(char *);
 //                                   "LAST_NAME", "GPA");
 #define  STUDENT_PRINT_HDR_STRING   "%-6s %-24s %-32s %-3s\n"
 #define  STUDENT_PRINT_FMT_STRING   "%-6d %-24.24s %-32.32s %-3.2f\n"
+#define  STUDENT_PRINT_FULL_FMT_STRING  "%-6d %-24s %-32s %-3.2f\n"
 
 #endif
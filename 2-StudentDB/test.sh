@@ -6,6 +6,8 @@ setup_file() {
     if [ -f "student.db" ]; then
         rm "student.db"
     fi
+    # and any index or other sidecar files left over from an earlier run
+    rm -f .student.db.*
 }
 
 @test "Check if database is empty to start" {
@@ -193,3 +195,806 @@ setup_file() {
         return 1
     }
 }
+
+@test "Add and find a student with per-op msync" {
+    run env SDB_MSYNC=op ./sdbsc -a 70 ann lee 377
+    [ "$status" -eq 0 ]
+    [ "${lines[0]}" = "Student 70 added to database." ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+
+    run ./sdbsc -f 70
+    [ "$status" -eq 0 ]
+    normalized_output=$(echo -n "${lines[1]}" | tr -s '[:space:]' ' ')
+    [ "$normalized_output" = "70 ann lee 3.77" ] || {
+        echo "Failed Output:  $normalized_output"
+        return 1
+    }
+}
+
+@test "Delete a student with close msync policy" {
+    run env SDB_MSYNC=close ./sdbsc -d 70
+    [ "$status" -eq 0 ]
+    [ "${lines[0]}" = "Student 70 was deleted from database." ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+
+    run ./sdbsc -c
+    [ "$status" -eq 0 ]
+    [ "${lines[0]}" = "Database contains 3 student record(s)." ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+}
+
+@test "Bulk load students from csv on stdin" {
+    run bash -c 'printf "id,fname,lname,gpa\n200,amy,ray,301\n202,bo,li,402\n201,cy,ng,299\n3,dup,row,100\n200,dup,row,100\n900000,big,id,100\n" | ./sdbsc -A -'
+    [ "$status" -eq 0 ]
+    [ "${lines[3]}" = "Loaded 3 student(s), skipped 3 line(s)." ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+
+    run ./sdbsc -f 201
+    [ "$status" -eq 0 ]
+    normalized_output=$(echo -n "${lines[1]}" | tr -s '[:space:]' ' ')
+    [ "$normalized_output" = "201 cy ng 2.99" ] || {
+        echo "Failed Output:  $normalized_output"
+        return 1
+    }
+
+    run ./sdbsc -c
+    [ "${lines[0]}" = "Database contains 6 student record(s)." ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+}
+
+@test "Sparse database scans skip holes" {
+    run ./sdbsc -a 99000 far away 333
+    [ "$status" -eq 0 ]
+
+    run ./sdbsc -c
+    [ "${lines[0]}" = "Database contains 7 student record(s)." ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+
+    run ./sdbsc -p
+    [ "$status" -eq 0 ]
+    normalized_output=$(echo -n "${lines[7]}" | tr -s '[:space:]' ' ')
+    [ "$normalized_output" = "99000 far away 3.33" ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+}
+
+@test "Find students by last name" {
+    run ./sdbsc -l doe
+    [ "$status" -eq 0 ]
+    normalized_output=$(echo -n "$output" | tr -s '[:space:]' ' ')
+    expected_output="ID FIRST_NAME LAST_NAME GPA 1 john doe 3.45 3 jane doe 3.90 63 jim doe 2.85"
+    [ "$normalized_output" = "$expected_output" ] || {
+        echo "Failed Output: $normalized_output"
+        echo "Expected Output: $expected_output"
+        return 1
+    }
+}
+
+@test "Last name index follows adds and deletes" {
+    run ./sdbsc -a 500 zed rayburn 250
+    [ "$status" -eq 0 ]
+    run ./sdbsc -d 200
+    [ "$status" -eq 0 ]
+
+    run ./sdbsc -L ray
+    [ "$status" -eq 0 ]
+    normalized_output=$(echo -n "$output" | tr -s '[:space:]' ' ')
+    [ "$normalized_output" = "ID FIRST_NAME LAST_NAME GPA 500 zed rayburn 2.50" ] || {
+        echo "Failed Output: $normalized_output"
+        return 1
+    }
+
+    run ./sdbsc -l ray
+    [ "$status" -eq 1 ]
+    [ "${lines[0]}" = "No students with last name ray found in database." ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+}
+
+@test "Write-ahead log replays updates lost from the db file" {
+    cp student.db student.db.bak
+    run ./sdbsc -a 777 wal test 311
+    [ "$status" -eq 0 ]
+
+    # roll the file back behind the log's back, keeping the same inode
+    cat student.db.bak > student.db
+    rm -f student.db.bak
+
+    run ./sdbsc -f 777
+    [ "$status" -eq 0 ]
+    normalized_output=$(echo -n "${lines[1]}" | tr -s '[:space:]' ' ')
+    [ "$normalized_output" = "777 wal test 3.11" ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+
+    run ./sdbsc -l test
+    [ "$status" -eq 0 ]
+}
+
+@test "Concurrent writers and readers share the database" {
+    # four writers race on the same ids, each id must be added exactly once
+    run bash -c 'for w in 1 2 3 4; do
+                     (for i in $(seq 3001 3040); do ./sdbsc -a $i con cur 250 >/dev/null && echo $i; done) &
+                 done
+                 ./sdbsc -c >/dev/null
+                 wait'
+    [ "$status" -eq 0 ]
+    [ "${#lines[@]}" -eq 40 ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+
+    run ./sdbsc -c
+    [ "$status" -eq 0 ]
+    [ "${lines[0]}" = "Database contains 48 student record(s)." ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+
+    run bash -c './sdbsc -l cur | wc -l'
+    [ "$output" = "41" ]
+
+    # deletes while another process compresses the file
+    run bash -c '(for i in $(seq 3001 3040); do ./sdbsc -d $i >/dev/null; done) &
+                 ./sdbsc -x >/dev/null
+                 wait'
+    run ./sdbsc -c
+    [ "$status" -eq 0 ]
+    [ "${lines[0]}" = "Database contains 8 student record(s)." ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+}
+
+@test "Compress punches deleted pages out in place" {
+    run bash -c 'seq 6400 6527 | sed "s/$/,del,eted,100/" | ./sdbsc -A -'
+    [ "$status" -eq 0 ]
+    run bash -c 'for i in $(seq 6400 6527); do ./sdbsc -d $i >/dev/null || exit 1; done'
+    [ "$status" -eq 0 ]
+
+    blocks_before=$(stat --format="%b" ./student.db)
+    inode_before=$(stat --format="%i" ./student.db)
+    run ./sdbsc -x
+    [ "$status" -eq 0 ]
+    [ "${lines[0]}" = "Database successfully compressed!" ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+    [ "$(stat --format="%b" ./student.db)" -lt "$blocks_before" ]
+    [ "$(stat --format="%i" ./student.db)" = "$inode_before" ]
+
+    run ./sdbsc -c
+    [ "${lines[0]}" = "Database contains 8 student record(s)." ]
+}
+
+@test "Compress falls back to copying live pages" {
+    run env SDB_COMPACT=copy ./sdbsc -x
+    [ "$status" -eq 0 ]
+    [ "${lines[0]}" = "Database successfully compressed!" ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+
+    run ./sdbsc -f 99000
+    [ "$status" -eq 0 ]
+    run ./sdbsc -c
+    [ "${lines[0]}" = "Database contains 8 student record(s)." ]
+    [ "$(stat --format="%s" ./student.db)" -eq $((99001 * 64)) ]
+}
+
+@test "GPA statistics come from the columnar snapshot" {
+    run ./sdbsc -S
+    [ "$status" -eq 0 ]
+    [ "${lines[0]}" = "Snapshot of 8 student(s) written." ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+
+    run ./sdbsc -g avg
+    [ "${lines[0]}" = "Average GPA of 8 student(s): 3.27" ]
+    run ./sdbsc -g max 1 100
+    [ "${lines[0]}" = "Highest GPA of 3 student(s): 3.90" ]
+    run ./sdbsc -g p50
+    [ "${lines[0]}" = "GPA percentile 50 of 8 student(s): 3.11" ]
+    run ./sdbsc -g hist
+    [ "${lines[6]}" = "2.50-2.99  3" ]
+
+    # a change makes the next report take a new snapshot
+    ./sdbsc -a 5 low gpa 100
+    run ./sdbsc -g min
+    [ "${lines[0]}" = "Lowest GPA of 9 student(s): 1.00" ]
+    ./sdbsc -d 5
+
+    run ./sdbsc -g min 2 2
+    [ "$status" -eq 1 ]
+    [ "${lines[0]}" = "No students to report on." ]
+    run ./sdbsc -g median
+    [ "$status" -eq 2 ]
+}
+
+@test "Range query prints students in an id range" {
+    run ./sdbsc -r 2 300
+    [ "$status" -eq 0 ]
+    [ "${#lines[@]}" -eq 5 ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+    [ "${lines[1]}" = "3      jane                     doe                              3.90" ]
+    [ "${lines[4]}" = "202    bo                       li                               4.02" ]
+
+    # the whole id space prints the same as -p
+    [ "$(./sdbsc -r 1 100000)" = "$(./sdbsc -p)" ]
+
+    run ./sdbsc -r 64 200
+    [ "$status" -eq 1 ]
+    [ "${lines[0]}" = "No students with ids 64 to 200 found in database." ]
+    run ./sdbsc -r 64
+    [ "$status" -eq 2 ]
+}
+
+@test "Print writes tsv, jsonl and binary rows" {
+    run ./sdbsc -p tsv
+    [ "$status" -eq 0 ]
+    [ "${#lines[@]}" -eq 9 ]
+    [ "${lines[0]}" = "$(printf 'id\tfname\tlname\tgpa')" ]
+    [ "${lines[1]}" = "$(printf '1\tjohn\tdoe\t3.45')" ]
+
+    run ./sdbsc -p jsonl
+    [ "$status" -eq 0 ]
+    [ "${#lines[@]}" -eq 8 ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+    [ "${lines[2]}" = '{"id":63,"fname":"jim","lname":"doe","gpa":2.85}' ]
+
+    # one 64 byte record per student
+    [ "$(./sdbsc -p binary | wc -c)" -eq 512 ]
+
+    run ./sdbsc -p xml
+    [ "$status" -eq 2 ]
+    [ "${lines[0]}" = "Unknown output format xml, use table, tsv, jsonl or binary." ]
+}
+
+@test "Parallel scans keep id order and counts" {
+    rm -rf ./par && mkdir ./par && cd ./par
+    # ids all over the file, so every worker gets parts to scan
+    for i in $(seq 1 20000); do echo "$((i * 5 - i % 3)),f$((i % 11)),l$((i % 13)),$((i % 400))"; done > in.csv
+    ../sdbsc -A in.csv
+
+    one="$(SDB_SCAN_THREADS=1 ../sdbsc -p)"
+    run env SDB_SCAN_THREADS=4 ../sdbsc -p
+    [ "$status" -eq 0 ]
+    [ "$output" = "$one" ]
+    [ "${#lines[@]}" -eq 20001 ]
+    SDB_SCAN_THREADS=4 ../sdbsc -p tsv | tail -n +2 | cut -f1 | sort -n -c
+
+    run env SDB_SCAN_THREADS=4 ../sdbsc -c
+    [ "${lines[0]}" = "Database contains 20000 student record(s)." ]
+
+    # delete the first 1000 and compact them away a round of slices at a time
+    for i in $(seq 1 1000); do printf '%s\0' $((i * 5 - i % 3)); done | \
+        xargs -0 -n 1 ../sdbsc -d > /dev/null
+    blocks_before=$(stat --format="%b" ./student.db)
+    run env SDB_SCAN_THREADS=4 SDB_COMPACT_SLICE=65536 ../sdbsc -x
+    [ "$status" -eq 0 ]
+    [ "$(stat --format="%b" ./student.db)" -lt "$blocks_before" ]
+    run env SDB_SCAN_THREADS=4 ../sdbsc -c
+    [ "${lines[0]}" = "Database contains 19000 student record(s)." ]
+    cd .. && rm -rf ./par
+}
+
+@test "Batch find and delete look up many ids at once" {
+    run ./sdbsc -f 777 1 5 99000
+    [ "$status" -eq 1 ]
+    [ "${#lines[@]}" -eq 5 ]
+    [ "${lines[1]}" = "777    wal                      test                             3.11" ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+    [ "${lines[3]}" = "99000  far                      away                             3.33" ]
+    [ "${lines[4]}" = "Student 5 was not found in database." ]
+
+    # the synchronous backend gives the same answers
+    [ "$(SDB_IO=sync ./sdbsc -f 777 1 5 99000)" = "$output" ]
+
+    # an id that cannot exist is not found, the others are still printed
+    run ./sdbsc -f 777 -5 1
+    [ "$status" -eq 1 ]
+    [ "${#lines[@]}" -eq 4 ]
+    [ "${lines[3]}" = "Student -5 was not found in database." ]
+
+    rm -rf ./batch && mkdir ./batch && cd ./batch
+    for i in $(seq 1 500); do echo "$((i * 97)),f$i,l$i,$((i % 400))"; done | ../sdbsc -A -
+    run ../sdbsc -d 97 194 291 5
+    [ "$status" -eq 1 ]
+    [ "${lines[0]}" = "Student 97 was deleted from database." ]
+    [ "${lines[3]}" = "Student 5 was not found in database." ]
+    run ../sdbsc -c
+    [ "${lines[0]}" = "Database contains 497 student record(s)." ]
+    cd .. && rm -rf ./batch
+}
+
+@test "Verify finds pages that fail their checksum" {
+    rm -rf ./sum && mkdir ./sum && cd ./sum
+    export SDB_WAL=0
+    ../sdbsc -a 1 john doe 345
+    ../sdbsc -a 3000 jane doe 390
+
+    run ../sdbsc -v
+    [ "$status" -eq 0 ]
+    [ "${lines[0]}" = "Database has no page checksums, checking record placement only." ]
+
+    run env SDB_CHECKSUM=1 ../sdbsc -v
+    [ "$status" -eq 0 ]
+    [ "${lines[0]}" = "Page checksums written for 47 page(s)." ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+    [ "${lines[1]}" = "Verified 47 page(s), no errors found." ]
+
+    # writers keep the sums up to date from now on
+    ../sdbsc -a 99000 far away 333
+    ../sdbsc -d 1
+    run ../sdbsc -v
+    [ "$status" -eq 0 ]
+    [ "${lines[0]}" = "Verified 1547 page(s), no errors found." ]
+
+    # flip a byte past the end of a name, where printing would not show it
+    printf 'X' | dd of=./student.db bs=1 seek=$((3000 * 64 + 20)) conv=notrunc 2>/dev/null
+    run ../sdbsc -v
+    [ "$status" -eq 1 ]
+    [ "${lines[0]}" = "Page 46 (ids 2944 to 3007) is corrupt." ]
+    [ "${lines[1]}" = "Verified 1547 page(s), 1 corrupt." ]
+    cd .. && rm -rf ./sum
+}
+
+@test "Archives are compressed, read-only and convert back" {
+    rm -rf ./arch && mkdir ./arch && cd ./arch
+    for i in $(seq 1 300); do echo "$((i * 3)),first$((i % 7)),last$((i % 5)),$((i % 400))"; done > in.csv
+    ../sdbsc -A in.csv
+    before="$(../sdbsc -p)"
+
+    run ../sdbsc -X ./copy.sdb
+    [ "$status" -eq 0 ]
+    [ "$(head -c 8 ./copy.sdb)" = "SDBARCH1" ]
+
+    run ../sdbsc -X
+    [ "$status" -eq 0 ]
+    [ "${lines[0]:0:26}" = "Archived 300 student(s) in" ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+    [ "$(stat --format="%s" ./student.db)" -lt 8192 ]
+    [ "$(../sdbsc -p)" = "$before" ]
+    run ../sdbsc -f 900
+    [ "${lines[1]}" = "900    first6                   last0                            3.00" ]
+    run ../sdbsc -f 901
+    [ "$status" -eq 1 ]
+    run ../sdbsc -r 10 20
+    [ "${#lines[@]}" -eq 4 ]
+
+    # nothing can change an archive
+    run ../sdbsc -a 1 no write 100
+    [ "$status" -eq 1 ]
+    run ../sdbsc -d 3
+    [ "$status" -eq 1 ]
+
+    run ../sdbsc -U
+    [ "$status" -eq 0 ]
+    [ "${lines[0]}" = "Restored 300 student(s) from the archive." ]
+    [ "$(../sdbsc -p)" = "$before" ]
+    ../sdbsc -a 1 can write 100
+    run ../sdbsc -U
+    [ "$status" -eq 1 ]
+    [ "${lines[0]}" = "Database is not an archive." ]
+    cd .. && rm -rf ./arch
+}
+
+@test "Thin client runs operations through the server" {
+    ./sdbsc -D ./test.sock >/dev/null 2>&1 3>&- &
+    server=$!
+    for i in $(seq 50); do [ -S ./test.sock ] && break; sleep 0.1; done
+
+    SDB_SERVER=./test.sock ./sdbsc -a 6 served student 301
+    run env SDB_SERVER=./test.sock ./sdbsc -f 6
+    [ "$status" -eq 0 ]
+    [ "${lines[1]}" = "6      served                   student                          3.01" ] || {
+        echo "Failed Output:  $output"
+        kill $server
+        return 1
+    }
+    run env SDB_SERVER=./test.sock ./sdbsc -a 6 served student 301
+    [ "$status" -eq 1 ]
+    run env SDB_SERVER=./test.sock ./sdbsc -f 6 5 1
+    [ "$status" -eq 1 ]
+    [ "$output" = "$(./sdbsc -f 6 5 1)" ]
+    run env SDB_SERVER=./test.sock ./sdbsc -c
+    [ "${lines[0]}" = "Database contains 9 student record(s)." ]
+    [ "$(SDB_SERVER=./test.sock ./sdbsc -p jsonl)" = "$(./sdbsc -p jsonl)" ]
+    run env SDB_SERVER=./test.sock ./sdbsc -d 6
+    [ "${lines[0]}" = "Student 6 was deleted from database." ]
+
+    kill $server
+    wait $server || true
+    [ ! -e ./test.sock ]
+
+    # the server's updates are in the file
+    run ./sdbsc -c
+    [ "${lines[0]}" = "Database contains 8 student record(s)." ]
+}
+
+@test "Server cache answers repeat lookups and sees other writers" {
+    rm -rf ./cache && mkdir ./cache && cd ./cache
+    ../sdbsc -a 5 hot student 300
+    ../sdbsc -D ./c.sock >/dev/null 2>&1 3>&- &
+    server=$!
+    for i in $(seq 50); do [ -S ./c.sock ] && break; sleep 0.1; done
+    export SDB_SERVER=./c.sock
+
+    for i in 1 2 3; do ../sdbsc -f 5 >/dev/null; done
+    ../sdbsc -f 6 || true
+    run ../sdbsc -i
+    [ "${lines[0]}" = "Cache: 1 of 256 page(s), 2 hit(s), 1 miss(es), 0 eviction(s), 0 invalidation(s)." ] || {
+        echo "Failed Output:  $output"
+        kill $server
+        return 1
+    }
+
+    # a change made without the server drops its cached pages
+    SDB_SERVER= ../sdbsc -a 6 cold student 310
+    run ../sdbsc -f 6
+    [ "${lines[1]}" = "6      cold                     student                          3.10" ]
+    SDB_SERVER= ../sdbsc -d 5
+    run ../sdbsc -f 5
+    [ "$status" -eq 1 ]
+    run ../sdbsc -i
+    [ "${lines[0]}" = "Cache: 1 of 256 page(s), 2 hit(s), 2 miss(es), 0 eviction(s), 1 invalidation(s)." ]
+
+    kill $server
+    wait $server || true
+    unset SDB_SERVER
+    run env SDB_CACHE_PAGES=0 ../sdbsc -i
+    [ "${lines[0]}" = "Cache is off (SDB_CACHE_PAGES=0)." ]
+    cd .. && rm -rf ./cache
+}
+
+@test "Id filter answers lookups of missing ids" {
+    rm -rf ./ids && mkdir ./ids && cd ./ids
+    export SDB_WAL=0
+    ../sdbsc -a 5 kept student 300
+    [ "$(stat --format="%s" ./.student.db.ids)" -eq 12568 ]
+
+    # a record written behind the database's back has no bit, so the
+    # filter is what answers
+    dd if=./student.db of=./student.db bs=64 skip=5 seek=9 count=1 conv=notrunc 2>/dev/null
+    printf '\x09' | dd of=./student.db bs=1 seek=$((9 * 64)) conv=notrunc 2>/dev/null
+    run ../sdbsc -f 9
+    [ "$status" -eq 1 ]
+    [ "${lines[0]}" = "Student 9 was not found in database." ]
+
+    # without the sidecar every lookup reads the file, the next change
+    # builds it again from the records
+    rm ./.student.db.ids
+    run ../sdbsc -f 9
+    [ "$status" -eq 0 ]
+    ../sdbsc -a 6 new student 310
+    run ../sdbsc -f 9 5 6 7
+    [ "${#lines[@]}" -eq 5 ]
+    [ "${lines[4]}" = "Student 7 was not found in database." ]
+
+    ../sdbsc -d 9
+    run ../sdbsc -d 9
+    [ "$status" -eq 1 ]
+    ../sdbsc -a 9 back again 100
+    run ../sdbsc -f 9
+    [ "${lines[1]}" = "9      back                     again                            1.00" ]
+    cd .. && rm -rf ./ids
+}
+
+@test "Dense format keeps sparse databases small" {
+    rm -rf ./dense && mkdir ./dense && cd ./dense
+    SDB_FORMAT=dense ../sdbsc -a 1 john doe 345
+    ../sdbsc -a 99000 jane roe 390
+    ../sdbsc -a 500 bob smith 280
+    ../sdbsc -d 1
+
+    run ../sdbsc -p
+    [ "$status" -eq 0 ]
+    [ "${lines[1]}" = "500    bob                      smith                            2.80" ]
+    [ "${lines[2]}" = "99000  jane                     roe                              3.90" ]
+
+    run ../sdbsc -f 99000
+    [ "$status" -eq 0 ]
+    run ../sdbsc -f 1
+    [ "$status" -eq 1 ]
+    run ../sdbsc -r 400 99000
+    [ "${#lines[@]}" -eq 3 ]
+    [ "${lines[1]}" = "500    bob                      smith                            2.80" ]
+
+    # header plus 64 record slots and their directory, not 99001 slots
+    [ "$(stat --format="%s" ./student.db)" -lt 8192 ]
+    [ "$(head -c 8 ./student.db)" = "SDBDENS1" ]
+
+    # truncating keeps the format
+    ../sdbsc -z
+    [ "$(head -c 8 ./student.db)" = "SDBDENS1" ]
+    run ../sdbsc -c
+    [ "${lines[0]}" = "Database contains no student records." ]
+    cd .. && rm -rf ./dense
+}
+
+@test "Change log streams adds and deletes by sequence number" {
+    rm -rf ./cdc && mkdir ./cdc && cd ./cdc
+    ../sdbsc -a 1 before log 100
+    run ../sdbsc -t 0
+    [ "$status" -eq 1 ]
+    [ "${lines[0]}" = "There is no change log, SDB_CDC=1 starts one." ]
+
+    SDB_CDC=1 ../sdbsc -a 2 john doe 345
+    ../sdbsc -a 3 jane roe 390
+    ../sdbsc -d 2
+    run ../sdbsc -t 0
+    [ "${#lines[@]}" -eq 4 ]
+    [ "${lines[0]}" = '{"seq":1,"op":"reset"}' ]
+    [ "${lines[1]}" = '{"seq":2,"op":"add","id":2,"fname":"john","lname":"doe","gpa":3.45}' ]
+    [ "${lines[3]}" = '{"seq":4,"op":"del","id":2,"fname":"john","lname":"doe","gpa":3.45}' ]
+    run ../sdbsc -t 4
+    [ "${#lines[@]}" -eq 1 ]
+    run ../sdbsc -t 4x
+    [ "$status" -eq 2 ]
+    run ../sdbsc -t -1
+    [ "$status" -eq 2 ]
+
+    # a follower sees new changes, and carries on after the log is compacted
+    ../sdbsc -t 4 follow > ./follow.out 3>&- &
+    follower=$!
+    ../sdbsc -a 5 bob smith 280
+    run ../sdbsc -t compact
+    [ "${lines[0]}" = "Change log compacted from 5 to 4 change(s)." ]
+    ../sdbsc -a 6 al bee 200
+    for i in $(seq 50); do [ "$(wc -l < ./follow.out)" -ge 3 ] && break; sleep 0.1; done
+    kill $follower
+    wait $follower || true
+    run cat ./follow.out
+    [ "${#lines[@]}" -eq 3 ]
+    [ "${lines[1]}" = '{"seq":5,"op":"add","id":5,"fname":"bob","lname":"smith","gpa":2.80}' ]
+    [ "${lines[2]}" = '{"seq":6,"op":"add","id":6,"fname":"al","lname":"bee","gpa":2.00}' ]
+
+    # compaction kept the last change of each id, with its number
+    run ../sdbsc -t 0
+    [ "${lines[1]}" = '{"seq":3,"op":"add","id":3,"fname":"jane","lname":"roe","gpa":3.90}' ]
+    [ "${lines[2]}" = '{"seq":4,"op":"del","id":2,"fname":"john","lname":"doe","gpa":3.45}' ]
+
+    # wholesale changes are a reset
+    ../sdbsc -z
+    run ../sdbsc -t 7
+    [ "${lines[0]}" = '{"seq":7,"op":"reset"}' ]
+    cd .. && rm -rf ./cdc
+}
+
+@test "Snapshots keep a consistent view while writes go on" {
+    rm -rf ./snap && mkdir ./snap && cd ./snap
+    ../sdbsc -a 1 john doe 345
+    ../sdbsc -a 2 jane roe 390
+    run ../sdbsc -s monday
+    [ "$status" -eq 0 ]
+    [ "${lines[0]}" = "Snapshot monday created (copied)." ] || [ "${lines[0]}" = "Snapshot monday created (cloned)." ]
+
+    ../sdbsc -d 1
+    ../sdbsc -a 3 bob smith 280
+
+    # the snapshot still has what was there when it was taken
+    SDB_SNAPSHOT=monday run ../sdbsc -c
+    [ "${lines[0]}" = "Database contains 2 student record(s)." ]
+    SDB_SNAPSHOT=monday run ../sdbsc -r 1 3
+    [ "${#lines[@]}" -eq 3 ]
+    [ "${lines[1]}" = "1      john                     doe                              3.45" ]
+    SDB_SNAPSHOT=monday run ../sdbsc -f 3
+    [ "$status" -eq 1 ]
+    run ../sdbsc -f 3
+    [ "$status" -eq 0 ]
+
+    # snapshots cannot be written
+    SDB_SNAPSHOT=monday run ../sdbsc -a 4 x y 100
+    [ "$status" -eq 2 ]
+    [ "${lines[0]}" = "Snapshots are read-only, -a cannot run with SDB_SNAPSHOT." ]
+
+    run ../sdbsc -s
+    [ "${#lines[@]}" -eq 2 ]
+    [ "${lines[1]:0:6}" = "monday" ]
+    run ../sdbsc -s -d monday
+    [ "${lines[0]}" = "Snapshot monday removed." ]
+    run ../sdbsc -s
+    [ "${lines[0]}" = "No snapshots." ]
+    SDB_SNAPSHOT=monday run ../sdbsc -c
+    [ "$status" -eq 1 ]
+    cd .. && rm -rf ./snap
+}
+
+@test "Var format keeps long names whole" {
+    rm -rf ./var && mkdir ./var && cd ./var
+    SDB_FORMAT=var ../sdbsc -a 1 john doe 345
+    ../sdbsc -a 99000 Maximiliana-Josephina-Theresia Wolfeschlegelsteinhausenbergerdorff 390
+    ../sdbsc -a 500 bob smith 280
+    ../sdbsc -d 1
+    [ "$(head -c 8 ./student.db)" = "SDBVAR01" ]
+
+    # -f prints the names whole, everything else sees them cut to fit
+    run ../sdbsc -f 99000
+    [ "$status" -eq 0 ]
+    [ "${lines[1]}" = "99000  Maximiliana-Josephina-Theresia Wolfeschlegelsteinhausenbergerdorff 3.90" ]
+    run ../sdbsc -p
+    [ "${lines[1]}" = "500    bob                      smith                            2.80" ]
+    [ "${lines[2]}" = "99000  Maximiliana-Josephina-T  Wolfeschlegelsteinhausenbergerd  3.90" ]
+    run ../sdbsc -f 1
+    [ "$status" -eq 1 ]
+
+    # compaction drops the deleted names and keeps the live ones
+    ../sdbsc -x
+    [ ! -e ./.student.db.compact ]
+    run ../sdbsc -f 99000
+    [ "${lines[1]}" = "99000  Maximiliana-Josephina-Theresia Wolfeschlegelsteinhausenbergerdorff 3.90" ]
+    run ../sdbsc -r 400 600
+    [ "${lines[1]}" = "500    bob                      smith                            2.80" ]
+
+    ../sdbsc -z
+    [ "$(head -c 8 ./student.db)" = "SDBVAR01" ]
+    cd .. && rm -rf ./var
+}
+
+@test "Var format keeps long names through log replay and the change log" {
+    rm -rf ./varlog && mkdir ./varlog && cd ./varlog
+    long=Wolfeschlegelsteinhausenbergerdorffvoralternwarengewissenhaft
+    SDB_FORMAT=var ../sdbsc -a 1 john doe 345
+    cp student.db student.db.bak
+    SDB_CDC=1 ../sdbsc -a 2 Maximiliana-Josephina-Theresia $long 390
+
+    # roll the file back behind the log's back, replay brings the names back whole
+    cat student.db.bak > student.db
+    rm -f student.db.bak
+    run ../sdbsc -f 2
+    [ "$status" -eq 0 ]
+    [ "${lines[1]}" = "2      Maximiliana-Josephina-Theresia $long 3.90" ]
+
+    # the change log carries them too, also after compaction
+    run ../sdbsc -t 0
+    [ "${lines[1]}" = "{\"seq\":4,\"op\":\"add\",\"id\":2,\"fname\":\"Maximiliana-Josephina-Theresia\",\"lname\":\"$long\",\"gpa\":3.90}" ]
+    ../sdbsc -a 3 Anna-Maria $long 280
+    ../sdbsc -d 1
+    ../sdbsc -t compact
+    run ../sdbsc -t 0
+    [ "${lines[1]}" = "{\"seq\":8,\"op\":\"add\",\"id\":3,\"fname\":\"Anna-Maria\",\"lname\":\"$long\",\"gpa\":2.80}" ]
+    cd .. && rm -rf ./varlog
+}
+
+@test "Standby follows the primary and syncs only changed pages" {
+    rm -rf ./repl && mkdir -p ./repl/primary ./repl/standby && cd ./repl/primary
+    for i in $(seq 200); do echo "$i,first$i,last$i,300"; done | ../../sdbsc -A -
+    ../../sdbsc -R ./repl.sock > ./serve.out 3>&- &
+    primary=$!
+    for i in $(seq 50); do [ -S ./repl.sock ] && break; sleep 0.1; done
+
+    # a new standby is synced first, then changes stream over
+    cd ../standby
+    ../../sdbsc -F ../primary/repl.sock > ./follow.out 3>&- &
+    follower=$!
+    for i in $(seq 50); do grep -q Synced ./follow.out && break; sleep 0.1; done
+    run ../../sdbsc -c
+    [ "${lines[0]}" = "Database contains 200 student record(s)." ]
+    (cd ../primary && ../../sdbsc -a 500 john doe 345 && ../../sdbsc -d 7)
+    for i in $(seq 50); do ../../sdbsc -f 7 > /dev/null || break; sleep 0.1; done
+    run ../../sdbsc -f 500
+    [ "${lines[1]}" = "500    john                     doe                              3.45" ]
+    run ../../sdbsc -F
+    [ "${lines[0]:0:38}" = "Applied change 3 of 3, 0 behind (0.0 s" ]
+    [ "${lines[1]}" = "2 change(s) applied, 1 sync(s), 4 of 4 page(s) received." ]
+
+    # a standby that missed a reset gets only the pages that differ
+    kill $follower
+    wait $follower || true
+    (cd ../primary && echo "250,new,name,400" | ../../sdbsc -A -)
+    ../../sdbsc -F ../primary/repl.sock > ./follow.out 3>&- &
+    follower=$!
+    for i in $(seq 50); do grep -q Synced ./follow.out && break; sleep 0.1; done
+    run cat ./follow.out
+    [ "${lines[1]}" = "Synced to change 4, 1 of 8 page(s) received." ]
+    cmp ./student.db ../primary/student.db
+
+    # failover: with the primary gone the standby takes writes
+    kill $primary
+    wait $primary || true
+    for i in $(seq 50); do grep -q Lost ./follow.out && break; sleep 0.1; done
+    kill $follower
+    wait $follower || true
+    run ../../sdbsc -a 600 jane roe 390
+    [ "$status" -eq 0 ]
+    run ../../sdbsc -c
+    [ "${lines[0]}" = "Database contains 202 student record(s)." ]
+    cd ../.. && rm -rf ./repl
+}
+
+@test "GPA index answers top, bottom, rank and count" {
+    rm -rf ./gpa && mkdir ./gpa && cd ./gpa
+    ../sdbsc -a 1 john doe 345
+    ../sdbsc -a 2 jane roe 390
+    ../sdbsc -a 3 bob smith 280
+    ../sdbsc -a 4 ann lee 345
+    run ../sdbsc -k top 2
+    [ "$status" -eq 0 ]
+    [ "${lines[1]}" = "2      jane                     roe                              3.90" ]
+    [ "${lines[2]}" = "1      john                     doe                              3.45" ]
+    run ../sdbsc -k bottom 1
+    [ "${lines[1]}" = "3      bob                      smith                            2.80" ]
+    run ../sdbsc -k rank 4
+    [ "${lines[0]}" = "Student 4 is ranked 3 of 4 by GPA (3.45), above 25.0% of students." ]
+
+    # changes move students in the index, a lost index is built again
+    ../sdbsc -d 2
+    ../sdbsc -a 5 sam poe 400
+    rm ./.student.db.gpa
+    run ../sdbsc -k count 340 400
+    [ "${lines[0]}" = "3 student(s) have a GPA from 3.40 to 4.00." ]
+    run ../sdbsc -k rank 5
+    [ "${lines[0]}" = "Student 5 is ranked 1 of 4 by GPA (4.00), above 75.0% of students." ]
+    run ../sdbsc -k middle 1
+    [ "$status" -eq 2 ]
+    cd .. && rm -rf ./gpa
+}
+
+@test "Transaction applies all of its changes or none" {
+    rm -rf ./tx && mkdir ./tx && cd ./tx
+    ../sdbsc -a 1 john doe 345
+    run ../sdbsc -T <<'END'
+add 2 jane roe 390
+# comments and blank lines are skipped
+
+update 1 300
+get 1
+del 1
+END
+    [ "$status" -eq 0 ]
+    [ "${lines[1]}" = "1      john                     doe                              3.00" ]
+    [ "${lines[2]}" = "Committed 4 operation(s), 2 change(s)." ]
+
+    # the duplicate add on line 2 undoes the add on line 1
+    run ../sdbsc -T <<'END'
+add 3 bob smith 280
+add 2 jane roe 390
+END
+    [ "$status" -eq 1 ]
+    [ "${lines[0]}" = "Line 2: student with ID=2 already exists" ]
+    [ "${lines[1]}" = "Rolled back, nothing was changed." ]
+    run ../sdbsc -p
+    [ "${#lines[@]}" -eq 2 ]
+    [ "${lines[1]}" = "2      jane                     roe                              3.90" ]
+    cd .. && rm -rf ./tx
+}
+
+@test "Ids out of range are not found, with any format" {
+    rm -rf ./range && mkdir ./range && cd ./range
+    SDB_FORMAT=dense ../sdbsc -a 1 john doe 345
+    run ../sdbsc -f -1
+    [ "$status" -eq 1 ]
+    [ "$output" = "Student -1 was not found in database." ]
+    run ../sdbsc -d -2
+    [ "$status" -eq 1 ]
+    [ "$output" = "Student -2 was not found in database." ]
+    run ../sdbsc -f 1
+    [ "$status" -eq 0 ]
+    cd .. && rm -rf ./range
+}